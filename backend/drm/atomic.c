@@ -1,9 +1,12 @@
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <wlr/render/drm_syncobj.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include <xf86drmMode.h>
@@ -73,6 +76,7 @@ static bool atomic_commit(struct atomic *atom, struct wlr_drm_backend *drm,
 
 	int ret = drmModeAtomicCommit(drm->fd, atom->req, flags, page_flip);
 	if (ret != 0) {
+		int err = errno;
 		enum wlr_log_importance log_level = WLR_ERROR;
 		if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
 			log_level = WLR_DEBUG;
@@ -88,6 +92,8 @@ static bool atomic_commit(struct atomic *atom, struct wlr_drm_backend *drm,
 		wlr_log(WLR_DEBUG, "(Atomic commit flags: %s)",
 			flags_str ? flags_str : "<error>");
 		free(flags_str);
+		// Let callers inspect the error
+		errno = err;
 		return false;
 	}
 
@@ -628,11 +634,153 @@ static void atomic_connector_add(struct atomic *atom,
 	}
 }
 
+// Output state fields which change the KMS configuration in ways not captured
+// by struct wlr_drm_test_key, or which have side effects when tested
+static const uint32_t TEST_CACHE_UNSUPPORTED_STATE =
+	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED |
+	WLR_OUTPUT_STATE_COLOR_TRANSFORM |
+	WLR_OUTPUT_STATE_IMAGE_DESCRIPTION;
+
+static void test_plane_key_init(struct wlr_drm_test_plane_key *key,
+		struct wlr_drm_fb *fb, const struct wlr_fbox *src_box,
+		const struct wlr_box *dst_box) {
+	// FBs are always imported from DMA-BUFs
+	struct wlr_dmabuf_attributes dmabuf = {0};
+	wlr_buffer_get_dmabuf(fb->wlr_buf, &dmabuf);
+
+	key->enabled = true;
+	key->format = dmabuf.format;
+	key->modifier = dmabuf.modifier;
+	key->width = fb->wlr_buf->width;
+	key->height = fb->wlr_buf->height;
+	key->n_planes = dmabuf.n_planes;
+	for (int i = 0; i < dmabuf.n_planes; i++) {
+		key->offset[i] = dmabuf.offset[i];
+		key->stride[i] = dmabuf.stride[i];
+	}
+	key->src_box = *src_box;
+	key->dst_box = *dst_box;
+}
+
+static bool test_key_init(struct wlr_drm_test_key *key,
+		const struct wlr_drm_device_state *state, uint32_t flags) {
+	// Modesets are rare, and their result depends on the state of the whole
+	// device
+	if (state->modeset || state->connectors_len > DRM_TEST_CACHE_MAX_CONNECTORS) {
+		return false;
+	}
+
+	memset(key, 0, sizeof(*key));
+	key->flags = flags;
+	key->connectors_len = state->connectors_len;
+
+	for (size_t i = 0; i < state->connectors_len; i++) {
+		const struct wlr_drm_connector_state *conn_state = &state->connectors[i];
+		struct wlr_drm_connector *conn = conn_state->connector;
+		struct wlr_drm_test_connector_key *conn_key = &key->connectors[i];
+
+		if (conn_state->base->committed & TEST_CACHE_UNSUPPORTED_STATE) {
+			return false;
+		}
+
+		conn_key->connector_id = conn->id;
+		conn_key->crtc_id = conn->crtc->id;
+		conn_key->active = conn_state->active;
+		conn_key->mode = conn_state->mode;
+		conn_key->in_fence = conn_state->wait_timeline != NULL;
+		conn_key->vrr_enabled =
+			conn->output.adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+		if (conn_state->base->committed & WLR_OUTPUT_STATE_COLOR_REPRESENTATION) {
+			conn_key->color_encoding = conn_state->base->color_encoding;
+			conn_key->color_range = conn_state->base->color_range;
+		}
+		if (!conn_state->active) {
+			continue;
+		}
+
+		if (conn_state->primary_fb == NULL) {
+			return false;
+		}
+		test_plane_key_init(&conn_key->primary, conn_state->primary_fb,
+			&conn_state->primary_viewport.src_box,
+			&conn_state->primary_viewport.dst_box);
+
+		// Some hardware restricts where the cursor can be placed, so the
+		// position is part of the key
+		if (conn->crtc->cursor != NULL && conn_state->cursor_fb != NULL &&
+				drm_connector_is_cursor_visible(conn)) {
+			struct wlr_buffer *cursor_buf = conn_state->cursor_fb->wlr_buf;
+			struct wlr_fbox cursor_src = {
+				.width = cursor_buf->width,
+				.height = cursor_buf->height,
+			};
+			struct wlr_box cursor_dst = {
+				.x = conn->cursor_x,
+				.y = conn->cursor_y,
+				.width = cursor_buf->width,
+				.height = cursor_buf->height,
+			};
+			test_plane_key_init(&conn_key->cursor, conn_state->cursor_fb,
+				&cursor_src, &cursor_dst);
+		}
+	}
+
+	return true;
+}
+
+static struct wlr_drm_test_cache_entry *test_cache_find(
+		struct wlr_drm_test_cache *cache, const struct wlr_drm_test_key *key) {
+	for (size_t i = 0; i < cache->entries_len; i++) {
+		struct wlr_drm_test_cache_entry *entry = &cache->entries[i];
+		if (memcmp(&entry->key, key, sizeof(*key)) == 0) {
+			entry->last_used = ++cache->seq;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static void test_cache_add(struct wlr_drm_test_cache *cache,
+		const struct wlr_drm_test_key *key, bool ok) {
+	struct wlr_drm_test_cache_entry *entry;
+	if (cache->entries_len < DRM_TEST_CACHE_SIZE) {
+		entry = &cache->entries[cache->entries_len++];
+	} else {
+		// Evict the least recently used entry
+		entry = &cache->entries[0];
+		for (size_t i = 1; i < cache->entries_len; i++) {
+			if (cache->entries[i].last_used < entry->last_used) {
+				entry = &cache->entries[i];
+			}
+		}
+	}
+
+	entry->key = *key;
+	entry->ok = ok;
+	entry->last_used = ++cache->seq;
+}
+
+void drm_test_cache_invalidate(struct wlr_drm_backend *drm) {
+	drm->test_cache.entries_len = 0;
+}
+
 static bool atomic_device_commit(struct wlr_drm_backend *drm,
 		const struct wlr_drm_device_state *state,
 		struct wlr_drm_page_flip *page_flip, uint32_t flags, bool test_only) {
 	bool ok = false;
 
+	struct wlr_drm_test_key test_key;
+	bool cacheable = test_only && test_key_init(&test_key, state, flags);
+	if (cacheable) {
+		struct wlr_drm_test_cache_entry *entry =
+			test_cache_find(&drm->test_cache, &test_key);
+		if (entry != NULL) {
+			drm->test_cache.hits++;
+			return entry->ok;
+		}
+		drm->test_cache.misses++;
+	}
+
 	for (size_t i = 0; i < state->connectors_len; i++) {
 		if (!drm_atomic_connector_prepare(&state->connectors[i], state->modeset)) {
 			goto out;
@@ -656,9 +804,21 @@ static bool atomic_device_commit(struct wlr_drm_backend *drm,
 		flags |= DRM_MODE_ATOMIC_NONBLOCK;
 	}
 
+	errno = 0;
 	ok = atomic_commit(&atom, drm, state, page_flip, flags);
+	int commit_errno = errno;
 	atomic_finish(&atom);
 
+	// Only remember rejections of the configuration itself, not transient
+	// errors
+	if (cacheable && (ok || commit_errno == EINVAL || commit_errno == ERANGE ||
+			commit_errno == ENOSPC)) {
+		test_cache_add(&drm->test_cache, &test_key, ok);
+	}
+	if (!test_only && (state->modeset || !ok)) {
+		drm_test_cache_invalidate(drm);
+	}
+
 out:
 	for (size_t i = 0; i < state->connectors_len; i++) {
 		struct wlr_drm_connector_state *conn_state = &state->connectors[i];
@@ -52,6 +52,7 @@ static void backend_destroy(struct wlr_backend *backend) {
 	wl_list_remove(&drm->dev_change.link);
 	wl_list_remove(&drm->dev_remove.link);
 
+	drm_fb_cache_flush(drm);
 	if (drm->mgpu_renderer.wlr_rend) {
 		wlr_drm_format_set_finish(&drm->mgpu_formats);
 		finish_drm_renderer(&drm->mgpu_renderer);
@@ -104,6 +105,18 @@ struct wlr_backend *wlr_drm_backend_get_parent(struct wlr_backend *backend) {
 	return drm->parent ? &drm->parent->backend : NULL;
 }
 
+void wlr_drm_backend_get_stats(struct wlr_backend *backend,
+		struct wlr_drm_backend_stats *stats) {
+	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
+	*stats = (struct wlr_drm_backend_stats){
+		.test_cache_hits = drm->test_cache.hits,
+		.test_cache_misses = drm->test_cache.misses,
+		.fb_cache_hits = drm->fb_cache.hits,
+		.fb_cache_misses = drm->fb_cache.misses,
+		.fb_cache_evictions = drm->fb_cache.evictions,
+	};
+}
+
 static void handle_session_active(struct wl_listener *listener, void *data) {
 	struct wlr_drm_backend *drm =
 		wl_container_of(listener, drm, session_active);
@@ -237,6 +250,7 @@ struct wlr_backend *wlr_drm_backend_create(struct wlr_session *session,
 
 	drm->session = session;
 	wl_list_init(&drm->fbs);
+	wl_list_init(&drm->fb_cache.fbs);
 	wl_list_init(&drm->connectors);
 	wl_list_init(&drm->page_flips);
 
@@ -14,6 +14,7 @@
 #include <wlr/backend/interface.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/render/drm_syncobj.h>
+#include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
@@ -600,6 +601,9 @@ static void drm_connector_apply_commit(const struct wlr_drm_connector_state *sta
 		drm_plane_finish_surface(crtc->primary);
 		drm_plane_finish_surface(crtc->cursor);
 		drm_fb_clear(&conn->cursor_pending_fb);
+		// The multi-GPU swapchains have been torn down, and the output's
+		// swapchains are about to be
+		drm_fb_cache_flush(conn->backend);
 
 		conn->cursor_enabled = false;
 		conn->crtc = NULL;
@@ -731,6 +735,19 @@ static void drm_connector_state_finish(struct wlr_drm_connector_state *state) {
 	wlr_drm_syncobj_timeline_unref(state->wait_timeline);
 }
 
+/**
+ * Check whether a buffer belongs to one of the output's swapchains. These
+ * buffers are never imported again once destroyed, so their FBs aren't worth
+ * caching.
+ */
+static bool is_output_swapchain_buffer(struct wlr_output *output,
+		struct wlr_buffer *buffer) {
+	return (output->swapchain != NULL &&
+		wlr_swapchain_has_buffer(output->swapchain, buffer)) ||
+		(output->cursor_swapchain != NULL &&
+		wlr_swapchain_has_buffer(output->cursor_swapchain, buffer));
+}
+
 static bool drm_connector_state_update_primary_fb(struct wlr_drm_connector *conn,
 		struct wlr_drm_connector_state *state) {
 	struct wlr_drm_backend *drm = conn->backend;
@@ -767,7 +784,11 @@ static bool drm_connector_state_update_primary_fb(struct wlr_drm_connector *conn
 			return false;
 		}
 
-		local_buf = drm_surface_blit(&plane->mgpu_surf, source_buf,
+		const pixman_region32_t *damage = NULL;
+		if (state->base->committed & WLR_OUTPUT_STATE_DAMAGE) {
+			damage = &state->base->damage;
+		}
+		local_buf = drm_surface_blit(&plane->mgpu_surf, source_buf, damage,
 			wait_timeline, wait_point);
 		if (local_buf == NULL) {
 			return false;
@@ -788,6 +809,10 @@ static bool drm_connector_state_update_primary_fb(struct wlr_drm_connector *conn
 
 	bool ok = drm_fb_import(&state->primary_fb, drm, local_buf,
 		&plane->formats);
+	if (ok && (local_buf != source_buf ||
+			is_output_swapchain_buffer(&conn->output, source_buf))) {
+		state->primary_fb->cacheable = false;
+	}
 	wlr_buffer_unlock(local_buf);
 	if (!ok) {
 		wlr_drm_conn_log(conn, WLR_DEBUG,
@@ -1174,7 +1199,7 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 				return false;
 			}
 
-			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer, NULL, 0);
+			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer, NULL, NULL, 0);
 			if (local_buf == NULL) {
 				return false;
 			}
@@ -1184,6 +1209,10 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 
 		bool ok = drm_fb_import(&conn->cursor_pending_fb, drm, local_buf,
 			&plane->formats);
+		if (ok && (local_buf != buffer ||
+				is_output_swapchain_buffer(&conn->output, buffer))) {
+			conn->cursor_pending_fb->cacheable = false;
+		}
 		wlr_buffer_unlock(local_buf);
 		if (!ok) {
 			return false;
@@ -1782,6 +1811,10 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 		wlr_log(WLR_INFO, "Scanning DRM connectors on %s", drm->name);
 	}
 
+	// Connectors may come and go, and other DRM masters may have changed the
+	// KMS state
+	drm_test_cache_invalidate(drm);
+
 	drmModeRes *res = drmModeGetResources(drm->fd);
 	if (!res) {
 		wlr_log_errno(WLR_ERROR, "Failed to get DRM resources");
@@ -2212,6 +2245,7 @@ struct wlr_drm_lease *wlr_drm_create_lease(struct wlr_output **outputs,
 		conn->crtc->lease = lease;
 		disconnect_drm_connector(conn);
 	}
+	drm_test_cache_invalidate(drm);
 
 	return lease;
 }
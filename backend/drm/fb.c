@@ -1,5 +1,7 @@
 #include <drm_fourcc.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/util/addon.h>
@@ -26,9 +28,56 @@ struct wlr_drm_fb *drm_fb_lock(struct wlr_drm_fb *fb) {
 	return fb;
 }
 
+static bool get_dmabuf_identity(const struct wlr_dmabuf_attributes *attribs,
+		dev_t dev[static WLR_DMABUF_MAX_PLANES],
+		ino_t ino[static WLR_DMABUF_MAX_PLANES]) {
+	for (int i = 0; i < attribs->n_planes; i++) {
+		struct stat st;
+		if (fstat(attribs->fd[i], &st) != 0) {
+			wlr_log_errno(WLR_DEBUG, "fstat failed");
+			return false;
+		}
+		dev[i] = st.st_dev;
+		ino[i] = st.st_ino;
+	}
+	return true;
+}
+
+/**
+ * Keep an FB whose buffer is being destroyed, in case the same DMA-BUF is
+ * imported again. Returns false if the FB can't be cached.
+ */
+static bool fb_cache_add(struct wlr_drm_fb *fb) {
+	// The buffer is still valid while its addons are destroyed
+	struct wlr_dmabuf_attributes attribs;
+	if (!fb->cacheable || !wlr_buffer_get_dmabuf(fb->wlr_buf, &attribs) ||
+			!get_dmabuf_identity(&attribs, fb->dmabuf_dev, fb->dmabuf_ino) ||
+			!wlr_dmabuf_attributes_copy(&fb->dmabuf, &attribs)) {
+		return false;
+	}
+
+	struct wlr_drm_fb_cache *cache = &fb->backend->fb_cache;
+	wl_list_insert(&cache->fbs, &fb->cache_link);
+	cache->len++;
+
+	if (cache->len > DRM_FB_CACHE_SIZE) {
+		struct wlr_drm_fb *oldest =
+			wl_container_of(cache->fbs.prev, oldest, cache_link);
+		drm_fb_destroy(oldest);
+		cache->evictions++;
+	}
+	return true;
+}
+
 static void drm_fb_handle_destroy(struct wlr_addon *addon) {
 	struct wlr_drm_fb *fb = wl_container_of(addon, fb, addon);
-	drm_fb_destroy(fb);
+	if (!fb_cache_add(fb)) {
+		drm_fb_destroy(fb);
+		return;
+	}
+
+	wlr_addon_finish(&fb->addon);
+	fb->wlr_buf = NULL;
 }
 
 static const struct wlr_addon_interface fb_addon_impl = {
@@ -36,6 +85,95 @@ static const struct wlr_addon_interface fb_addon_impl = {
 	.destroy = drm_fb_handle_destroy,
 };
 
+static void drm_fb_attach(struct wlr_drm_fb *fb, struct wlr_buffer *buf) {
+	fb->wlr_buf = buf;
+	wlr_addon_init(&fb->addon, &buf->addons, fb->backend, &fb_addon_impl);
+}
+
+static bool fb_matches_dmabuf(const struct wlr_drm_fb *fb,
+		const struct wlr_dmabuf_attributes *attribs, uint32_t format,
+		const dev_t dev[static WLR_DMABUF_MAX_PLANES],
+		const ino_t ino[static WLR_DMABUF_MAX_PLANES]) {
+	const struct wlr_dmabuf_attributes *fb_attribs = &fb->dmabuf;
+	if (fb->format != format ||
+			fb_attribs->width != attribs->width ||
+			fb_attribs->height != attribs->height ||
+			fb_attribs->format != attribs->format ||
+			fb_attribs->modifier != attribs->modifier ||
+			fb_attribs->n_planes != attribs->n_planes) {
+		return false;
+	}
+	for (int i = 0; i < attribs->n_planes; i++) {
+		if (fb->dmabuf_dev[i] != dev[i] || fb->dmabuf_ino[i] != ino[i] ||
+				fb_attribs->offset[i] != attribs->offset[i] ||
+				fb_attribs->stride[i] != attribs->stride[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Take a cached FB created from the same DMA-BUF, with the given FB format.
+ */
+static struct wlr_drm_fb *fb_cache_take(struct wlr_drm_backend *drm,
+		const struct wlr_dmabuf_attributes *attribs, uint32_t format) {
+	struct wlr_drm_fb_cache *cache = &drm->fb_cache;
+	dev_t dev[WLR_DMABUF_MAX_PLANES] = {0};
+	ino_t ino[WLR_DMABUF_MAX_PLANES] = {0};
+	if (cache->len == 0 || !get_dmabuf_identity(attribs, dev, ino)) {
+		return NULL;
+	}
+
+	struct wlr_drm_fb *fb;
+	wl_list_for_each(fb, &cache->fbs, cache_link) {
+		if (fb_matches_dmabuf(fb, attribs, format, dev, ino)) {
+			wl_list_remove(&fb->cache_link);
+			cache->len--;
+			// The new buffer keeps the DMA-BUF alive from now on
+			wlr_dmabuf_attributes_finish(&fb->dmabuf);
+			fb->dmabuf = (struct wlr_dmabuf_attributes){0};
+			return fb;
+		}
+	}
+	return NULL;
+}
+
+void drm_fb_cache_flush(struct wlr_drm_backend *drm) {
+	struct wlr_drm_fb *fb, *tmp;
+	wl_list_for_each_safe(fb, tmp, &drm->fb_cache.fbs, cache_link) {
+		drm_fb_destroy(fb);
+	}
+}
+
+/**
+ * Pick the format of the FB for a buffer: the format of the buffer if the
+ * plane supports it, its opaque substitute otherwise.
+ */
+static bool get_fb_format(const struct wlr_drm_format_set *formats,
+		const struct wlr_dmabuf_attributes *attribs, uint32_t *format) {
+	*format = attribs->format;
+	if (formats == NULL ||
+			wlr_drm_format_set_has(formats, attribs->format, attribs->modifier)) {
+		return true;
+	}
+
+	// The format isn't supported by the plane. Try stripping the alpha
+	// channel, if any.
+	const struct wlr_pixel_format_info *info =
+		drm_get_pixel_format_info(attribs->format);
+	if (info != NULL && info->opaque_substitute != DRM_FORMAT_INVALID &&
+			wlr_drm_format_set_has(formats, info->opaque_substitute, attribs->modifier)) {
+		*format = info->opaque_substitute;
+		return true;
+	}
+
+	wlr_log(WLR_DEBUG, "Buffer format 0x%"PRIX32" with modifier "
+		"0x%"PRIX64" cannot be scanned out",
+		attribs->format, attribs->modifier);
+	return false;
+}
+
 static uint32_t get_fb_for_bo(struct wlr_drm_backend *drm,
 		struct wlr_dmabuf_attributes *dmabuf, uint32_t handles[static 4]) {
 	uint64_t modifiers[4] = {0};
@@ -159,28 +297,29 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 		return NULL;
 	}
 
-	struct wlr_drm_fb *fb = calloc(1, sizeof(*fb));
+	uint32_t format;
+	if (!get_fb_format(formats, &attribs, &format)) {
+		return NULL;
+	}
+
+	// Re-use the FB of a destroyed buffer with the same DMA-BUF, if it has
+	// the format this plane needs
+	struct wlr_drm_fb *fb = fb_cache_take(drm, &attribs, format);
+	if (fb != NULL) {
+		drm->fb_cache.hits++;
+		fb->cacheable = true;
+		drm_fb_attach(fb, buf);
+		return fb;
+	}
+	drm->fb_cache.misses++;
+
+	fb = calloc(1, sizeof(*fb));
 	if (!fb) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
 		return NULL;
 	}
 
-	if (formats && !wlr_drm_format_set_has(formats, attribs.format,
-			attribs.modifier)) {
-		// The format isn't supported by the plane. Try stripping the alpha
-		// channel, if any.
-		const struct wlr_pixel_format_info *info =
-			drm_get_pixel_format_info(attribs.format);
-		if (info != NULL && info->opaque_substitute != DRM_FORMAT_INVALID &&
-				wlr_drm_format_set_has(formats, info->opaque_substitute, attribs.modifier)) {
-			attribs.format = info->opaque_substitute;
-		} else {
-			wlr_log(WLR_DEBUG, "Buffer format 0x%"PRIX32" with modifier "
-				"0x%"PRIX64" cannot be scanned out",
-				attribs.format, attribs.modifier);
-			goto error_fb;
-		}
-	}
+	attribs.format = format;
 
 	uint32_t handles[4] = {0};
 	for (int i = 0; i < attribs.n_planes; ++i) {
@@ -200,17 +339,16 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 
 	close_all_bo_handles(drm, handles);
 
+	fb->format = format;
+	fb->cacheable = true;
 	fb->backend = drm;
-	fb->wlr_buf = buf;
-
-	wlr_addon_init(&fb->addon, &buf->addons, drm, &fb_addon_impl);
+	drm_fb_attach(fb, buf);
 	wl_list_insert(&drm->fbs, &fb->link);
 
 	return fb;
 
 error_bo_handle:
 	close_all_bo_handles(drm, handles);
-error_fb:
 	free(fb);
 	return NULL;
 }
@@ -219,7 +357,13 @@ void drm_fb_destroy(struct wlr_drm_fb *fb) {
 	struct wlr_drm_backend *drm = fb->backend;
 
 	wl_list_remove(&fb->link);
-	wlr_addon_finish(&fb->addon);
+	if (fb->wlr_buf != NULL) {
+		wlr_addon_finish(&fb->addon);
+	} else {
+		wl_list_remove(&fb->cache_link);
+		drm->fb_cache.len--;
+	}
+	wlr_dmabuf_attributes_finish(&fb->dmabuf);
 
 	int ret = drmModeCloseFB(drm->fd, fb->id);
 	if (ret == -EINVAL) {
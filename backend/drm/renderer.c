@@ -4,6 +4,7 @@
 #include <wlr/render/drm_syncobj.h>
 #include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include "backend/drm/drm.h"
 #include "backend/drm/fb.h"
@@ -50,6 +51,7 @@ void finish_drm_surface(struct wlr_drm_surface *surf) {
 		return;
 	}
 
+	wlr_damage_ring_finish(&surf->damage_ring);
 	wlr_drm_syncobj_timeline_unref(surf->timeline);
 	wlr_swapchain_destroy(surf->swapchain);
 
@@ -83,13 +85,14 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 		}
 	}
 
+	wlr_damage_ring_init(&surf->damage_ring);
 	surf->renderer = renderer;
 
 	return true;
 }
 
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
-		struct wlr_buffer *buffer,
+		struct wlr_buffer *buffer, const pixman_region32_t *damage,
 		struct wlr_drm_syncobj_timeline *wait_timeline, uint64_t wait_point) {
 	struct wlr_renderer *renderer = surf->renderer->wlr_rend;
 
@@ -111,6 +114,18 @@ struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
 		goto error_tex;
 	}
 
+	struct wlr_box buffer_box = { .width = buffer->width, .height = buffer->height };
+	if (damage != NULL) {
+		wlr_damage_ring_add(&surf->damage_ring, damage);
+	} else {
+		wlr_damage_ring_add_box(&surf->damage_ring, &buffer_box);
+	}
+
+	// Only copy the regions the destination buffer is missing
+	pixman_region32_t dst_damage;
+	pixman_region32_init(&dst_damage);
+	wlr_damage_ring_rotate_buffer(&surf->damage_ring, dst, &dst_damage);
+
 	surf->point++;
 	const struct wlr_buffer_pass_options pass_options = {
 		.signal_timeline = surf->timeline,
@@ -125,6 +140,7 @@ struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
 	wlr_render_pass_add_texture(pass, &(struct wlr_render_texture_options){
 		.texture = tex,
 		.blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+		.clip = &dst_damage,
 		.wait_timeline = wait_timeline,
 		.wait_point = wait_point,
 	});
@@ -133,11 +149,15 @@ struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
 		goto error_dst;
 	}
 
+	pixman_region32_fini(&dst_damage);
 	wlr_texture_destroy(tex);
 
 	return dst;
 
 error_dst:
+	// The destination buffer is in an unknown state
+	wlr_damage_ring_add_box(&surf->damage_ring, &buffer_box);
+	pixman_region32_fini(&dst_damage);
 	wlr_buffer_unlock(dst);
 error_tex:
 	wlr_texture_destroy(tex);
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/types/wlr_output_layer.h>
 #include <wlr/util/log.h>
@@ -67,9 +68,16 @@ static bool output_commit(struct wlr_output *wlr_output,
 	}
 
 	if (output_pending_enabled(wlr_output, state)) {
+		// The frame timer stands in for the vblank. Take the presentation
+		// time before arming it, so that the next frame event never comes
+		// less than a refresh period after it.
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
 		struct wlr_output_event_present present_event = {
 			.commit_seq = wlr_output->commit_seq + 1,
 			.presented = true,
+			.when = now,
+			.refresh = output->frame_delay * 1000000,
 		};
 		output_defer_present(wlr_output, present_event);
 
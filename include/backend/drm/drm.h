@@ -8,6 +8,7 @@
 #include <wayland-util.h>
 #include <wlr/backend/drm.h>
 #include <wlr/backend/session.h>
+#include <wlr/render/dmabuf.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/types/wlr_output_layer.h>
 #include <xf86drmMode.h>
@@ -88,6 +89,77 @@ struct wlr_drm_crtc {
 	struct wlr_drm_crtc_props props;
 };
 
+#define DRM_TEST_CACHE_SIZE 16
+#define DRM_TEST_CACHE_MAX_CONNECTORS 4
+
+struct wlr_drm_test_plane_key {
+	bool enabled;
+	uint32_t format;
+	uint64_t modifier;
+	int width, height;
+	// Drivers check the memory layout of the FB, e.g. its pitch alignment
+	int n_planes;
+	uint32_t offset[WLR_DMABUF_MAX_PLANES];
+	uint32_t stride[WLR_DMABUF_MAX_PLANES];
+	struct wlr_fbox src_box;
+	struct wlr_box dst_box;
+};
+
+struct wlr_drm_test_connector_key {
+	uint32_t connector_id, crtc_id;
+	bool active;
+	drmModeModeInfo mode;
+	struct wlr_drm_test_plane_key primary, cursor;
+	bool in_fence;
+	bool vrr_enabled;
+	uint32_t color_encoding, color_range;
+};
+
+/**
+ * Parts of a device state which may affect the result of a TEST_ONLY commit.
+ * Compared with memcmp(), so padding must be zeroed.
+ */
+struct wlr_drm_test_key {
+	uint32_t flags;
+	size_t connectors_len;
+	struct wlr_drm_test_connector_key connectors[DRM_TEST_CACHE_MAX_CONNECTORS];
+};
+
+struct wlr_drm_test_cache_entry {
+	struct wlr_drm_test_key key;
+	bool ok;
+	uint64_t last_used;
+};
+
+/**
+ * Results of recent TEST_ONLY commits (atomic interface only). Cleared
+ * whenever the KMS state may have changed in a way which isn't captured by
+ * struct wlr_drm_test_key: modesets, failed commits, hotplug and leases.
+ */
+struct wlr_drm_test_cache {
+	struct wlr_drm_test_cache_entry entries[DRM_TEST_CACHE_SIZE];
+	size_t entries_len;
+	uint64_t seq;
+
+	uint64_t hits, misses;
+};
+
+#define DRM_FB_CACHE_SIZE 8
+
+/**
+ * FBs whose buffer has been destroyed, most recently used first. Clients may
+ * import the same DMA-BUF again, e.g. when re-creating their buffers or when
+ * cycling through a pool of video frames: the FB is then re-used instead of
+ * being created again. Cached FBs keep their DMA-BUF memory alive, so the
+ * cache is kept small.
+ */
+struct wlr_drm_fb_cache {
+	struct wl_list fbs; // wlr_drm_fb.cache_link
+	size_t len;
+
+	uint64_t hits, misses, evictions;
+};
+
 struct wlr_drm_backend {
 	struct wlr_backend backend;
 
@@ -115,6 +187,7 @@ struct wlr_drm_backend {
 	struct wl_listener dev_remove;
 
 	struct wl_list fbs; // wlr_drm_fb.link
+	struct wlr_drm_fb_cache fb_cache;
 	struct wl_list connectors; // wlr_drm_connector.link
 
 	struct wl_list page_flips; // wlr_drm_page_flip.link
@@ -129,6 +202,8 @@ struct wlr_drm_backend {
 	struct wlr_drm_format_set mgpu_formats;
 
 	bool supports_tearing_page_flips;
+
+	struct wlr_drm_test_cache test_cache;
 };
 
 struct wlr_drm_mode {
@@ -242,6 +317,7 @@ size_t drm_crtc_get_gamma_lut_size(struct wlr_drm_backend *drm,
 	struct wlr_drm_crtc *crtc);
 void drm_lease_destroy(struct wlr_drm_lease *lease);
 void drm_page_flip_destroy(struct wlr_drm_page_flip *page_flip);
+void drm_test_cache_invalidate(struct wlr_drm_backend *drm);
 
 struct wlr_drm_layer *get_drm_layer(struct wlr_drm_backend *drm,
 	struct wlr_output_layer *layer);
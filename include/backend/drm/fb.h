@@ -3,22 +3,42 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <wlr/render/dmabuf.h>
 #include <wlr/util/addon.h>
 
 struct wlr_drm_format_set;
 
 struct wlr_drm_fb {
-	struct wlr_buffer *wlr_buf;
+	struct wlr_buffer *wlr_buf; // NULL while in wlr_drm_backend.fb_cache
 	struct wlr_addon addon;
 	struct wlr_drm_backend *backend;
 	struct wl_list link; // wlr_drm_backend.fbs
 
 	uint32_t id;
+	// Format of the FB, which may be the opaque substitute of the format of
+	// the buffer
+	uint32_t format;
+
+	// False if the FB must not be cached once its buffer is destroyed, e.g.
+	// because the buffer belongs to a swapchain
+	bool cacheable;
+	// DMA-BUF the FB was created from, with its own FDs so that the DMA-BUF
+	// identity can't be reused while the FB is alive. Only set while the FB
+	// is in wlr_drm_backend.fb_cache.
+	struct wlr_dmabuf_attributes dmabuf;
+	dev_t dmabuf_dev[WLR_DMABUF_MAX_PLANES];
+	ino_t dmabuf_ino[WLR_DMABUF_MAX_PLANES];
+	struct wl_list cache_link; // wlr_drm_fb_cache.fbs
 };
 
 bool drm_fb_import(struct wlr_drm_fb **fb, struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats);
 void drm_fb_destroy(struct wlr_drm_fb *fb);
+/**
+ * Destroy the FBs of all buffers which have been destroyed.
+ */
+void drm_fb_cache_flush(struct wlr_drm_backend *drm);
 
 void drm_fb_clear(struct wlr_drm_fb **fb);
 void drm_fb_copy(struct wlr_drm_fb **new, struct wlr_drm_fb *old);
@@ -3,8 +3,10 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <pixman.h>
 #include <wlr/backend.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_damage_ring.h>
 #include <wlr/util/addon.h>
 
 struct wlr_drm_backend;
@@ -23,6 +25,9 @@ struct wlr_drm_surface {
 
 	struct wlr_drm_syncobj_timeline *timeline;
 	uint64_t point;
+
+	// Tracks which parts of each swapchain buffer are out of date
+	struct wlr_damage_ring damage_ring;
 };
 
 bool init_drm_renderer(struct wlr_drm_backend *drm,
@@ -34,8 +39,15 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 	const struct wlr_drm_format *drm_format);
 void finish_drm_surface(struct wlr_drm_surface *surf);
 
+/**
+ * Copy a buffer into the next buffer of the surface's swapchain.
+ *
+ * The damage is the region of the buffer which changed since the previous
+ * blit, in buffer-local coordinates, or NULL if unknown. Only the regions
+ * which are out of date in the destination buffer are copied.
+ */
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
-	struct wlr_buffer *buffer,
+	struct wlr_buffer *buffer, const pixman_region32_t *damage,
 	struct wlr_drm_syncobj_timeline *wait_timeline, uint64_t wait_point);
 
 bool drm_plane_pick_render_format(struct wlr_drm_plane *plane,
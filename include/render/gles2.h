@@ -21,6 +21,11 @@
 // https://gitlab.freedesktop.org/mesa/mesa/-/merge_requests/23144
 typedef void (GL_APIENTRYP PFNGLGETINTEGER64VEXTPROC) (GLenum pname, GLint64 *data);
 
+// GLES 3.0 buffer usage hint, not defined by the GLES2 headers
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+
 struct wlr_gles2_pixel_format {
 	uint32_t drm_format;
 	// optional field, if empty then internalformat = format
@@ -71,6 +76,13 @@ struct wlr_gles2_renderer {
 		PFNGLGETQUERYOBJECTIVEXTPROC glGetQueryObjectivEXT;
 		PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
 		PFNGLGETINTEGER64VEXTPROC glGetInteger64vEXT;
+		// GLES 3.0 functions, loaded if stage.enabled is set. The
+		// signatures match the ones of these extension types.
+		PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRange;
+		PFNGLUNMAPBUFFEROESPROC glUnmapBuffer;
+		PFNGLFENCESYNCAPPLEPROC glFenceSync;
+		PFNGLCLIENTWAITSYNCAPPLEPROC glClientWaitSync;
+		PFNGLDELETESYNCAPPLEPROC glDeleteSync;
 	} procs;
 
 	struct {
@@ -87,6 +99,44 @@ struct wlr_gles2_renderer {
 
 	struct wl_list buffers; // wlr_gles2_buffer.link
 	struct wl_list textures; // wlr_gles2_texture.link
+
+	struct wlr_gles2_upload_stats upload_stats;
+
+	struct {
+		bool enabled; // pixel buffer objects are supported (GLES 3.0)
+		struct wl_list buffers; // wlr_gles2_stage_buffer.link
+		size_t n_buffers;
+	} stage;
+
+	struct wl_list read_pixels_tasks; // wlr_gles2_read_pixels_task.link
+};
+
+// A pixel buffer object used to move pixels between the CPU and the GPU
+// without stalling
+struct wlr_gles2_stage_buffer {
+	struct wl_list link; // wlr_gles2_renderer.stage.buffers
+	GLuint pbo;
+	GLsizeiptr size;
+	GLenum usage;
+	// Set while the GPU may still be accessing the buffer
+	GLsync fence;
+	// Set between gles2_get_stage_buffer() and gles2_stage_buffer_release()
+	bool acquired;
+};
+
+// An asynchronous read of texture pixels into a stage buffer
+struct wlr_gles2_read_pixels_task {
+	struct wlr_texture_read_pixels_task base;
+	struct wlr_gles2_renderer *renderer;
+	struct wl_list link; // wlr_gles2_renderer.read_pixels_tasks
+
+	struct wlr_gles2_stage_buffer *stage_buf; // holds the region, tightly packed
+
+	GLsync fence; // signaled once the pixels have been read
+	bool signaled;
+	int fence_fd; // -1 if unsupported, the fence is polled instead
+	struct wl_event_loop *event_loop;
+	struct wl_event_source *event_source;
 };
 
 struct wlr_gles2_render_timer {
@@ -169,6 +219,24 @@ void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
 #define push_gles2_debug(renderer) push_gles2_debug_(renderer, _WLR_FILENAME, __func__)
 void pop_gles2_debug(struct wlr_gles2_renderer *renderer);
 
+/**
+ * Get an idle stage buffer of at least the specified size, for use with the
+ * specified usage hint (GL_STREAM_DRAW for uploads, GL_STREAM_READ for
+ * readbacks). Returns NULL if staging is unsupported or if all buffers are
+ * busy, in which case the caller should transfer the data directly.
+ *
+ * The GL context must be current.
+ */
+struct wlr_gles2_stage_buffer *gles2_get_stage_buffer(
+	struct wlr_gles2_renderer *renderer, GLsizeiptr size, GLenum usage);
+/**
+ * Give back a stage buffer. If the GPU may still access the buffer, the
+ * caller must set fence to true: the buffer won't be reused until the GPU
+ * commands issued so far complete.
+ */
+void gles2_stage_buffer_release(struct wlr_gles2_renderer *renderer,
+	struct wlr_gles2_stage_buffer *buffer, bool fence);
+
 struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *buffer,
 	struct wlr_egl_context *prev_ctx, struct wlr_gles2_render_timer *timer,
 	struct wlr_drm_syncobj_timeline *signal_timeline, uint64_t signal_point);
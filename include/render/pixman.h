@@ -5,6 +5,7 @@
 #include <wlr/render/interface.h>
 #include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/box.h>
 #include "render/pixel_format.h"
 
 struct wlr_pixman_pixel_format {
@@ -13,14 +14,33 @@ struct wlr_pixman_pixel_format {
 };
 
 struct wlr_pixman_buffer;
+struct worker_pool;
+
+// Number of solid fill images cached by the renderer
+#define WLR_PIXMAN_SOLID_IMAGE_CACHE_SIZE 16
+
+struct wlr_pixman_solid_image {
+	struct pixman_color color;
+	pixman_image_t *image; // NULL if the cache entry is unused
+	uint64_t last_used;
+};
 
 struct wlr_pixman_renderer {
 	struct wlr_renderer wlr_renderer;
 
 	struct wl_list buffers; // wlr_pixman_buffer.link
 	struct wl_list textures; // wlr_pixman_texture.link
+	struct wl_list passes; // wlr_pixman_render_pass.link
 
 	struct wlr_drm_format_set drm_formats;
+
+	struct worker_pool *worker_pool; // NULL if rendering on a single thread
+	bool copy_shm; // copy shm buffers into textures instead of reading them
+
+	// Solid fill images used as rect sources and texture alpha masks
+	struct wlr_pixman_solid_image solid_images[WLR_PIXMAN_SOLID_IMAGE_CACHE_SIZE];
+	uint64_t solid_images_seq;
+	pixman_image_t *scratch_image; // 1x1, used to prepare cached images
 };
 
 struct wlr_pixman_buffer {
@@ -42,13 +62,49 @@ struct wlr_pixman_texture {
 	pixman_format_code_t format;
 	const struct wlr_pixel_format_info *format_info;
 
-	void *data; // if created via texture_from_pixels
-	struct wlr_buffer *buffer; // if created via texture_from_buffer
+	void *data; // if the buffer contents are copied
+	struct wlr_buffer *buffer; // if the buffer is read directly
+
+	// Number of render passes using the texture which haven't been submitted
+	// yet
+	size_t n_pass_refs;
+	bool destroyed; // destroyed while still in use by a render pass
+};
+
+enum wlr_pixman_render_command_type {
+	WLR_PIXMAN_RENDER_COMMAND_TEXTURE,
+	WLR_PIXMAN_RENDER_COMMAND_RECT,
+};
+
+struct wlr_pixman_render_command {
+	enum wlr_pixman_render_command_type type;
+	pixman_op_t op;
+	struct wlr_box dst_box;
+	pixman_region32_t clip; // within dst_box and the buffer bounds
+
+	// WLR_PIXMAN_RENDER_COMMAND_RECT
+	struct pixman_color color;
+	pixman_image_t *fill; // NULL if the color is written directly
+
+	// WLR_PIXMAN_RENDER_COMMAND_TEXTURE
+	struct wlr_pixman_texture *texture;
+	struct wlr_box src_box;
+	bool has_transform;
+	struct pixman_transform transform;
+	enum wlr_scale_filter_mode filter_mode;
+	float alpha;
+	pixman_image_t *mask; // NULL if alpha is 1
 };
 
 struct wlr_pixman_render_pass {
 	struct wlr_render_pass base;
-	struct wlr_pixman_buffer *buffer;
+	struct wlr_pixman_buffer *buffer; // NULL if the renderer is destroyed
+	struct wl_list link; // wlr_pixman_renderer.passes
+
+	// Commands are recorded and executed on submit, possibly spread over
+	// multiple threads
+	struct wl_array commands; // struct wlr_pixman_render_command
+	struct wl_array textures; // struct wlr_pixman_texture *
 };
 
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
@@ -58,7 +114,37 @@ const uint32_t *get_pixman_drm_formats(size_t *len);
 bool begin_pixman_data_ptr_access(struct wlr_buffer *buffer, pixman_image_t **image_ptr,
 	uint32_t flags);
 
+/**
+ * Start using a texture in a render pass. Destroying the texture is deferred
+ * until the matching pixman_texture_end_pass().
+ */
+void pixman_texture_begin_pass(struct wlr_pixman_texture *texture);
+void pixman_texture_end_pass(struct wlr_pixman_texture *texture);
+
+/**
+ * Access the texture's buffer data pointer, if it reads the buffer directly,
+ * until the matching pixman_texture_end_access(). The access is shared by all
+ * textures created from the same buffer.
+ */
+bool pixman_texture_begin_access(struct wlr_pixman_texture *texture);
+void pixman_texture_end_access(struct wlr_pixman_texture *texture);
+
+/**
+ * Get a solid fill image from the renderer's cache, creating it if necessary.
+ * A new reference is returned. The image can be used concurrently by multiple
+ * threads, as long as its reference is only released from the compositor
+ * thread.
+ */
+pixman_image_t *pixman_renderer_get_solid_image(
+	struct wlr_pixman_renderer *renderer, const struct pixman_color *color);
+
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
 	struct wlr_pixman_buffer *buffer);
+/**
+ * Release everything held by a render pass which hasn't been submitted yet,
+ * because its renderer is being destroyed. Commands added to the pass
+ * afterwards are ignored and submitting it fails.
+ */
+void pixman_render_pass_detach(struct wlr_pixman_render_pass *pass);
 
 #endif
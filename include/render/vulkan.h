@@ -361,6 +361,8 @@ struct wlr_vk_renderer {
 		VkImage dst_image;
 		VkDeviceMemory dst_img_memory;
 	} read_pixels_cache;
+
+	struct wl_list read_pixels_tasks; // wlr_vk_read_pixels_task.link
 };
 
 // vertex shader push constant range data
@@ -411,6 +413,9 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 // executed before the next frame.
 VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer);
 
+// Submits the current stage command buffer without waiting for it. Returns
+// the timeline point signaled on completion, or 0 on error.
+uint64_t vulkan_submit_stage(struct wlr_vk_renderer *renderer, int wait_sync_file_fd);
 // Submits the current stage command buffer and waits until it has
 // finished execution.
 bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer, int wait_sync_file_fd);
@@ -509,6 +514,26 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 	uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
 	uint32_t dst_x, uint32_t dst_y, void *data,
 	struct wlr_drm_syncobj_timeline *wait_timeline, uint64_t wait_point);
+struct wlr_texture_read_pixels_task *vulkan_read_pixels_async(
+	struct wlr_vk_texture *texture,
+	const struct wlr_texture_read_pixels_async_options *options);
+
+// An asynchronous read of texture pixels, copied out of a host-visible image
+// once the stage command buffer has completed
+struct wlr_vk_read_pixels_task {
+	struct wlr_texture_read_pixels_task base;
+	struct wlr_vk_renderer *renderer;
+	struct wl_list link; // wlr_vk_renderer.read_pixels_tasks
+
+	// Taken from the renderer's read_pixels_cache, returned on destruction
+	VkImage dst_image;
+	VkDeviceMemory dst_img_memory;
+	uint32_t width, height;
+
+	uint64_t timeline_point;
+	bool signaled;
+	struct wl_event_source *timer; // polls the timeline semaphore
+};
 
 // State (e.g. image texture) associated with a surface.
 struct wlr_vk_texture {
@@ -27,6 +27,17 @@ bool output_cursor_refresh_color_transform(struct wlr_output_cursor *cursor,
 
 void output_defer_present(struct wlr_output *output, struct wlr_output_event_present event);
 
+void output_emit_frame(struct wlr_output *output);
+/**
+ * Delay the frame event if frame pacing is enabled. Returns false if the frame
+ * event should be emitted right away.
+ */
+bool output_frame_pacing_delay_frame(struct wlr_output *output);
+void output_frame_pacing_cancel(struct wlr_output *output);
+void output_frame_pacing_handle_present(struct wlr_output *output,
+	const struct wlr_output_event_present *event);
+void output_frame_pacing_destroy(struct wlr_output *output);
+
 bool output_prepare_commit(struct wlr_output *output, const struct wlr_output_state *state);
 void output_apply_commit(struct wlr_output *output, const struct wlr_output_state *state);
 void output_send_commit_event(struct wlr_output *output, const struct wlr_output_state *state);
@@ -9,4 +9,16 @@ void scene_node_get_size(struct wlr_scene_node *node, int *width, int *height);
 
 void scene_surface_set_clip(struct wlr_scene_surface *surface, struct wlr_box *clip);
 
+/**
+ * Drop the cached snapshot if something changed in the region, in layout
+ * coordinates.
+ */
+void scene_snapshot_cache_invalidate(struct wlr_scene *scene,
+	const pixman_region32_t *region);
+/**
+ * Destroy the snapshots released from other threads.
+ */
+void scene_snapshot_cache_collect(struct wlr_scene *scene);
+void scene_snapshot_cache_destroy(struct wlr_scene *scene);
+
 #endif
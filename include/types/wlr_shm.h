@@ -0,0 +1,31 @@
+#ifndef TYPES_WLR_SHM_H
+#define TYPES_WLR_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct wlr_buffer;
+struct wlr_shm_mapping;
+
+/**
+ * Begin a read access to the memory backing a wl_shm buffer, without going
+ * through wlr_buffer_begin_data_ptr_access().
+ *
+ * Unlike data pointer accesses, any number of these accesses may be in
+ * progress for the same buffer, and the memory may be read from any thread.
+ * The memory is protected against SIGBUS until shm_mapping_end_access() is
+ * called, and stays mapped even if the client resizes or destroys the pool.
+ *
+ * NULL is returned if the buffer isn't a wl_shm buffer created by wlr_shm, or
+ * on error.
+ */
+struct wlr_shm_mapping *shm_buffer_begin_mapping_access(
+	struct wlr_buffer *buffer, const void **data, uint32_t *format,
+	size_t *stride);
+/**
+ * End an access started with shm_buffer_begin_mapping_access(), once the memory
+ * is no longer read. May unmap the memory.
+ */
+void shm_mapping_end_access(struct wlr_shm_mapping *mapping);
+
+#endif
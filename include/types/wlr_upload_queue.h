@@ -0,0 +1,71 @@
+#ifndef TYPES_WLR_UPLOAD_QUEUE_H
+#define TYPES_WLR_UPLOAD_QUEUE_H
+
+#include <pixman.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct wlr_buffer;
+
+/**
+ * A worker thread which copies the damaged regions of shared memory buffers
+ * into staging buffers owned by the compositor.
+ *
+ * Jobs are executed in submission order. Completion is reported on the thread
+ * running the event loop passed to upload_queue_create().
+ */
+struct upload_queue;
+
+/**
+ * A sequence of buffers copied into a common set of staging buffers, e.g. the
+ * buffers committed to a surface. Only the damaged regions are copied.
+ */
+struct upload_stream;
+
+struct upload_event {
+	int64_t latency_nsec; // time elapsed between submission and completion
+	size_t bytes; // number of bytes copied
+};
+
+/**
+ * Called when a job completes. The event is NULL if the job has been
+ * cancelled, in which case the staging buffer contents are undefined.
+ */
+typedef void (*upload_done_func_t)(const struct upload_event *event, void *data);
+
+struct upload_queue *upload_queue_create(struct wl_event_loop *loop);
+/**
+ * Destroy the queue. Jobs which haven't completed yet are executed on the
+ * calling thread before returning.
+ */
+void upload_queue_destroy(struct upload_queue *queue);
+
+struct upload_stream *upload_stream_create(void);
+/**
+ * Destroy the stream. Jobs which haven't completed yet are cancelled.
+ */
+void upload_stream_destroy(struct upload_stream *stream);
+
+/**
+ * Queue a copy of a buffer into one of the stream's staging buffers. The damage
+ * is the region which changed since the previous buffer submitted to the
+ * stream, in buffer-local coordinates.
+ *
+ * On success, the staging buffer is returned locked and done() will be called
+ * exactly once. The staging buffer must not be read before then. The source
+ * buffer is unlocked as soon as the copy completes.
+ *
+ * The source buffer is read without a data pointer access, so it may be
+ * accessed with wlr_buffer_begin_data_ptr_access() or submitted again while
+ * the copy is in progress.
+ *
+ * NULL is returned if the buffer can't be copied asynchronously, e.g. because
+ * it isn't a wl_shm buffer or because all staging buffers are in use.
+ * The buffer should then be used directly.
+ */
+struct wlr_buffer *upload_stream_submit(struct upload_stream *stream,
+	struct upload_queue *queue, struct wlr_buffer *buffer,
+	const pixman_region32_t *damage, upload_done_func_t done, void *data);
+
+#endif
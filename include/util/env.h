@@ -20,4 +20,12 @@ bool env_parse_bool(const char *option);
  */
 size_t env_parse_switch(const char *option, const char **switches);
 
+/**
+ * Parse a thread count from an environment variable. Zero means one thread per
+ * CPU.
+ *
+ * On success, the thread count is returned. On error, one is returned.
+ */
+size_t env_parse_threads(const char *option);
+
 #endif
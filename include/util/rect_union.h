@@ -14,8 +14,9 @@
  *
  * Add rectangles to the union with `rect_union_add()`; to compute the disjoint
  * union, run `rect_union_evaluate()`, which will place the result in `.region`.
- * If there were any allocation failures, `.region` will instead contain the
- * bounding box for the entire list of rectangles.
+ * If there were any allocation failures, or the union became too complex to
+ * be worth tracking exactly, `.region` will instead contain the bounding box
+ * for the entire list of rectangles.
  *
  * Example usage:
  *
@@ -38,7 +39,9 @@ struct rect_union {
 	pixman_region32_t region; // Updated only on _evaluate()
 
 	struct wl_array unsorted; // pixman_box32_t
-	bool alloc_failure; // If this is true, fall back to computing a bounding box
+	// If this is true, fall back to computing a bounding box. Set on allocation
+	// failure or when the complexity limit is exceeded.
+	bool alloc_failure;
 };
 
 /**
@@ -56,7 +59,11 @@ void rect_union_finish(struct rect_union *r);
  * Add a rectangle to the union. If `box` is empty or invalid (x2 > x1 || y2 > y1),
  * do nothing.
  *
- * Amortized time: O(1)
+ * Pending rectangles are periodically sorted, merged and folded into the
+ * region to bound memory usage.
+ *
+ * Amortized time: O(log t + r/t), where r is the number of rectangles in the
+ * region and t the compaction threshold
  */
 void rect_union_add(struct rect_union *r, const pixman_box32_t *box);
 
@@ -65,13 +72,18 @@ void rect_union_add(struct rect_union *r, const pixman_box32_t *box);
  * a pointer to a pixman_region32_t giving that cover. The pointer will
  * remain valid until the next time *r is modified.
  *
- * An internal complexity limit is enforced by rect_union. If exceeded, this
- * function will instead return a single-rectangle bounding box.
+ * An internal complexity limit is enforced by rect_union: once the region
+ * holds more than a minimum number of rectangles, it is replaced by its
+ * bounding box if the area the bounding box would add is small compared to
+ * the cost of handling each rectangle separately, or if a hard limit on the
+ * number of rectangles is exceeded. In that case this function will instead
+ * return a single-rectangle bounding box.
  *
  * This may be called multiple times and interleaved with rect_union_add().
  *
- * Worst case time: O(t^2), where t is the number of rectangles in the list.
- * Best case time: O(t), if rectangles are disjoint and have y-x band structure
+ * Worst case time: O(t^2), where t is the number of pending rectangles.
+ * Best case time: O(t log t), if rectangles are disjoint and have y-x band
+ * structure, or are runs of rectangles on the same rows
  */
 const pixman_region32_t *rect_union_evaluate(struct rect_union *r);
 
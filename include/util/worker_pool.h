@@ -0,0 +1,42 @@
+#ifndef UTIL_WORKER_POOL_H
+#define UTIL_WORKER_POOL_H
+
+#include <stddef.h>
+
+/**
+ * A fixed set of threads which run the iterations of parallel loops.
+ *
+ * The thread calling worker_pool_run() takes part in running the loop, so a
+ * pool with N worker threads runs up to N + 1 iterations at once.
+ */
+struct worker_pool;
+
+typedef void (*worker_pool_func_t)(size_t index, void *data);
+
+/**
+ * Create a pool with the specified number of worker threads. Returns NULL on
+ * error.
+ */
+struct worker_pool *worker_pool_create(size_t n_threads);
+
+/**
+ * Stop and join the worker threads, and free the pool. Must not be called
+ * while worker_pool_run() is in progress.
+ */
+void worker_pool_destroy(struct worker_pool *pool);
+
+/**
+ * Get the number of worker threads of the pool.
+ */
+size_t worker_pool_get_size(const struct worker_pool *pool);
+
+/**
+ * Run func(index, data) for each index in [0, n), and wait for all iterations
+ * to complete. Iterations may run concurrently and in any order.
+ *
+ * Must only be called from a single thread at a time.
+ */
+void worker_pool_run(struct worker_pool *pool, size_t n,
+	worker_pool_func_t func, void *data);
+
+#endif
@@ -47,6 +47,22 @@ bool wlr_output_is_drm(const struct wlr_output *output);
  */
 struct wlr_backend *wlr_drm_backend_get_parent(struct wlr_backend *backend);
 
+struct wlr_drm_backend_stats {
+	// Atomic TEST_ONLY commits answered from the cache of recent results,
+	// and commits sent to the kernel because no result was cached
+	uint64_t test_cache_hits, test_cache_misses;
+	// Buffers imported with a framebuffer left over from a destroyed buffer
+	// referring to the same DMA-BUF, buffers imported with a new framebuffer,
+	// and left-over framebuffers destroyed to keep the cache bounded
+	uint64_t fb_cache_hits, fb_cache_misses, fb_cache_evictions;
+};
+
+/**
+ * Get statistics about the DRM backend, e.g. for debugging performance.
+ */
+void wlr_drm_backend_get_stats(struct wlr_backend *backend,
+	struct wlr_drm_backend_stats *stats);
+
 /**
  * Get the KMS connector object ID.
  */
@@ -10,6 +10,7 @@
 #define WLR_RENDER_GLES2_H
 
 #include <GLES2/gl2.h>
+#include <stdint.h>
 
 #include <wlr/render/wlr_renderer.h>
 
@@ -35,6 +36,21 @@ struct wlr_egl *wlr_gles2_renderer_get_egl(struct wlr_renderer *renderer);
 bool wlr_gles2_renderer_check_ext(struct wlr_renderer *renderer, const char *ext);
 GLuint wlr_gles2_renderer_get_buffer_fbo(struct wlr_renderer *renderer, struct wlr_buffer *buffer);
 
+/**
+ * Cumulative statistics about shared memory texture uploads.
+ */
+struct wlr_gles2_upload_stats {
+	uint64_t bytes; // pixel data uploaded, in bytes
+	uint64_t calls; // number of glTexImage2D() and glTexSubImage2D() calls
+};
+
+/**
+ * Get the texture upload statistics of the renderer. The counters are never
+ * reset: sample them once per frame to get per-frame figures.
+ */
+void wlr_gles2_renderer_get_upload_stats(struct wlr_renderer *renderer,
+	struct wlr_gles2_upload_stats *stats);
+
 struct wlr_gles2_texture_attribs {
 	GLenum target; /* either GL_TEXTURE_2D or GL_TEXTURE_EXTERNAL_OES */
 	GLuint tex;
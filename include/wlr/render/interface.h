@@ -43,11 +43,66 @@ struct wlr_texture_impl {
 		const struct wlr_texture_read_pixels_options *options);
 	uint32_t (*preferred_read_format)(struct wlr_texture *texture);
 	void (*destroy)(struct wlr_texture *texture);
+	// Optional, pixels are read synchronously if unset
+	struct wlr_texture_read_pixels_task *(*read_pixels_async)(
+		struct wlr_texture *texture,
+		const struct wlr_texture_read_pixels_async_options *options);
 };
 
 void wlr_texture_init(struct wlr_texture *texture, struct wlr_renderer *rendener,
 	const struct wlr_texture_impl *impl, uint32_t width, uint32_t height);
 
+struct wlr_texture_read_pixels_task_impl {
+	/**
+	 * Copy the pixels read back by the GPU into the destination buffer. Called
+	 * once the GPU is done, with the buffer's data pointer accessed.
+	 */
+	bool (*copy)(struct wlr_texture_read_pixels_task *task,
+		const struct wlr_texture_read_pixels_options *options);
+	void (*destroy)(struct wlr_texture_read_pixels_task *task);
+};
+
+struct wlr_texture_read_pixels_task {
+	const struct wlr_texture_read_pixels_task_impl *impl;
+
+	struct wlr_buffer *buffer; // locked
+	uint32_t format, stride; // of the destination buffer
+	uint32_t dst_x, dst_y;
+	struct wlr_box src_box;
+	pixman_region32_t region; // relative to src_box, clipped to it
+	struct wl_event_loop *event_loop;
+
+	wlr_texture_read_pixels_done_func_t done;
+	void *data;
+
+	struct {
+		struct wl_event_source *idle;
+		bool ok;
+	} WLR_PRIVATE;
+};
+
+/**
+ * Initialize a task for an asynchronous read. Fails if the destination
+ * buffer doesn't support data pointer access.
+ */
+bool wlr_texture_read_pixels_task_init(struct wlr_texture_read_pixels_task *task,
+	const struct wlr_texture_read_pixels_task_impl *impl,
+	struct wlr_texture *texture,
+	const struct wlr_texture_read_pixels_async_options *options);
+/**
+ * Complete a task: on success, the pixels are copied into the destination
+ * buffer. done() is then called and the task is destroyed.
+ */
+void wlr_texture_read_pixels_task_finish(struct wlr_texture_read_pixels_task *task,
+	bool ok);
+/**
+ * Read pixels synchronously and report completion from an idle callback. Used
+ * by renderers which can't read pixels asynchronously.
+ */
+struct wlr_texture_read_pixels_task *wlr_texture_read_pixels_deferred(
+	struct wlr_texture *texture,
+	const struct wlr_texture_read_pixels_async_options *options);
+
 struct wlr_render_pass {
 	const struct wlr_render_pass_impl *impl;
 };
@@ -86,5 +141,8 @@ void wlr_texture_read_pixels_options_get_src_box(
 	const struct wlr_texture *texture, struct wlr_box *box);
 void *wlr_texture_read_pixel_options_get_data(
 	const struct wlr_texture_read_pixels_options *options);
+void wlr_texture_read_pixels_async_options_get_src_box(
+	const struct wlr_texture_read_pixels_async_options *options,
+	const struct wlr_texture *texture, struct wlr_box *box);
 
 #endif
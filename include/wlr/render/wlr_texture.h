@@ -44,6 +44,62 @@ struct wlr_texture_read_pixels_options {
 bool wlr_texture_read_pixels(struct wlr_texture *texture,
 	const struct wlr_texture_read_pixels_options *options);
 
+/**
+ * A pending asynchronous read started with wlr_texture_read_pixels_async().
+ */
+struct wlr_texture_read_pixels_task;
+
+/**
+ * Called when an asynchronous read completes. On success, the destination
+ * buffer contains the requested pixels.
+ */
+typedef void (*wlr_texture_read_pixels_done_func_t)(bool ok, void *data);
+
+struct wlr_texture_read_pixels_async_options {
+	/** Buffer to read pixels into, must support data pointer access */
+	struct wlr_buffer *buffer;
+	/** Destination offsets */
+	uint32_t dst_x, dst_y;
+	/** Source box of the texture to read from. If empty, the full texture is assumed. */
+	const struct wlr_box src_box;
+	/**
+	 * Region to read, relative to the source box. If NULL, the whole source
+	 * box is read. Pixels of the buffer outside of the region are left
+	 * untouched.
+	 */
+	const pixman_region32_t *region;
+	struct wlr_drm_syncobj_timeline *wait_timeline;
+	uint64_t wait_point;
+
+	/** Event loop used to report completion */
+	struct wl_event_loop *event_loop;
+	wlr_texture_read_pixels_done_func_t done;
+	void *data;
+};
+
+/**
+ * Start reading pixels from a texture into a buffer, without waiting for the
+ * GPU to complete the read.
+ *
+ * The texture contents are captured by this call: the texture can be destroyed
+ * right after it returns. The destination buffer is locked until the read
+ * completes and only accessed from the event loop's thread.
+ *
+ * On success, done() is called exactly once from the event loop, never from
+ * within this function, unless the task is cancelled first. If the renderer
+ * is destroyed before the read completes, done() is called from
+ * wlr_renderer_destroy() instead. NULL is returned on failure.
+ */
+struct wlr_texture_read_pixels_task *wlr_texture_read_pixels_async(
+	struct wlr_texture *texture,
+	const struct wlr_texture_read_pixels_async_options *options);
+
+/**
+ * Cancel a pending asynchronous read. done() won't be called and the
+ * destination buffer won't be written to anymore.
+ */
+void wlr_texture_read_pixels_task_cancel(struct wlr_texture_read_pixels_task *task);
+
 uint32_t wlr_texture_preferred_read_format(struct wlr_texture *texture);
 
 /**
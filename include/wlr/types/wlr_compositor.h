@@ -268,11 +268,20 @@ struct wlr_surface {
 
 		struct wl_resource *pending_buffer_resource;
 		struct wl_listener pending_buffer_resource_destroy;
+
+		struct upload_stream *upload_stream; // NULL if unused
 	} WLR_PRIVATE;
 };
 
 struct wlr_renderer;
 
+struct wlr_compositor_shm_upload_event {
+	struct wlr_surface *surface;
+	// Time elapsed between the client's commit and the end of the copy
+	int64_t latency_nsec;
+	size_t bytes; // number of bytes copied
+};
+
 struct wlr_compositor {
 	struct wl_global *global;
 	struct wlr_renderer *renderer; // may be NULL
@@ -280,11 +289,19 @@ struct wlr_compositor {
 	struct {
 		struct wl_signal new_surface;
 		struct wl_signal destroy;
+		/**
+		 * Signals that a shared memory buffer has been copied off-thread, see
+		 * wlr_compositor_set_async_shm_upload().
+		 */
+		struct wl_signal shm_upload; // struct wlr_compositor_shm_upload_event
 	} events;
 
 	struct {
 		struct wl_listener display_destroy;
 		struct wl_listener renderer_destroy;
+
+		struct wl_event_loop *event_loop;
+		struct upload_queue *upload_queue; // NULL if disabled
 	} WLR_PRIVATE;
 };
 
@@ -578,4 +595,20 @@ struct wlr_compositor *wlr_compositor_create(struct wl_display *display,
 void wlr_compositor_set_renderer(struct wlr_compositor *compositor,
 	struct wlr_renderer *renderer);
 
+/**
+ * Enable or disable off-thread copies of shared memory buffers.
+ *
+ * When enabled, the damaged regions of shared memory buffers committed by
+ * clients are copied into compositor-owned staging memory by a worker thread.
+ * The surface commit is applied once the copy completes, and the client's
+ * buffer is released right away. The copy latency is reported via the
+ * shm_upload event.
+ *
+ * Disabling blocks until the copies in progress have completed.
+ *
+ * Returns false if the worker thread couldn't be started.
+ */
+bool wlr_compositor_set_async_shm_upload(struct wlr_compositor *compositor,
+	bool enabled);
+
 #endif
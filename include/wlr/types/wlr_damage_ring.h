@@ -15,10 +15,14 @@
 #include <pixman.h>
 #include <wayland-server-core.h>
 
+#define WLR_DAMAGE_RING_SLOTS 4
+
 struct wlr_box;
 
 struct wlr_damage_ring_buffer {
-	struct wlr_buffer *buffer;
+	struct wlr_buffer *buffer; // NULL if the slot is unused
+	// Damage accumulated since the buffer was last rotated in, excluding the
+	// ring's current damage
 	pixman_region32_t damage;
 
 	struct wlr_damage_ring *ring;
@@ -33,8 +37,19 @@ struct wlr_damage_ring {
 	// Difference between the current buffer and the previous one
 	pixman_region32_t current;
 
+	// Statistics about the last wlr_damage_ring_rotate_buffer() call, except
+	// for simplifications which is never reset
+	struct {
+		int rects; // Rectangles in the accumulated damage, before simplification
+		uint64_t current_area; // Area of the current damage
+		uint64_t accumulated_area; // Area of the returned damage
+		uint64_t simplifications; // Regions replaced with their extents
+	} stats;
+
 	struct {
+		// Slots in use, most recently used first
 		struct wl_list buffers; // wlr_damage_ring_buffer.link
+		struct wlr_damage_ring_buffer slots[WLR_DAMAGE_RING_SLOTS];
 	} WLR_PRIVATE;
 };
 
@@ -71,6 +86,10 @@ void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring);
  * Users should damage the ring if an error occurs while rendering or
  * submitting the new buffer to the backend.
  *
+ * The ring tracks damage for up to WLR_DAMAGE_RING_SLOTS buffers. When a new
+ * buffer is rotated in while all slots are in use, the least recently used
+ * buffer is forgotten and will be fully damaged the next time it's used.
+ *
  * The returned damage will be in the buffer-local coordinate space.
  */
 void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
@@ -58,6 +58,14 @@ struct wlr_ext_image_copy_capture_frame_v1 {
 
 	struct {
 		struct wlr_ext_image_copy_capture_session_v1 *session;
+
+		// Set while the buffer is copied asynchronously
+		struct wlr_texture_read_pixels_task *copy_task;
+		// Set if the frame has been marked ready before the copy completed
+		bool ready_pending;
+		enum wl_output_transform ready_transform;
+		struct timespec ready_presentation_time;
+		pixman_region32_t ready_damage;
 	} WLR_PRIVATE;
 };
 
@@ -67,6 +75,9 @@ struct wlr_ext_image_copy_capture_manager_v1 *wlr_ext_image_copy_capture_manager
 /**
  * Notify the client that the frame is ready.
  *
+ * If the buffer is still being copied, the notification is deferred until the
+ * copy completes. The frame fails if the copy does.
+ *
  * This function destroys the frame.
  */
 void wlr_ext_image_copy_capture_frame_v1_ready(struct wlr_ext_image_copy_capture_frame_v1 *frame,
@@ -80,6 +91,8 @@ void wlr_ext_image_copy_capture_frame_v1_fail(struct wlr_ext_image_copy_capture_
 	enum ext_image_copy_capture_frame_v1_failure_reason reason);
 /**
  * Copy a struct wlr_buffer into the client-provided buffer for the frame.
+ *
+ * Copies into shared memory buffers complete asynchronously.
  */
 bool wlr_ext_image_copy_capture_frame_v1_copy_buffer(struct wlr_ext_image_copy_capture_frame_v1 *frame,
 	struct wlr_buffer *src, struct wlr_renderer *renderer);
@@ -172,6 +172,7 @@ struct wlr_output_state {
 };
 
 struct wlr_output_impl;
+struct wlr_output_frame_pacing;
 struct wlr_render_pass;
 
 /**
@@ -282,6 +283,7 @@ struct wlr_output {
 		struct wlr_output_image_description image_description_value;
 		struct wlr_color_transform *color_transform;
 		struct wlr_color_primaries default_primaries_value;
+		struct wlr_output_frame_pacing *frame_pacing; // may be NULL
 	} WLR_PRIVATE;
 };
 
@@ -415,6 +417,35 @@ bool wlr_output_commit_state(struct wlr_output *output,
  * it is a no-op.
  */
 void wlr_output_schedule_frame(struct wlr_output *output);
+
+struct wlr_output_frame_pacing_options {
+	// Time to keep between the predicted end of rendering and the next
+	// vblank, in nanoseconds
+	int64_t margin_ns;
+};
+
+/**
+ * Enable frame pacing, or disable it if options is NULL.
+ *
+ * By default, the `frame` event is emitted as soon as the previous frame has
+ * been presented, so the new frame waits for almost a full refresh cycle
+ * before being displayed. With frame pacing, the `frame` event is delayed
+ * until the predicted render time plus the margin before the next vblank.
+ * The next vblank is predicted from the `present` events, and the render
+ * time from the durations reported with wlr_output_report_render_duration().
+ *
+ * Frames aren't delayed until both are known, nor while adaptive sync is
+ * enabled.
+ */
+bool wlr_output_set_frame_pacing(struct wlr_output *output,
+	const struct wlr_output_frame_pacing_options *options);
+/**
+ * Report how long rendering a frame took for this output, for instance as
+ * returned by wlr_scene_timer_get_duration_ns(). Negative durations are
+ * ignored.
+ */
+void wlr_output_report_render_duration(struct wlr_output *output,
+	int64_t duration_ns);
 /**
  * Returns the maximum length of each gamma ramp, or 0 if unsupported.
  */
@@ -578,7 +609,9 @@ void wlr_output_state_set_buffer(struct wlr_output_state *state,
 /**
  * Sets the damage region for an output. This is used as a hint to the backend
  * and can be used to reduce power consumption or increase performance on some
- * devices.
+ * devices. For instance, on multi-GPU setups the DRM backend only copies the
+ * damaged regions to the secondary GPU, so the damage must include everything
+ * that changed since the previous buffer.
  *
  * This should be called in along with wlr_output_state_set_buffer().
  * This state will be applied once wlr_output_commit_state() is called.
@@ -39,6 +39,9 @@ struct wlr_surface;
 struct wlr_scene_node;
 struct wlr_scene_buffer;
 struct wlr_scene_output_layout;
+struct wlr_scene_batch;
+struct wlr_scene_snapshot_cache;
+struct worker_pool;
 
 struct wlr_presentation;
 struct wlr_linux_dmabuf_v1;
@@ -92,6 +95,13 @@ struct wlr_scene_tree {
 	struct wlr_scene_node node;
 
 	struct wl_list children; // wlr_scene_node.link
+
+	struct {
+		// Bounding box of all enabled descendants, relative to the tree's
+		// origin. Only valid when bounds_dirty is false.
+		struct wlr_box bounds;
+		bool bounds_dirty;
+	} WLR_PRIVATE;
 };
 
 /** The root scene-graph node. */
@@ -109,6 +119,14 @@ struct wlr_scene {
 
 	bool restack_xwayland_surfaces;
 
+	// Counters for profiling scene-graph updates, never reset
+	struct {
+		// Number of times the visible region of a node was re-computed
+		uint64_t visibility_updates;
+		// Number of times the render list of an output was constructed
+		uint64_t render_list_builds;
+	} stats;
+
 	struct {
 		struct wl_listener linux_dmabuf_v1_destroy;
 		struct wl_listener gamma_control_manager_v1_destroy;
@@ -122,6 +140,17 @@ struct wlr_scene {
 		bool direct_scanout;
 		bool calculate_visibility;
 		bool highlight_transparent_region;
+		bool spatial_index;
+
+		int batch_depth;
+		// NULL if no batch is in progress
+		struct wlr_scene_batch *batch;
+
+		// NULL if output states are built on a single thread
+		struct worker_pool *worker_pool;
+
+		// NULL until the first snapshot is created
+		struct wlr_scene_snapshot_cache *snapshot_cache;
 	} WLR_PRIVATE;
 };
 
@@ -244,6 +273,10 @@ struct wlr_scene_output {
 
 		uint8_t index;
 
+		// Layout box of the output the last time the active outputs of the
+		// scene buffers were updated
+		struct wlr_box geometry;
+
 		/**
 		 * When scanout is applicable, we increment this every time a frame is rendered until
 		 * DMABUF_FEEDBACK_DEBOUNCE_FRAMES is hit to debounce the scanout dmabuf feedback. Likewise,
@@ -267,7 +300,12 @@ struct wlr_scene_output {
 
 		struct wl_list damage_highlight_regions;
 
+		// The render list is kept across frames, and only constructed again
+		// once the scene changed inside of the box it was built for
 		struct wl_array render_list;
+		struct wlr_box render_list_box;
+		bool render_list_fractional_scale;
+		bool render_list_dirty;
 
 		struct wlr_drm_syncobj_timeline *in_timeline;
 		uint64_t in_point;
@@ -362,6 +400,89 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
  */
 struct wlr_scene *wlr_scene_create(void);
 
+/**
+ * Start a batch of scene-graph changes.
+ *
+ * Until the matching wlr_scene_commit_batch() call, node visibility, output
+ * enter/leave events and output damage are not updated. This allows a
+ * compositor re-arranging many nodes at once to only pay for these updates
+ * once. Outputs should not be rendered while a batch is in progress.
+ *
+ * Batches can be nested, in which case the outermost one is applied.
+ */
+void wlr_scene_begin_batch(struct wlr_scene *scene);
+/**
+ * Apply the changes made since the matching wlr_scene_begin_batch() call.
+ */
+void wlr_scene_commit_batch(struct wlr_scene *scene);
+
+/** A node captured by a scene snapshot. */
+struct wlr_scene_snapshot_node {
+	// WLR_SCENE_NODE_RECT or WLR_SCENE_NODE_BUFFER
+	enum wlr_scene_node_type type;
+	// Position and size of the node, in layout coordinates
+	struct wlr_box box;
+	// Visible region of the node, in layout coordinates, clipped to the
+	// snapshot's box
+	pixman_region32_t visible;
+
+	// Only set for rect nodes
+	float color[4];
+
+	// Only set for buffer nodes. The buffer is locked by the snapshot, it is
+	// NULL if the node only displays a texture.
+	struct wlr_buffer *buffer;
+	struct wlr_fbox src_box;
+	enum wl_output_transform transform;
+	float opacity;
+	enum wlr_scale_filter_mode filter_mode;
+	struct wlr_drm_syncobj_timeline *wait_timeline;
+	uint64_t wait_point;
+};
+
+/**
+ * An immutable copy of the nodes of a scene inside a box.
+ *
+ * Snapshots can be read from any thread without synchronization, and
+ * references to them can be taken and dropped from any thread. Modifying the
+ * scene never changes an existing snapshot.
+ */
+struct wlr_scene_snapshot {
+	// Box captured by the snapshot, in layout coordinates
+	struct wlr_box box;
+	// Captured nodes, from bottom to top
+	const struct wlr_scene_snapshot_node *nodes;
+	size_t nodes_len;
+};
+
+/**
+ * Capture the enabled, visible nodes of the scene inside a box, in layout
+ * coordinates. If the box is NULL, the whole scene is captured.
+ *
+ * If nothing changed in the box since the last snapshot of the same box was
+ * taken, a new reference to that snapshot is returned instead of capturing
+ * the scene again.
+ *
+ * Must be called from the compositor thread, not while a batch is in
+ * progress. Returns NULL on error.
+ */
+struct wlr_scene_snapshot *wlr_scene_snapshot_create(struct wlr_scene *scene,
+	const struct wlr_box *box);
+/**
+ * Take a new reference to the snapshot. Can be called from any thread.
+ */
+struct wlr_scene_snapshot *wlr_scene_snapshot_ref(struct wlr_scene_snapshot *snapshot);
+/**
+ * Drop a reference to the snapshot. Can be called from any thread.
+ *
+ * Since struct wlr_buffer isn't thread-safe, the buffers captured by the
+ * snapshot are unlocked on the compositor thread once the last reference is
+ * dropped: the next time the scene creates a snapshot or an output of the
+ * scene is committed. All references must be dropped before the scene is
+ * destroyed.
+ */
+void wlr_scene_snapshot_unref(struct wlr_scene_snapshot *snapshot);
+
 /**
  * Handles linux_dmabuf_v1 feedback for all surfaces in the scene.
  *
@@ -639,6 +760,32 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output,
 bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	struct wlr_output_state *state, const struct wlr_scene_output_state_options *options);
 
+struct wlr_scene_output_build_job {
+	struct wlr_scene_output *scene_output;
+	struct wlr_output_state *state;
+	// May be NULL
+	const struct wlr_scene_output_state_options *options;
+
+	// Set by wlr_scene_build_output_states()
+	bool ok;
+};
+
+/**
+ * Render and populate the given states of several outputs of a scene. This is
+ * equivalent to calling wlr_scene_output_build_state() for each job, except
+ * that the render lists and the regions to render of the outputs are computed
+ * concurrently if the WLR_SCENE_THREADS environment variable is set.
+ *
+ * The worker threads only read the scene graph, so the scene must not be
+ * modified from another thread until this function returns. Render passes are
+ * recorded and signals are emitted on the calling thread, but listeners must
+ * not modify the scene graph either. Each output may appear in one job only.
+ *
+ * Returns true if the states of all outputs were built.
+ */
+bool wlr_scene_build_output_states(struct wlr_scene *scene,
+	struct wlr_scene_output_build_job *jobs, size_t jobs_len);
+
 /**
  * Retrieve the duration in nanoseconds between the last wlr_scene_output_commit() call and the end
  * of its operations, including those on the GPU that may have finished after the call returned.
@@ -9,7 +9,9 @@
 #ifndef WLR_TYPES_WLR_SCREENCOPY_V1_H
 #define WLR_TYPES_WLR_SCREENCOPY_V1_H
 
+#include <pixman.h>
 #include <stdbool.h>
+#include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/util/box.h>
@@ -65,6 +67,11 @@ struct wlr_screencopy_frame_v1 {
 	struct {
 		struct wl_listener output_commit;
 		struct wl_listener output_destroy;
+
+		// Set while the output contents are read back asynchronously
+		struct wlr_texture_read_pixels_task *copy_task;
+		struct timespec copy_when;
+		pixman_region32_t damage; // damage reported along with the copy
 	} WLR_PRIVATE;
 };
 
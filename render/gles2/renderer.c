@@ -199,11 +199,140 @@ struct wlr_egl *wlr_gles2_renderer_get_egl(struct wlr_renderer *wlr_renderer) {
 	return renderer->egl;
 }
 
+void wlr_gles2_renderer_get_upload_stats(struct wlr_renderer *wlr_renderer,
+		struct wlr_gles2_upload_stats *stats) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	*stats = renderer->upload_stats;
+}
+
+// Maximum number of stage buffers, and maximum size of a stage buffer
+static const size_t max_stage_buffers = 4;
+static const GLsizeiptr max_stage_size = 64 * 1024 * 1024;
+
+static void stage_buffer_destroy(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_stage_buffer *buf) {
+	if (buf->fence != NULL) {
+		renderer->procs.glDeleteSync(buf->fence);
+	}
+	glDeleteBuffers(1, &buf->pbo);
+	wl_list_remove(&buf->link);
+	renderer->stage.n_buffers--;
+	free(buf);
+}
+
+// Returns true if the GPU is done with the buffer. The buffer is destroyed if
+// its fence can't be waited on.
+static bool stage_buffer_poll(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_stage_buffer *buf) {
+	if (buf->fence == NULL) {
+		return true;
+	}
+
+	GLenum status = renderer->procs.glClientWaitSync(buf->fence,
+		GL_SYNC_FLUSH_COMMANDS_BIT_APPLE, 0);
+	if (status == GL_WAIT_FAILED_APPLE) {
+		// The fence will never signal, don't hold on to the buffer forever
+		wlr_log(WLR_ERROR, "Failed to wait for stage buffer fence");
+		stage_buffer_destroy(renderer, buf);
+		return false;
+	}
+	if (status != GL_ALREADY_SIGNALED_APPLE &&
+			status != GL_CONDITION_SATISFIED_APPLE) {
+		return false;
+	}
+
+	renderer->procs.glDeleteSync(buf->fence);
+	buf->fence = NULL;
+	return true;
+}
+
+struct wlr_gles2_stage_buffer *gles2_get_stage_buffer(
+		struct wlr_gles2_renderer *renderer, GLsizeiptr size, GLenum usage) {
+	if (!renderer->stage.enabled || size > max_stage_size) {
+		return NULL;
+	}
+
+	// Prefer an idle buffer with the same usage, ideally large enough, so
+	// that uploads and readbacks don't keep reallocating each other's
+	// buffers
+	struct wlr_gles2_stage_buffer *buf, *buf_tmp, *found = NULL, *other_usage = NULL;
+	wl_list_for_each_safe(buf, buf_tmp, &renderer->stage.buffers, link) {
+		if (buf->acquired || !stage_buffer_poll(renderer, buf)) {
+			continue;
+		}
+		if (buf->usage != usage) {
+			other_usage = buf;
+			continue;
+		}
+		if (found == NULL || buf->size >= size) {
+			found = buf;
+		}
+		if (buf->size >= size) {
+			break;
+		}
+	}
+
+	if (found == NULL && renderer->stage.n_buffers < max_stage_buffers) {
+		found = calloc(1, sizeof(*found));
+		if (found == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return NULL;
+		}
+		glGenBuffers(1, &found->pbo);
+		wl_list_insert(renderer->stage.buffers.prev, &found->link);
+		renderer->stage.n_buffers++;
+	}
+	if (found == NULL) {
+		found = other_usage;
+	}
+	if (found == NULL) {
+		return NULL;
+	}
+
+	if (found->size < size || found->usage != usage) {
+		// Round up to limit reallocations when the size varies slightly
+		GLsizeiptr alloc_size = 256 * 1024;
+		while (alloc_size < size) {
+			alloc_size *= 2;
+		}
+		if (alloc_size > max_stage_size) {
+			alloc_size = max_stage_size;
+		}
+
+		GLenum target = usage == GL_STREAM_READ ?
+			GL_PIXEL_PACK_BUFFER_NV : GL_PIXEL_UNPACK_BUFFER_NV;
+		glBindBuffer(target, found->pbo);
+		glBufferData(target, alloc_size, NULL, usage);
+		glBindBuffer(target, 0);
+		found->size = alloc_size;
+		found->usage = usage;
+	}
+
+	found->acquired = true;
+	return found;
+}
+
+void gles2_stage_buffer_release(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_stage_buffer *buf, bool fence) {
+	assert(buf->acquired);
+	assert(buf->fence == NULL);
+	buf->acquired = false;
+	if (fence) {
+		buf->fence = renderer->procs.glFenceSync(
+			GL_SYNC_GPU_COMMANDS_COMPLETE_APPLE, 0);
+	}
+}
+
 static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
 
 	wlr_egl_make_current(renderer->egl, NULL);
 
+	struct wlr_gles2_read_pixels_task *task, *task_tmp;
+	wl_list_for_each_safe(task, task_tmp, &renderer->read_pixels_tasks, link) {
+		wlr_texture_read_pixels_task_finish(&task->base, false);
+	}
+
 	struct wlr_gles2_texture *tex, *tex_tmp;
 	wl_list_for_each_safe(tex, tex_tmp, &renderer->textures, link) {
 		gles2_texture_destroy(tex);
@@ -215,6 +344,10 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 	}
 
 	push_gles2_debug(renderer);
+	struct wlr_gles2_stage_buffer *stage_buf, *stage_buf_tmp;
+	wl_list_for_each_safe(stage_buf, stage_buf_tmp, &renderer->stage.buffers, link) {
+		stage_buffer_destroy(renderer, stage_buf);
+	}
 	glDeleteProgram(renderer->shaders.quad.program);
 	glDeleteProgram(renderer->shaders.tex_rgba.program);
 	glDeleteProgram(renderer->shaders.tex_rgbx.program);
@@ -493,6 +626,12 @@ static void load_gl_proc(void *proc_ptr, const char *name) {
 	*(void **)proc_ptr = proc;
 }
 
+static bool try_load_gl_proc(void *proc_ptr, const char *name) {
+	void *proc = (void *)eglGetProcAddress(name);
+	*(void **)proc_ptr = proc;
+	return proc != NULL;
+}
+
 struct wlr_renderer *wlr_gles2_renderer_create_with_drm_fd(int drm_fd) {
 	struct wlr_egl *egl = wlr_egl_create_with_drm_fd(drm_fd);
 	if (egl == NULL) {
@@ -530,6 +669,8 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->stage.buffers);
+	wl_list_init(&renderer->read_pixels_tasks);
 
 	renderer->egl = egl;
 	renderer->exts_str = exts_str;
@@ -618,6 +759,27 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		}
 	}
 
+	// Pixel buffer objects, buffer mapping and fences are core in GLES 3.0.
+	// Mesa and most drivers hand out a GLES 3 context when GLES 2 is
+	// requested.
+	int gl_major = 0;
+	const char *gl_version = (const char *)glGetString(GL_VERSION);
+	if (gl_version != NULL &&
+			sscanf(gl_version, "OpenGL ES %d.", &gl_major) == 1 && gl_major >= 3) {
+		// Without EGL_KHR_get_all_proc_addresses, eglGetProcAddress() may
+		// not return core functions: staging is optional, don't fail
+		renderer->stage.enabled =
+			try_load_gl_proc(&renderer->procs.glMapBufferRange, "glMapBufferRange") &&
+			try_load_gl_proc(&renderer->procs.glUnmapBuffer, "glUnmapBuffer") &&
+			try_load_gl_proc(&renderer->procs.glFenceSync, "glFenceSync") &&
+			try_load_gl_proc(&renderer->procs.glClientWaitSync, "glClientWaitSync") &&
+			try_load_gl_proc(&renderer->procs.glDeleteSync, "glDeleteSync");
+		if (!renderer->stage.enabled) {
+			wlr_log(WLR_DEBUG, "GLES 3 buffer functions are unavailable, "
+				"disabling staging buffers");
+		}
+	}
+
 	if (renderer->exts.KHR_debug) {
 		glEnable(GL_DEBUG_OUTPUT_KHR);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
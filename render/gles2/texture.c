@@ -4,6 +4,7 @@
 #include <GLES2/gl2ext.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wayland-server-protocol.h>
 #include <wayland-util.h>
@@ -29,6 +30,169 @@ struct wlr_gles2_texture *gles2_get_texture(
 	return texture;
 }
 
+// Damage rectangles are uploaded in batches: the bounding box of
+// consecutive rectangles is uploaded with a single call, as long as it
+// doesn't contain too much undamaged area. Pixman regions are sorted in
+// bands of rows, so this mostly merges rectangles of the same or adjacent
+// bands, e.g. the lines of text updated by a terminal.
+struct upload_box {
+	pixman_box32_t extents;
+	int64_t damaged_area; // zero if the box is empty
+};
+
+// Undamaged area which can always be added to a batch, in pixels. Uploading
+// a few extra rows is cheaper than an additional call.
+#define UPLOAD_BOX_MIN_SLACK 4096
+
+static int64_t box_area(const pixman_box32_t *box) {
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static bool upload_box_merge(struct upload_box *box, const pixman_box32_t *rect) {
+	if (box->damaged_area == 0) {
+		box->extents = *rect;
+		box->damaged_area = box_area(rect);
+		return true;
+	}
+
+	pixman_box32_t extents = {
+		.x1 = box->extents.x1 < rect->x1 ? box->extents.x1 : rect->x1,
+		.y1 = box->extents.y1 < rect->y1 ? box->extents.y1 : rect->y1,
+		.x2 = box->extents.x2 > rect->x2 ? box->extents.x2 : rect->x2,
+		.y2 = box->extents.y2 > rect->y2 ? box->extents.y2 : rect->y2,
+	};
+	int64_t damaged_area = box->damaged_area + box_area(rect);
+	if (box_area(&extents) > 2 * damaged_area + UPLOAD_BOX_MIN_SLACK) {
+		return false;
+	}
+
+	box->extents = extents;
+	box->damaged_area = damaged_area;
+	return true;
+}
+
+// Get the next batch of damage rectangles to upload, starting at *index
+static bool upload_box_next(const pixman_box32_t *rects, int rects_len,
+		int *index, pixman_box32_t *extents) {
+	if (*index >= rects_len) {
+		return false;
+	}
+	struct upload_box box = {0};
+	while (*index < rects_len && upload_box_merge(&box, &rects[*index])) {
+		(*index)++;
+	}
+	*extents = box.extents;
+	return true;
+}
+
+// Uploads smaller than this are done directly from the buffer data, staging
+// them doesn't pay off
+#define STAGED_UPLOAD_MIN_SIZE (64 * 1024)
+
+static size_t staged_box_size(const pixman_box32_t *box,
+		const struct wlr_pixel_format_info *drm_fmt) {
+	size_t size = (size_t)(box->x2 - box->x1) * (box->y2 - box->y1) *
+		drm_fmt->bytes_per_block;
+	return (size + 15) & ~(size_t)15;
+}
+
+static void upload_boxes(struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *fmt,
+		const struct wlr_pixel_format_info *drm_fmt, const void *data,
+		size_t stride, const pixman_box32_t *rects, int rects_len) {
+	// Rows are addressed via the data pointer, so only the row length needs
+	// to be set up for all calls
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / drm_fmt->bytes_per_block);
+
+	pixman_box32_t extents;
+	int index = 0;
+	while (upload_box_next(rects, rects_len, &index, &extents)) {
+		const char *pixels = (const char *)data + (size_t)extents.y1 * stride +
+			(size_t)extents.x1 * drm_fmt->bytes_per_block;
+		int width = extents.x2 - extents.x1;
+		int height = extents.y2 - extents.y1;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, extents.x1, extents.y1, width, height,
+			fmt->gl_format, fmt->gl_type, pixels);
+
+		renderer->upload_stats.bytes +=
+			(uint64_t)width * height * drm_fmt->bytes_per_block;
+		renderer->upload_stats.calls++;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+}
+
+// Copy the boxes into a stage buffer, tightly packed, and upload them from
+// there. The GPU reads the stage buffer asynchronously.
+static bool upload_boxes_staged(struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *fmt,
+		const struct wlr_pixel_format_info *drm_fmt, const void *data,
+		size_t stride, const pixman_box32_t *rects, int rects_len,
+		size_t staged_size) {
+	struct wlr_gles2_stage_buffer *stage_buf =
+		gles2_get_stage_buffer(renderer, staged_size, GL_STREAM_DRAW);
+	if (stage_buf == NULL) {
+		return false;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, stage_buf->pbo);
+
+	// The buffer is idle, no need to synchronize with the GPU
+	char *map = renderer->procs.glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_NV,
+		0, staged_size, GL_MAP_WRITE_BIT_EXT | GL_MAP_INVALIDATE_BUFFER_BIT_EXT |
+		GL_MAP_UNSYNCHRONIZED_BIT_EXT);
+	if (map == NULL) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		gles2_stage_buffer_release(renderer, stage_buf, false);
+		return false;
+	}
+
+	pixman_box32_t extents;
+	size_t offset = 0;
+	int index = 0;
+	while (upload_box_next(rects, rects_len, &index, &extents)) {
+		size_t row_size = (size_t)(extents.x2 - extents.x1) * drm_fmt->bytes_per_block;
+		const char *src = (const char *)data + (size_t)extents.y1 * stride +
+			(size_t)extents.x1 * drm_fmt->bytes_per_block;
+		char *dst = map + offset;
+		for (int y = extents.y1; y < extents.y2; y++) {
+			memcpy(dst, src, row_size);
+			dst += row_size;
+			src += stride;
+		}
+		offset += staged_box_size(&extents, drm_fmt);
+	}
+
+	if (!renderer->procs.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_NV)) {
+		// The buffer contents have been lost
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		gles2_stage_buffer_release(renderer, stage_buf, false);
+		return false;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	offset = 0;
+	index = 0;
+	while (upload_box_next(rects, rects_len, &index, &extents)) {
+		int width = extents.x2 - extents.x1;
+		int height = extents.y2 - extents.y1;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, extents.x1, extents.y1, width, height,
+			fmt->gl_format, fmt->gl_type, (const void *)(uintptr_t)offset);
+		offset += staged_box_size(&extents, drm_fmt);
+
+		renderer->upload_stats.bytes +=
+			(uint64_t)width * height * drm_fmt->bytes_per_block;
+		renderer->upload_stats.calls++;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+
+	gles2_stage_buffer_release(renderer, stage_buf, true);
+	return true;
+}
+
 static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
 	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
@@ -78,22 +242,19 @@ static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 	int rects_len = 0;
 	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
 
-	for (int i = 0; i < rects_len; i++) {
-		pixman_box32_t rect = rects[i];
-
-		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / drm_fmt->bytes_per_block);
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, rect.x1);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, rect.y1);
-
-		int width = rect.x2 - rect.x1;
-		int height = rect.y2 - rect.y1;
-		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x1, rect.y1, width, height,
-			fmt->gl_format, fmt->gl_type, data);
+	size_t staged_size = 0;
+	pixman_box32_t extents;
+	int index = 0;
+	while (upload_box_next(rects, rects_len, &index, &extents)) {
+		staged_size += staged_box_size(&extents, drm_fmt);
 	}
 
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	if (staged_size < STAGED_UPLOAD_MIN_SIZE ||
+			!upload_boxes_staged(texture->renderer, fmt, drm_fmt, data, stride,
+			rects, rects_len, staged_size)) {
+		upload_boxes(texture->renderer, fmt, drm_fmt, data, stride,
+			rects, rects_len);
+	}
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -165,24 +326,112 @@ static bool gles2_texture_bind(struct wlr_gles2_texture *texture) {
 	return true;
 }
 
-static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
-		const struct wlr_texture_read_pixels_options *options) {
-	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+// Start reading rectangles of the bound framebuffer into a stage buffer. The
+// rectangles are relative to the source box and batched like uploads: reading
+// a few extra pixels is cheaper than an additional call.
+static struct wlr_gles2_stage_buffer *read_pixels_to_stage(
+		struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *fmt,
+		const struct wlr_pixel_format_info *drm_fmt, const struct wlr_box *src,
+		const pixman_box32_t *rects, int rects_len) {
+	pixman_box32_t extents;
+	size_t size = 0;
+	int index = 0;
+	while (upload_box_next(rects, rects_len, &index, &extents)) {
+		size += staged_box_size(&extents, drm_fmt);
+	}
+	if (size == 0) {
+		return NULL;
+	}
 
-	struct wlr_box src;
-	wlr_texture_read_pixels_options_get_src_box(options, wlr_texture, &src);
+	struct wlr_gles2_stage_buffer *stage_buf =
+		gles2_get_stage_buffer(renderer, size, GL_STREAM_READ);
+	if (stage_buf == NULL) {
+		return NULL;
+	}
 
-	const struct wlr_gles2_pixel_format *fmt =
-		get_gles2_format_from_drm(options->format);
-	if (fmt == NULL || !is_gles2_pixel_format_supported(texture->renderer, fmt)) {
-		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format 0x%"PRIX32, options->format);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, stage_buf->pbo);
+	size_t offset = 0;
+	index = 0;
+	while (upload_box_next(rects, rects_len, &index, &extents)) {
+		glReadPixels(src->x + extents.x1, src->y + extents.y1,
+			extents.x2 - extents.x1, extents.y2 - extents.y1,
+			fmt->gl_format, fmt->gl_type, (void *)(uintptr_t)offset);
+		offset += staged_box_size(&extents, drm_fmt);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+	return stage_buf;
+}
+
+// Copy rectangles read by read_pixels_to_stage() into the destination, which
+// points to the top-left corner of the source box
+static bool copy_pixels_from_stage(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_stage_buffer *stage_buf,
+		const struct wlr_pixel_format_info *drm_fmt,
+		const pixman_box32_t *rects, int rects_len,
+		unsigned char *dst, uint32_t dst_stride) {
+	// Mapping waits for the read to complete, no need for glFinish()
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, stage_buf->pbo);
+	const unsigned char *map = renderer->procs.glMapBufferRange(
+		GL_PIXEL_PACK_BUFFER_NV, 0, stage_buf->size, GL_MAP_READ_BIT_EXT);
+	if (map == NULL) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
 		return false;
 	}
 
-	if (fmt->gl_format == GL_BGRA_EXT && !texture->renderer->exts.EXT_read_format_bgra) {
+	pixman_box32_t extents;
+	size_t offset = 0;
+	int index = 0;
+	while (upload_box_next(rects, rects_len, &index, &extents)) {
+		size_t row_size = (size_t)(extents.x2 - extents.x1) * drm_fmt->bytes_per_block;
+		const unsigned char *src = map + offset;
+		unsigned char *p = dst + (size_t)extents.y1 * dst_stride +
+			(size_t)extents.x1 * drm_fmt->bytes_per_block;
+		for (int y = extents.y1; y < extents.y2; y++) {
+			memcpy(p, src, row_size);
+			p += dst_stride;
+			src += row_size;
+		}
+		offset += staged_box_size(&extents, drm_fmt);
+	}
+
+	bool ok = renderer->procs.glUnmapBuffer(GL_PIXEL_PACK_BUFFER_NV);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+	return ok;
+}
+
+// Read pixels into a stage buffer with a single call, then copy them into
+// the destination with its own stride. GLES2 lacks GL_PACK_ROW_LENGTH, so
+// without a stage buffer a call per row is needed when the strides differ.
+static bool read_pixels_staged(struct wlr_gles2_renderer *renderer,
+		const struct wlr_gles2_pixel_format *fmt,
+		const struct wlr_pixel_format_info *drm_fmt, const struct wlr_box *src,
+		unsigned char *dst, uint32_t dst_stride) {
+	pixman_box32_t rect = { 0, 0, src->width, src->height };
+	struct wlr_gles2_stage_buffer *stage_buf =
+		read_pixels_to_stage(renderer, fmt, drm_fmt, src, &rect, 1);
+	if (stage_buf == NULL) {
+		return false;
+	}
+
+	bool ok = copy_pixels_from_stage(renderer, stage_buf, drm_fmt,
+		&rect, 1, dst, dst_stride);
+	gles2_stage_buffer_release(renderer, stage_buf, false);
+	return ok;
+}
+
+static const struct wlr_gles2_pixel_format *get_read_format(
+		struct wlr_gles2_renderer *renderer, uint32_t drm_format) {
+	const struct wlr_gles2_pixel_format *fmt = get_gles2_format_from_drm(drm_format);
+	if (fmt == NULL || !is_gles2_pixel_format_supported(renderer, fmt)) {
+		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format 0x%"PRIX32, drm_format);
+		return NULL;
+	}
+
+	if (fmt->gl_format == GL_BGRA_EXT && !renderer->exts.EXT_read_format_bgra) {
 		wlr_log(WLR_ERROR,
 			"Cannot read pixels: missing GL_EXT_read_format_bgra extension");
-		return false;
+		return NULL;
 	}
 
 	const struct wlr_pixel_format_info *drm_fmt =
@@ -190,9 +439,45 @@ static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
 	assert(drm_fmt);
 	if (pixel_format_info_pixels_per_block(drm_fmt) != 1) {
 		wlr_log(WLR_ERROR, "Cannot read pixels: block formats are not supported");
+		return NULL;
+	}
+
+	return fmt;
+}
+
+static bool wait_timeline(struct wlr_gles2_renderer *renderer,
+		struct wlr_drm_syncobj_timeline *timeline, uint64_t point) {
+	int sync_file_fd = wlr_drm_syncobj_timeline_export_sync_file(timeline, point);
+	if (sync_file_fd < 0) {
+		return false;
+	}
+
+	EGLSyncKHR sync = wlr_egl_create_sync(renderer->egl, sync_file_fd);
+	close(sync_file_fd);
+	if (sync == EGL_NO_SYNC_KHR) {
 		return false;
 	}
 
+	bool ok = wlr_egl_wait_sync(renderer->egl, sync);
+	wlr_egl_destroy_sync(renderer->egl, sync);
+	return ok;
+}
+
+static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
+		const struct wlr_texture_read_pixels_options *options) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+
+	struct wlr_box src;
+	wlr_texture_read_pixels_options_get_src_box(options, wlr_texture, &src);
+
+	const struct wlr_gles2_pixel_format *fmt =
+		get_read_format(texture->renderer, options->format);
+	if (fmt == NULL) {
+		return false;
+	}
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(fmt->drm_format);
+
 	push_gles2_debug(texture->renderer);
 	struct wlr_egl_context prev_ctx;
 	if (!wlr_egl_make_current(texture->renderer->egl, &prev_ctx)) {
@@ -203,55 +488,263 @@ static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
 		return false;
 	}
 
-	if (options->wait_timeline != NULL) {
-		int sync_file_fd =
-			wlr_drm_syncobj_timeline_export_sync_file(options->wait_timeline, options->wait_point);
-		if (sync_file_fd < 0) {
-			return false;
+	if (options->wait_timeline != NULL && !wait_timeline(texture->renderer,
+			options->wait_timeline, options->wait_point)) {
+		return false;
+	}
+
+	glGetError(); // Clear the error flag
+
+	unsigned char *p = wlr_texture_read_pixel_options_get_data(options);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	uint32_t pack_stride = pixel_format_info_min_stride(drm_fmt, src.width);
+	if (!read_pixels_staged(texture->renderer, fmt, drm_fmt, &src,
+			p, options->stride)) {
+		// Make sure any pending drawing is finished before we try to read it
+		glFinish();
+
+		if (pack_stride == options->stride && options->dst_x == 0) {
+			// Under these particular conditions, we can read the pixels with
+			// only one glReadPixels call
+
+			glReadPixels(src.x, src.y, src.width, src.height, fmt->gl_format, fmt->gl_type, p);
+		} else {
+			// Unfortunately GLES2 doesn't support GL_PACK_ROW_LENGTH, so we have
+			// to read the lines out row by row
+			for (int32_t i = 0; i < src.height; ++i) {
+				uint32_t y = src.y + i;
+				glReadPixels(src.x, y, src.width, 1, fmt->gl_format,
+					fmt->gl_type, p + i * options->stride);
+			}
 		}
+	}
 
-		struct wlr_gles2_renderer *renderer = texture->renderer;
-		EGLSyncKHR sync = wlr_egl_create_sync(renderer->egl, sync_file_fd);
-		close(sync_file_fd);
-		if (sync == EGL_NO_SYNC_KHR) {
-			return false;
+	wlr_egl_restore_context(&prev_ctx);
+	pop_gles2_debug(texture->renderer);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+static struct wlr_gles2_read_pixels_task *read_pixels_task_from_base(
+		struct wlr_texture_read_pixels_task *base) {
+	struct wlr_gles2_read_pixels_task *task = wl_container_of(base, task, base);
+	return task;
+}
+
+static bool read_pixels_task_copy(struct wlr_texture_read_pixels_task *base,
+		const struct wlr_texture_read_pixels_options *options) {
+	struct wlr_gles2_read_pixels_task *task = read_pixels_task_from_base(base);
+	struct wlr_gles2_renderer *renderer = task->renderer;
+
+	push_gles2_debug(renderer);
+	struct wlr_egl_context prev_ctx;
+	bool ok = wlr_egl_make_current(renderer->egl, &prev_ctx);
+	if (ok) {
+		int rects_len = 0;
+		const pixman_box32_t *rects =
+			pixman_region32_rectangles(&task->base.region, &rects_len);
+		ok = copy_pixels_from_stage(renderer, task->stage_buf,
+			drm_get_pixel_format_info(options->format), rects, rects_len,
+			wlr_texture_read_pixel_options_get_data(options), options->stride);
+		wlr_egl_restore_context(&prev_ctx);
+	}
+	pop_gles2_debug(renderer);
+	return ok;
+}
+
+static void read_pixels_task_destroy(struct wlr_texture_read_pixels_task *base) {
+	struct wlr_gles2_read_pixels_task *task = read_pixels_task_from_base(base);
+	struct wlr_gles2_renderer *renderer = task->renderer;
+
+	if (task->event_source != NULL) {
+		wl_event_source_remove(task->event_source);
+	}
+	if (task->fence_fd >= 0) {
+		close(task->fence_fd);
+	}
+
+	struct wlr_egl_context prev_ctx;
+	if (wlr_egl_make_current(renderer->egl, &prev_ctx)) {
+		if (task->fence != NULL) {
+			renderer->procs.glDeleteSync(task->fence);
+		}
+		if (task->stage_buf != NULL) {
+			// The GPU may still be writing to the stage buffer if the task
+			// has been cancelled
+			gles2_stage_buffer_release(renderer, task->stage_buf, !task->signaled);
 		}
+		wlr_egl_restore_context(&prev_ctx);
+	}
 
-		bool ok = wlr_egl_wait_sync(renderer->egl, sync);
-		wlr_egl_destroy_sync(renderer->egl, sync);
-		if (!ok) {
-			return false;
+	wl_list_remove(&task->link);
+	free(task);
+}
+
+static const struct wlr_texture_read_pixels_task_impl read_pixels_task_impl = {
+	.copy = read_pixels_task_copy,
+	.destroy = read_pixels_task_destroy,
+};
+
+static int read_pixels_task_handle_timer(void *data);
+
+static bool read_pixels_task_add_timer(struct wlr_gles2_read_pixels_task *task) {
+	task->event_source = wl_event_loop_add_timer(task->event_loop,
+		read_pixels_task_handle_timer, task);
+	if (task->event_source == NULL) {
+		return false;
+	}
+	wl_event_source_timer_update(task->event_source, 1);
+	return true;
+}
+
+static int read_pixels_task_poll(struct wlr_gles2_read_pixels_task *task) {
+	struct wlr_gles2_renderer *renderer = task->renderer;
+
+	struct wlr_egl_context prev_ctx;
+	if (!wlr_egl_make_current(renderer->egl, &prev_ctx)) {
+		wlr_texture_read_pixels_task_finish(&task->base, false);
+		return 0;
+	}
+	GLenum status = renderer->procs.glClientWaitSync(task->fence,
+		GL_SYNC_FLUSH_COMMANDS_BIT_APPLE, 0);
+	wlr_egl_restore_context(&prev_ctx);
+
+	if (status == GL_TIMEOUT_EXPIRED_APPLE) {
+		if (task->fence_fd < 0) {
+			wl_event_source_timer_update(task->event_source, 1);
+			return 0;
+		}
+
+		// The fence FD is readable but the GL fence isn't signaled yet. The
+		// FD stays readable, poll the GL fence instead.
+		wl_event_source_remove(task->event_source);
+		close(task->fence_fd);
+		task->fence_fd = -1;
+		if (!read_pixels_task_add_timer(task)) {
+			wlr_log(WLR_ERROR, "Failed to add read pixels task timer");
+			wlr_texture_read_pixels_task_finish(&task->base, false);
 		}
+		return 0;
 	}
 
-	// Make sure any pending drawing is finished before we try to read it
-	glFinish();
+	task->signaled = status != GL_WAIT_FAILED_APPLE;
+	wlr_texture_read_pixels_task_finish(&task->base, task->signaled);
+	return 0;
+}
 
-	glGetError(); // Clear the error flag
+static int read_pixels_task_handle_fence(int fd, uint32_t mask, void *data) {
+	struct wlr_gles2_read_pixels_task *task = data;
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		wlr_texture_read_pixels_task_finish(&task->base, false);
+		return 0;
+	}
+	return read_pixels_task_poll(task);
+}
 
-	unsigned char *p = wlr_texture_read_pixel_options_get_data(options);
+static int read_pixels_task_handle_timer(void *data) {
+	struct wlr_gles2_read_pixels_task *task = data;
+	return read_pixels_task_poll(task);
+}
 
-	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	uint32_t pack_stride = pixel_format_info_min_stride(drm_fmt, src.width);
-	if (pack_stride == options->stride && options->dst_x == 0) {
-		// Under these particular conditions, we can read the pixels with only
-		// one glReadPixels call
+static struct wlr_texture_read_pixels_task *gles2_texture_read_pixels_async(
+		struct wlr_texture *wlr_texture,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+	struct wlr_gles2_renderer *renderer = texture->renderer;
 
-		glReadPixels(src.x, src.y, src.width, src.height, fmt->gl_format, fmt->gl_type, p);
-	} else {
-		// Unfortunately GLES2 doesn't support GL_PACK_ROW_LENGTH, so we have to read
-		// the lines out row by row
-		for (int32_t i = 0; i < src.height; ++i) {
-			uint32_t y = src.y + i;
-			glReadPixels(src.x, y, src.width, 1, fmt->gl_format,
-				fmt->gl_type, p + i * options->stride);
+	if (!renderer->stage.enabled) {
+		return wlr_texture_read_pixels_deferred(wlr_texture, options);
+	}
+
+	struct wlr_gles2_read_pixels_task *task = calloc(1, sizeof(*task));
+	if (task == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	if (!wlr_texture_read_pixels_task_init(&task->base,
+			&read_pixels_task_impl, wlr_texture, options)) {
+		free(task);
+		return NULL;
+	}
+	task->renderer = renderer;
+	task->fence_fd = -1;
+	task->event_loop = options->event_loop;
+	wl_list_insert(&renderer->read_pixels_tasks, &task->link);
+
+	if (pixman_region32_empty(&task->base.region)) {
+		// Nothing to read, the GPU isn't needed
+		wlr_texture_read_pixels_task_cancel(&task->base);
+		return wlr_texture_read_pixels_deferred(wlr_texture, options);
+	}
+
+	const struct wlr_gles2_pixel_format *fmt =
+		get_read_format(renderer, task->base.format);
+	if (fmt == NULL) {
+		goto error;
+	}
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(fmt->drm_format);
+
+	int rects_len = 0;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&task->base.region, &rects_len);
+
+	push_gles2_debug(renderer);
+	struct wlr_egl_context prev_ctx;
+	if (!wlr_egl_make_current(renderer->egl, &prev_ctx)) {
+		pop_gles2_debug(renderer);
+		goto error;
+	}
+
+	bool ok = gles2_texture_bind(texture);
+	if (ok && options->wait_timeline != NULL) {
+		ok = wait_timeline(renderer, options->wait_timeline, options->wait_point);
+	}
+	if (ok) {
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		task->stage_buf = read_pixels_to_stage(renderer, fmt, drm_fmt,
+			&task->base.src_box, rects, rects_len);
+		ok = task->stage_buf != NULL;
+	}
+	if (ok) {
+		task->fence = renderer->procs.glFenceSync(
+			GL_SYNC_GPU_COMMANDS_COMPLETE_APPLE, 0);
+		ok = task->fence != NULL;
+	}
+	if (ok) {
+		// Prefer being woken up by a native fence over polling
+		EGLSyncKHR sync = wlr_egl_create_sync(renderer->egl, -1);
+		if (sync != EGL_NO_SYNC_KHR) {
+			task->fence_fd = wlr_egl_dup_fence_fd(renderer->egl, sync);
+			wlr_egl_destroy_sync(renderer->egl, sync);
 		}
+		glFlush();
 	}
 
 	wlr_egl_restore_context(&prev_ctx);
-	pop_gles2_debug(texture->renderer);
+	pop_gles2_debug(renderer);
 
-	return glGetError() == GL_NO_ERROR;
+	if (!ok) {
+		goto error;
+	}
+
+	if (task->fence_fd >= 0) {
+		task->event_source = wl_event_loop_add_fd(options->event_loop,
+			task->fence_fd, WL_EVENT_READABLE, read_pixels_task_handle_fence, task);
+	} else {
+		read_pixels_task_add_timer(task);
+	}
+	if (task->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add read pixels task to event loop");
+		goto error;
+	}
+
+	return &task->base;
+
+error:
+	wlr_texture_read_pixels_task_cancel(&task->base);
+	return NULL;
 }
 
 static uint32_t gles2_texture_preferred_read_format(struct wlr_texture *wlr_texture) {
@@ -300,6 +793,7 @@ static const struct wlr_texture_impl texture_impl = {
 	.read_pixels = gles2_texture_read_pixels,
 	.preferred_read_format = gles2_texture_preferred_read_format,
 	.destroy = handle_gles2_texture_destroy,
+	.read_pixels_async = gles2_texture_read_pixels_async,
 };
 
 static struct wlr_gles2_texture *gles2_texture_create(
@@ -370,6 +864,10 @@ static struct wlr_texture *gles2_texture_from_pixels(
 		fmt->gl_format, fmt->gl_type, data);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
 
+	renderer->upload_stats.bytes +=
+		(uint64_t)width * height * drm_fmt->bytes_per_block;
+	renderer->upload_stats.calls++;
+
 	glBindTexture(GL_TEXTURE_2D, 0);
 
 	pop_gles2_debug(renderer);
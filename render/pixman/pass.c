@@ -1,6 +1,16 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include "render/pixel_format.h"
 #include "render/pixman.h"
+#include "util/worker_pool.h"
+
+// Minimum height of the bands rendered by each thread
+#define MIN_BAND_HEIGHT 16
+// Number of bands per thread, to balance the load when damage is uneven
+#define BANDS_PER_THREAD 4
 
 static const struct wlr_render_pass_impl render_pass_impl;
 
@@ -16,11 +26,326 @@ static struct wlr_pixman_texture *get_texture(struct wlr_texture *wlr_texture) {
 	return texture;
 }
 
-static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
-	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
+static void execute_texture_command(const struct wlr_pixman_render_command *command,
+		pixman_image_t *dst, const pixman_region32_t *clip) {
+	// Use a separate image for each command, so that its transform and
+	// filter don't affect other commands possibly executed concurrently
+	pixman_image_t *texture_image = command->texture->image;
+	pixman_image_t *src = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(texture_image),
+		pixman_image_get_width(texture_image),
+		pixman_image_get_height(texture_image),
+		pixman_image_get_data(texture_image),
+		pixman_image_get_stride(texture_image));
+	if (src == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create source image");
+		return;
+	}
+
+	pixman_image_set_clip_region32(dst, clip);
+
+	pixman_image_t *mask = command->mask;
+	const struct wlr_box *src_box = &command->src_box;
+	const struct wlr_box *dst_box = &command->dst_box;
+	if (command->has_transform) {
+		pixman_image_set_transform(src, &command->transform);
+
+		switch (command->filter_mode) {
+		case WLR_SCALE_FILTER_BILINEAR:
+			pixman_image_set_repeat(src, PIXMAN_REPEAT_PAD);
+			pixman_image_set_filter(src, PIXMAN_FILTER_BILINEAR, NULL, 0);
+			break;
+		case WLR_SCALE_FILTER_NEAREST:
+			pixman_image_set_filter(src, PIXMAN_FILTER_NEAREST, NULL, 0);
+			break;
+		}
+
+		// Now composite the result onto the pass buffer.  We specify a source origin of 0,0
+		// because the x,y part of source crop is already done using the transform. The
+		// width,height part of source crop is done here by the width and height we pass:
+		// because of the scaling, cropping at the end by dst_box.{width,height} is
+		// equivalent to if we cropped at the start by src_box.{width,height}.
+		pixman_image_composite32(command->op, src, mask, dst,
+			0, 0, // source x,y
+			0, 0, // mask x,y
+			dst_box->x, dst_box->y, // dest x,y
+			dst_box->width, dst_box->height // composite width,height
+		);
+	} else {
+		// No transforms or crop needed, just a straight blit from the source
+		pixman_image_composite32(command->op, src, mask, dst,
+			src_box->x, src_box->y, 0, 0, dst_box->x, dst_box->y,
+			src_box->width, src_box->height);
+	}
+
+	pixman_image_unref(src);
+}
+
+static void execute_rect_command(const struct wlr_pixman_render_command *command,
+		pixman_image_t *dst, const pixman_region32_t *clip) {
+	if (command->fill == NULL) {
+		// No blending needed, fill the clip rectangles with the color
+		int n_rects;
+		const pixman_box32_t *rects = pixman_region32_rectangles(clip, &n_rects);
+		pixman_image_set_clip_region32(dst, NULL);
+		pixman_image_fill_boxes(PIXMAN_OP_SRC, dst, &command->color, n_rects, rects);
+		return;
+	}
+
+	pixman_image_set_clip_region32(dst, clip);
+
+	const struct wlr_box *box = &command->dst_box;
+	pixman_image_composite32(command->op, command->fill, NULL, dst,
+		0, 0, 0, 0, box->x, box->y, box->width, box->height);
+}
+
+struct render_bands_job {
+	struct wlr_pixman_render_pass *pass;
+	int y1, y2, band_height;
+};
+
+// Execute all commands for the rows of a band, into a separate destination
+// image so that bands can be rendered concurrently
+static void render_band(size_t index, void *data) {
+	struct render_bands_job *job = data;
+	struct wlr_pixman_render_pass *pass = job->pass;
+
+	int y1 = job->y1 + (int)index * job->band_height;
+	int y2 = y1 + job->band_height < job->y2 ? y1 + job->band_height : job->y2;
+
+	pixman_image_t *buffer_image = pass->buffer->image;
+	int width = pixman_image_get_width(buffer_image);
+	pixman_image_t *dst = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(buffer_image),
+		width, pixman_image_get_height(buffer_image),
+		pixman_image_get_data(buffer_image),
+		pixman_image_get_stride(buffer_image));
+	if (dst == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create destination image");
+		return;
+	}
+
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+
+	struct wlr_pixman_render_command *command;
+	wl_array_for_each(command, &pass->commands) {
+		const pixman_box32_t *extents = pixman_region32_extents(&command->clip);
+		if (extents->y2 <= y1 || extents->y1 >= y2) {
+			continue;
+		}
+
+		pixman_region32_intersect_rect(&clip, &command->clip, 0, y1, width, y2 - y1);
+		if (pixman_region32_empty(&clip)) {
+			continue;
+		}
+
+		switch (command->type) {
+		case WLR_PIXMAN_RENDER_COMMAND_TEXTURE:
+			execute_texture_command(command, dst, &clip);
+			break;
+		case WLR_PIXMAN_RENDER_COMMAND_RECT:
+			execute_rect_command(command, dst, &clip);
+			break;
+		}
+	}
+
+	pixman_region32_fini(&clip);
+	pixman_image_unref(dst);
+}
+
+static void execute_commands(struct wlr_pixman_render_pass *pass) {
+	int y1 = INT_MAX, y2 = INT_MIN;
+	struct wlr_pixman_render_command *command;
+	wl_array_for_each(command, &pass->commands) {
+		const pixman_box32_t *extents = pixman_region32_extents(&command->clip);
+		y1 = extents->y1 < y1 ? extents->y1 : y1;
+		y2 = extents->y2 > y2 ? extents->y2 : y2;
+	}
+	if (y1 >= y2) {
+		return;
+	}
+
+	struct worker_pool *pool = pass->buffer->renderer->worker_pool;
+	int n_bands = 1;
+	if (pool != NULL) {
+		n_bands = (int)(worker_pool_get_size(pool) + 1) * BANDS_PER_THREAD;
+	}
+
+	int band_height = (y2 - y1 + n_bands - 1) / n_bands;
+	if (band_height < MIN_BAND_HEIGHT) {
+		band_height = MIN_BAND_HEIGHT;
+	}
+	n_bands = (y2 - y1 + band_height - 1) / band_height;
+
+	struct render_bands_job job = {
+		.pass = pass,
+		.y1 = y1,
+		.y2 = y2,
+		.band_height = band_height,
+	};
+	if (n_bands == 1) {
+		render_band(0, &job);
+	} else {
+		worker_pool_run(pool, n_bands, render_band, &job);
+	}
+}
+
+static void command_finish(struct wlr_pixman_render_command *command) {
+	pixman_region32_fini(&command->clip);
+	if (command->fill != NULL) {
+		pixman_image_unref(command->fill);
+	}
+	if (command->mask != NULL) {
+		pixman_image_unref(command->mask);
+	}
+}
+
+// Check whether a command overwrites all pixels of its clip, regardless of
+// what was drawn before
+static bool command_is_opaque(const struct wlr_pixman_render_command *command) {
+	if (command->op == PIXMAN_OP_SRC) {
+		return true;
+	}
+
+	switch (command->type) {
+	case WLR_PIXMAN_RENDER_COMMAND_TEXTURE:;
+		const struct wlr_pixman_texture *texture = command->texture;
+		// Pixels sampled outside of the source are transparent unless the
+		// edges are padded
+		return command->alpha == 1 &&
+			!pixel_format_has_alpha(texture->format_info->drm_format) &&
+			(!command->has_transform ||
+			command->filter_mode == WLR_SCALE_FILTER_BILINEAR);
+	case WLR_PIXMAN_RENDER_COMMAND_RECT:
+		return command->color.alpha == 0xFFFF;
+	}
+	abort();
+}
+
+/**
+ * Remove the parts of each command covered by opaque later commands, and
+ * drop the commands which are entirely covered.
+ */
+static void eliminate_overdraw(struct wlr_pixman_render_pass *pass) {
+	struct wlr_pixman_render_command *commands = pass->commands.data;
+	size_t n_commands = pass->commands.size / sizeof(commands[0]);
+
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+
+	size_t n_dropped = 0;
+	for (size_t i = n_commands; i-- > 0;) {
+		struct wlr_pixman_render_command *command = &commands[i];
+		pixman_region32_subtract(&command->clip, &command->clip, &opaque);
+		if (pixman_region32_empty(&command->clip)) {
+			command_finish(command);
+			n_dropped++;
+			continue;
+		}
+
+		if (command_is_opaque(command)) {
+			pixman_region32_union(&opaque, &opaque, &command->clip);
+		}
+
+		// Move the command up over the dropped ones
+		if (n_dropped > 0) {
+			commands[i + n_dropped] = *command;
+		}
+	}
+
+	pixman_region32_fini(&opaque);
+
+	if (n_dropped > 0) {
+		memmove(commands, &commands[n_dropped],
+			(n_commands - n_dropped) * sizeof(commands[0]));
+		pass->commands.size -= n_dropped * sizeof(commands[0]);
+	}
+}
+
+static void drop_texture_commands(struct wlr_pixman_render_pass *pass,
+		struct wlr_pixman_texture *texture) {
+	struct wlr_pixman_render_command *commands = pass->commands.data;
+	size_t n_commands = pass->commands.size / sizeof(commands[0]);
+
+	size_t n_kept = 0;
+	for (size_t i = 0; i < n_commands; i++) {
+		struct wlr_pixman_render_command *command = &commands[i];
+		if (command->type == WLR_PIXMAN_RENDER_COMMAND_TEXTURE &&
+				command->texture == texture) {
+			command_finish(command);
+			continue;
+		}
+		commands[n_kept++] = *command;
+	}
+	pass->commands.size = n_kept * sizeof(commands[0]);
+}
+
+/**
+ * Access the buffers of the textures used by the pass. Buffers are only
+ * accessed while the pass is being submitted, so that they can be accessed
+ * elsewhere while commands are recorded. Commands using a texture which can't
+ * be read are dropped.
+ */
+static void begin_texture_access(struct wlr_pixman_render_pass *pass) {
+	struct wlr_pixman_texture **textures = pass->textures.data;
+	size_t n_textures = pass->textures.size / sizeof(textures[0]);
+
+	size_t n_accessed = 0;
+	for (size_t i = 0; i < n_textures; i++) {
+		struct wlr_pixman_texture *texture = textures[i];
+		if (!pixman_texture_begin_access(texture)) {
+			wlr_log(WLR_ERROR, "Failed to access texture buffer");
+			drop_texture_commands(pass, texture);
+			pixman_texture_end_pass(texture);
+			continue;
+		}
+		textures[n_accessed++] = texture;
+	}
+	pass->textures.size = n_accessed * sizeof(textures[0]);
+}
+
+// Texture buffers are only accessed while the pass is being submitted
+static void render_pass_finish(struct wlr_pixman_render_pass *pass,
+		bool textures_accessed) {
+	struct wlr_pixman_render_command *command;
+	wl_array_for_each(command, &pass->commands) {
+		command_finish(command);
+	}
+	wl_array_release(&pass->commands);
+
+	struct wlr_pixman_texture **texture_ptr;
+	wl_array_for_each(texture_ptr, &pass->textures) {
+		if (textures_accessed) {
+			pixman_texture_end_access(*texture_ptr);
+		}
+		pixman_texture_end_pass(*texture_ptr);
+	}
+	wl_array_release(&pass->textures);
 
 	wlr_buffer_end_data_ptr_access(pass->buffer->buffer);
 	wlr_buffer_unlock(pass->buffer->buffer);
+	wl_list_remove(&pass->link);
+	pass->buffer = NULL;
+}
+
+void pixman_render_pass_detach(struct wlr_pixman_render_pass *pass) {
+	render_pass_finish(pass, false);
+}
+
+static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
+	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
+
+	if (pass->buffer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to submit render pass: renderer destroyed");
+		free(pass);
+		return false;
+	}
+
+	begin_texture_access(pass);
+	eliminate_overdraw(pass);
+	execute_commands(pass);
+	render_pass_finish(pass, true);
 	free(pass);
 
 	return true;
@@ -36,20 +361,70 @@ static pixman_op_t get_pixman_blending(enum wlr_render_blend_mode mode) {
 	abort();
 }
 
+static bool pass_use_texture(struct wlr_pixman_render_pass *pass,
+		struct wlr_pixman_texture *texture) {
+	struct wlr_pixman_texture **texture_ptr;
+	wl_array_for_each(texture_ptr, &pass->textures) {
+		if (*texture_ptr == texture) {
+			return true;
+		}
+	}
+
+	texture_ptr = wl_array_add(&pass->textures, sizeof(*texture_ptr));
+	if (texture_ptr == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+	pixman_texture_begin_pass(texture);
+	*texture_ptr = texture;
+	return true;
+}
+
+static struct wlr_pixman_render_command *pass_add_command(
+		struct wlr_pixman_render_pass *pass,
+		enum wlr_pixman_render_command_type type, pixman_op_t op,
+		const struct wlr_box *dst_box, const pixman_region32_t *clip) {
+	struct wlr_buffer *buffer = pass->buffer->buffer;
+
+	pixman_region32_t command_clip;
+	pixman_region32_init_rect(&command_clip, 0, 0, buffer->width, buffer->height);
+	pixman_region32_intersect_rect(&command_clip, &command_clip,
+		dst_box->x, dst_box->y, dst_box->width, dst_box->height);
+	if (clip != NULL) {
+		pixman_region32_intersect(&command_clip, &command_clip, clip);
+	}
+	if (pixman_region32_empty(&command_clip)) {
+		pixman_region32_fini(&command_clip);
+		return NULL;
+	}
+
+	struct wlr_pixman_render_command *command =
+		wl_array_add(&pass->commands, sizeof(*command));
+	if (command == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		pixman_region32_fini(&command_clip);
+		return NULL;
+	}
+
+	*command = (struct wlr_pixman_render_command){
+		.type = type,
+		.op = op,
+		.dst_box = *dst_box,
+		// pixman_region32_t is safe to move
+		.clip = command_clip,
+	};
+	return command;
+}
+
 static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_texture_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
 	struct wlr_pixman_texture *texture = get_texture(options->texture);
 	struct wlr_pixman_buffer *buffer = pass->buffer;
-
-	if (texture->buffer != NULL && !begin_pixman_data_ptr_access(texture->buffer,
-			&texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
+	if (buffer == NULL) {
 		return;
 	}
 
-	pixman_op_t op = get_pixman_blending(options->blend_mode);
-	pixman_image_set_clip_region32(buffer->image, options->clip);
-
 	struct wlr_fbox src_fbox;
 	wlr_render_texture_options_get_src_box(options, &src_fbox);
 	struct wlr_box src_box = {
@@ -62,22 +437,38 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	struct wlr_box dst_box;
 	wlr_render_texture_options_get_dst_box(options, &dst_box);
 
-	pixman_image_t *mask = NULL;
-	float alpha = wlr_render_texture_options_get_alpha(options);
-	if (alpha != 1) {
-		mask = pixman_image_create_solid_fill(&(struct pixman_color){
-			.alpha = 0xFFFF * alpha,
-		});
-	}
-
 	// Rotate the source size into destination coordinates
 	struct wlr_box src_box_transformed;
 	wlr_box_transform(&src_box_transformed, &src_box, options->transform,
 		buffer->buffer->width, buffer->buffer->height);
 
-	if (options->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
-			src_box_transformed.width != dst_box.width ||
-			src_box_transformed.height != dst_box.height) {
+	bool has_transform = options->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+		src_box_transformed.width != dst_box.width ||
+		src_box_transformed.height != dst_box.height;
+	pixman_op_t op = get_pixman_blending(options->blend_mode);
+	struct wlr_pixman_render_command *command = pass_add_command(pass,
+		WLR_PIXMAN_RENDER_COMMAND_TEXTURE, op, &dst_box, options->clip);
+	if (command == NULL) {
+		return;
+	}
+
+	command->texture = texture;
+	command->src_box = src_box;
+	command->filter_mode = options->filter_mode;
+	command->alpha = wlr_render_texture_options_get_alpha(options);
+	if (command->alpha != 1) {
+		command->mask = pixman_renderer_get_solid_image(buffer->renderer,
+			&(struct pixman_color){ .alpha = 0xFFFF * command->alpha });
+	}
+
+	if ((command->alpha != 1 && command->mask == NULL) ||
+			!pass_use_texture(pass, texture)) {
+		command_finish(command);
+		pass->commands.size -= sizeof(*command);
+		return;
+	}
+
+	if (has_transform) {
 		// Cosinus/sinus values are exact integers for enum wl_output_transform entries
 		int tr_cos = 1, tr_sin = 0, tr_x = 0, tr_y = 0;
 		switch (options->transform) {
@@ -155,75 +546,47 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		pixman_transform_translate(&transform, NULL,
 			pixman_int_to_fixed(src_box.x), pixman_int_to_fixed(src_box.y));
 
-		pixman_image_set_transform(texture->image, &transform);
-
-		switch (options->filter_mode) {
-		case WLR_SCALE_FILTER_BILINEAR:
-			pixman_image_set_repeat(texture->image, PIXMAN_REPEAT_PAD);
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
-			break;
-		case WLR_SCALE_FILTER_NEAREST:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_NEAREST, NULL, 0);
-			break;
-		}
-
-		// Now composite the result onto the pass buffer.  We specify a source origin of 0,0
-		// because the x,y part of source crop is already done using the transform. The
-		// width,height part of source crop is done here by the width and height we pass:
-		// because of the scaling, cropping at the end by dst_box.{width,height} is
-		// equivalent to if we cropped at the start by src_box.{width,height}.
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			0, 0, // source x,y
-			0, 0, // mask x,y
-			dst_box.x, dst_box.y, // dest x,y
-			dst_box.width, dst_box.height // composite width,height
-		);
-
-		pixman_image_set_transform(texture->image, NULL);
-	} else {
-		// No transforms or crop needed, just a straight blit from the source
-		pixman_image_set_transform(texture->image, NULL);
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			src_box.x, src_box.y, 0, 0, dst_box.x, dst_box.y,
-			src_box.width, src_box.height);
-	}
-
-	pixman_image_set_clip_region32(buffer->image, NULL);
-
-	if (texture->buffer != NULL) {
-		wlr_buffer_end_data_ptr_access(texture->buffer);
-	}
-
-	if (mask != NULL) {
-		pixman_image_unref(mask);
+		command->has_transform = true;
+		command->transform = transform;
 	}
 }
 
 static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_rect_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
-	struct wlr_pixman_buffer *buffer = pass->buffer;
+	if (pass->buffer == NULL) {
+		return;
+	}
+
 	struct wlr_box box;
 	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
 
 	pixman_op_t op = get_pixman_blending(options->color.a == 1 ?
 		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
 
-	struct pixman_color color = {
+	struct wlr_pixman_render_command *command = pass_add_command(pass,
+		WLR_PIXMAN_RENDER_COMMAND_RECT, op, &box, options->clip);
+	if (command == NULL) {
+		return;
+	}
+
+	command->color = (struct pixman_color){
 		.red = options->color.r * 0xFFFF,
 		.green = options->color.g * 0xFFFF,
 		.blue = options->color.b * 0xFFFF,
 		.alpha = options->color.a * 0xFFFF,
 	};
 
-	pixman_image_t *fill = pixman_image_create_solid_fill(&color);
-
-	pixman_image_set_clip_region32(buffer->image, options->clip);
-	pixman_image_composite32(op, fill, NULL, buffer->image,
-		0, 0, 0, 0, box.x, box.y, box.width, box.height);
-	pixman_image_set_clip_region32(buffer->image, NULL);
-
-	pixman_image_unref(fill);
+	// Rects which don't need blending are written directly into the buffer,
+	// others are composited from a cached solid fill image
+	if (op != PIXMAN_OP_SRC) {
+		command->fill = pixman_renderer_get_solid_image(pass->buffer->renderer,
+			&command->color);
+		if (command->fill == NULL) {
+			command_finish(command);
+			pass->commands.size -= sizeof(*command);
+		}
+	}
 }
 
 static const struct wlr_render_pass_impl render_pass_impl = {
@@ -249,6 +612,9 @@ struct wlr_pixman_render_pass *begin_pixman_render_pass(
 
 	wlr_buffer_lock(buffer->buffer);
 	pass->buffer = buffer;
+	wl_list_insert(&buffer->renderer->passes, &pass->link);
+	wl_array_init(&pass->commands);
+	wl_array_init(&pass->textures);
 
 	return pass;
 }
@@ -2,13 +2,18 @@
 #include <drm_fourcc.h>
 #include <pixman.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-util.h>
 #include <wlr/render/interface.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/util/addon.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
 
 #include "render/pixman.h"
 #include "types/wlr_buffer.h"
+#include "util/env.h"
+#include "util/worker_pool.h"
 
 static const struct wlr_renderer_impl renderer_impl;
 
@@ -23,10 +28,32 @@ static struct wlr_pixman_renderer *get_renderer(
 	return renderer;
 }
 
-bool begin_pixman_data_ptr_access(struct wlr_buffer *wlr_buffer, pixman_image_t **image_ptr,
-		uint32_t flags) {
+// If the data pointer has changed, re-create the Pixman image. This can
+// happen if it's a client buffer and the wl_shm_pool has been resized.
+static bool update_pixman_image(pixman_image_t **image_ptr,
+		struct wlr_buffer *wlr_buffer, void *data, uint32_t drm_format,
+		size_t stride) {
 	pixman_image_t *image = *image_ptr;
+	if (data == pixman_image_get_data(image)) {
+		return true;
+	}
+
+	pixman_format_code_t format = get_pixman_format_from_drm(drm_format);
+	assert(format != 0);
 
+	pixman_image_t *new_image = pixman_image_create_bits_no_clear(format,
+		wlr_buffer->width, wlr_buffer->height, data, stride);
+	if (new_image == NULL) {
+		return false;
+	}
+
+	pixman_image_unref(image);
+	*image_ptr = new_image;
+	return true;
+}
+
+bool begin_pixman_data_ptr_access(struct wlr_buffer *wlr_buffer, pixman_image_t **image_ptr,
+		uint32_t flags) {
 	void *data = NULL;
 	uint32_t drm_format;
 	size_t stride;
@@ -35,25 +62,80 @@ bool begin_pixman_data_ptr_access(struct wlr_buffer *wlr_buffer, pixman_image_t
 		return false;
 	}
 
-	// If the data pointer has changed, re-create the Pixman image. This can
-	// happen if it's a client buffer and the wl_shm_pool has been resized.
-	if (data != pixman_image_get_data(image)) {
-		pixman_format_code_t format = get_pixman_format_from_drm(drm_format);
-		assert(format != 0);
+	if (!update_pixman_image(image_ptr, wlr_buffer, data, drm_format, stride)) {
+		wlr_buffer_end_data_ptr_access(wlr_buffer);
+		return false;
+	}
 
-		pixman_image_t *new_image = pixman_image_create_bits_no_clear(format,
-			wlr_buffer->width, wlr_buffer->height, data, stride);
-		if (new_image == NULL) {
-			wlr_buffer_end_data_ptr_access(wlr_buffer);
-			return false;
-		}
+	return true;
+}
+
+/**
+ * Read access to a buffer's data pointer, shared by all textures created from
+ * the buffer which are being read.
+ */
+struct pixman_buffer_read_access {
+	struct wlr_addon addon;
+	size_t n_refs;
+	void *data;
+	uint32_t drm_format;
+	size_t stride;
+};
+
+static void read_access_handle_buffer_destroy(struct wlr_addon *addon) {
+	// Textures keep their buffer locked while accessing it
+	struct pixman_buffer_read_access *access = wl_container_of(addon, access, addon);
+	assert(access->n_refs == 0);
+	wlr_addon_finish(&access->addon);
+	free(access);
+}
+
+static const struct wlr_addon_interface read_access_addon_impl = {
+	.name = "wlr_pixman_buffer_read_access",
+	.destroy = read_access_handle_buffer_destroy,
+};
 
-		pixman_image_unref(image);
-		image = new_image;
+static struct pixman_buffer_read_access *begin_buffer_read_access(
+		struct wlr_pixman_renderer *renderer, struct wlr_buffer *wlr_buffer) {
+	struct wlr_addon *addon = wlr_addon_find(&wlr_buffer->addons, renderer,
+		&read_access_addon_impl);
+	if (addon != NULL) {
+		struct pixman_buffer_read_access *access =
+			wl_container_of(addon, access, addon);
+		access->n_refs++;
+		return access;
 	}
 
-	*image_ptr = image;
-	return true;
+	struct pixman_buffer_read_access *access = calloc(1, sizeof(*access));
+	if (access == NULL) {
+		return NULL;
+	}
+	if (!wlr_buffer_begin_data_ptr_access(wlr_buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+			&access->data, &access->drm_format, &access->stride)) {
+		free(access);
+		return NULL;
+	}
+
+	wlr_addon_init(&access->addon, &wlr_buffer->addons, renderer,
+		&read_access_addon_impl);
+	access->n_refs = 1;
+	return access;
+}
+
+static void end_buffer_read_access(struct wlr_pixman_renderer *renderer,
+		struct wlr_buffer *wlr_buffer) {
+	struct wlr_addon *addon = wlr_addon_find(&wlr_buffer->addons, renderer,
+		&read_access_addon_impl);
+	assert(addon != NULL);
+	struct pixman_buffer_read_access *access = wl_container_of(addon, access, addon);
+	access->n_refs--;
+	if (access->n_refs > 0) {
+		return;
+	}
+
+	wlr_buffer_end_data_ptr_access(wlr_buffer);
+	wlr_addon_finish(&access->addon);
+	free(access);
 }
 
 static struct wlr_pixman_buffer *get_buffer(
@@ -80,8 +162,7 @@ static struct wlr_pixman_texture *get_texture(
 	return texture;
 }
 
-static void texture_destroy(struct wlr_texture *wlr_texture) {
-	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+static void texture_finish(struct wlr_pixman_texture *texture) {
 	wl_list_remove(&texture->link);
 	pixman_image_unref(texture->image);
 	wlr_buffer_unlock(texture->buffer);
@@ -89,6 +170,52 @@ static void texture_destroy(struct wlr_texture *wlr_texture) {
 	free(texture);
 }
 
+static void texture_destroy(struct wlr_texture *wlr_texture) {
+	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+	if (texture->n_pass_refs > 0) {
+		// Still referenced by a render pass, finish on submit
+		texture->destroyed = true;
+		return;
+	}
+	texture_finish(texture);
+}
+
+void pixman_texture_begin_pass(struct wlr_pixman_texture *texture) {
+	texture->n_pass_refs++;
+}
+
+void pixman_texture_end_pass(struct wlr_pixman_texture *texture) {
+	assert(texture->n_pass_refs > 0);
+	texture->n_pass_refs--;
+	if (texture->n_pass_refs == 0 && texture->destroyed) {
+		texture_finish(texture);
+	}
+}
+
+bool pixman_texture_begin_access(struct wlr_pixman_texture *texture) {
+	if (texture->buffer == NULL) {
+		return true;
+	}
+
+	struct pixman_buffer_read_access *access =
+		begin_buffer_read_access(texture->renderer, texture->buffer);
+	if (access == NULL) {
+		return false;
+	}
+	if (!update_pixman_image(&texture->image, texture->buffer,
+			access->data, access->drm_format, access->stride)) {
+		end_buffer_read_access(texture->renderer, texture->buffer);
+		return false;
+	}
+	return true;
+}
+
+void pixman_texture_end_access(struct wlr_pixman_texture *texture) {
+	if (texture->buffer != NULL) {
+		end_buffer_read_access(texture->renderer, texture->buffer);
+	}
+}
+
 static bool texture_read_pixels(struct wlr_texture *wlr_texture,
 		const struct wlr_texture_read_pixels_options *options) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
@@ -106,10 +233,19 @@ static bool texture_read_pixels(struct wlr_texture *wlr_texture,
 
 	pixman_image_t *dst = pixman_image_create_bits_no_clear(fmt,
 			src.width, src.height, p, options->stride);
+	if (dst == NULL) {
+		return false;
+	}
+
+	if (!pixman_texture_begin_access(texture)) {
+		pixman_image_unref(dst);
+		return false;
+	}
 
 	pixman_image_composite32(PIXMAN_OP_SRC, texture->image, NULL, dst,
 			src.x, src.y, 0, 0, 0, 0, src.width, src.height);
 
+	pixman_texture_end_access(texture);
 	pixman_image_unref(dst);
 
 	return true;
@@ -122,7 +258,58 @@ static uint32_t pixman_texture_preferred_read_format(struct wlr_texture *wlr_tex
 	return get_drm_format_from_pixman(pixman_format);
 }
 
+static void texture_copy_rects(struct wlr_pixman_texture *texture,
+		const void *data, size_t stride, const pixman_box32_t *rects, int n_rects) {
+	uint32_t bpp = texture->format_info->bytes_per_block;
+	size_t dst_stride = pixman_image_get_stride(texture->image);
+	char *dst = texture->data;
+	const char *src = data;
+
+	for (int i = 0; i < n_rects; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		size_t offset = (size_t)rect->x1 * bpp;
+		size_t len = (size_t)(rect->x2 - rect->x1) * bpp;
+		if (len == dst_stride && stride == dst_stride) {
+			memcpy(dst + rect->y1 * dst_stride, src + rect->y1 * stride,
+				(rect->y2 - rect->y1) * dst_stride);
+			continue;
+		}
+		for (int y = rect->y1; y < rect->y2; y++) {
+			memcpy(dst + y * dst_stride + offset, src + y * stride + offset, len);
+		}
+	}
+}
+
+static bool pixman_texture_update_from_buffer(struct wlr_texture *wlr_texture,
+		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
+	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+
+	// Only textures holding a copy of the buffer contents can be updated, and
+	// not while a render pass is still going to read the previous contents
+	if (texture->data == NULL || texture->n_pass_refs > 0) {
+		return false;
+	}
+
+	struct pixman_buffer_read_access *access =
+		begin_buffer_read_access(texture->renderer, buffer);
+	if (access == NULL) {
+		return false;
+	}
+	if (access->drm_format != texture->format_info->drm_format) {
+		end_buffer_read_access(texture->renderer, buffer);
+		return false;
+	}
+
+	int n_rects = 0;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &n_rects);
+	texture_copy_rects(texture, access->data, access->stride, rects, n_rects);
+
+	end_buffer_read_access(texture->renderer, buffer);
+	return true;
+}
+
 static const struct wlr_texture_impl texture_impl = {
+	.update_from_buffer = pixman_texture_update_from_buffer,
 	.read_pixels = texture_read_pixels,
 	.preferred_read_format = pixman_texture_preferred_read_format,
 	.destroy = texture_destroy,
@@ -236,32 +423,71 @@ static struct wlr_pixman_texture *pixman_texture_create(
 		return NULL;
 	}
 
+	texture->renderer = renderer;
 	wl_list_insert(&renderer->textures, &texture->link);
 
 	return texture;
 }
 
+// Create an image holding a copy of the buffer contents, so that the client
+// can't modify or truncate the buffer while it's being rendered
+static pixman_image_t *create_copy_image(struct wlr_pixman_texture *texture,
+		const void *data, size_t stride) {
+	uint32_t width = texture->wlr_texture.width;
+	uint32_t height = texture->wlr_texture.height;
+	if (pixel_format_info_pixels_per_block(texture->format_info) != 1) {
+		return NULL;
+	}
+
+	// pixman requires the stride to be a multiple of 4 bytes
+	size_t copy_stride = ((size_t)width * texture->format_info->bytes_per_block + 3) & ~(size_t)3;
+	texture->data = malloc(copy_stride * height);
+	if (texture->data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	texture->image = pixman_image_create_bits_no_clear(texture->format,
+		width, height, texture->data, copy_stride);
+	if (texture->image == NULL) {
+		free(texture->data);
+		texture->data = NULL;
+		return NULL;
+	}
+
+	pixman_box32_t box = { .x2 = width, .y2 = height };
+	texture_copy_rects(texture, data, stride, &box, 1);
+	return texture->image;
+}
+
 static struct wlr_texture *pixman_texture_from_buffer(
 		struct wlr_renderer *wlr_renderer, struct wlr_buffer *buffer) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 
-	void *data = NULL;
-	uint32_t drm_format;
-	size_t stride;
-	if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
-			&data, &drm_format, &stride)) {
+	// The buffer may already be accessed by a render pass using another
+	// texture created from it
+	struct pixman_buffer_read_access *access =
+		begin_buffer_read_access(renderer, buffer);
+	if (access == NULL) {
 		return NULL;
 	}
-	wlr_buffer_end_data_ptr_access(buffer);
 
 	struct wlr_pixman_texture *texture = pixman_texture_create(renderer,
-		drm_format, buffer->width, buffer->height);
+		access->drm_format, buffer->width, buffer->height);
 	if (texture == NULL) {
+		end_buffer_read_access(renderer, buffer);
 		return NULL;
 	}
 
-	texture->image = pixman_image_create_bits_no_clear(texture->format,
-		buffer->width, buffer->height, data, stride);
+	struct wlr_shm_attributes shm;
+	bool copy = renderer->copy_shm && wlr_buffer_get_shm(buffer, &shm);
+	if (copy) {
+		texture->image = create_copy_image(texture, access->data, access->stride);
+	} else {
+		texture->image = pixman_image_create_bits_no_clear(texture->format,
+			buffer->width, buffer->height, access->data, access->stride);
+	}
+	end_buffer_read_access(renderer, buffer);
 	if (!texture->image) {
 		wlr_log(WLR_ERROR, "Failed to create pixman image");
 		wl_list_remove(&texture->link);
@@ -269,7 +495,9 @@ static struct wlr_texture *pixman_texture_from_buffer(
 		return NULL;
 	}
 
-	texture->buffer = wlr_buffer_lock(buffer);
+	if (!copy) {
+		texture->buffer = wlr_buffer_lock(buffer);
+	}
 
 	return &texture->wlr_texture;
 }
@@ -277,6 +505,13 @@ static struct wlr_texture *pixman_texture_from_buffer(
 static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 
+	// Passes which haven't been submitted yet reference buffers, textures and
+	// the worker pool
+	struct wlr_pixman_render_pass *pass, *pass_tmp;
+	wl_list_for_each_safe(pass, pass_tmp, &renderer->passes, link) {
+		pixman_render_pass_detach(pass);
+	}
+
 	struct wlr_pixman_buffer *buffer, *buffer_tmp;
 	wl_list_for_each_safe(buffer, buffer_tmp, &renderer->buffers, link) {
 		destroy_buffer(buffer);
@@ -287,11 +522,71 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 		wlr_texture_destroy(&tex->wlr_texture);
 	}
 
+	for (size_t i = 0; i < WLR_PIXMAN_SOLID_IMAGE_CACHE_SIZE; i++) {
+		if (renderer->solid_images[i].image != NULL) {
+			pixman_image_unref(renderer->solid_images[i].image);
+		}
+	}
+	if (renderer->scratch_image != NULL) {
+		pixman_image_unref(renderer->scratch_image);
+	}
+
 	wlr_drm_format_set_finish(&renderer->drm_formats);
+	worker_pool_destroy(renderer->worker_pool);
 
 	free(renderer);
 }
 
+pixman_image_t *pixman_renderer_get_solid_image(
+		struct wlr_pixman_renderer *renderer, const struct pixman_color *color) {
+	struct wlr_pixman_solid_image *entry = NULL;
+	struct wlr_pixman_solid_image *lru = &renderer->solid_images[0];
+	for (size_t i = 0; i < WLR_PIXMAN_SOLID_IMAGE_CACHE_SIZE; i++) {
+		struct wlr_pixman_solid_image *solid = &renderer->solid_images[i];
+		if (solid->image != NULL && memcmp(&solid->color, color, sizeof(*color)) == 0) {
+			entry = solid;
+			break;
+		}
+		if (lru->image != NULL &&
+				(solid->image == NULL || solid->last_used < lru->last_used)) {
+			lru = solid;
+		}
+	}
+
+	if (entry == NULL) {
+		if (renderer->scratch_image == NULL) {
+			renderer->scratch_image =
+				pixman_image_create_bits(PIXMAN_a8, 1, 1, NULL, 0);
+			if (renderer->scratch_image == NULL) {
+				wlr_log(WLR_ERROR, "Failed to create scratch image");
+				return NULL;
+			}
+		}
+
+		pixman_image_t *image = pixman_image_create_solid_fill(color);
+		if (image == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create solid fill image");
+			return NULL;
+		}
+
+		// pixman lazily computes the properties of an image the first time
+		// it's used, which isn't thread-safe. Use it once here, so that render
+		// threads only ever read it.
+		pixman_image_composite32(PIXMAN_OP_DST, image, NULL,
+			renderer->scratch_image, 0, 0, 0, 0, 0, 0, 1, 1);
+
+		if (lru->image != NULL) {
+			pixman_image_unref(lru->image);
+		}
+		entry = lru;
+		entry->color = *color;
+		entry->image = image;
+	}
+
+	entry->last_used = ++renderer->solid_images_seq;
+	return pixman_image_ref(entry->image);
+}
+
 static struct wlr_render_pass *pixman_begin_buffer_pass(struct wlr_renderer *wlr_renderer,
 		struct wlr_buffer *wlr_buffer, const struct wlr_buffer_pass_options *options) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
@@ -330,6 +625,7 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 	renderer->wlr_renderer.features.output_color_transform = false;
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->passes);
 
 	size_t len = 0;
 	const uint32_t *formats = get_pixman_drm_formats(&len);
@@ -341,6 +637,20 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 			DRM_FORMAT_MOD_LINEAR);
 	}
 
+	renderer->copy_shm = env_parse_bool("WLR_PIXMAN_COPY_SHM");
+
+	// The compositor thread renders too, only spawn the additional threads
+	size_t threads = env_parse_threads("WLR_PIXMAN_THREADS");
+	if (threads > 1) {
+		renderer->worker_pool = worker_pool_create(threads - 1);
+		if (renderer->worker_pool == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create render threads, "
+				"rendering on a single thread");
+		} else {
+			wlr_log(WLR_INFO, "Rendering with %zu threads", threads);
+		}
+	}
+
 	return &renderer->wlr_renderer;
 }
 
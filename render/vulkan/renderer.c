@@ -484,9 +484,9 @@ VkSemaphore vulkan_command_buffer_wait_sync_file(struct wlr_vk_renderer *rendere
 	return *sem_ptr;
 }
 
-bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer, int wait_sync_file_fd) {
+uint64_t vulkan_submit_stage(struct wlr_vk_renderer *renderer, int wait_sync_file_fd) {
 	if (renderer->stage.cb == NULL) {
-		return false;
+		return 0;
 	}
 
 	struct wlr_vk_command_buffer *cb = renderer->stage.cb;
@@ -494,7 +494,7 @@ bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer, int wait_sync_fi
 
 	uint64_t timeline_point = vulkan_end_command_buffer(cb, renderer);
 	if (timeline_point == 0) {
-		return false;
+		return 0;
 	}
 
 	VkSemaphore wait_semaphore;
@@ -516,7 +516,7 @@ bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer, int wait_sync_fi
 	if (wait_sync_file_fd != -1) {
 		wait_semaphore = vulkan_command_buffer_wait_sync_file(renderer, cb, 0, wait_sync_file_fd);
 		if (wait_semaphore == VK_NULL_HANDLE) {
-			return false;
+			return 0;
 		}
 		submit_info.waitSemaphoreCount = 1;
 		submit_info.pWaitSemaphores = &wait_semaphore;
@@ -528,6 +528,16 @@ bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer, int wait_sync_fi
 	VkResult res = vkQueueSubmit(renderer->dev->queue, 1, &submit_info, VK_NULL_HANDLE);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("vkQueueSubmit", res);
+		return 0;
+	}
+
+	return timeline_point;
+}
+
+bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer, int wait_sync_file_fd) {
+	struct wlr_vk_command_buffer *cb = renderer->stage.cb;
+	uint64_t timeline_point = vulkan_submit_stage(renderer, wait_sync_file_fd);
+	if (timeline_point == 0) {
 		return false;
 	}
 
@@ -1227,6 +1237,13 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 		wlr_vk_error("vkDeviceWaitIdle", res);
 	}
 
+	// Pending reads have completed by now
+	struct wlr_vk_read_pixels_task *task, *task_tmp;
+	wl_list_for_each_safe(task, task_tmp, &renderer->read_pixels_tasks, link) {
+		task->signaled = res == VK_SUCCESS;
+		wlr_texture_read_pixels_task_finish(&task->base, task->signaled);
+	}
+
 	for (size_t i = 0; i < VULKAN_COMMAND_BUFFERS_CAP; i++) {
 		struct wlr_vk_command_buffer *cb = &renderer->command_buffers[i];
 		if (cb->vk == VK_NULL_HANDLE) {
@@ -1319,12 +1336,15 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 	free(renderer);
 }
 
-bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
-		VkFormat src_format, VkImage src_image,
-		uint32_t drm_format, uint32_t stride,
+// Records a copy of rectangles of a box of src_image into the
+// read_pixels_cache image, in the layout matching drm_format. The rectangles
+// are relative to the box.
+static bool read_pixels_record(struct wlr_vk_renderer *vk_renderer,
+		VkFormat src_format, VkImage src_image, uint32_t drm_format,
 		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
-		uint32_t dst_x, uint32_t dst_y, void *data,
-		struct wlr_drm_syncobj_timeline *wait_timeline, uint64_t wait_point) {
+		const pixman_box32_t *rects, int rects_len,
+		struct wlr_drm_syncobj_timeline *wait_timeline, uint64_t wait_point,
+		int *wait_sync_file_fd) {
 	VkDevice dev = vk_renderer->dev->dev;
 
 	const struct wlr_pixel_format_info *pixel_format_info = drm_get_pixel_format_info(drm_format);
@@ -1429,8 +1449,18 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 		vk_renderer->read_pixels_cache.height = height;
 	}
 
+	// Allocated before recording, so that the command buffer isn't left
+	// half-recorded on failure
+	void *regions = calloc(rects_len,
+		blit_supported ? sizeof(VkImageBlit) : sizeof(VkImageCopy));
+	if (regions == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
 	VkCommandBuffer cb = vulkan_record_stage_cb(vk_renderer);
 	if (cb == VK_NULL_HANDLE) {
+		free(regions);
 		return false;
 	}
 
@@ -1450,50 +1480,69 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 			VK_ACCESS_TRANSFER_READ_BIT);
 
 	if (blit_supported) {
-		VkImageBlit image_blit_region = {
-			.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.srcSubresource.layerCount = 1,
-			.srcOffsets[0] = {
-				.x = src_x,
-				.y = src_y,
-				.z = 0,
-			},
-			.srcOffsets[1] = {
-				.x = src_x + width,
-				.y = src_y + height,
-				.z = 1,
-			},
-			.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.dstSubresource.layerCount = 1,
-			.dstOffsets[1] = {
-				.x = width,
-				.y = height,
-				.z = 1,
-			}
-		};
+		VkImageBlit *blit_regions = regions;
+		for (int i = 0; i < rects_len; i++) {
+			const pixman_box32_t *rect = &rects[i];
+			blit_regions[i] = (VkImageBlit){
+				.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.srcSubresource.layerCount = 1,
+				.srcOffsets[0] = {
+					.x = src_x + rect->x1,
+					.y = src_y + rect->y1,
+					.z = 0,
+				},
+				.srcOffsets[1] = {
+					.x = src_x + rect->x2,
+					.y = src_y + rect->y2,
+					.z = 1,
+				},
+				.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.dstSubresource.layerCount = 1,
+				.dstOffsets[0] = {
+					.x = rect->x1,
+					.y = rect->y1,
+					.z = 0,
+				},
+				.dstOffsets[1] = {
+					.x = rect->x2,
+					.y = rect->y2,
+					.z = 1,
+				}
+			};
+		}
 		vkCmdBlitImage(cb, src_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 				dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1, &image_blit_region, VK_FILTER_NEAREST);
+				rects_len, blit_regions, VK_FILTER_NEAREST);
 	} else {
 		wlr_log(WLR_DEBUG, "vulkan_read_pixels: blit unsupported, falling back to vkCmdCopyImage.");
-		VkImageCopy image_region = {
-			.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.srcSubresource.layerCount = 1,
-			.srcOffset = {
-				.x = src_x,
-				.y = src_y,
-			},
-			.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.dstSubresource.layerCount = 1,
-			.extent = {
-				.width = width,
-				.height = height,
-				.depth = 1,
-			}
-		};
+		VkImageCopy *copy_regions = regions;
+		for (int i = 0; i < rects_len; i++) {
+			const pixman_box32_t *rect = &rects[i];
+			copy_regions[i] = (VkImageCopy){
+				.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.srcSubresource.layerCount = 1,
+				.srcOffset = {
+					.x = src_x + rect->x1,
+					.y = src_y + rect->y1,
+				},
+				.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.dstSubresource.layerCount = 1,
+				.dstOffset = {
+					.x = rect->x1,
+					.y = rect->y1,
+				},
+				.extent = {
+					.width = rect->x2 - rect->x1,
+					.height = rect->y2 - rect->y1,
+					.depth = 1,
+				}
+			};
+		}
 		vkCmdCopyImage(cb, src_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &image_region);
+				dst_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				rects_len, copy_regions);
 	}
+	free(regions);
 
 	vulkan_change_layout(cb, dst_image,
 			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
@@ -1510,19 +1559,36 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 			VK_PIPELINE_STAGE_TRANSFER_BIT,
 			VK_ACCESS_MEMORY_READ_BIT);
 
-	int wait_sync_file_fd = -1;
+	*wait_sync_file_fd = -1;
 	if (wait_timeline != NULL) {
-		wait_sync_file_fd = wlr_drm_syncobj_timeline_export_sync_file(wait_timeline, wait_point);
-		if (wait_sync_file_fd < 0) {
+		*wait_sync_file_fd = wlr_drm_syncobj_timeline_export_sync_file(wait_timeline, wait_point);
+		if (*wait_sync_file_fd < 0) {
 			wlr_log(WLR_ERROR, "Failed to export wait timeline point as sync_file");
 			return false;
 		}
 	}
 
-	if (!vulkan_submit_stage_wait(vk_renderer, wait_sync_file_fd)) {
-		close(wait_sync_file_fd);
-		return false;
-	}
+	return true;
+
+free_memory:
+	vkFreeMemory(dev, dst_img_memory, NULL);
+destroy_image:
+	vkDestroyImage(dev, dst_image, NULL);
+
+	return false;
+}
+
+// Copies rectangles out of a host-visible image filled by read_pixels_record()
+static bool read_pixels_copy(struct wlr_vk_renderer *vk_renderer,
+		VkImage dst_image, VkDeviceMemory dst_img_memory, uint32_t drm_format,
+		uint32_t stride, uint32_t width, uint32_t height,
+		const pixman_box32_t *rects, int rects_len,
+		uint32_t dst_x, uint32_t dst_y, void *data) {
+	VkDevice dev = vk_renderer->dev->dev;
+	VkResult res;
+
+	const struct wlr_pixel_format_info *pixel_format_info = drm_get_pixel_format_info(drm_format);
+	assert(pixel_format_info);
 
 	VkImageSubresource img_sub_res = {
 		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -1556,24 +1622,205 @@ bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
 	unsigned char *p = (unsigned char *)data + dst_y * stride;
 	uint32_t bytes_per_pixel = pixel_format_info->bytes_per_block;
 	uint32_t pack_stride = img_sub_layout.rowPitch;
-	if (pack_stride == stride && dst_x == 0) {
+	bool full = rects_len == 1 && rects[0].x1 == 0 && rects[0].y1 == 0 &&
+		(uint32_t)rects[0].x2 == width && (uint32_t)rects[0].y2 == height;
+	if (full && pack_stride == stride && dst_x == 0) {
 		memcpy(p, d, height * stride);
 	} else {
-		for (size_t i = 0; i < height; ++i) {
-			memcpy(p + i * stride + dst_x * bytes_per_pixel, d + i * pack_stride, width * bytes_per_pixel);
+		for (int i = 0; i < rects_len; i++) {
+			const pixman_box32_t *rect = &rects[i];
+			size_t row_size = (size_t)(rect->x2 - rect->x1) * bytes_per_pixel;
+			for (int y = rect->y1; y < rect->y2; y++) {
+				memcpy(p + (size_t)y * stride + (dst_x + rect->x1) * bytes_per_pixel,
+					d + (size_t)y * pack_stride + rect->x1 * bytes_per_pixel, row_size);
+			}
 		}
 	}
 
 	vkUnmapMemory(dev, dst_img_memory);
-	// Don't need to free anything else, since memory and image are cached
 	return true;
+}
 
-free_memory:
-	vkFreeMemory(dev, dst_img_memory, NULL);
-destroy_image:
-	vkDestroyImage(dev, dst_image, NULL);
+bool vulkan_read_pixels(struct wlr_vk_renderer *vk_renderer,
+		VkFormat src_format, VkImage src_image,
+		uint32_t drm_format, uint32_t stride,
+		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
+		uint32_t dst_x, uint32_t dst_y, void *data,
+		struct wlr_drm_syncobj_timeline *wait_timeline, uint64_t wait_point) {
+	pixman_box32_t rect = { 0, 0, width, height };
+	int wait_sync_file_fd;
+	if (!read_pixels_record(vk_renderer, src_format, src_image, drm_format,
+			width, height, src_x, src_y, &rect, 1, wait_timeline, wait_point,
+			&wait_sync_file_fd)) {
+		return false;
+	}
 
-	return false;
+	if (!vulkan_submit_stage_wait(vk_renderer, wait_sync_file_fd)) {
+		close(wait_sync_file_fd);
+		return false;
+	}
+
+	// Don't need to free anything else, since memory and image are cached
+	return read_pixels_copy(vk_renderer, vk_renderer->read_pixels_cache.dst_image,
+		vk_renderer->read_pixels_cache.dst_img_memory, drm_format, stride,
+		width, height, &rect, 1, dst_x, dst_y, data);
+}
+
+static struct wlr_vk_read_pixels_task *read_pixels_task_from_base(
+		struct wlr_texture_read_pixels_task *base) {
+	struct wlr_vk_read_pixels_task *task = wl_container_of(base, task, base);
+	return task;
+}
+
+static bool read_pixels_task_copy(struct wlr_texture_read_pixels_task *base,
+		const struct wlr_texture_read_pixels_options *options) {
+	struct wlr_vk_read_pixels_task *task = read_pixels_task_from_base(base);
+	int rects_len = 0;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&task->base.region, &rects_len);
+	return read_pixels_copy(task->renderer, task->dst_image, task->dst_img_memory,
+		options->format, options->stride, task->width, task->height,
+		rects, rects_len, 0, 0, wlr_texture_read_pixel_options_get_data(options));
+}
+
+static void read_pixels_task_destroy(struct wlr_texture_read_pixels_task *base) {
+	struct wlr_vk_read_pixels_task *task = read_pixels_task_from_base(base);
+	struct wlr_vk_renderer *renderer = task->renderer;
+	VkDevice dev = renderer->dev->dev;
+
+	if (task->timer != NULL) {
+		wl_event_source_remove(task->timer);
+	}
+
+	if (task->dst_image != VK_NULL_HANDLE) {
+		if (!task->signaled) {
+			// Cancelled while the copy is in flight, the image can't be
+			// re-used or destroyed before it completes
+			VkSemaphoreWaitInfoKHR wait_info = {
+				.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+				.semaphoreCount = 1,
+				.pSemaphores = &renderer->timeline_semaphore,
+				.pValues = &task->timeline_point,
+			};
+			VkResult res = renderer->dev->api.vkWaitSemaphoresKHR(dev,
+				&wait_info, UINT64_MAX);
+			if (res != VK_SUCCESS) {
+				wlr_vk_error("vkWaitSemaphoresKHR", res);
+			}
+		}
+
+		if (!renderer->read_pixels_cache.initialized) {
+			renderer->read_pixels_cache.initialized = true;
+			renderer->read_pixels_cache.drm_format = task->base.format;
+			renderer->read_pixels_cache.dst_image = task->dst_image;
+			renderer->read_pixels_cache.dst_img_memory = task->dst_img_memory;
+			renderer->read_pixels_cache.width = task->width;
+			renderer->read_pixels_cache.height = task->height;
+		} else {
+			vkFreeMemory(dev, task->dst_img_memory, NULL);
+			vkDestroyImage(dev, task->dst_image, NULL);
+		}
+	}
+
+	wl_list_remove(&task->link);
+	free(task);
+}
+
+static const struct wlr_texture_read_pixels_task_impl read_pixels_task_impl = {
+	.copy = read_pixels_task_copy,
+	.destroy = read_pixels_task_destroy,
+};
+
+static int read_pixels_task_handle_timer(void *data) {
+	struct wlr_vk_read_pixels_task *task = data;
+	struct wlr_vk_renderer *renderer = task->renderer;
+
+	uint64_t current_point;
+	VkResult res = renderer->dev->api.vkGetSemaphoreCounterValueKHR(renderer->dev->dev,
+		renderer->timeline_semaphore, &current_point);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetSemaphoreCounterValueKHR", res);
+		wlr_texture_read_pixels_task_finish(&task->base, false);
+		return 0;
+	}
+
+	if (current_point < task->timeline_point) {
+		wl_event_source_timer_update(task->timer, 1);
+		return 0;
+	}
+
+	task->signaled = true;
+	wlr_texture_read_pixels_task_finish(&task->base, true);
+	return 0;
+}
+
+struct wlr_texture_read_pixels_task *vulkan_read_pixels_async(
+		struct wlr_vk_texture *texture,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	struct wlr_vk_renderer *renderer = texture->renderer;
+
+	struct wlr_vk_read_pixels_task *task = calloc(1, sizeof(*task));
+	if (task == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	if (!wlr_texture_read_pixels_task_init(&task->base,
+			&read_pixels_task_impl, &texture->wlr_texture, options)) {
+		free(task);
+		return NULL;
+	}
+	task->renderer = renderer;
+	wl_list_insert(&renderer->read_pixels_tasks, &task->link);
+
+	if (pixman_region32_empty(&task->base.region)) {
+		// Nothing to read, the GPU isn't needed
+		wlr_texture_read_pixels_task_cancel(&task->base);
+		return wlr_texture_read_pixels_deferred(&texture->wlr_texture, options);
+	}
+
+	const struct wlr_box *src = &task->base.src_box;
+	int rects_len = 0;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles(&task->base.region, &rects_len);
+
+	int wait_sync_file_fd;
+	if (!read_pixels_record(renderer, texture->format->vk, texture->image,
+			task->base.format, src->width, src->height, src->x, src->y,
+			rects, rects_len, options->wait_timeline, options->wait_point,
+			&wait_sync_file_fd)) {
+		goto error;
+	}
+
+	// The texture must not be destroyed before the copy has executed
+	texture->last_used_cb = renderer->stage.cb;
+
+	task->timeline_point = vulkan_submit_stage(renderer, wait_sync_file_fd);
+	if (task->timeline_point == 0) {
+		close(wait_sync_file_fd);
+		goto error;
+	}
+
+	// Take the image out of the cache, so that other reads don't overwrite
+	// it until the pixels have been copied
+	task->dst_image = renderer->read_pixels_cache.dst_image;
+	task->dst_img_memory = renderer->read_pixels_cache.dst_img_memory;
+	task->width = src->width;
+	task->height = src->height;
+	renderer->read_pixels_cache.initialized = false;
+
+	task->timer = wl_event_loop_add_timer(options->event_loop,
+		read_pixels_task_handle_timer, task);
+	if (task->timer == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add read pixels task to event loop");
+		goto error;
+	}
+	wl_event_source_timer_update(task->timer, 1);
+
+	return &task->base;
+
+error:
+	wlr_texture_read_pixels_task_cancel(&task->base);
+	return NULL;
 }
 
 static int vulkan_get_drm_fd(struct wlr_renderer *wlr_renderer) {
@@ -2752,6 +2999,7 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 	wl_list_init(&renderer->stage.buffers);
 	wl_list_init(&renderer->foreign_textures);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->read_pixels_tasks);
 	wl_list_init(&renderer->descriptor_pools);
 	wl_list_init(&renderer->output_descriptor_pools);
 	wl_list_init(&renderer->render_format_setups);
@@ -242,6 +242,13 @@ static bool vulkan_texture_read_pixels(struct wlr_texture *wlr_texture,
 		options->wait_timeline, options->wait_point);
 }
 
+static struct wlr_texture_read_pixels_task *vulkan_texture_read_pixels_async(
+		struct wlr_texture *wlr_texture,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
+	return vulkan_read_pixels_async(texture, options);
+}
+
 static uint32_t vulkan_texture_preferred_read_format(struct wlr_texture *wlr_texture) {
 	struct wlr_vk_texture *texture = vulkan_get_texture(wlr_texture);
 	return texture->format->drm;
@@ -252,6 +259,7 @@ static const struct wlr_texture_impl texture_impl = {
 	.read_pixels = vulkan_texture_read_pixels,
 	.preferred_read_format = vulkan_texture_preferred_read_format,
 	.destroy = vulkan_texture_unref,
+	.read_pixels_async = vulkan_texture_read_pixels_async,
 };
 
 static struct wlr_vk_texture *vulkan_texture_create(
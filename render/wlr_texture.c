@@ -44,6 +44,22 @@ void wlr_texture_read_pixels_options_get_src_box(
 	*box = options->src_box;
 }
 
+void wlr_texture_read_pixels_async_options_get_src_box(
+		const struct wlr_texture_read_pixels_async_options *options,
+		const struct wlr_texture *texture, struct wlr_box *box) {
+	if (wlr_box_empty(&options->src_box)) {
+		*box = (struct wlr_box){
+			.x = 0,
+			.y = 0,
+			.width = texture->width,
+			.height = texture->height,
+		};
+		return;
+	}
+
+	*box = options->src_box;
+}
+
 void *wlr_texture_read_pixel_options_get_data(
 		const struct wlr_texture_read_pixels_options *options) {
 	const struct wlr_pixel_format_info *fmt = drm_get_pixel_format_info(options->format);
@@ -62,6 +78,166 @@ bool wlr_texture_read_pixels(struct wlr_texture *texture,
 	return texture->impl->read_pixels(texture, options);
 }
 
+bool wlr_texture_read_pixels_task_init(struct wlr_texture_read_pixels_task *task,
+		const struct wlr_texture_read_pixels_task_impl *impl,
+		struct wlr_texture *texture,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	assert(options->event_loop != NULL && options->done != NULL);
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(options->buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
+		return false;
+	}
+	wlr_buffer_end_data_ptr_access(options->buffer);
+
+	*task = (struct wlr_texture_read_pixels_task){
+		.impl = impl,
+		.buffer = wlr_buffer_lock(options->buffer),
+		.format = format,
+		.stride = stride,
+		.dst_x = options->dst_x,
+		.dst_y = options->dst_y,
+		.event_loop = options->event_loop,
+		.done = options->done,
+		.data = options->data,
+	};
+
+	wlr_texture_read_pixels_async_options_get_src_box(options, texture,
+		&task->src_box);
+	pixman_region32_init_rect(&task->region, 0, 0,
+		task->src_box.width, task->src_box.height);
+	if (options->region != NULL) {
+		pixman_region32_intersect(&task->region, &task->region, options->region);
+	}
+
+	return true;
+}
+
+static void read_pixels_task_destroy(struct wlr_texture_read_pixels_task *task) {
+	if (task->idle != NULL) {
+		wl_event_source_remove(task->idle);
+	}
+	wlr_buffer_unlock(task->buffer);
+	pixman_region32_fini(&task->region);
+	task->impl->destroy(task);
+}
+
+void wlr_texture_read_pixels_task_finish(struct wlr_texture_read_pixels_task *task,
+		bool ok) {
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (ok && task->impl->copy != NULL) {
+		if (wlr_buffer_begin_data_ptr_access(task->buffer,
+				WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
+			ok = format == task->format && task->impl->copy(task,
+				&(struct wlr_texture_read_pixels_options){
+					.data = data,
+					.format = format,
+					.stride = stride,
+					.dst_x = task->dst_x,
+					.dst_y = task->dst_y,
+				});
+			wlr_buffer_end_data_ptr_access(task->buffer);
+		} else {
+			ok = false;
+		}
+	}
+
+	wlr_texture_read_pixels_done_func_t done = task->done;
+	void *done_data = task->data;
+	read_pixels_task_destroy(task);
+	done(ok, done_data);
+}
+
+void wlr_texture_read_pixels_task_cancel(struct wlr_texture_read_pixels_task *task) {
+	read_pixels_task_destroy(task);
+}
+
+static void deferred_task_destroy(struct wlr_texture_read_pixels_task *task) {
+	free(task);
+}
+
+static const struct wlr_texture_read_pixels_task_impl deferred_task_impl = {
+	.destroy = deferred_task_destroy,
+};
+
+static void deferred_task_handle_idle(void *data) {
+	struct wlr_texture_read_pixels_task *task = data;
+	task->idle = NULL;
+	wlr_texture_read_pixels_task_finish(task, task->ok);
+}
+
+struct wlr_texture_read_pixels_task *wlr_texture_read_pixels_deferred(
+		struct wlr_texture *texture,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	struct wlr_texture_read_pixels_task *task = calloc(1, sizeof(*task));
+	if (task == NULL) {
+		return NULL;
+	}
+	if (!wlr_texture_read_pixels_task_init(task, &deferred_task_impl,
+			texture, options)) {
+		free(task);
+		return NULL;
+	}
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (wlr_buffer_begin_data_ptr_access(task->buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
+		task->ok = true;
+
+		int rects_len = 0;
+		const pixman_box32_t *rects =
+			pixman_region32_rectangles(&task->region, &rects_len);
+		for (int i = 0; i < rects_len && task->ok; i++) {
+			const pixman_box32_t *rect = &rects[i];
+			task->ok = wlr_texture_read_pixels(texture, &(struct wlr_texture_read_pixels_options){
+				.data = data,
+				.format = format,
+				.stride = stride,
+				.dst_x = task->dst_x + rect->x1,
+				.dst_y = task->dst_y + rect->y1,
+				.src_box = {
+					.x = task->src_box.x + rect->x1,
+					.y = task->src_box.y + rect->y1,
+					.width = rect->x2 - rect->x1,
+					.height = rect->y2 - rect->y1,
+				},
+				// Only the first read needs to wait
+				.wait_timeline = i == 0 ? options->wait_timeline : NULL,
+				.wait_point = options->wait_point,
+			});
+		}
+		wlr_buffer_end_data_ptr_access(task->buffer);
+	}
+
+	task->idle = wl_event_loop_add_idle(task->event_loop,
+		deferred_task_handle_idle, task);
+	if (task->idle == NULL) {
+		wlr_texture_read_pixels_task_cancel(task);
+		return NULL;
+	}
+
+	return task;
+}
+
+struct wlr_texture_read_pixels_task *wlr_texture_read_pixels_async(
+		struct wlr_texture *texture,
+		const struct wlr_texture_read_pixels_async_options *options) {
+	if (texture->impl->read_pixels_async) {
+		return texture->impl->read_pixels_async(texture, options);
+	}
+	if (!texture->impl->read_pixels) {
+		return NULL;
+	}
+	return wlr_texture_read_pixels_deferred(texture, options);
+}
+
 uint32_t wlr_texture_preferred_read_format(struct wlr_texture *texture) {
 	if (!texture->impl->preferred_read_format) {
 		return DRM_FORMAT_INVALID;
@@ -0,0 +1,265 @@
+#include <drm_fourcc.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layer.h>
+#include "mock_kms.h"
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+
+// Buffers cycled through by the primary plane
+#define SWAPCHAIN_LEN 3
+#define LAYERS 4
+#define LAYER_SIZE 256
+
+// Page-flips complete on simulated 60Hz vblanks
+#define FRAMES 60
+
+struct bench {
+	struct wl_event_loop *loop;
+	struct mock_kms *kms;
+	struct wlr_backend *backend;
+	struct wlr_output *output;
+	struct wl_listener new_output;
+	struct wl_listener present;
+	bool frame_pending;
+
+	struct wlr_buffer *swapchain[SWAPCHAIN_LEN];
+	struct wlr_output_layer *layers[LAYERS];
+	struct wlr_buffer *layer_buffers[LAYERS];
+};
+
+struct scenario {
+	const char *name;
+	// Environment variable selecting the DRM interface
+	const char *env;
+	struct mock_kms_options options;
+	bool layers;
+};
+
+static const struct scenario scenarios[] = {
+	{ "atomic", NULL, { .realtime_vblank = true }, false },
+	{ "legacy", "WLR_DRM_NO_ATOMIC", { .realtime_vblank = true }, false },
+	{
+		"layers, 3 overlays", "WLR_DRM_FORCE_LIBLIFTOFF",
+		{ .realtime_vblank = true, .overlay_planes = 3 }, true,
+	},
+	{
+		"layers, 1 overlay", "WLR_DRM_FORCE_LIBLIFTOFF",
+		{ .realtime_vblank = true, .overlay_planes = 1 }, true,
+	},
+	{
+		"layers, 4 planes max", "WLR_DRM_FORCE_LIBLIFTOFF",
+		{ .realtime_vblank = true, .overlay_planes = 3, .max_active_planes = 4 }, true,
+	},
+};
+
+static double timespec_diff_msec(struct timespec *start, struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) * 1e3 +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void handle_present(struct wl_listener *listener, void *data) {
+	struct bench *bench = wl_container_of(listener, bench, present);
+	bench->frame_pending = false;
+}
+
+static void handle_new_output(struct wl_listener *listener, void *data) {
+	struct bench *bench = wl_container_of(listener, bench, new_output);
+	if (bench->output == NULL) {
+		bench->output = data;
+		bench->present.notify = handle_present;
+		wl_signal_add(&bench->output->events.present, &bench->present);
+	}
+}
+
+static bool bench_init(struct bench *bench, const struct scenario *scenario) {
+	bench->loop = wl_event_loop_create();
+	if (bench->loop == NULL) {
+		return false;
+	}
+	bench->kms = mock_kms_create(bench->loop, &scenario->options);
+	if (bench->kms == NULL) {
+		return false;
+	}
+
+	// The interface is picked when the backend is created
+	if (scenario->env != NULL) {
+		setenv(scenario->env, "1", 1);
+	}
+	bench->backend = mock_kms_create_backend(bench->kms);
+	if (scenario->env != NULL) {
+		unsetenv(scenario->env);
+	}
+	if (bench->backend == NULL) {
+		return false;
+	}
+
+	bench->new_output.notify = handle_new_output;
+	wl_signal_add(&bench->backend->events.new_output, &bench->new_output);
+	if (!wlr_backend_start(bench->backend) || bench->output == NULL) {
+		return false;
+	}
+
+	for (size_t i = 0; i < SWAPCHAIN_LEN; i++) {
+		bench->swapchain[i] = mock_kms_buffer_create(OUTPUT_WIDTH, OUTPUT_HEIGHT,
+			DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_INVALID);
+		if (bench->swapchain[i] == NULL) {
+			return false;
+		}
+	}
+	if (scenario->layers) {
+		for (size_t i = 0; i < LAYERS; i++) {
+			bench->layers[i] = wlr_output_layer_create(bench->output);
+			bench->layer_buffers[i] = mock_kms_buffer_create(LAYER_SIZE, LAYER_SIZE,
+				DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_INVALID);
+			if (bench->layers[i] == NULL || bench->layer_buffers[i] == NULL) {
+				return false;
+			}
+		}
+	}
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	wlr_output_state_set_mode(&state, wlr_output_preferred_mode(bench->output));
+	wlr_output_state_set_buffer(&state, bench->swapchain[0]);
+	bool ok = wlr_output_commit_state(bench->output, &state);
+	wlr_output_state_finish(&state);
+	bench->frame_pending = ok;
+	return ok;
+}
+
+static void bench_finish(struct bench *bench) {
+	for (size_t i = 0; i < LAYERS; i++) {
+		if (bench->layers[i] != NULL) {
+			wlr_output_layer_destroy(bench->layers[i]);
+		}
+		if (bench->layer_buffers[i] != NULL) {
+			wlr_buffer_drop(bench->layer_buffers[i]);
+		}
+	}
+	if (bench->output != NULL) {
+		wl_list_remove(&bench->present.link);
+	}
+	if (bench->backend != NULL) {
+		wl_list_remove(&bench->new_output.link);
+	}
+	// Destroys the backend
+	mock_kms_destroy(bench->kms);
+	for (size_t i = 0; i < SWAPCHAIN_LEN; i++) {
+		if (bench->swapchain[i] != NULL) {
+			wlr_buffer_drop(bench->swapchain[i]);
+		}
+	}
+	if (bench->loop != NULL) {
+		wl_event_loop_destroy(bench->loop);
+	}
+}
+
+static bool wait_for_present(struct bench *bench) {
+	for (int i = 0; i < 100 && bench->frame_pending; i++) {
+		wl_event_loop_dispatch(bench->loop, 100);
+	}
+	return !bench->frame_pending;
+}
+
+static bool bench_frames(const struct scenario *scenario) {
+	struct bench bench = {0};
+	if (!bench_init(&bench, scenario)) {
+		bool has_backend = bench.backend != NULL;
+		bench_finish(&bench);
+		if (scenario->layers && !has_backend) {
+			// libliftoff may not be available
+			printf("%-22s skipped\n", scenario->name);
+			return true;
+		}
+		fprintf(stderr, "%s: failed to set up output\n", scenario->name);
+		return false;
+	}
+	mock_kms_reset_stats(bench.kms);
+
+	struct wlr_output_layer_state layer_states[LAYERS];
+	int layers_len = scenario->layers ? LAYERS : 0;
+	int layers_accepted = 0;
+
+	double elapsed = 0;
+	bool ok = true;
+	for (int frame = 0; frame < FRAMES && ok; frame++) {
+		ok = wait_for_present(&bench);
+		if (!ok) {
+			break;
+		}
+
+		struct wlr_output_state state;
+		wlr_output_state_init(&state);
+		wlr_output_state_set_buffer(&state, bench.swapchain[(frame + 1) % SWAPCHAIN_LEN]);
+		for (int i = 0; i < layers_len; i++) {
+			layer_states[i] = (struct wlr_output_layer_state){
+				.layer = bench.layers[i],
+				.buffer = bench.layer_buffers[i],
+				.dst_box = {
+					.x = 100 + i * 300 + frame % 32 * 4,
+					.y = 100 + i * 150,
+					.width = LAYER_SIZE,
+					.height = LAYER_SIZE,
+				},
+			};
+		}
+		if (layers_len > 0) {
+			wlr_output_state_set_layers(&state, layer_states, layers_len);
+		}
+
+		// Like a compositor would, test layers first to find out which ones
+		// need to be composited
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (layers_len > 0) {
+			ok = wlr_output_test_state(bench.output, &state);
+		}
+		ok = ok && wlr_output_commit_state(bench.output, &state);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed += timespec_diff_msec(&start, &end);
+		wlr_output_state_finish(&state);
+
+		for (int i = 0; i < layers_len; i++) {
+			layers_accepted += layer_states[i].accepted;
+		}
+		bench.frame_pending = ok;
+	}
+	ok = ok && wait_for_present(&bench);
+
+	const struct mock_kms_stats *stats = mock_kms_get_stats(bench.kms);
+	if (ok) {
+		printf("%-22s %.3f ms/commit, %.2f tests/frame (%.2f failed)",
+			scenario->name, elapsed / FRAMES,
+			(double)stats->test_commits / FRAMES,
+			(double)stats->failed_test_commits / FRAMES);
+		if (layers_len > 0) {
+			printf(", %.1f%% layers composited",
+				100.0 * (1.0 - (double)layers_accepted / (layers_len * FRAMES)));
+		}
+		printf("\n");
+	} else {
+		fprintf(stderr, "%s: commit failed (%"PRIu64" failed commits)\n",
+			scenario->name, stats->failed_commits);
+	}
+
+	bench_finish(&bench);
+	return ok;
+}
+
+int main(void) {
+	bool ok = true;
+	size_t scenarios_len = sizeof(scenarios) / sizeof(scenarios[0]);
+	for (size_t i = 0; i < scenarios_len && ok; i++) {
+		ok = bench_frames(&scenarios[i]);
+	}
+	return ok ? 0 : 1;
+}
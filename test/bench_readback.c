@@ -0,0 +1,246 @@
+#include <drm_fourcc.h>
+#include <inttypes.h>
+#include <pixman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_damage_ring.h>
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define BYTES_PER_PIXEL 4
+
+// Screen capture clients usually alternate between two buffers
+#define CLIENT_BUFFERS 2
+
+#define FRAMES 120
+
+struct bench_buffer {
+	struct wlr_buffer base;
+	uint8_t *data;
+	size_t stride;
+};
+
+struct damage_pattern {
+	const char *name;
+	// Damage of the frame, moved by the given offset every frame
+	struct wlr_box box;
+	int rects;
+	int dx, dy;
+};
+
+static const struct damage_pattern patterns[] = {
+	{ "cursor", { 600, 400, 32, 32 }, 1, 7, 3 },
+	{ "terminal lines", { 40, 300, 800, 16 }, 3, 0, 16 },
+	{ "video", { 320, 180, 640, 360 }, 1, 0, 0 },
+	{ "full", { 0, 0, OUTPUT_WIDTH, OUTPUT_HEIGHT }, 1, 0, 0 },
+};
+
+static double timespec_diff_msec(struct timespec *start, struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) * 1e3 +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void bench_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	wlr_buffer_finish(wlr_buffer);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool bench_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct bench_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*data = buffer->data;
+	*format = DRM_FORMAT_ARGB8888;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void bench_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// This space is intentionally left blank
+}
+
+static const struct wlr_buffer_impl bench_buffer_impl = {
+	.destroy = bench_buffer_destroy,
+	.begin_data_ptr_access = bench_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = bench_buffer_end_data_ptr_access,
+};
+
+static struct bench_buffer *bench_buffer_create(void) {
+	struct bench_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+	wlr_buffer_init(&buffer->base, &bench_buffer_impl, OUTPUT_WIDTH, OUTPUT_HEIGHT);
+	buffer->stride = OUTPUT_WIDTH * BYTES_PER_PIXEL;
+	buffer->data = calloc(OUTPUT_HEIGHT, buffer->stride);
+	if (buffer->data == NULL) {
+		free(buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+static uint64_t region_area(const pixman_region32_t *region) {
+	uint64_t area = 0;
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+	}
+	return area;
+}
+
+static void pattern_get_damage(const struct damage_pattern *pattern, int frame,
+		pixman_region32_t *damage) {
+	pixman_region32_clear(damage);
+	for (int i = 0; i < pattern->rects; i++) {
+		int x = pattern->box.x + (frame * pattern->dx) % 512;
+		int y = pattern->box.y + (frame * pattern->dy + i * 2 * pattern->box.height) % 512;
+		pixman_region32_union_rect(damage, damage,
+			x, y, pattern->box.width, pattern->box.height);
+	}
+	pixman_region32_intersect_rect(damage, damage, 0, 0, OUTPUT_WIDTH, OUTPUT_HEIGHT);
+}
+
+// Simulate the compositor painting the damaged region of the output
+static void paint_damage(struct bench_buffer *output, const pixman_region32_t *damage,
+		uint32_t color) {
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		for (int y = rects[i].y1; y < rects[i].y2; y++) {
+			uint32_t *row = (uint32_t *)(output->data + y * output->stride);
+			for (int x = rects[i].x1; x < rects[i].x2; x++) {
+				row[x] = color + x;
+			}
+		}
+	}
+}
+
+static void handle_read_done(bool ok, void *data) {
+	int *result = data;
+	*result = ok ? 1 : 0;
+}
+
+/**
+ * Mirrors screencopy with damage: the output is read back into one of the
+ * client buffers every frame, either fully or only where the client buffer
+ * is outdated.
+ */
+static bool bench_readback(struct wlr_renderer *renderer,
+		struct wl_event_loop *loop, const struct damage_pattern *pattern,
+		bool limit_to_damage) {
+	struct bench_buffer *output = bench_buffer_create();
+	struct bench_buffer *clients[CLIENT_BUFFERS] = {0};
+	for (size_t i = 0; i < CLIENT_BUFFERS; i++) {
+		clients[i] = bench_buffer_create();
+	}
+
+	struct wlr_damage_ring ring;
+	wlr_damage_ring_init(&ring);
+
+	pixman_region32_t damage, buffer_damage;
+	pixman_region32_init(&damage);
+	pixman_region32_init(&buffer_damage);
+
+	bool ok = output != NULL;
+	uint64_t bytes = 0;
+	double elapsed = 0;
+	for (int frame = 0; frame < FRAMES && ok; frame++) {
+		pattern_get_damage(pattern, frame, &damage);
+		paint_damage(output, &damage, (uint32_t)frame << 16);
+
+		struct bench_buffer *client = clients[frame % CLIENT_BUFFERS];
+		if (client == NULL) {
+			ok = false;
+			break;
+		}
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		wlr_damage_ring_add(&ring, &damage);
+		wlr_damage_ring_rotate_buffer(&ring, &client->base, &buffer_damage);
+
+		struct wlr_texture *texture = wlr_texture_from_buffer(renderer, &output->base);
+		if (texture == NULL) {
+			ok = false;
+			break;
+		}
+
+		int result = -1;
+		struct wlr_texture_read_pixels_task *task = wlr_texture_read_pixels_async(texture,
+			&(struct wlr_texture_read_pixels_async_options){
+				.buffer = &client->base,
+				.region = limit_to_damage ? &buffer_damage : NULL,
+				.event_loop = loop,
+				.done = handle_read_done,
+				.data = &result,
+			});
+		wlr_texture_destroy(texture);
+		if (task == NULL) {
+			ok = false;
+			break;
+		}
+		while (result < 0) {
+			// Completion may be reported from an idle source, don't block
+			wl_event_loop_dispatch(loop, 0);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed += timespec_diff_msec(&start, &end);
+
+		bytes += limit_to_damage ? region_area(&buffer_damage) * BYTES_PER_PIXEL :
+			(uint64_t)OUTPUT_WIDTH * OUTPUT_HEIGHT * BYTES_PER_PIXEL;
+		ok = result == 1 &&
+			memcmp(client->data, output->data, OUTPUT_HEIGHT * output->stride) == 0;
+	}
+
+	if (ok) {
+		printf("%-16s %-8s %10.1f KiB/frame, %.3f ms/frame\n", pattern->name,
+			limit_to_damage ? "damage" : "full",
+			(double)bytes / FRAMES / 1024, elapsed / FRAMES);
+	} else {
+		fprintf(stderr, "%s: readback failed or mismatched\n", pattern->name);
+	}
+
+	pixman_region32_fini(&buffer_damage);
+	pixman_region32_fini(&damage);
+	wlr_damage_ring_finish(&ring);
+	for (size_t i = 0; i < CLIENT_BUFFERS; i++) {
+		if (clients[i] != NULL) {
+			wlr_buffer_drop(&clients[i]->base);
+		}
+	}
+	if (output != NULL) {
+		wlr_buffer_drop(&output->base);
+	}
+	return ok;
+}
+
+int main(void) {
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wlr_renderer *renderer = wlr_pixman_renderer_create();
+	if (loop == NULL || renderer == NULL) {
+		fprintf(stderr, "failed to create renderer\n");
+		return 99;
+	}
+
+	bool ok = true;
+	size_t npatterns = sizeof(patterns) / sizeof(patterns[0]);
+	for (size_t i = 0; i < npatterns && ok; i++) {
+		ok = bench_readback(renderer, loop, &patterns[i], false) &&
+			bench_readback(renderer, loop, &patterns[i], true);
+	}
+
+	wlr_renderer_destroy(renderer);
+	wl_event_loop_destroy(loop);
+	return ok ? 0 : 1;
+}
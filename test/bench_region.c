@@ -0,0 +1,344 @@
+#include <pixman.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_damage_ring.h>
+#include <wlr/util/region.h>
+#include "util/rect_union.h"
+
+// A 4K output with a fractional scale of 1.5
+#define BUFFER_WIDTH 3840
+#define BUFFER_HEIGHT 2160
+#define SCALE 1.5f
+#define LOGICAL_WIDTH 2560
+#define LOGICAL_HEIGHT 1440
+
+#define CULLING_WINDOWS 64
+
+struct damage_pattern {
+	const char *name;
+	struct wl_array boxes; // pixman_box32_t
+	pixman_region32_t region;
+};
+
+static double timespec_diff_msec(struct timespec *start, struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) * 1e3 +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void print_result(const char *bench, const char *pattern, int iters,
+		struct timespec *start, struct timespec *end) {
+	double elapsed = timespec_diff_msec(start, end);
+	printf("%-22s %-16s %d iters, %.3f ms, %.3f us/iter\n",
+		bench, pattern, iters, elapsed, elapsed * 1e3 / iters);
+}
+
+static uint32_t next_random(uint32_t *state) {
+	// Deterministic xorshift, so that runs can be compared
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static bool pattern_add_box(struct damage_pattern *pattern,
+		int x, int y, int width, int height) {
+	pixman_box32_t *box = wl_array_add(&pattern->boxes, sizeof(*box));
+	if (box == NULL) {
+		return false;
+	}
+	*box = (pixman_box32_t){ x, y, x + width, y + height };
+	pixman_region32_union_rect(&pattern->region, &pattern->region,
+		x, y, width, height);
+	return true;
+}
+
+static void pattern_init(struct damage_pattern *pattern, const char *name) {
+	pattern->name = name;
+	wl_array_init(&pattern->boxes);
+	pixman_region32_init(&pattern->region);
+}
+
+static void pattern_finish(struct damage_pattern *pattern) {
+	wl_array_release(&pattern->boxes);
+	pixman_region32_fini(&pattern->region);
+}
+
+// Many small rects, like a terminal or spreadsheet updating single cells
+static bool build_small_rects(struct damage_pattern *pattern) {
+	pattern_init(pattern, "small rects");
+	uint32_t state = 0x12345678;
+	for (int i = 0; i < 2000; i++) {
+		int col = next_random(&state) % (LOGICAL_WIDTH / 8);
+		int row = next_random(&state) % (LOGICAL_HEIGHT / 16);
+		if (!pattern_add_box(pattern, col * 8, row * 16, 8, 16)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// A scrolling text view: every line of the view is damaged, split into runs
+// of text of varying length separated by blank space
+static bool build_scrolling_strip(struct damage_pattern *pattern) {
+	pattern_init(pattern, "scrolling strip");
+	uint32_t state = 0x9abcdef0;
+	int x = 200, width = 1600, line_height = 24, char_width = 12;
+	for (int y = 100; y + line_height <= 1300; y += line_height) {
+		for (int run = 0; run < 4; run++) {
+			int run_x = x + run * width / 4;
+			int run_width = (1 + next_random(&state) % 32) * char_width;
+			if (!pattern_add_box(pattern, run_x, y, run_width, line_height)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// A few large overlapping windows
+static bool build_windows(struct damage_pattern *pattern) {
+	pattern_init(pattern, "windows");
+	for (int i = 0; i < 16; i++) {
+		if (!pattern_add_box(pattern, 100 + i * 97, 50 + i * 53, 900, 700)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void bench_rect_union(struct damage_pattern *pattern) {
+	int iters = 200;
+	int nboxes = pattern->boxes.size / sizeof(pixman_box32_t);
+	const pixman_box32_t *boxes = pattern->boxes.data;
+	int nrects = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		struct rect_union r;
+		rect_union_init(&r);
+		for (int j = 0; j < nboxes; j++) {
+			rect_union_add(&r, &boxes[j]);
+		}
+		nrects = pixman_region32_n_rects(rect_union_evaluate(&r));
+		rect_union_finish(&r);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	print_result("rect_union", pattern->name, iters, &start, &end);
+	printf("%-22s %-16s %d boxes in, %d rects out\n", "", "", nboxes, nrects);
+}
+
+static void bench_scale(struct damage_pattern *pattern) {
+	int iters = 1000;
+	pixman_region32_t dst;
+	pixman_region32_init(&dst);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		wlr_region_scale_xy(&dst, &pattern->region, SCALE, SCALE);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("wlr_region_scale_xy", pattern->name, iters, &start, &end);
+
+	// Fractional scales need the damage to be expanded to account for
+	// filtering, see scale_region() in the scene-graph
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		wlr_region_scale_xy(&dst, &pattern->region, SCALE, SCALE);
+		wlr_region_expand(&dst, &dst, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("scale + expand", pattern->name, iters, &start, &end);
+
+	pixman_region32_fini(&dst);
+}
+
+static void bench_transform(struct damage_pattern *pattern) {
+	int iters = 1000;
+	pixman_region32_t dst;
+	pixman_region32_init(&dst);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		wlr_region_transform(&dst, &pattern->region, WL_OUTPUT_TRANSFORM_90,
+			LOGICAL_WIDTH, LOGICAL_HEIGHT);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("wlr_region_transform", pattern->name, iters, &start, &end);
+
+	pixman_region32_fini(&dst);
+}
+
+static void bench_expand(struct damage_pattern *pattern) {
+	int iters = 1000;
+	pixman_region32_t dst;
+	pixman_region32_init(&dst);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		wlr_region_expand(&dst, &pattern->region, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("wlr_region_expand", pattern->name, iters, &start, &end);
+
+	pixman_region32_fini(&dst);
+}
+
+static void bench_buffer_destroy(struct wlr_buffer *buffer) {
+	wlr_buffer_finish(buffer);
+	free(buffer);
+}
+
+static const struct wlr_buffer_impl bench_buffer_impl = {
+	.destroy = bench_buffer_destroy,
+};
+
+static bool bench_damage_ring(struct damage_pattern *pattern) {
+	// Triple-buffered swapchain
+	struct wlr_buffer *buffers[3];
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+		buffers[i] = calloc(1, sizeof(*buffers[i]));
+		if (buffers[i] == NULL) {
+			fprintf(stderr, "calloc failed\n");
+			return false;
+		}
+		wlr_buffer_init(buffers[i], &bench_buffer_impl, BUFFER_WIDTH, BUFFER_HEIGHT);
+	}
+
+	struct wlr_damage_ring ring;
+	wlr_damage_ring_init(&ring);
+
+	pixman_region32_t damage, buffer_damage;
+	pixman_region32_init(&damage);
+	pixman_region32_init(&buffer_damage);
+	wlr_region_scale_xy(&buffer_damage, &pattern->region, SCALE, SCALE);
+
+	int iters = 1000;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		// Alternate the damage between frames, so that the accumulated
+		// damage of the older buffers differs from the current one
+		pixman_region32_translate(&buffer_damage, i % 2 ? -8 : 8, 0);
+		wlr_damage_ring_add(&ring, &buffer_damage);
+		wlr_damage_ring_rotate_buffer(&ring, buffers[i % 3], &damage);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("damage_ring_rotate", pattern->name, iters, &start, &end);
+	printf("%-22s %-16s %d rects, %.2fx current area, %" PRIu64 " simplifications\n",
+		"", "", ring.stats.rects,
+		ring.stats.current_area > 0 ?
+			(double)ring.stats.accumulated_area / ring.stats.current_area : 0.0,
+		ring.stats.simplifications);
+
+	pixman_region32_fini(&buffer_damage);
+	pixman_region32_fini(&damage);
+	wlr_damage_ring_finish(&ring);
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+		wlr_buffer_drop(buffers[i]);
+	}
+	return true;
+}
+
+/**
+ * Mirrors the loop culling the background behind opaque nodes in
+ * wlr_scene_output_build_state(): a cascade of opaque windows, each one only
+ * partially visible.
+ */
+static void bench_opaque_culling(struct damage_pattern *pattern) {
+	int nwindows = CULLING_WINDOWS;
+	pixman_region32_t opaque[CULLING_WINDOWS], visible[CULLING_WINDOWS];
+	pixman_region32_t covered;
+	pixman_region32_init(&covered);
+	for (int i = nwindows - 1; i >= 0; i--) {
+		int x = (i % 16) * 80, y = (i / 16) * 120 + (i % 16) * 20;
+		pixman_region32_init_rect(&opaque[i], x, y, 1200, 800);
+		pixman_region32_init(&visible[i]);
+		pixman_region32_subtract(&visible[i], &opaque[i], &covered);
+		pixman_region32_union(&covered, &covered, &opaque[i]);
+	}
+	pixman_region32_fini(&covered);
+
+	pixman_region32_t damage, background, node_opaque;
+	pixman_region32_init(&damage);
+	pixman_region32_init(&background);
+	pixman_region32_init(&node_opaque);
+	wlr_region_scale_xy(&damage, &pattern->region, SCALE, SCALE);
+	wlr_region_expand(&damage, &damage, 1);
+
+	int iters = 200;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		pixman_region32_copy(&background, &damage);
+		for (int j = nwindows - 1; j >= 0; j--) {
+			pixman_region32_intersect(&node_opaque, &opaque[j], &visible[j]);
+			wlr_region_scale(&node_opaque, &node_opaque, SCALE);
+			wlr_region_expand(&node_opaque, &node_opaque, 1);
+			pixman_region32_subtract(&background, &background, &node_opaque);
+		}
+		wlr_region_expand(&background, &background, 1);
+		pixman_region32_intersect(&background, &background, &damage);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("opaque culling", pattern->name, iters, &start, &end);
+
+	pixman_region32_fini(&node_opaque);
+	pixman_region32_fini(&background);
+	pixman_region32_fini(&damage);
+	for (int i = 0; i < nwindows; i++) {
+		pixman_region32_fini(&opaque[i]);
+		pixman_region32_fini(&visible[i]);
+	}
+}
+
+int main(void) {
+	struct damage_pattern patterns[3];
+	if (!build_small_rects(&patterns[0]) ||
+			!build_scrolling_strip(&patterns[1]) ||
+			!build_windows(&patterns[2])) {
+		fprintf(stderr, "failed to build damage patterns\n");
+		return 99;
+	}
+
+	size_t npatterns = sizeof(patterns) / sizeof(patterns[0]);
+	for (size_t i = 0; i < npatterns; i++) {
+		struct damage_pattern *pattern = &patterns[i];
+		printf("%s: %d rects\n", pattern->name,
+			pixman_region32_n_rects(&pattern->region));
+	}
+	printf("\n");
+
+	for (size_t i = 0; i < npatterns; i++) {
+		bench_rect_union(&patterns[i]);
+	}
+	for (size_t i = 0; i < npatterns; i++) {
+		bench_scale(&patterns[i]);
+	}
+	for (size_t i = 0; i < npatterns; i++) {
+		bench_transform(&patterns[i]);
+	}
+	for (size_t i = 0; i < npatterns; i++) {
+		bench_expand(&patterns[i]);
+	}
+	for (size_t i = 0; i < npatterns; i++) {
+		if (!bench_damage_ring(&patterns[i])) {
+			return 99;
+		}
+	}
+	for (size_t i = 0; i < npatterns; i++) {
+		bench_opaque_culling(&patterns[i]);
+	}
+
+	for (size_t i = 0; i < npatterns; i++) {
+		pattern_finish(&patterns[i]);
+	}
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <wlr/types/wlr_scene.h>
 
@@ -130,6 +131,326 @@ static void bench_scene_node_for_each_buffer(struct wlr_scene *scene, struct tre
 		iters, elapsed, nodes / elapsed, hits, iters);
 }
 
+struct desktop_spec {
+	// Parameters for the desktop we'll construct. Workspaces are laid out
+	// in a grid, each one containing a grid of windows with borders.
+	int workspaces;
+	int workspace_cols;
+	int windows;
+	int window_cols;
+	int window_width;
+	int window_height;
+	int border;
+
+	// Stats around the desktop we built
+	int node_count;
+	int max_x;
+	int max_y;
+};
+
+static bool build_window(struct wlr_scene_tree *parent, struct desktop_spec *spec,
+		int x, int y) {
+	float content_color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	float border_color[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	int w = spec->window_width, h = spec->window_height, b = spec->border;
+
+	struct wlr_scene_tree *tree = wlr_scene_tree_create(parent);
+	if (tree == NULL) {
+		return false;
+	}
+	wlr_scene_node_set_position(&tree->node, x, y);
+	spec->node_count++;
+
+	struct wlr_box rects[] = {
+		{ b, b, w - 2 * b, h - 2 * b },
+		{ 0, 0, w, b },
+		{ 0, h - b, w, b },
+		{ 0, b, b, h - 2 * b },
+		{ w - b, b, b, h - 2 * b },
+	};
+	for (size_t i = 0; i < sizeof(rects) / sizeof(rects[0]); i++) {
+		struct wlr_scene_rect *rect = wlr_scene_rect_create(tree,
+			rects[i].width, rects[i].height, i == 0 ? content_color : border_color);
+		if (rect == NULL) {
+			return false;
+		}
+		wlr_scene_node_set_position(&rect->node, rects[i].x, rects[i].y);
+		spec->node_count++;
+	}
+	return true;
+}
+
+static bool build_desktop(struct wlr_scene *scene, struct desktop_spec *spec) {
+	int window_rows = (spec->windows + spec->window_cols - 1) / spec->window_cols;
+	int workspace_width = spec->window_cols * spec->window_width;
+	int workspace_height = window_rows * spec->window_height;
+
+	for (int i = 0; i < spec->workspaces; i++) {
+		struct wlr_scene_tree *workspace = wlr_scene_tree_create(&scene->tree);
+		if (workspace == NULL) {
+			fprintf(stderr, "wlr_scene_tree_create failed\n");
+			return false;
+		}
+		int ws_x = (i % spec->workspace_cols) * workspace_width;
+		int ws_y = (i / spec->workspace_cols) * workspace_height;
+		wlr_scene_node_set_position(&workspace->node, ws_x, ws_y);
+		spec->node_count++;
+
+		for (int j = 0; j < spec->windows; j++) {
+			int x = (j % spec->window_cols) * spec->window_width;
+			int y = (j / spec->window_cols) * spec->window_height;
+			if (!build_window(workspace, spec, x, y)) {
+				fprintf(stderr, "build_window failed\n");
+				return false;
+			}
+		}
+
+		spec->max_x = max(spec->max_x, ws_x + workspace_width);
+		spec->max_y = max(spec->max_y, ws_y + workspace_height);
+	}
+	return true;
+}
+
+static bool bench_desktop(bool spatial_index) {
+	// The spatial index can only be toggled at scene creation time
+	if (spatial_index) {
+		unsetenv("WLR_SCENE_DISABLE_SPATIAL_INDEX");
+	} else {
+		setenv("WLR_SCENE_DISABLE_SPATIAL_INDEX", "1", true);
+	}
+
+	struct wlr_scene *scene = wlr_scene_create();
+	if (scene == NULL) {
+		fprintf(stderr, "wlr_scene_create failed\n");
+		return false;
+	}
+
+	struct desktop_spec spec = {
+		.workspaces = 16,
+		.workspace_cols = 4,
+		.windows = 128,
+		.window_cols = 16,
+		.window_width = 120,
+		.window_height = 68,
+		.border = 2,
+	};
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!build_desktop(scene, &spec)) {
+		wlr_scene_node_destroy(&scene->tree.node);
+		return false;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = timespec_diff_msec(&start, &end);
+	printf("\nBuilt desktop with %d nodes (spatial index %s)\n\n",
+		spec.node_count, spatial_index ? "enabled" : "disabled");
+	printf("create desktop:                 %d nodes, %.3f ms, %.0f nodes/ms\n",
+		spec.node_count, elapsed, spec.node_count / elapsed);
+
+	int iters = 10000;
+	int hits = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		double lx = (double)(i * 97 % spec.max_x);
+		double ly = (double)(i * 53 % spec.max_y);
+		if (wlr_scene_node_at(&scene->tree.node, lx, ly, NULL, NULL) != NULL) {
+			hits++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = timespec_diff_msec(&start, &end);
+	printf("wlr_scene_node_at:              %d iters, %.3f ms, %.3f us/iter (hits: %d/%d)\n",
+		iters, elapsed, elapsed * 1e3 / iters, hits, iters);
+
+	// Move a window around, forcing visibility to be re-computed in the
+	// damaged area
+	struct wlr_scene_tree *workspace = wl_container_of(scene->tree.children.next,
+		workspace, node.link);
+	struct wlr_scene_node *window = wl_container_of(workspace->children.prev,
+		window, link);
+	iters = 1000;
+	uint64_t updates = scene->stats.visibility_updates;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		wlr_scene_node_set_position(window, i % 512, i % 256);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = timespec_diff_msec(&start, &end);
+	updates = scene->stats.visibility_updates - updates;
+	printf("wlr_scene_node_set_position:    %d iters, %.3f ms, %.3f us/iter, %.1f nodes updated/iter\n",
+		iters, elapsed, elapsed * 1e3 / iters, (double)updates / iters);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	return true;
+}
+
+static void bench_move_in_stack(struct wlr_scene *scene,
+		struct wlr_scene_node *node, const char *name) {
+	int iters = 1000;
+	uint64_t updates = scene->stats.visibility_updates;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		wlr_scene_node_set_position(node, i % 64, i % 32);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = timespec_diff_msec(&start, &end);
+	updates = scene->stats.visibility_updates - updates;
+	printf("move %-26s %d iters, %.3f ms, %.3f us/iter, %.1f nodes updated/iter\n",
+		name, iters, elapsed, elapsed * 1e3 / iters, (double)updates / iters);
+}
+
+static bool bench_stacked_windows(void) {
+	struct wlr_scene *scene = wlr_scene_create();
+	if (scene == NULL) {
+		fprintf(stderr, "wlr_scene_create failed\n");
+		return false;
+	}
+
+	// Overlapping opaque windows, cascaded like a floating window manager
+	// would place them
+	int count = 256;
+	float color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	struct wlr_scene_node *bottom = NULL, *top = NULL;
+	for (int i = 0; i < count; i++) {
+		struct wlr_scene_rect *rect =
+			wlr_scene_rect_create(&scene->tree, 800, 600, color);
+		if (rect == NULL) {
+			fprintf(stderr, "wlr_scene_rect_create failed\n");
+			wlr_scene_node_destroy(&scene->tree.node);
+			return false;
+		}
+		wlr_scene_node_set_position(&rect->node, i % 16 * 8, i % 16 * 8);
+		if (bottom == NULL) {
+			bottom = &rect->node;
+		}
+		top = &rect->node;
+	}
+
+	printf("\nBuilt stack of %d overlapping windows\n\n", count);
+	bench_move_in_stack(scene, top, "top window:");
+	bench_move_in_stack(scene, bottom, "bottom window:");
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	return true;
+}
+
+static bool bench_rearrange(bool batch) {
+	struct wlr_scene *scene = wlr_scene_create();
+	if (scene == NULL) {
+		fprintf(stderr, "wlr_scene_create failed\n");
+		return false;
+	}
+
+	struct desktop_spec spec = {
+		.workspaces = 1,
+		.workspace_cols = 1,
+		.windows = 40,
+		.window_cols = 8,
+		.window_width = 240,
+		.window_height = 216,
+		.border = 2,
+	};
+	if (!build_desktop(scene, &spec)) {
+		wlr_scene_node_destroy(&scene->tree.node);
+		return false;
+	}
+
+	// Shift all windows of the workspace by one tile, like a tiling layout
+	// would after a window has been inserted at the front
+	struct wlr_scene_tree *workspace = wl_container_of(scene->tree.children.next,
+		workspace, node.link);
+	int iters = 100;
+	uint64_t updates = scene->stats.visibility_updates;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		if (batch) {
+			wlr_scene_begin_batch(scene);
+		}
+		int j = i;
+		struct wlr_scene_node *window;
+		wl_list_for_each(window, &workspace->children, link) {
+			j = (j + 1) % spec.windows;
+			wlr_scene_node_set_position(window,
+				(j % spec.window_cols) * spec.window_width,
+				(j / spec.window_cols) * spec.window_height);
+		}
+		if (batch) {
+			wlr_scene_commit_batch(scene);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = timespec_diff_msec(&start, &end);
+	updates = scene->stats.visibility_updates - updates;
+	printf("re-arrange %d windows%-11s %d iters, %.3f ms, %.3f us/iter, %.1f nodes updated/iter\n",
+		spec.windows, batch ? " (batch):" : ":", iters, elapsed,
+		elapsed * 1e3 / iters, (double)updates / iters);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	return true;
+}
+
+static bool bench_snapshot(void) {
+	struct wlr_scene *scene = wlr_scene_create();
+	if (scene == NULL) {
+		fprintf(stderr, "wlr_scene_create failed\n");
+		return false;
+	}
+
+	struct desktop_spec spec = {
+		.workspaces = 1,
+		.workspace_cols = 1,
+		.windows = 40,
+		.window_cols = 8,
+		.window_width = 240,
+		.window_height = 216,
+		.border = 2,
+	};
+	if (!build_desktop(scene, &spec)) {
+		wlr_scene_node_destroy(&scene->tree.node);
+		return false;
+	}
+
+	struct wlr_scene_tree *workspace = wl_container_of(scene->tree.children.next,
+		workspace, node.link);
+	struct wlr_scene_node *window = wl_container_of(workspace->children.prev,
+		window, link);
+	struct wlr_box box = { 0, 0, 960, 540 };
+
+	// Moving a window invalidates the cached snapshot if it overlaps with
+	// the box, so every other iteration re-creates it
+	int iters = 1000;
+	size_t nodes = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iters; i++) {
+		wlr_scene_node_set_position(window, i % 2 * 1200, 0);
+		struct wlr_scene_snapshot *snapshot = wlr_scene_snapshot_create(scene, &box);
+		if (snapshot == NULL) {
+			fprintf(stderr, "wlr_scene_snapshot_create failed\n");
+			wlr_scene_node_destroy(&scene->tree.node);
+			return false;
+		}
+		nodes += snapshot->nodes_len;
+		wlr_scene_snapshot_unref(snapshot);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = timespec_diff_msec(&start, &end);
+	printf("wlr_scene_snapshot_create:      %d iters, %.3f ms, %.3f us/iter, %.1f nodes/snapshot\n",
+		iters, elapsed, elapsed * 1e3 / iters, (double)nodes / iters);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	return true;
+}
+
 int main(void) {
 	struct wlr_scene *scene = wlr_scene_create();
 	if (scene == NULL) {
@@ -150,5 +471,20 @@ int main(void) {
 	bench_scene_node_for_each_buffer(scene, &spec);
 
 	wlr_scene_node_destroy(&scene->tree.node);
+
+	if (!bench_desktop(false) || !bench_desktop(true)) {
+		return 99;
+	}
+	if (!bench_stacked_windows()) {
+		return 99;
+	}
+
+	printf("\n");
+	if (!bench_rearrange(false) || !bench_rearrange(true)) {
+		return 99;
+	}
+	if (!bench_snapshot()) {
+		return 99;
+	}
 	return 0;
 }
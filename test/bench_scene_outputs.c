@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+
+#define OUTPUTS 4
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+
+#define WINDOWS 500
+#define WINDOW_WIDTH 480
+#define WINDOW_HEIGHT 320
+#define BORDER 4
+
+#define FRAMES 200
+
+struct bench {
+	struct wl_event_loop *loop;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct wlr_scene *scene;
+
+	struct wlr_scene_output *scene_outputs[OUTPUTS];
+	// Small rect moved on every output each frame, like a cursor
+	struct wlr_scene_rect *markers[OUTPUTS];
+};
+
+static double timespec_diff_msec(struct timespec *start, struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) * 1e3 +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static bool build_window(struct wlr_scene_tree *parent, int x, int y) {
+	// Translucent windows, so that every window is visible on the outputs
+	float content_color[4] = { 0.2f, 0.2f, 0.2f, 0.5f };
+	float border_color[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	int w = WINDOW_WIDTH, h = WINDOW_HEIGHT, b = BORDER;
+
+	struct wlr_scene_tree *tree = wlr_scene_tree_create(parent);
+	if (tree == NULL) {
+		return false;
+	}
+	wlr_scene_node_set_position(&tree->node, x, y);
+
+	struct wlr_box rects[] = {
+		{ b, b, w - 2 * b, h - 2 * b },
+		{ 0, 0, w, b },
+		{ 0, h - b, w, b },
+		{ 0, b, b, h - 2 * b },
+		{ w - b, b, b, h - 2 * b },
+	};
+	for (size_t i = 0; i < sizeof(rects) / sizeof(rects[0]); i++) {
+		struct wlr_scene_rect *rect = wlr_scene_rect_create(tree,
+			rects[i].width, rects[i].height, i == 0 ? content_color : border_color);
+		if (rect == NULL) {
+			return false;
+		}
+		wlr_scene_node_set_position(&rect->node, rects[i].x, rects[i].y);
+	}
+	return true;
+}
+
+static bool bench_init(struct bench *bench) {
+	bench->loop = wl_event_loop_create();
+	if (bench->loop == NULL) {
+		return false;
+	}
+	bench->backend = wlr_headless_backend_create(bench->loop);
+	bench->renderer = wlr_pixman_renderer_create();
+	if (bench->backend == NULL || bench->renderer == NULL) {
+		return false;
+	}
+	bench->allocator = wlr_allocator_autocreate(bench->backend, bench->renderer);
+	if (bench->allocator == NULL || !wlr_backend_start(bench->backend)) {
+		return false;
+	}
+
+	bench->scene = wlr_scene_create();
+	if (bench->scene == NULL) {
+		return false;
+	}
+
+	for (int i = 0; i < WINDOWS; i++) {
+		int x = i * 61 % (OUTPUTS * OUTPUT_WIDTH - WINDOW_WIDTH);
+		int y = i * 37 % (OUTPUT_HEIGHT - WINDOW_HEIGHT);
+		if (!build_window(&bench->scene->tree, x, y)) {
+			fprintf(stderr, "build_window failed\n");
+			return false;
+		}
+	}
+
+	for (int i = 0; i < OUTPUTS; i++) {
+		struct wlr_output *output = wlr_headless_add_output(bench->backend,
+			OUTPUT_WIDTH, OUTPUT_HEIGHT);
+		if (output == NULL || !wlr_output_init_render(output,
+				bench->allocator, bench->renderer)) {
+			return false;
+		}
+
+		struct wlr_output_state state;
+		wlr_output_state_init(&state);
+		wlr_output_state_set_enabled(&state, true);
+		bool ok = wlr_output_commit_state(output, &state);
+		wlr_output_state_finish(&state);
+		if (!ok) {
+			return false;
+		}
+
+		bench->scene_outputs[i] = wlr_scene_output_create(bench->scene, output);
+		if (bench->scene_outputs[i] == NULL) {
+			return false;
+		}
+		wlr_scene_output_set_position(bench->scene_outputs[i], i * OUTPUT_WIDTH, 0);
+
+		float color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		bench->markers[i] = wlr_scene_rect_create(&bench->scene->tree, 24, 24, color);
+		if (bench->markers[i] == NULL) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void bench_finish(struct bench *bench) {
+	if (bench->scene != NULL) {
+		wlr_scene_node_destroy(&bench->scene->tree.node);
+	}
+	if (bench->backend != NULL) {
+		wlr_backend_destroy(bench->backend);
+	}
+	if (bench->allocator != NULL) {
+		wlr_allocator_destroy(bench->allocator);
+	}
+	if (bench->renderer != NULL) {
+		wlr_renderer_destroy(bench->renderer);
+	}
+	if (bench->loop != NULL) {
+		wl_event_loop_destroy(bench->loop);
+	}
+}
+
+static bool bench_frames(struct bench *bench, const char *name, bool concurrent) {
+	struct wlr_output_state states[OUTPUTS];
+	struct wlr_scene_output_build_job jobs[OUTPUTS];
+
+	double elapsed = 0;
+	bool ok = true;
+	for (int frame = 0; frame < FRAMES && ok; frame++) {
+		for (int i = 0; i < OUTPUTS; i++) {
+			wlr_scene_node_set_position(&bench->markers[i]->node,
+				i * OUTPUT_WIDTH + 100 + frame % 64 * 8, 100 + frame % 32 * 8);
+			wlr_output_state_init(&states[i]);
+			jobs[i] = (struct wlr_scene_output_build_job){
+				.scene_output = bench->scene_outputs[i],
+				.state = &states[i],
+			};
+		}
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (concurrent) {
+			ok = wlr_scene_build_output_states(bench->scene, jobs, OUTPUTS);
+		} else {
+			for (int i = 0; i < OUTPUTS; i++) {
+				ok = wlr_scene_output_build_state(bench->scene_outputs[i],
+					&states[i], NULL) && ok;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed += timespec_diff_msec(&start, &end);
+
+		for (int i = 0; i < OUTPUTS; i++) {
+			if (ok) {
+				ok = wlr_output_commit_state(bench->scene_outputs[i]->output, &states[i]);
+			}
+			wlr_output_state_finish(&states[i]);
+		}
+	}
+
+	if (!ok) {
+		fprintf(stderr, "%s: failed to build output states\n", name);
+		return false;
+	}
+	printf("%-12s %d outputs, %.3f ms/frame\n", name, OUTPUTS, elapsed / FRAMES);
+	return true;
+}
+
+int main(void) {
+	// Scene threads are set up when the scene is created
+	if (getenv("WLR_SCENE_THREADS") == NULL) {
+		setenv("WLR_SCENE_THREADS", "0", 1);
+	}
+
+	struct bench bench = {0};
+	bool ok = bench_init(&bench);
+	if (!ok) {
+		fprintf(stderr, "failed to set up outputs\n");
+		bench_finish(&bench);
+		return 99;
+	}
+
+	ok = bench_frames(&bench, "serial", false) &&
+		bench_frames(&bench, "concurrent", true);
+
+	bench_finish(&bench);
+	return ok ? 0 : 1;
+}
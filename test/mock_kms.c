@@ -0,0 +1,2017 @@
+#undef _POSIX_C_SOURCE
+#define _GNU_SOURCE // for RTLD_NEXT and memfd_create()
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wlr/backend/drm.h>
+#include <wlr/backend/session.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/dmabuf.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "mock_kms.h"
+
+#define CURSOR_SIZE 64
+#define GAMMA_SIZE 256
+#define MAX_FB_SIZE 16384
+
+enum mock_prop {
+	PROP_ACTIVE,
+	PROP_CRTC_H,
+	PROP_CRTC_ID,
+	PROP_CRTC_W,
+	PROP_CRTC_X,
+	PROP_CRTC_Y,
+	PROP_DPMS,
+	PROP_EDID,
+	PROP_FB_DAMAGE_CLIPS,
+	PROP_FB_ID,
+	PROP_GAMMA_LUT,
+	PROP_GAMMA_LUT_SIZE,
+	PROP_IN_FORMATS,
+	PROP_LINK_STATUS,
+	PROP_MODE_ID,
+	PROP_NON_DESKTOP,
+	PROP_SRC_H,
+	PROP_SRC_W,
+	PROP_SRC_X,
+	PROP_SRC_Y,
+	PROP_TYPE,
+	PROP_VRR_CAPABLE,
+	PROP_VRR_ENABLED,
+	PROP_ZPOS,
+	PROP_COUNT,
+};
+
+// Property object IDs come before all other object IDs
+#define PROP_ID(prop) ((uint32_t)(prop) + 1)
+#define PROP_BIT(prop) (1u << (prop))
+
+struct prop_info {
+	const char *name;
+	uint32_t flags;
+	uint64_t values[2]; // range bounds, or object type
+	const struct drm_mode_property_enum *enums;
+	size_t enums_len;
+};
+
+static const struct drm_mode_property_enum dpms_enums[] = {
+	{ DRM_MODE_DPMS_ON, "On" },
+	{ DRM_MODE_DPMS_STANDBY, "Standby" },
+	{ DRM_MODE_DPMS_SUSPEND, "Suspend" },
+	{ DRM_MODE_DPMS_OFF, "Off" },
+};
+
+static const struct drm_mode_property_enum link_status_enums[] = {
+	{ DRM_MODE_LINK_STATUS_GOOD, "Good" },
+	{ DRM_MODE_LINK_STATUS_BAD, "Bad" },
+};
+
+static const struct drm_mode_property_enum plane_type_enums[] = {
+	{ DRM_PLANE_TYPE_OVERLAY, "Overlay" },
+	{ DRM_PLANE_TYPE_PRIMARY, "Primary" },
+	{ DRM_PLANE_TYPE_CURSOR, "Cursor" },
+};
+
+#define ENUMS(enums) enums, sizeof(enums) / sizeof(enums[0])
+#define RANGE DRM_MODE_PROP_RANGE
+#define ATOMIC DRM_MODE_PROP_ATOMIC
+#define IMMUTABLE DRM_MODE_PROP_IMMUTABLE
+
+static const struct prop_info props[PROP_COUNT] = {
+	[PROP_ACTIVE] = { "ACTIVE", RANGE | ATOMIC, { 0, 1 } },
+	[PROP_CRTC_H] = { "CRTC_H", RANGE | ATOMIC, { 0, INT32_MAX } },
+	[PROP_CRTC_ID] = { "CRTC_ID", DRM_MODE_PROP_OBJECT | ATOMIC, { DRM_MODE_OBJECT_CRTC } },
+	[PROP_CRTC_W] = { "CRTC_W", RANGE | ATOMIC, { 0, INT32_MAX } },
+	[PROP_CRTC_X] = { "CRTC_X", DRM_MODE_PROP_SIGNED_RANGE | ATOMIC,
+		{ (uint64_t)(int64_t)INT32_MIN, INT32_MAX } },
+	[PROP_CRTC_Y] = { "CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE | ATOMIC,
+		{ (uint64_t)(int64_t)INT32_MIN, INT32_MAX } },
+	[PROP_DPMS] = { "DPMS", DRM_MODE_PROP_ENUM, { 0 }, ENUMS(dpms_enums) },
+	[PROP_EDID] = { "EDID", DRM_MODE_PROP_BLOB | IMMUTABLE },
+	[PROP_FB_DAMAGE_CLIPS] = { "FB_DAMAGE_CLIPS", DRM_MODE_PROP_BLOB | ATOMIC },
+	[PROP_FB_ID] = { "FB_ID", DRM_MODE_PROP_OBJECT | ATOMIC, { DRM_MODE_OBJECT_FB } },
+	[PROP_GAMMA_LUT] = { "GAMMA_LUT", DRM_MODE_PROP_BLOB },
+	[PROP_GAMMA_LUT_SIZE] = { "GAMMA_LUT_SIZE", RANGE | IMMUTABLE, { 0, UINT32_MAX } },
+	[PROP_IN_FORMATS] = { "IN_FORMATS", DRM_MODE_PROP_BLOB | IMMUTABLE },
+	[PROP_LINK_STATUS] = { "link-status", DRM_MODE_PROP_ENUM, { 0 }, ENUMS(link_status_enums) },
+	[PROP_MODE_ID] = { "MODE_ID", DRM_MODE_PROP_BLOB | ATOMIC },
+	[PROP_NON_DESKTOP] = { "non-desktop", RANGE | IMMUTABLE, { 0, 1 } },
+	[PROP_SRC_H] = { "SRC_H", RANGE | ATOMIC, { 0, UINT32_MAX } },
+	[PROP_SRC_W] = { "SRC_W", RANGE | ATOMIC, { 0, UINT32_MAX } },
+	[PROP_SRC_X] = { "SRC_X", RANGE | ATOMIC, { 0, UINT32_MAX } },
+	[PROP_SRC_Y] = { "SRC_Y", RANGE | ATOMIC, { 0, UINT32_MAX } },
+	[PROP_TYPE] = { "type", DRM_MODE_PROP_ENUM | IMMUTABLE, { 0 }, ENUMS(plane_type_enums) },
+	[PROP_VRR_CAPABLE] = { "vrr_capable", RANGE | IMMUTABLE, { 0, 1 } },
+	[PROP_VRR_ENABLED] = { "VRR_ENABLED", RANGE, { 0, 1 } },
+	[PROP_ZPOS] = { "zpos", RANGE, { 0, 255 } },
+};
+
+#undef RANGE
+#undef ATOMIC
+#undef IMMUTABLE
+#undef ENUMS
+
+static const uint32_t crtc_props = PROP_BIT(PROP_ACTIVE) | PROP_BIT(PROP_MODE_ID) |
+	PROP_BIT(PROP_GAMMA_LUT) | PROP_BIT(PROP_GAMMA_LUT_SIZE) |
+	PROP_BIT(PROP_VRR_ENABLED);
+static const uint32_t connector_props = PROP_BIT(PROP_CRTC_ID) | PROP_BIT(PROP_DPMS) |
+	PROP_BIT(PROP_EDID) | PROP_BIT(PROP_LINK_STATUS) | PROP_BIT(PROP_NON_DESKTOP) |
+	PROP_BIT(PROP_VRR_CAPABLE);
+static const uint32_t plane_props = PROP_BIT(PROP_TYPE) | PROP_BIT(PROP_FB_ID) |
+	PROP_BIT(PROP_CRTC_ID) | PROP_BIT(PROP_SRC_X) | PROP_BIT(PROP_SRC_Y) |
+	PROP_BIT(PROP_SRC_W) | PROP_BIT(PROP_SRC_H) | PROP_BIT(PROP_CRTC_X) |
+	PROP_BIT(PROP_CRTC_Y) | PROP_BIT(PROP_CRTC_W) | PROP_BIT(PROP_CRTC_H) |
+	PROP_BIT(PROP_FB_DAMAGE_CLIPS) | PROP_BIT(PROP_ZPOS);
+
+static const uint32_t default_formats[] = { DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888 };
+static const uint32_t cursor_formats[] = { DRM_FORMAT_ARGB8888 };
+
+static const struct mock_kms_connector_options default_connector = {
+	.connected = true,
+	.width = 1920,
+	.height = 1080,
+	.refresh = 60000,
+};
+
+struct mock_object {
+	uint32_t id;
+	uint32_t type;
+	uint32_t props; // bitmask of enum mock_prop
+	uint64_t values[PROP_COUNT];
+	// State of the commit being checked
+	uint64_t pending[PROP_COUNT];
+};
+
+struct mock_crtc {
+	struct mock_object base;
+	size_t index;
+
+	int64_t period; // ns, 0 when inactive
+	int64_t vblank_base; // ns, timestamp of a vblank
+	uint32_t seq;
+
+	bool flip_pending;
+	uint64_t flip_user_data;
+	int64_t flip_deadline; // ns
+};
+
+struct mock_connector {
+	struct mock_object base;
+	uint32_t encoder_id;
+	uint32_t type_id;
+	bool connected;
+	struct drm_mode_modeinfo mode;
+};
+
+struct mock_plane {
+	struct mock_object base;
+	uint32_t type;
+	uint32_t possible_crtcs;
+	const uint32_t *formats;
+	size_t formats_len;
+};
+
+struct mock_blob {
+	uint32_t id;
+	int n_refs;
+	bool user; // not destroyed by user-space yet
+	struct wl_list link; // mock_kms.blobs
+	size_t length;
+	uint8_t data[];
+};
+
+struct mock_fb {
+	uint32_t id;
+	int n_refs;
+	bool user;
+	struct wl_list link; // mock_kms.fbs
+	uint32_t width, height, format;
+	uint64_t modifier; // DRM_FORMAT_MOD_INVALID if implicit
+	dev_t bo_dev;
+	ino_t bo_ino;
+};
+
+struct mock_bo {
+	uint32_t handle;
+	struct wl_list link; // mock_kms.bos
+	dev_t dev;
+	ino_t ino;
+};
+
+struct mock_kms {
+	struct mock_kms_options options;
+	struct mock_kms_stats stats;
+	struct wl_list link; // devices
+
+	struct wl_event_loop *loop;
+	int fd; // our end of the socket, page-flip events are written to it
+	int client_fd;
+	dev_t client_dev;
+	ino_t client_ino;
+	int timer_fd;
+	struct wl_event_source *timer;
+
+	uint32_t next_id;
+	uint32_t next_handle;
+	bool atomic;
+
+	struct mock_crtc *crtcs;
+	size_t crtcs_len;
+	struct mock_connector *connectors;
+	size_t connectors_len;
+	struct mock_plane *planes;
+	size_t planes_len;
+
+	uint32_t *formats;
+	size_t formats_len;
+	uint64_t *modifiers;
+	size_t modifiers_len;
+
+	struct wl_list blobs; // mock_blob.link
+	struct wl_list fbs; // mock_fb.link
+	struct wl_list bos; // mock_bo.link
+
+	struct wlr_session *session;
+	struct wlr_device *device;
+	struct wlr_backend *backend;
+	struct wl_listener backend_destroy;
+};
+
+static struct wl_list devices = { &devices, &devices };
+
+static int64_t get_time_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static struct mock_kms *kms_from_fd(int fd) {
+	if (wl_list_empty(&devices)) {
+		return NULL;
+	}
+
+	// The backend may duplicate its FD, so match the socket itself
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return NULL;
+	}
+	struct mock_kms *kms;
+	wl_list_for_each(kms, &devices, link) {
+		if (st.st_dev == kms->client_dev && st.st_ino == kms->client_ino) {
+			return kms;
+		}
+	}
+	return NULL;
+}
+
+static struct mock_blob *blob_create(struct mock_kms *kms,
+		const void *data, size_t length) {
+	struct mock_blob *blob = calloc(1, sizeof(*blob) + length);
+	if (blob == NULL) {
+		return NULL;
+	}
+	blob->id = kms->next_id++;
+	blob->n_refs = 1;
+	blob->length = length;
+	memcpy(blob->data, data, length);
+	wl_list_insert(&kms->blobs, &blob->link);
+	return blob;
+}
+
+static struct mock_blob *blob_lookup(struct mock_kms *kms, uint64_t id) {
+	struct mock_blob *blob;
+	wl_list_for_each(blob, &kms->blobs, link) {
+		if (blob->id == id) {
+			return blob;
+		}
+	}
+	return NULL;
+}
+
+static void blob_unref(struct mock_blob *blob) {
+	if (blob == NULL || --blob->n_refs > 0) {
+		return;
+	}
+	wl_list_remove(&blob->link);
+	free(blob);
+}
+
+static struct mock_fb *fb_lookup(struct mock_kms *kms, uint64_t id) {
+	struct mock_fb *fb;
+	wl_list_for_each(fb, &kms->fbs, link) {
+		if (fb->id == id) {
+			return fb;
+		}
+	}
+	return NULL;
+}
+
+static void fb_unref(struct mock_fb *fb) {
+	if (fb == NULL || --fb->n_refs > 0) {
+		return;
+	}
+	wl_list_remove(&fb->link);
+	free(fb);
+}
+
+static struct mock_bo *bo_lookup(struct mock_kms *kms, uint32_t handle) {
+	struct mock_bo *bo;
+	wl_list_for_each(bo, &kms->bos, link) {
+		if (bo->handle == handle) {
+			return bo;
+		}
+	}
+	return NULL;
+}
+
+static struct mock_bo *bo_import(struct mock_kms *kms, dev_t dev, ino_t ino) {
+	// Importing the same buffer twice yields the same handle
+	struct mock_bo *bo;
+	wl_list_for_each(bo, &kms->bos, link) {
+		if (bo->dev == dev && bo->ino == ino) {
+			return bo;
+		}
+	}
+
+	bo = calloc(1, sizeof(*bo));
+	if (bo == NULL) {
+		return NULL;
+	}
+	bo->handle = kms->next_handle++;
+	bo->dev = dev;
+	bo->ino = ino;
+	wl_list_insert(&kms->bos, &bo->link);
+	return bo;
+}
+
+static struct mock_crtc *crtc_lookup(struct mock_kms *kms, uint64_t id) {
+	for (size_t i = 0; i < kms->crtcs_len; i++) {
+		if (kms->crtcs[i].base.id == id) {
+			return &kms->crtcs[i];
+		}
+	}
+	return NULL;
+}
+
+static struct mock_connector *connector_lookup(struct mock_kms *kms, uint64_t id) {
+	for (size_t i = 0; i < kms->connectors_len; i++) {
+		if (kms->connectors[i].base.id == id) {
+			return &kms->connectors[i];
+		}
+	}
+	return NULL;
+}
+
+static struct mock_plane *plane_lookup(struct mock_kms *kms, uint64_t id) {
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		if (kms->planes[i].base.id == id) {
+			return &kms->planes[i];
+		}
+	}
+	return NULL;
+}
+
+static struct mock_object *object_lookup(struct mock_kms *kms, uint64_t id) {
+	struct mock_crtc *crtc = crtc_lookup(kms, id);
+	if (crtc != NULL) {
+		return &crtc->base;
+	}
+	struct mock_connector *conn = connector_lookup(kms, id);
+	if (conn != NULL) {
+		return &conn->base;
+	}
+	struct mock_plane *plane = plane_lookup(kms, id);
+	if (plane != NULL) {
+		return &plane->base;
+	}
+	return NULL;
+}
+
+static struct mock_plane *crtc_get_primary(struct mock_kms *kms,
+		struct mock_crtc *crtc) {
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		struct mock_plane *plane = &kms->planes[i];
+		if (plane->type == DRM_PLANE_TYPE_PRIMARY &&
+				(plane->possible_crtcs & (1u << crtc->index))) {
+			return plane;
+		}
+	}
+	abort(); // unreachable
+}
+
+// Bitmask of the CRTCs an object is bound to in the given state
+static uint32_t object_get_crtcs(struct mock_kms *kms,
+		const struct mock_object *obj, const uint64_t values[static PROP_COUNT]) {
+	struct mock_crtc *crtc;
+	if (obj->type == DRM_MODE_OBJECT_CRTC) {
+		crtc = wl_container_of(obj, crtc, base);
+	} else {
+		crtc = crtc_lookup(kms, values[PROP_CRTC_ID]);
+	}
+	return crtc != NULL ? 1u << crtc->index : 0;
+}
+
+static bool plane_supports(const struct mock_kms *kms, const struct mock_plane *plane,
+		uint32_t format, uint64_t modifier) {
+	bool has_format = false;
+	for (size_t i = 0; i < plane->formats_len; i++) {
+		if (plane->formats[i] == format) {
+			has_format = true;
+			break;
+		}
+	}
+	if (!has_format) {
+		return false;
+	}
+
+	if (modifier == DRM_FORMAT_MOD_INVALID) {
+		return true;
+	} else if (plane->type == DRM_PLANE_TYPE_CURSOR) {
+		return modifier == DRM_FORMAT_MOD_LINEAR;
+	}
+	for (size_t i = 0; i < kms->modifiers_len; i++) {
+		if (kms->modifiers[i] == modifier) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void crtc_send_flip(struct mock_kms *kms, struct mock_crtc *crtc,
+		int64_t time) {
+	assert(crtc->flip_pending);
+	crtc->flip_pending = false;
+
+	struct drm_event_vblank event = {
+		.base = {
+			.type = DRM_EVENT_FLIP_COMPLETE,
+			.length = sizeof(event),
+		},
+		.user_data = crtc->flip_user_data,
+		.tv_sec = time / 1000000000,
+		.tv_usec = time % 1000000000 / 1000,
+		.sequence = crtc->seq,
+		.crtc_id = crtc->base.id,
+	};
+	if (write(kms->fd, &event, sizeof(event)) != sizeof(event)) {
+		perror("mock_kms: failed to write page-flip event");
+		return;
+	}
+	kms->stats.page_flips++;
+}
+
+static void kms_update_timer(struct mock_kms *kms) {
+	int64_t deadline = 0;
+	for (size_t i = 0; i < kms->crtcs_len; i++) {
+		struct mock_crtc *crtc = &kms->crtcs[i];
+		if (crtc->flip_pending && (deadline == 0 || crtc->flip_deadline < deadline)) {
+			deadline = crtc->flip_deadline;
+		}
+	}
+
+	// A zero it_value disarms the timer
+	struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = deadline / 1000000000,
+			.tv_nsec = deadline % 1000000000,
+		},
+	};
+	timerfd_settime(kms->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void crtc_complete_flip(struct mock_kms *kms, struct mock_crtc *crtc) {
+	// Count the vblanks since the last modeset
+	crtc->seq = (crtc->flip_deadline - crtc->vblank_base) / crtc->period;
+	crtc_send_flip(kms, crtc, crtc->flip_deadline);
+}
+
+static int handle_timer(int fd, uint32_t mask, void *data) {
+	struct mock_kms *kms = data;
+
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+		perror("mock_kms: failed to read timer");
+		return 0;
+	}
+
+	int64_t now = get_time_ns();
+	for (size_t i = 0; i < kms->crtcs_len; i++) {
+		struct mock_crtc *crtc = &kms->crtcs[i];
+		if (crtc->flip_pending && crtc->flip_deadline <= now) {
+			crtc_complete_flip(kms, crtc);
+		}
+	}
+	kms_update_timer(kms);
+	return 0;
+}
+
+static void crtc_queue_flip(struct mock_kms *kms, struct mock_crtc *crtc,
+		uint64_t user_data) {
+	assert(!crtc->flip_pending);
+	crtc->flip_pending = true;
+	crtc->flip_user_data = user_data;
+
+	int64_t now = get_time_ns();
+	if (kms->timer == NULL || crtc->period == 0) {
+		crtc->seq++;
+		crtc_send_flip(kms, crtc, now);
+		return;
+	}
+
+	// Complete on the next vblank
+	int64_t vblanks = (now - crtc->vblank_base) / crtc->period + 1;
+	crtc->flip_deadline = crtc->vblank_base + vblanks * crtc->period;
+	kms_update_timer(kms);
+}
+
+static void crtc_flush_flip(struct mock_kms *kms, struct mock_crtc *crtc) {
+	// Only pending with simulated vblanks: complete it early rather than
+	// blocking until the deadline
+	if (crtc->flip_pending) {
+		crtc_complete_flip(kms, crtc);
+		kms_update_timer(kms);
+	}
+}
+
+static void kms_begin_state(struct mock_kms *kms) {
+	for (size_t i = 0; i < kms->crtcs_len; i++) {
+		struct mock_object *obj = &kms->crtcs[i].base;
+		memcpy(obj->pending, obj->values, sizeof(obj->values));
+	}
+	for (size_t i = 0; i < kms->connectors_len; i++) {
+		struct mock_object *obj = &kms->connectors[i].base;
+		memcpy(obj->pending, obj->values, sizeof(obj->values));
+	}
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		struct mock_object *obj = &kms->planes[i].base;
+		memcpy(obj->pending, obj->values, sizeof(obj->values));
+	}
+}
+
+static int kms_set_prop(struct mock_kms *kms, struct mock_object *obj,
+		uint32_t prop_id, uint64_t value) {
+	if (prop_id < PROP_ID(0) || prop_id >= PROP_ID(PROP_COUNT)) {
+		return -ENOENT;
+	}
+	enum mock_prop prop = prop_id - PROP_ID(0);
+	if (!(obj->props & PROP_BIT(prop))) {
+		return -ENOENT;
+	}
+
+	const struct prop_info *info = &props[prop];
+	if (info->flags & DRM_MODE_PROP_IMMUTABLE) {
+		return -EINVAL;
+	}
+
+	if (info->flags & DRM_MODE_PROP_RANGE) {
+		if (value < info->values[0] || value > info->values[1]) {
+			return -EINVAL;
+		}
+	} else if (info->flags & DRM_MODE_PROP_SIGNED_RANGE) {
+		if ((int64_t)value < (int64_t)info->values[0] ||
+				(int64_t)value > (int64_t)info->values[1]) {
+			return -EINVAL;
+		}
+	} else if (info->flags & DRM_MODE_PROP_ENUM) {
+		bool found = false;
+		for (size_t i = 0; i < info->enums_len; i++) {
+			found = found || info->enums[i].value == value;
+		}
+		if (!found) {
+			return -EINVAL;
+		}
+	} else if (info->flags & DRM_MODE_PROP_BLOB) {
+		if (value != 0 && blob_lookup(kms, value) == NULL) {
+			return -EINVAL;
+		}
+	} else if (info->flags & DRM_MODE_PROP_OBJECT) {
+		bool found = value == 0 ||
+			(info->values[0] == DRM_MODE_OBJECT_FB && fb_lookup(kms, value) != NULL) ||
+			(info->values[0] == DRM_MODE_OBJECT_CRTC && crtc_lookup(kms, value) != NULL);
+		if (!found) {
+			return -ENOENT;
+		}
+	}
+
+	obj->pending[prop] = value;
+	return 0;
+}
+
+static bool mode_blob_equal(struct mock_blob *a, struct mock_blob *b) {
+	if (a == NULL || b == NULL) {
+		return a == b;
+	}
+	return a->length == b->length && memcmp(a->data, b->data, a->length) == 0;
+}
+
+/**
+ * Check the pending state, like a driver's atomic_check would. Sets modeset
+ * if the pending state requires a modeset.
+ */
+static int kms_check_state(struct mock_kms *kms, uint32_t *crtcs, bool *modeset) {
+	size_t active_planes[kms->crtcs_len];
+	memset(active_planes, 0, sizeof(active_planes));
+
+	*modeset = false;
+	for (size_t i = 0; i < kms->connectors_len; i++) {
+		struct mock_object *obj = &kms->connectors[i].base;
+		if (obj->pending[PROP_CRTC_ID] != obj->values[PROP_CRTC_ID]) {
+			*crtcs |= object_get_crtcs(kms, obj, obj->values) |
+				object_get_crtcs(kms, obj, obj->pending);
+			*modeset = true;
+		}
+	}
+
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		struct mock_plane *plane = &kms->planes[i];
+		const uint64_t *state = plane->base.pending;
+		if (memcmp(plane->base.pending, plane->base.values, sizeof(plane->base.values)) != 0) {
+			*crtcs |= object_get_crtcs(kms, &plane->base, plane->base.values) |
+				object_get_crtcs(kms, &plane->base, plane->base.pending);
+		}
+
+		if (state[PROP_FB_ID] == 0 && state[PROP_CRTC_ID] == 0) {
+			continue;
+		} else if (state[PROP_FB_ID] == 0 || state[PROP_CRTC_ID] == 0) {
+			return -EINVAL;
+		}
+
+		struct mock_crtc *crtc = crtc_lookup(kms, state[PROP_CRTC_ID]);
+		if (!(plane->possible_crtcs & (1u << crtc->index)) ||
+				!crtc->base.pending[PROP_ACTIVE]) {
+			return -EINVAL;
+		}
+		active_planes[crtc->index]++;
+
+		struct mock_fb *fb = fb_lookup(kms, state[PROP_FB_ID]);
+		if (!plane_supports(kms, plane, fb->format, fb->modifier)) {
+			return -EINVAL;
+		}
+
+		uint64_t src_x = state[PROP_SRC_X], src_y = state[PROP_SRC_Y];
+		uint64_t src_w = state[PROP_SRC_W], src_h = state[PROP_SRC_H];
+		if (src_w == 0 || src_h == 0 || state[PROP_CRTC_W] == 0 ||
+				state[PROP_CRTC_H] == 0) {
+			return -EINVAL;
+		}
+		if (src_x + src_w > (uint64_t)fb->width << 16 ||
+				src_y + src_h > (uint64_t)fb->height << 16) {
+			return -ENOSPC;
+		}
+
+		if (plane->type == DRM_PLANE_TYPE_CURSOR) {
+			if (state[PROP_CRTC_W] > CURSOR_SIZE || state[PROP_CRTC_H] > CURSOR_SIZE ||
+					src_w >> 16 != state[PROP_CRTC_W] ||
+					src_h >> 16 != state[PROP_CRTC_H]) {
+				return -EINVAL;
+			}
+		}
+
+		if (state[PROP_FB_DAMAGE_CLIPS] != 0) {
+			struct mock_blob *clips = blob_lookup(kms, state[PROP_FB_DAMAGE_CLIPS]);
+			if (clips->length % sizeof(struct drm_mode_rect) != 0) {
+				return -EINVAL;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < kms->crtcs_len; i++) {
+		struct mock_crtc *crtc = &kms->crtcs[i];
+		const uint64_t *state = crtc->base.pending;
+		if (memcmp(crtc->base.pending, crtc->base.values, sizeof(crtc->base.values)) != 0) {
+			*crtcs |= 1u << crtc->index;
+		}
+
+		struct mock_blob *mode = blob_lookup(kms, state[PROP_MODE_ID]);
+		struct mock_blob *current_mode = blob_lookup(kms, crtc->base.values[PROP_MODE_ID]);
+		if (state[PROP_ACTIVE] != crtc->base.values[PROP_ACTIVE] ||
+				!mode_blob_equal(mode, current_mode)) {
+			*modeset = true;
+		}
+
+		if (mode != NULL && mode->length != sizeof(struct drm_mode_modeinfo)) {
+			return -EINVAL;
+		}
+		if (state[PROP_GAMMA_LUT] != 0) {
+			struct mock_blob *lut = blob_lookup(kms, state[PROP_GAMMA_LUT]);
+			if (lut->length % sizeof(struct drm_color_lut) != 0 ||
+					lut->length / sizeof(struct drm_color_lut) > GAMMA_SIZE) {
+				return -EINVAL;
+			}
+		}
+
+		if (!state[PROP_ACTIVE]) {
+			continue;
+		}
+		if (mode == NULL) {
+			return -EINVAL;
+		}
+
+		bool has_connector = false;
+		for (size_t j = 0; j < kms->connectors_len; j++) {
+			has_connector = has_connector ||
+				kms->connectors[j].base.pending[PROP_CRTC_ID] == crtc->base.id;
+		}
+		if (!has_connector) {
+			return -EINVAL;
+		}
+
+		if (kms->options.max_active_planes != 0 &&
+				active_planes[i] > kms->options.max_active_planes) {
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void object_apply_state(struct mock_kms *kms, struct mock_object *obj) {
+	// The state holds a reference to the framebuffers and blobs it uses
+	static const enum mock_prop ref_props[] = {
+		PROP_FB_ID, PROP_MODE_ID, PROP_GAMMA_LUT, PROP_FB_DAMAGE_CLIPS,
+	};
+	for (size_t i = 0; i < sizeof(ref_props) / sizeof(ref_props[0]); i++) {
+		enum mock_prop prop = ref_props[i];
+		if (!(obj->props & PROP_BIT(prop)) || obj->pending[prop] == obj->values[prop]) {
+			continue;
+		}
+		if (prop == PROP_FB_ID) {
+			struct mock_fb *fb = fb_lookup(kms, obj->pending[prop]);
+			if (fb != NULL) {
+				fb->n_refs++;
+			}
+			fb_unref(fb_lookup(kms, obj->values[prop]));
+		} else {
+			struct mock_blob *blob = blob_lookup(kms, obj->pending[prop]);
+			if (blob != NULL) {
+				blob->n_refs++;
+			}
+			blob_unref(blob_lookup(kms, obj->values[prop]));
+		}
+	}
+
+	memcpy(obj->values, obj->pending, sizeof(obj->values));
+}
+
+/**
+ * Check the pending state, and apply it unless flags contains
+ * DRM_MODE_ATOMIC_TEST_ONLY. crtcs is the bitmask of the CRTCs explicitly
+ * part of the commit.
+ */
+static int kms_commit_state(struct mock_kms *kms, uint32_t flags, uint32_t crtcs,
+		uint64_t user_data) {
+	bool modeset;
+	int ret = kms_check_state(kms, &crtcs, &modeset);
+	if (ret == 0 && modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+		ret = -EINVAL;
+	}
+
+	// Events can't be requested for CRTCs being turned off
+	for (size_t i = 0; i < kms->crtcs_len && ret == 0; i++) {
+		struct mock_crtc *crtc = &kms->crtcs[i];
+		if ((flags & DRM_MODE_PAGE_FLIP_EVENT) && (crtcs & (1u << i)) &&
+				!crtc->base.pending[PROP_ACTIVE]) {
+			ret = -EINVAL;
+		}
+		if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY) && (flags & DRM_MODE_ATOMIC_NONBLOCK) &&
+				(crtcs & (1u << i)) && crtc->flip_pending) {
+			ret = -EBUSY;
+		}
+	}
+
+	if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+		kms->stats.test_commits++;
+		if (ret != 0) {
+			kms->stats.failed_test_commits++;
+		}
+		return ret;
+	} else if (ret != 0) {
+		kms->stats.failed_commits++;
+		return ret;
+	}
+
+	for (size_t i = 0; i < kms->connectors_len; i++) {
+		object_apply_state(kms, &kms->connectors[i].base);
+	}
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		object_apply_state(kms, &kms->planes[i].base);
+	}
+	for (size_t i = 0; i < kms->crtcs_len; i++) {
+		struct mock_crtc *crtc = &kms->crtcs[i];
+		if (!(crtcs & (1u << i))) {
+			object_apply_state(kms, &crtc->base);
+			continue;
+		}
+
+		// Blocking commits wait for the previous page-flip to complete
+		crtc_flush_flip(kms, crtc);
+
+		struct mock_blob *mode = blob_lookup(kms, crtc->base.pending[PROP_MODE_ID]);
+		struct mock_blob *current_mode = blob_lookup(kms, crtc->base.values[PROP_MODE_ID]);
+		bool was_active = crtc->base.values[PROP_ACTIVE];
+		object_apply_state(kms, &crtc->base);
+
+		if (!crtc->base.values[PROP_ACTIVE]) {
+			crtc->period = 0;
+		} else if (!was_active || !mode_blob_equal(mode, current_mode)) {
+			const struct drm_mode_modeinfo *info = (const void *)mode->data;
+			crtc->period = (int64_t)info->htotal * info->vtotal * 1000000 / info->clock;
+			crtc->vblank_base = get_time_ns();
+		}
+
+		if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
+			crtc_queue_flip(kms, crtc, user_data);
+		}
+	}
+
+	kms->stats.commits++;
+	if (modeset) {
+		kms->stats.modesets++;
+	}
+	return 0;
+}
+
+// Mimics the kernel: arrays are only filled if user-space made enough room
+static void copy_array(uint64_t ptr, uint32_t *count, const void *data,
+		size_t len, size_t elem_size) {
+	if (ptr != 0 && *count >= len && len > 0) {
+		memcpy((void *)(uintptr_t)ptr, data, len * elem_size);
+	}
+	*count = len;
+}
+
+static size_t object_get_props(const struct mock_object *obj,
+		uint32_t ids[static PROP_COUNT], uint64_t values[static PROP_COUNT]) {
+	size_t len = 0;
+	for (enum mock_prop prop = 0; prop < PROP_COUNT; prop++) {
+		if (obj->props & PROP_BIT(prop)) {
+			ids[len] = PROP_ID(prop);
+			values[len] = obj->values[prop];
+			len++;
+		}
+	}
+	return len;
+}
+
+static int handle_version(struct mock_kms *kms, struct drm_version *version) {
+	static const char *const strings[] = { "mock", "20250101", "Mock KMS device" };
+	size_t *lens[] = { &version->name_len, &version->date_len, &version->desc_len };
+	char *bufs[] = { version->name, version->date, version->desc };
+	for (size_t i = 0; i < 3; i++) {
+		size_t len = strlen(strings[i]);
+		if (bufs[i] != NULL && *lens[i] > 0) {
+			memcpy(bufs[i], strings[i], *lens[i] < len ? *lens[i] : len);
+		}
+		*lens[i] = len;
+	}
+	version->version_major = 1;
+	version->version_minor = 0;
+	version->version_patchlevel = 0;
+	return 0;
+}
+
+static int handle_get_cap(struct mock_kms *kms, struct drm_get_cap *cap) {
+	switch (cap->capability) {
+	case DRM_CAP_PRIME:
+		cap->value = DRM_PRIME_CAP_IMPORT | DRM_PRIME_CAP_EXPORT;
+		return 0;
+	case DRM_CAP_TIMESTAMP_MONOTONIC:
+	case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+		cap->value = 1;
+		return 0;
+	case DRM_CAP_CURSOR_WIDTH:
+	case DRM_CAP_CURSOR_HEIGHT:
+		cap->value = CURSOR_SIZE;
+		return 0;
+	case DRM_CAP_ADDFB2_MODIFIERS:
+		cap->value = kms->modifiers_len > 0;
+		return 0;
+	case DRM_CAP_DUMB_BUFFER:
+	case DRM_CAP_ASYNC_PAGE_FLIP:
+	case DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP:
+	case DRM_CAP_SYNCOBJ:
+	case DRM_CAP_SYNCOBJ_TIMELINE:
+		cap->value = 0;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static int handle_set_client_cap(struct mock_kms *kms, struct drm_set_client_cap *cap) {
+	if (cap->value > 1) {
+		return -EINVAL;
+	}
+	switch (cap->capability) {
+	case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+		return 0;
+	case DRM_CLIENT_CAP_ATOMIC:
+		if (kms->options.legacy_only) {
+			return -EOPNOTSUPP;
+		}
+		kms->atomic = cap->value;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static int handle_prime_fd_to_handle(struct mock_kms *kms, struct drm_prime_handle *args) {
+	struct stat st;
+	if (fstat(args->fd, &st) != 0) {
+		return -EBADF;
+	}
+	struct mock_bo *bo = bo_import(kms, st.st_dev, st.st_ino);
+	if (bo == NULL) {
+		return -ENOMEM;
+	}
+	args->handle = bo->handle;
+	return 0;
+}
+
+static int handle_gem_close(struct mock_kms *kms, struct drm_gem_close *args) {
+	struct mock_bo *bo = bo_lookup(kms, args->handle);
+	if (bo == NULL) {
+		return -EINVAL;
+	}
+	wl_list_remove(&bo->link);
+	free(bo);
+	return 0;
+}
+
+static int handle_get_resources(struct mock_kms *kms, struct drm_mode_card_res *res) {
+	uint32_t fb_ids[wl_list_length(&kms->fbs) + 1];
+	size_t fbs_len = 0;
+	struct mock_fb *fb;
+	wl_list_for_each(fb, &kms->fbs, link) {
+		if (fb->user) {
+			fb_ids[fbs_len++] = fb->id;
+		}
+	}
+	copy_array(res->fb_id_ptr, &res->count_fbs, fb_ids, fbs_len, sizeof(fb_ids[0]));
+
+	uint32_t crtc_ids[kms->crtcs_len];
+	for (size_t i = 0; i < kms->crtcs_len; i++) {
+		crtc_ids[i] = kms->crtcs[i].base.id;
+	}
+	copy_array(res->crtc_id_ptr, &res->count_crtcs, crtc_ids,
+		kms->crtcs_len, sizeof(crtc_ids[0]));
+
+	uint32_t conn_ids[kms->connectors_len], enc_ids[kms->connectors_len];
+	for (size_t i = 0; i < kms->connectors_len; i++) {
+		conn_ids[i] = kms->connectors[i].base.id;
+		enc_ids[i] = kms->connectors[i].encoder_id;
+	}
+	copy_array(res->connector_id_ptr, &res->count_connectors, conn_ids,
+		kms->connectors_len, sizeof(conn_ids[0]));
+	copy_array(res->encoder_id_ptr, &res->count_encoders, enc_ids,
+		kms->connectors_len, sizeof(enc_ids[0]));
+
+	res->min_width = res->min_height = 1;
+	res->max_width = res->max_height = MAX_FB_SIZE;
+	return 0;
+}
+
+static int handle_get_crtc(struct mock_kms *kms, struct drm_mode_crtc *args) {
+	struct mock_crtc *crtc = crtc_lookup(kms, args->crtc_id);
+	if (crtc == NULL) {
+		return -ENOENT;
+	}
+
+	struct mock_plane *primary = crtc_get_primary(kms, crtc);
+	args->fb_id = primary->base.values[PROP_FB_ID];
+	args->x = primary->base.values[PROP_SRC_X] >> 16;
+	args->y = primary->base.values[PROP_SRC_Y] >> 16;
+	args->gamma_size = GAMMA_SIZE;
+
+	struct mock_blob *mode = blob_lookup(kms, crtc->base.values[PROP_MODE_ID]);
+	args->mode_valid = crtc->base.values[PROP_ACTIVE] && mode != NULL;
+	if (args->mode_valid) {
+		memcpy(&args->mode, mode->data, sizeof(args->mode));
+	} else {
+		memset(&args->mode, 0, sizeof(args->mode));
+	}
+	return 0;
+}
+
+static int handle_set_crtc(struct mock_kms *kms, struct drm_mode_crtc *args) {
+	struct mock_crtc *crtc = crtc_lookup(kms, args->crtc_id);
+	if (crtc == NULL) {
+		return -ENOENT;
+	}
+	if (args->mode_valid && (args->fb_id == 0 || args->count_connectors == 0)) {
+		return -EINVAL;
+	}
+
+	kms_begin_state(kms);
+
+	struct mock_blob *mode = NULL;
+	if (args->mode_valid) {
+		mode = blob_create(kms, &args->mode, sizeof(args->mode));
+		if (mode == NULL) {
+			return -ENOMEM;
+		}
+	}
+	crtc->base.pending[PROP_ACTIVE] = args->mode_valid;
+	crtc->base.pending[PROP_MODE_ID] = mode != NULL ? mode->id : 0;
+
+	// The legacy API disables all planes of the CRTC
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		struct mock_object *obj = &kms->planes[i].base;
+		if (obj->values[PROP_CRTC_ID] == crtc->base.id) {
+			obj->pending[PROP_FB_ID] = obj->pending[PROP_CRTC_ID] = 0;
+		}
+	}
+
+	int ret = 0;
+	if (args->mode_valid) {
+		struct mock_object *primary = &crtc_get_primary(kms, crtc)->base;
+		struct drm_mode_modeinfo *info = &args->mode;
+		struct { enum mock_prop prop; uint64_t value; } plane_state[] = {
+			{ PROP_FB_ID, args->fb_id },
+			{ PROP_CRTC_ID, crtc->base.id },
+			{ PROP_SRC_X, (uint64_t)args->x << 16 },
+			{ PROP_SRC_Y, (uint64_t)args->y << 16 },
+			{ PROP_SRC_W, (uint64_t)info->hdisplay << 16 },
+			{ PROP_SRC_H, (uint64_t)info->vdisplay << 16 },
+			{ PROP_CRTC_X, 0 },
+			{ PROP_CRTC_Y, 0 },
+			{ PROP_CRTC_W, info->hdisplay },
+			{ PROP_CRTC_H, info->vdisplay },
+		};
+		for (size_t i = 0; i < sizeof(plane_state) / sizeof(plane_state[0]) && ret == 0; i++) {
+			ret = kms_set_prop(kms, primary, PROP_ID(plane_state[i].prop),
+				plane_state[i].value);
+		}
+	}
+
+	const uint32_t *conn_ids = (const uint32_t *)(uintptr_t)args->set_connectors_ptr;
+	for (size_t i = 0; i < kms->connectors_len && ret == 0; i++) {
+		struct mock_connector *conn = &kms->connectors[i];
+		bool set = false;
+		for (size_t j = 0; j < args->count_connectors; j++) {
+			if (conn_ids[j] == conn->base.id) {
+				set = true;
+			} else if (connector_lookup(kms, conn_ids[j]) == NULL) {
+				ret = -ENOENT;
+			}
+		}
+		if (set) {
+			conn->base.pending[PROP_CRTC_ID] = crtc->base.id;
+		} else if (conn->base.values[PROP_CRTC_ID] == crtc->base.id) {
+			conn->base.pending[PROP_CRTC_ID] = 0;
+		}
+	}
+
+	if (ret == 0) {
+		ret = kms_commit_state(kms, DRM_MODE_ATOMIC_ALLOW_MODESET,
+			1u << crtc->index, 0);
+	} else {
+		kms->stats.failed_commits++;
+	}
+	blob_unref(mode);
+	return ret;
+}
+
+static int handle_page_flip(struct mock_kms *kms, struct drm_mode_crtc_page_flip *args) {
+	struct mock_crtc *crtc = crtc_lookup(kms, args->crtc_id);
+	if (crtc == NULL) {
+		return -ENOENT;
+	}
+	if ((args->flags & ~DRM_MODE_PAGE_FLIP_EVENT) != 0 || !crtc->base.values[PROP_ACTIVE]) {
+		return -EINVAL;
+	}
+
+	kms_begin_state(kms);
+	int ret = kms_set_prop(kms, &crtc_get_primary(kms, crtc)->base,
+		PROP_ID(PROP_FB_ID), args->fb_id);
+	if (ret != 0) {
+		kms->stats.failed_commits++;
+		return ret;
+	}
+	return kms_commit_state(kms, args->flags | DRM_MODE_ATOMIC_NONBLOCK,
+		1u << crtc->index, args->user_data);
+}
+
+static int handle_cursor(struct mock_kms *kms, struct drm_mode_cursor *args) {
+	if (crtc_lookup(kms, args->crtc_id) == NULL) {
+		return -ENOENT;
+	}
+	if ((args->flags & DRM_MODE_CURSOR_BO) && args->handle != 0) {
+		if (bo_lookup(kms, args->handle) == NULL) {
+			return -ENOENT;
+		}
+		if (args->width > CURSOR_SIZE || args->height > CURSOR_SIZE) {
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int handle_set_gamma(struct mock_kms *kms, struct drm_mode_crtc_lut *args) {
+	if (crtc_lookup(kms, args->crtc_id) == NULL) {
+		return -ENOENT;
+	}
+	return args->gamma_size == GAMMA_SIZE ? 0 : -EINVAL;
+}
+
+static int handle_get_encoder(struct mock_kms *kms, struct drm_mode_get_encoder *args) {
+	for (size_t i = 0; i < kms->connectors_len; i++) {
+		struct mock_connector *conn = &kms->connectors[i];
+		if (conn->encoder_id != args->encoder_id) {
+			continue;
+		}
+		args->encoder_type = DRM_MODE_ENCODER_TMDS;
+		args->crtc_id = conn->base.values[PROP_CRTC_ID];
+		args->possible_crtcs = (1u << kms->crtcs_len) - 1;
+		args->possible_clones = 0;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+static int handle_get_connector(struct mock_kms *kms, struct drm_mode_get_connector *args) {
+	struct mock_connector *conn = connector_lookup(kms, args->connector_id);
+	if (conn == NULL) {
+		return -ENOENT;
+	}
+
+	args->encoder_id = conn->base.values[PROP_CRTC_ID] != 0 ? conn->encoder_id : 0;
+	args->connector_type = DRM_MODE_CONNECTOR_VIRTUAL;
+	args->connector_type_id = conn->type_id;
+	args->connection = conn->connected ? DRM_MODE_CONNECTED : DRM_MODE_DISCONNECTED;
+	args->mm_width = args->mm_height = 0;
+	args->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+
+	copy_array(args->modes_ptr, &args->count_modes, &conn->mode,
+		conn->connected ? 1 : 0, sizeof(conn->mode));
+	copy_array(args->encoders_ptr, &args->count_encoders, &conn->encoder_id,
+		1, sizeof(conn->encoder_id));
+
+	uint32_t ids[PROP_COUNT];
+	uint64_t values[PROP_COUNT];
+	size_t len = object_get_props(&conn->base, ids, values);
+	uint32_t count_props = args->count_props;
+	copy_array(args->props_ptr, &args->count_props, ids, len, sizeof(ids[0]));
+	copy_array(args->prop_values_ptr, &count_props, values, len, sizeof(values[0]));
+	return 0;
+}
+
+static int handle_get_plane_resources(struct mock_kms *kms,
+		struct drm_mode_get_plane_res *args) {
+	uint32_t ids[kms->planes_len];
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		ids[i] = kms->planes[i].base.id;
+	}
+	copy_array(args->plane_id_ptr, &args->count_planes, ids,
+		kms->planes_len, sizeof(ids[0]));
+	return 0;
+}
+
+static int handle_get_plane(struct mock_kms *kms, struct drm_mode_get_plane *args) {
+	struct mock_plane *plane = plane_lookup(kms, args->plane_id);
+	if (plane == NULL) {
+		return -ENOENT;
+	}
+
+	args->crtc_id = plane->base.values[PROP_CRTC_ID];
+	args->fb_id = plane->base.values[PROP_FB_ID];
+	args->possible_crtcs = plane->possible_crtcs;
+	args->gamma_size = 0;
+	copy_array(args->format_type_ptr, &args->count_format_types, plane->formats,
+		plane->formats_len, sizeof(plane->formats[0]));
+	return 0;
+}
+
+static int handle_obj_get_properties(struct mock_kms *kms,
+		struct drm_mode_obj_get_properties *args) {
+	struct mock_object *obj = object_lookup(kms, args->obj_id);
+	if (obj == NULL || (args->obj_type != DRM_MODE_OBJECT_ANY &&
+			args->obj_type != obj->type)) {
+		return -ENOENT;
+	}
+
+	uint32_t ids[PROP_COUNT];
+	uint64_t values[PROP_COUNT];
+	size_t len = object_get_props(obj, ids, values);
+	uint32_t count_props = args->count_props;
+	copy_array(args->props_ptr, &args->count_props, ids, len, sizeof(ids[0]));
+	copy_array(args->prop_values_ptr, &count_props, values, len, sizeof(values[0]));
+	return 0;
+}
+
+static int handle_obj_set_property(struct mock_kms *kms,
+		struct drm_mode_obj_set_property *args) {
+	struct mock_object *obj = object_lookup(kms, args->obj_id);
+	if (obj == NULL || obj->type != args->obj_type) {
+		return -ENOENT;
+	}
+
+	// Like atomic drivers, perform a full commit
+	kms_begin_state(kms);
+	int ret = kms_set_prop(kms, obj, args->prop_id, args->value);
+	if (ret != 0) {
+		kms->stats.failed_commits++;
+		return ret;
+	}
+	return kms_commit_state(kms, DRM_MODE_ATOMIC_ALLOW_MODESET,
+		object_get_crtcs(kms, obj, obj->pending), 0);
+}
+
+static int handle_connector_set_property(struct mock_kms *kms,
+		struct drm_mode_connector_set_property *args) {
+	struct drm_mode_obj_set_property obj_args = {
+		.value = args->value,
+		.prop_id = args->prop_id,
+		.obj_id = args->connector_id,
+		.obj_type = DRM_MODE_OBJECT_CONNECTOR,
+	};
+	return handle_obj_set_property(kms, &obj_args);
+}
+
+static int handle_get_property(struct mock_kms *kms, struct drm_mode_get_property *args) {
+	if (args->prop_id < PROP_ID(0) || args->prop_id >= PROP_ID(PROP_COUNT)) {
+		return -ENOENT;
+	}
+	const struct prop_info *info = &props[args->prop_id - PROP_ID(0)];
+
+	args->flags = info->flags;
+	snprintf(args->name, sizeof(args->name), "%s", info->name);
+
+	if (info->flags & DRM_MODE_PROP_ENUM) {
+		uint64_t values[info->enums_len];
+		for (size_t i = 0; i < info->enums_len; i++) {
+			values[i] = info->enums[i].value;
+		}
+		copy_array(args->values_ptr, &args->count_values, values,
+			info->enums_len, sizeof(values[0]));
+		copy_array(args->enum_blob_ptr, &args->count_enum_blobs, info->enums,
+			info->enums_len, sizeof(info->enums[0]));
+	} else if (info->flags & DRM_MODE_PROP_BLOB) {
+		args->count_values = 0;
+		args->count_enum_blobs = 0;
+	} else {
+		size_t len = (info->flags & DRM_MODE_PROP_OBJECT) ? 1 : 2;
+		copy_array(args->values_ptr, &args->count_values, info->values,
+			len, sizeof(info->values[0]));
+		args->count_enum_blobs = 0;
+	}
+	return 0;
+}
+
+static int handle_get_blob(struct mock_kms *kms, struct drm_mode_get_blob *args) {
+	struct mock_blob *blob = blob_lookup(kms, args->blob_id);
+	if (blob == NULL) {
+		return -ENOENT;
+	}
+	if (args->data != 0 && args->length >= blob->length) {
+		memcpy((void *)(uintptr_t)args->data, blob->data, blob->length);
+	}
+	args->length = blob->length;
+	return 0;
+}
+
+static int handle_create_blob(struct mock_kms *kms, struct drm_mode_create_blob *args) {
+	if (args->length == 0) {
+		return -EINVAL;
+	}
+	struct mock_blob *blob = blob_create(kms, (const void *)(uintptr_t)args->data,
+		args->length);
+	if (blob == NULL) {
+		return -ENOMEM;
+	}
+	blob->user = true;
+	args->blob_id = blob->id;
+	return 0;
+}
+
+static int handle_destroy_blob(struct mock_kms *kms, struct drm_mode_destroy_blob *args) {
+	struct mock_blob *blob = blob_lookup(kms, args->blob_id);
+	if (blob == NULL) {
+		return -ENOENT;
+	} else if (!blob->user) {
+		return -EPERM;
+	}
+	blob->user = false;
+	blob_unref(blob);
+	return 0;
+}
+
+static int kms_add_fb(struct mock_kms *kms, uint32_t width, uint32_t height,
+		uint32_t format, uint64_t modifier, uint32_t handle, uint32_t *fb_id) {
+	if (width == 0 || height == 0 || width > MAX_FB_SIZE || height > MAX_FB_SIZE) {
+		return -EINVAL;
+	}
+	struct mock_bo *bo = bo_lookup(kms, handle);
+	if (bo == NULL) {
+		return -ENOENT;
+	}
+
+	bool supported = false;
+	for (size_t i = 0; i < kms->planes_len; i++) {
+		supported = supported || plane_supports(kms, &kms->planes[i], format, modifier);
+	}
+	if (!supported) {
+		return -EINVAL;
+	}
+
+	struct mock_fb *fb = calloc(1, sizeof(*fb));
+	if (fb == NULL) {
+		return -ENOMEM;
+	}
+	*fb = (struct mock_fb){
+		.id = kms->next_id++,
+		.n_refs = 1,
+		.user = true,
+		.width = width,
+		.height = height,
+		.format = format,
+		.modifier = modifier,
+		.bo_dev = bo->dev,
+		.bo_ino = bo->ino,
+	};
+	wl_list_insert(&kms->fbs, &fb->link);
+	kms->stats.fbs_created++;
+	*fb_id = fb->id;
+	return 0;
+}
+
+static int handle_add_fb2(struct mock_kms *kms, struct drm_mode_fb_cmd2 *args) {
+	uint64_t modifier = DRM_FORMAT_MOD_INVALID;
+	if (args->flags & DRM_MODE_FB_MODIFIERS) {
+		if (kms->modifiers_len == 0) {
+			return -EINVAL;
+		}
+		modifier = args->modifier[0];
+	}
+	return kms_add_fb(kms, args->width, args->height, args->pixel_format,
+		modifier, args->handles[0], &args->fb_id);
+}
+
+static int handle_add_fb(struct mock_kms *kms, struct drm_mode_fb_cmd *args) {
+	if (args->bpp != 32 || (args->depth != 24 && args->depth != 32)) {
+		return -EINVAL;
+	}
+	uint32_t format = args->depth == 32 ? DRM_FORMAT_ARGB8888 : DRM_FORMAT_XRGB8888;
+	return kms_add_fb(kms, args->width, args->height, format,
+		DRM_FORMAT_MOD_INVALID, args->handle, &args->fb_id);
+}
+
+static int handle_get_fb(struct mock_kms *kms, struct drm_mode_fb_cmd *args) {
+	struct mock_fb *fb = fb_lookup(kms, args->fb_id);
+	if (fb == NULL) {
+		return -ENOENT;
+	}
+	// Hands out a new handle to the buffer, which user-space must close
+	struct mock_bo *bo = bo_import(kms, fb->bo_dev, fb->bo_ino);
+	if (bo == NULL) {
+		return -ENOMEM;
+	}
+	args->width = fb->width;
+	args->height = fb->height;
+	args->pitch = fb->width * 4;
+	args->bpp = 32;
+	args->depth = fb->format == DRM_FORMAT_ARGB8888 ? 32 : 24;
+	args->handle = bo->handle;
+	return 0;
+}
+
+static int kms_remove_fb(struct mock_kms *kms, uint32_t fb_id, bool disable_planes) {
+	struct mock_fb *fb = fb_lookup(kms, fb_id);
+	if (fb == NULL || !fb->user) {
+		return -ENOENT;
+	}
+	fb->user = false;
+
+	if (disable_planes) {
+		kms_begin_state(kms);
+		for (size_t i = 0; i < kms->planes_len; i++) {
+			struct mock_plane *plane = &kms->planes[i];
+			if (plane->base.values[PROP_FB_ID] == fb_id) {
+				plane->base.pending[PROP_FB_ID] = plane->base.pending[PROP_CRTC_ID] = 0;
+				object_apply_state(kms, &plane->base);
+			}
+		}
+	}
+
+	fb_unref(fb);
+	return 0;
+}
+
+static int handle_list_lessees(struct mock_kms *kms, struct drm_mode_list_lessees *args) {
+	args->count_lessees = 0;
+	return 0;
+}
+
+static int handle_atomic(struct mock_kms *kms, struct drm_mode_atomic *args) {
+	if (!kms->atomic || (args->flags & ~DRM_MODE_ATOMIC_FLAGS) != 0 ||
+			(args->flags & DRM_MODE_PAGE_FLIP_ASYNC) ||
+			((args->flags & DRM_MODE_ATOMIC_TEST_ONLY) &&
+			(args->flags & DRM_MODE_PAGE_FLIP_EVENT))) {
+		return -EINVAL;
+	}
+
+	const uint32_t *obj_ids = (const uint32_t *)(uintptr_t)args->objs_ptr;
+	const uint32_t *count_props = (const uint32_t *)(uintptr_t)args->count_props_ptr;
+	const uint32_t *prop_ids = (const uint32_t *)(uintptr_t)args->props_ptr;
+	const uint64_t *values = (const uint64_t *)(uintptr_t)args->prop_values_ptr;
+
+	kms_begin_state(kms);
+
+	int ret = 0;
+	uint32_t crtcs = 0;
+	size_t k = 0;
+	for (size_t i = 0; i < args->count_objs && ret == 0; i++) {
+		struct mock_object *obj = object_lookup(kms, obj_ids[i]);
+		if (obj == NULL) {
+			ret = -ENOENT;
+			break;
+		}
+		for (size_t j = 0; j < count_props[i] && ret == 0; j++, k++) {
+			ret = kms_set_prop(kms, obj, prop_ids[k], values[k]);
+		}
+		crtcs |= object_get_crtcs(kms, obj, obj->values) |
+			object_get_crtcs(kms, obj, obj->pending);
+	}
+
+	if (ret != 0) {
+		if (args->flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+			kms->stats.test_commits++;
+			kms->stats.failed_test_commits++;
+		} else {
+			kms->stats.failed_commits++;
+		}
+		return ret;
+	}
+	return kms_commit_state(kms, args->flags, crtcs, args->user_data);
+}
+
+static int kms_ioctl(struct mock_kms *kms, unsigned long request, void *arg) {
+	switch (request) {
+	case DRM_IOCTL_VERSION:
+		return handle_version(kms, arg);
+	case DRM_IOCTL_GET_CAP:
+		return handle_get_cap(kms, arg);
+	case DRM_IOCTL_SET_CLIENT_CAP:
+		return handle_set_client_cap(kms, arg);
+	case DRM_IOCTL_SET_MASTER:
+	case DRM_IOCTL_DROP_MASTER:
+		return 0;
+	case DRM_IOCTL_AUTH_MAGIC:
+		// drmIsMaster() relies on this failing with anything but EACCES
+		return -EINVAL;
+	case DRM_IOCTL_PRIME_FD_TO_HANDLE:
+		return handle_prime_fd_to_handle(kms, arg);
+	case DRM_IOCTL_GEM_CLOSE:
+		return handle_gem_close(kms, arg);
+	case DRM_IOCTL_MODE_GETRESOURCES:
+		return handle_get_resources(kms, arg);
+	case DRM_IOCTL_MODE_GETCRTC:
+		return handle_get_crtc(kms, arg);
+	case DRM_IOCTL_MODE_SETCRTC:
+		return handle_set_crtc(kms, arg);
+	case DRM_IOCTL_MODE_PAGE_FLIP:
+		return handle_page_flip(kms, arg);
+	case DRM_IOCTL_MODE_CURSOR:
+	case DRM_IOCTL_MODE_CURSOR2:
+		// The start of both structs is the same
+		return handle_cursor(kms, arg);
+	case DRM_IOCTL_MODE_SETGAMMA:
+		return handle_set_gamma(kms, arg);
+	case DRM_IOCTL_MODE_GETENCODER:
+		return handle_get_encoder(kms, arg);
+	case DRM_IOCTL_MODE_GETCONNECTOR:
+		return handle_get_connector(kms, arg);
+	case DRM_IOCTL_MODE_GETPLANERESOURCES:
+		return handle_get_plane_resources(kms, arg);
+	case DRM_IOCTL_MODE_GETPLANE:
+		return handle_get_plane(kms, arg);
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES:
+		return handle_obj_get_properties(kms, arg);
+	case DRM_IOCTL_MODE_OBJ_SETPROPERTY:
+		return handle_obj_set_property(kms, arg);
+	case DRM_IOCTL_MODE_SETPROPERTY:
+		return handle_connector_set_property(kms, arg);
+	case DRM_IOCTL_MODE_GETPROPERTY:
+		return handle_get_property(kms, arg);
+	case DRM_IOCTL_MODE_GETPROPBLOB:
+		return handle_get_blob(kms, arg);
+	case DRM_IOCTL_MODE_CREATEPROPBLOB:
+		return handle_create_blob(kms, arg);
+	case DRM_IOCTL_MODE_DESTROYPROPBLOB:
+		return handle_destroy_blob(kms, arg);
+	case DRM_IOCTL_MODE_ADDFB:
+		return handle_add_fb(kms, arg);
+	case DRM_IOCTL_MODE_ADDFB2:
+		return handle_add_fb2(kms, arg);
+	case DRM_IOCTL_MODE_GETFB:
+		return handle_get_fb(kms, arg);
+	case DRM_IOCTL_MODE_RMFB:
+		return kms_remove_fb(kms, *(unsigned int *)arg, true);
+	case DRM_IOCTL_MODE_CLOSEFB:;
+		struct drm_mode_closefb *closefb = arg;
+		return kms_remove_fb(kms, closefb->fb_id, false);
+	case DRM_IOCTL_MODE_LIST_LESSEES:
+		return handle_list_lessees(kms, arg);
+	case DRM_IOCTL_MODE_ATOMIC:
+		return handle_atomic(kms, arg);
+	}
+	return -EINVAL;
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+	va_list args;
+	va_start(args, request);
+	void *arg = va_arg(args, void *);
+	va_end(args);
+
+	struct mock_kms *kms = kms_from_fd(fd);
+	if (kms != NULL) {
+		int ret = kms_ioctl(kms, request, arg);
+		if (ret != 0) {
+			errno = -ret;
+			return -1;
+		}
+		return 0;
+	}
+
+	static int (*real_ioctl)(int fd, unsigned long request, ...) = NULL;
+	if (real_ioctl == NULL) {
+		real_ioctl = (int (*)(int, unsigned long, ...))dlsym(RTLD_NEXT, "ioctl");
+	}
+	return real_ioctl(fd, request, arg);
+}
+
+char *drmGetDeviceNameFromFd2(int fd) {
+	if (kms_from_fd(fd) != NULL) {
+		return strdup("/dev/dri/mock");
+	}
+
+	static char *(*real_get_device_name)(int fd) = NULL;
+	if (real_get_device_name == NULL) {
+		real_get_device_name = (char *(*)(int))dlsym(RTLD_NEXT, "drmGetDeviceNameFromFd2");
+	}
+	return real_get_device_name(fd);
+}
+
+int libseat_close_device(struct libseat *seat, int device_id);
+
+int libseat_close_device(struct libseat *seat, int device_id) {
+	// Our fake session doesn't have a seat
+	if (seat == NULL) {
+		return 0;
+	}
+
+	static int (*real_close_device)(struct libseat *seat, int device_id) = NULL;
+	if (real_close_device == NULL) {
+		real_close_device = (int (*)(struct libseat *, int))dlsym(RTLD_NEXT,
+			"libseat_close_device");
+	}
+	return real_close_device(seat, device_id);
+}
+
+static void generate_mode(struct drm_mode_modeinfo *mode, int width, int height,
+		int refresh) {
+	// Reduced blanking timings
+	int htotal = width + 160;
+	int vtotal = height + 40;
+	*mode = (struct drm_mode_modeinfo){
+		.clock = (uint64_t)htotal * vtotal * refresh / 1000000,
+		.hdisplay = width,
+		.hsync_start = width + 48,
+		.hsync_end = width + 80,
+		.htotal = htotal,
+		.vdisplay = height,
+		.vsync_start = height + 3,
+		.vsync_end = height + 8,
+		.vtotal = vtotal,
+		.vrefresh = (refresh + 500) / 1000,
+		.flags = DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_NVSYNC,
+		.type = DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED,
+	};
+	snprintf(mode->name, sizeof(mode->name), "%dx%d", width, height);
+}
+
+static struct mock_blob *create_in_formats_blob(struct mock_kms *kms,
+		const uint32_t *formats, size_t formats_len,
+		const uint64_t *modifiers, size_t modifiers_len) {
+	assert(formats_len <= 64);
+
+	struct drm_format_modifier_blob header = {
+		.version = FORMAT_BLOB_CURRENT,
+		.count_formats = formats_len,
+		.formats_offset = sizeof(header),
+		.count_modifiers = modifiers_len,
+		.modifiers_offset = sizeof(header) + formats_len * sizeof(formats[0]),
+	};
+	// Keep the modifiers 8-byte aligned
+	header.modifiers_offset = (header.modifiers_offset + 7) & ~7u;
+
+	size_t size = header.modifiers_offset +
+		modifiers_len * sizeof(struct drm_format_modifier);
+	uint8_t *data = calloc(1, size);
+	if (data == NULL) {
+		return NULL;
+	}
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + header.formats_offset, formats, formats_len * sizeof(formats[0]));
+	struct drm_format_modifier *mods = (void *)(data + header.modifiers_offset);
+	for (size_t i = 0; i < modifiers_len; i++) {
+		mods[i] = (struct drm_format_modifier){
+			.formats = formats_len == 64 ? UINT64_MAX : (UINT64_C(1) << formats_len) - 1,
+			.modifier = modifiers[i],
+		};
+	}
+
+	struct mock_blob *blob = blob_create(kms, data, size);
+	free(data);
+	return blob;
+}
+
+static void object_init(struct mock_kms *kms, struct mock_object *obj,
+		uint32_t type, uint32_t obj_props) {
+	obj->id = kms->next_id++;
+	obj->type = type;
+	obj->props = obj_props;
+}
+
+static bool kms_init_objects(struct mock_kms *kms) {
+	const struct mock_kms_options *options = &kms->options;
+
+	const struct mock_kms_connector_options *conn_options = options->connectors;
+	size_t conns_len = options->connectors_len;
+	if (conns_len == 0) {
+		conn_options = &default_connector;
+		conns_len = 1;
+	}
+	size_t crtcs_len = options->crtcs != 0 ? options->crtcs : conns_len;
+	assert(crtcs_len <= 32);
+
+	kms->crtcs = calloc(crtcs_len, sizeof(kms->crtcs[0]));
+	kms->connectors = calloc(conns_len, sizeof(kms->connectors[0]));
+	kms->planes_len = crtcs_len * (2 + options->overlay_planes);
+	kms->planes = calloc(kms->planes_len, sizeof(kms->planes[0]));
+	if (kms->crtcs == NULL || kms->connectors == NULL || kms->planes == NULL) {
+		return false;
+	}
+	kms->crtcs_len = crtcs_len;
+	kms->connectors_len = conns_len;
+
+	struct mock_blob *in_formats = NULL, *cursor_in_formats = NULL;
+	if (kms->modifiers_len > 0) {
+		static const uint64_t cursor_modifiers[] = { DRM_FORMAT_MOD_LINEAR };
+		in_formats = create_in_formats_blob(kms, kms->formats, kms->formats_len,
+			kms->modifiers, kms->modifiers_len);
+		cursor_in_formats = create_in_formats_blob(kms, cursor_formats, 1,
+			cursor_modifiers, 1);
+		if (in_formats == NULL || cursor_in_formats == NULL) {
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < crtcs_len; i++) {
+		struct mock_crtc *crtc = &kms->crtcs[i];
+		object_init(kms, &crtc->base, DRM_MODE_OBJECT_CRTC, crtc_props);
+		crtc->index = i;
+		crtc->base.values[PROP_GAMMA_LUT_SIZE] = GAMMA_SIZE;
+	}
+
+	for (size_t i = 0; i < conns_len; i++) {
+		struct mock_connector *conn = &kms->connectors[i];
+		conn->encoder_id = kms->next_id++;
+		object_init(kms, &conn->base, DRM_MODE_OBJECT_CONNECTOR, connector_props);
+		conn->type_id = i + 1;
+		conn->connected = conn_options[i].connected;
+		generate_mode(&conn->mode, conn_options[i].width, conn_options[i].height,
+			conn_options[i].refresh);
+		conn->base.values[PROP_DPMS] = DRM_MODE_DPMS_OFF;
+		conn->base.values[PROP_LINK_STATUS] = DRM_MODE_LINK_STATUS_GOOD;
+	}
+
+	size_t plane_index = 0;
+	for (size_t i = 0; i < crtcs_len; i++) {
+		size_t zpos = 0;
+		for (size_t j = 0; j < 2 + options->overlay_planes; j++) {
+			struct mock_plane *plane = &kms->planes[plane_index++];
+			uint32_t obj_props = plane_props;
+			if (in_formats != NULL) {
+				obj_props |= PROP_BIT(PROP_IN_FORMATS);
+			}
+			object_init(kms, &plane->base, DRM_MODE_OBJECT_PLANE, obj_props);
+			plane->possible_crtcs = 1u << i;
+
+			// Primary plane at the bottom, cursor plane on top
+			if (j == 0) {
+				plane->type = DRM_PLANE_TYPE_PRIMARY;
+			} else if (j == 1 + options->overlay_planes) {
+				plane->type = DRM_PLANE_TYPE_CURSOR;
+			} else {
+				plane->type = DRM_PLANE_TYPE_OVERLAY;
+			}
+
+			if (plane->type == DRM_PLANE_TYPE_CURSOR) {
+				plane->formats = cursor_formats;
+				plane->formats_len = 1;
+			} else {
+				plane->formats = kms->formats;
+				plane->formats_len = kms->formats_len;
+			}
+			plane->base.values[PROP_TYPE] = plane->type;
+			plane->base.values[PROP_ZPOS] = zpos++;
+			if (in_formats != NULL) {
+				struct mock_blob *blob = plane->type == DRM_PLANE_TYPE_CURSOR ?
+					cursor_in_formats : in_formats;
+				plane->base.values[PROP_IN_FORMATS] = blob->id;
+			}
+		}
+	}
+
+	return true;
+}
+
+struct mock_kms *mock_kms_create(struct wl_event_loop *loop,
+		const struct mock_kms_options *options) {
+	struct mock_kms *kms = calloc(1, sizeof(*kms));
+	if (kms == NULL) {
+		return NULL;
+	}
+	kms->options = *options;
+	kms->loop = loop;
+	kms->fd = kms->client_fd = kms->timer_fd = -1;
+	kms->next_id = PROP_ID(PROP_COUNT);
+	kms->next_handle = 1;
+	wl_list_init(&kms->blobs);
+	wl_list_init(&kms->fbs);
+	wl_list_init(&kms->bos);
+	wl_list_init(&kms->backend_destroy.link);
+
+	const uint32_t *formats = options->formats;
+	kms->formats_len = options->formats_len;
+	if (kms->formats_len == 0) {
+		formats = default_formats;
+		kms->formats_len = sizeof(default_formats) / sizeof(default_formats[0]);
+	}
+	kms->formats = calloc(kms->formats_len, sizeof(formats[0]));
+	kms->modifiers_len = options->modifiers_len;
+	kms->modifiers = calloc(kms->modifiers_len + 1, sizeof(kms->modifiers[0]));
+	if (kms->formats == NULL || kms->modifiers == NULL) {
+		goto error;
+	}
+	memcpy(kms->formats, formats, kms->formats_len * sizeof(formats[0]));
+	if (kms->modifiers_len > 0) {
+		memcpy(kms->modifiers, options->modifiers,
+			kms->modifiers_len * sizeof(kms->modifiers[0]));
+	}
+	if (!kms_init_objects(kms)) {
+		goto error;
+	}
+	// The options may point to temporary storage
+	kms->options.connectors = NULL;
+	kms->options.formats = NULL;
+	kms->options.modifiers = NULL;
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		goto error;
+	}
+	kms->fd = fds[0];
+	kms->client_fd = fds[1];
+
+	struct stat st;
+	if (fstat(kms->client_fd, &st) != 0) {
+		goto error;
+	}
+	kms->client_dev = st.st_dev;
+	kms->client_ino = st.st_ino;
+
+	if (options->realtime_vblank) {
+		kms->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		if (kms->timer_fd < 0) {
+			goto error;
+		}
+		kms->timer = wl_event_loop_add_fd(loop, kms->timer_fd, WL_EVENT_READABLE,
+			handle_timer, kms);
+		if (kms->timer == NULL) {
+			goto error;
+		}
+	}
+
+	kms->session = calloc(1, sizeof(*kms->session));
+	if (kms->session == NULL) {
+		goto error;
+	}
+	kms->session->active = true;
+	kms->session->event_loop = loop;
+	wl_list_init(&kms->session->devices);
+	wl_signal_init(&kms->session->events.active);
+	wl_signal_init(&kms->session->events.add_drm_card);
+	wl_signal_init(&kms->session->events.destroy);
+
+	wl_list_insert(&devices, &kms->link);
+	return kms;
+
+error:
+	wl_list_init(&kms->link);
+	mock_kms_destroy(kms);
+	return NULL;
+}
+
+void mock_kms_destroy(struct mock_kms *kms) {
+	if (kms == NULL) {
+		return;
+	}
+
+	if (kms->backend != NULL) {
+		wlr_backend_destroy(kms->backend);
+	}
+	if (kms->session != NULL) {
+		wl_signal_emit_mutable(&kms->session->events.destroy, kms->session);
+		free(kms->session);
+	}
+
+	wl_list_remove(&kms->link);
+	if (kms->timer != NULL) {
+		wl_event_source_remove(kms->timer);
+	}
+	if (kms->timer_fd >= 0) {
+		close(kms->timer_fd);
+	}
+	if (kms->fd >= 0) {
+		close(kms->fd);
+		close(kms->client_fd);
+	}
+
+	struct mock_blob *blob, *blob_tmp;
+	wl_list_for_each_safe(blob, blob_tmp, &kms->blobs, link) {
+		wl_list_remove(&blob->link);
+		free(blob);
+	}
+	struct mock_fb *fb, *fb_tmp;
+	wl_list_for_each_safe(fb, fb_tmp, &kms->fbs, link) {
+		wl_list_remove(&fb->link);
+		free(fb);
+	}
+	struct mock_bo *bo, *bo_tmp;
+	wl_list_for_each_safe(bo, bo_tmp, &kms->bos, link) {
+		wl_list_remove(&bo->link);
+		free(bo);
+	}
+
+	free(kms->crtcs);
+	free(kms->connectors);
+	free(kms->planes);
+	free(kms->formats);
+	free(kms->modifiers);
+	free(kms);
+}
+
+static void handle_backend_destroy(struct wl_listener *listener, void *data) {
+	struct mock_kms *kms = wl_container_of(listener, kms, backend_destroy);
+	// The device is closed along with the backend
+	wl_list_remove(&kms->backend_destroy.link);
+	wl_list_init(&kms->backend_destroy.link);
+	kms->backend = NULL;
+	kms->device = NULL;
+}
+
+struct wlr_backend *mock_kms_create_backend(struct mock_kms *kms) {
+	assert(kms->backend == NULL && kms->device == NULL);
+
+	struct wlr_device *dev = calloc(1, sizeof(*dev));
+	if (dev == NULL) {
+		return NULL;
+	}
+	// Closed by the backend
+	dev->fd = fcntl(kms->client_fd, F_DUPFD_CLOEXEC, 0);
+	if (dev->fd < 0) {
+		free(dev);
+		return NULL;
+	}
+	wl_signal_init(&dev->events.change);
+	wl_signal_init(&dev->events.remove);
+	wl_list_insert(&kms->session->devices, &dev->link);
+
+	// On failure, the backend may have closed the device already
+	kms->backend = wlr_drm_backend_create(kms->session, dev, NULL);
+	if (kms->backend == NULL) {
+		return NULL;
+	}
+	kms->device = dev;
+
+	kms->backend_destroy.notify = handle_backend_destroy;
+	wl_signal_add(&kms->backend->events.destroy, &kms->backend_destroy);
+	return kms->backend;
+}
+
+void mock_kms_set_connected(struct mock_kms *kms, size_t index, bool connected) {
+	assert(index < kms->connectors_len);
+	struct mock_connector *conn = &kms->connectors[index];
+	if (conn->connected == connected) {
+		return;
+	}
+	conn->connected = connected;
+
+	if (kms->device != NULL) {
+		struct wlr_device_change_event event = {
+			.type = WLR_DEVICE_HOTPLUG,
+			.hotplug = {
+				.connector_id = conn->base.id,
+			},
+		};
+		wl_signal_emit_mutable(&kms->device->events.change, &event);
+	}
+}
+
+const struct mock_kms_stats *mock_kms_get_stats(const struct mock_kms *kms) {
+	return &kms->stats;
+}
+
+void mock_kms_reset_stats(struct mock_kms *kms) {
+	kms->stats = (struct mock_kms_stats){0};
+}
+
+struct mock_buffer {
+	struct wlr_buffer base;
+	struct wlr_dmabuf_attributes dmabuf;
+};
+
+static void mock_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct mock_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	wlr_buffer_finish(wlr_buffer);
+	close(buffer->dmabuf.fd[0]);
+	free(buffer);
+}
+
+static bool mock_buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
+		struct wlr_dmabuf_attributes *attribs) {
+	struct mock_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*attribs = buffer->dmabuf;
+	return true;
+}
+
+static const struct wlr_buffer_impl mock_buffer_impl = {
+	.destroy = mock_buffer_destroy,
+	.get_dmabuf = mock_buffer_get_dmabuf,
+};
+
+struct wlr_buffer *mock_kms_buffer_create(int width, int height,
+		uint32_t format, uint64_t modifier) {
+	struct mock_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	// Only the identity of the file matters to the fake device
+	int fd = memfd_create("mock-kms-buffer", MFD_CLOEXEC);
+	if (fd < 0) {
+		free(buffer);
+		return NULL;
+	}
+
+	wlr_buffer_init(&buffer->base, &mock_buffer_impl, width, height);
+	buffer->dmabuf = (struct wlr_dmabuf_attributes){
+		.width = width,
+		.height = height,
+		.format = format,
+		.modifier = modifier,
+		.n_planes = 1,
+		.stride = { width * 4 },
+		.fd = { fd, -1, -1, -1 },
+	};
+	return &buffer->base;
+}
+
+struct wlr_buffer *mock_kms_buffer_dup(struct wlr_buffer *wlr_buffer) {
+	assert(wlr_buffer->impl == &mock_buffer_impl);
+	struct mock_buffer *orig = wl_container_of(wlr_buffer, orig, base);
+
+	struct mock_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	buffer->dmabuf = orig->dmabuf;
+	buffer->dmabuf.fd[0] = fcntl(orig->dmabuf.fd[0], F_DUPFD_CLOEXEC, 0);
+	if (buffer->dmabuf.fd[0] < 0) {
+		free(buffer);
+		return NULL;
+	}
+
+	wlr_buffer_init(&buffer->base, &mock_buffer_impl,
+		wlr_buffer->width, wlr_buffer->height);
+	return &buffer->base;
+}
@@ -0,0 +1,97 @@
+#ifndef TEST_MOCK_KMS_H
+#define TEST_MOCK_KMS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+/**
+ * A fake KMS device, for exercising the DRM backend without a GPU.
+ *
+ * The DRM backend is handed one end of a socket pair as its DRM FD. DRM ioctls
+ * issued on that FD are interposed and served from an in-memory model of the
+ * device's CRTCs, connectors and planes, and page-flip events are written to
+ * the socket so that the backend's drmHandleEvent() consumes them as usual.
+ *
+ * Test programs using this must export their symbols (-rdynamic) so that the
+ * interposed functions take precedence over the ones in libc and libdrm.
+ */
+struct mock_kms;
+
+struct mock_kms_connector_options {
+	bool connected;
+	int width, height;
+	int refresh; // mHz
+};
+
+struct mock_kms_options {
+	// Defaults to a single connected 1920x1080@60Hz connector
+	const struct mock_kms_connector_options *connectors;
+	size_t connectors_len;
+	// Defaults to one CRTC per connector. Each CRTC gets a primary plane, a
+	// cursor plane and overlay_planes overlays.
+	size_t crtcs;
+	size_t overlay_planes;
+
+	// Formats supported by primary and overlay planes, defaults to XRGB8888
+	// and ARGB8888. Cursor planes only support linear ARGB8888.
+	const uint32_t *formats;
+	size_t formats_len;
+	// Modifiers supported with all of the above formats. If empty, the device
+	// doesn't support explicit modifiers.
+	const uint64_t *modifiers;
+	size_t modifiers_len;
+
+	// Maximum number of enabled planes per CRTC, 0 for no limit. Configurations
+	// above it are rejected, like a driver running out of bandwidth would.
+	size_t max_active_planes;
+	// Don't support the atomic API
+	bool legacy_only;
+	// Deliver page-flip events on simulated vblanks at the refresh rate of
+	// the current mode, instead of right after the commit
+	bool realtime_vblank;
+};
+
+struct mock_kms_stats {
+	uint64_t commits; // successful atomic commits, legacy modesets and flips
+	uint64_t failed_commits;
+	uint64_t test_commits; // TEST_ONLY atomic commits
+	uint64_t failed_test_commits;
+	uint64_t modesets;
+	uint64_t page_flips; // page-flip events delivered
+	uint64_t fbs_created;
+};
+
+struct mock_kms *mock_kms_create(struct wl_event_loop *loop,
+	const struct mock_kms_options *options);
+/**
+ * Destroy the device. The DRM backend, if any, is destroyed as well.
+ */
+void mock_kms_destroy(struct mock_kms *kms);
+/**
+ * Create a DRM backend driving the fake device. Only one backend can be
+ * created per device.
+ */
+struct wlr_backend *mock_kms_create_backend(struct mock_kms *kms);
+/**
+ * Connect or disconnect a connector, and notify the backend about the
+ * hotplug.
+ */
+void mock_kms_set_connected(struct mock_kms *kms, size_t connector, bool connected);
+const struct mock_kms_stats *mock_kms_get_stats(const struct mock_kms *kms);
+void mock_kms_reset_stats(struct mock_kms *kms);
+
+/**
+ * Create a single-plane DMA-BUF buffer which can be imported into the fake
+ * device. The buffer is backed by a memfd and its contents are never read.
+ */
+struct wlr_buffer *mock_kms_buffer_create(int width, int height,
+	uint32_t format, uint64_t modifier);
+/**
+ * Create a new buffer referring to the same DMA-BUF as a buffer created with
+ * mock_kms_buffer_create(), like a client importing a DMA-BUF again.
+ */
+struct wlr_buffer *mock_kms_buffer_dup(struct wlr_buffer *buffer);
+
+#endif
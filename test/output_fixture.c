@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <wlr/backend.h>
+#include <wlr/types/wlr_output.h>
+#include "output_fixture.h"
+
+static void output_handle_frame(struct wl_listener *listener, void *data) {
+	struct output_fixture *fixture =
+		wl_container_of(listener, fixture, output_frame);
+	fixture->frames++;
+	clock_gettime(CLOCK_MONOTONIC, &fixture->last_frame);
+}
+
+static void output_handle_present(struct wl_listener *listener, void *data) {
+	struct output_fixture *fixture =
+		wl_container_of(listener, fixture, output_present);
+	struct wlr_output_event_present *event = data;
+	fixture->presents++;
+	fixture->last_present = event->when;
+}
+
+static void output_remove_listeners(struct output_fixture *fixture) {
+	wl_list_remove(&fixture->output_frame.link);
+	wl_list_remove(&fixture->output_present.link);
+	wl_list_remove(&fixture->output_destroy.link);
+	fixture->output = NULL;
+}
+
+static void output_handle_destroy(struct wl_listener *listener, void *data) {
+	struct output_fixture *fixture =
+		wl_container_of(listener, fixture, output_destroy);
+	output_remove_listeners(fixture);
+}
+
+static void handle_new_output(struct wl_listener *listener, void *data) {
+	struct output_fixture *fixture =
+		wl_container_of(listener, fixture, new_output);
+	struct wlr_output *output = data;
+	assert(fixture->output == NULL);
+
+	fixture->output = output;
+	fixture->output_frame.notify = output_handle_frame;
+	wl_signal_add(&output->events.frame, &fixture->output_frame);
+	fixture->output_present.notify = output_handle_present;
+	wl_signal_add(&output->events.present, &fixture->output_present);
+	fixture->output_destroy.notify = output_handle_destroy;
+	wl_signal_add(&output->events.destroy, &fixture->output_destroy);
+}
+
+void output_fixture_init(struct output_fixture *fixture,
+		struct wl_event_loop *loop, struct wlr_backend *backend) {
+	*fixture = (struct output_fixture){
+		.loop = loop,
+		.backend = backend,
+	};
+
+	fixture->new_output.notify = handle_new_output;
+	wl_signal_add(&backend->events.new_output, &fixture->new_output);
+
+	bool ok = wlr_backend_start(backend);
+	assert(ok);
+}
+
+void output_fixture_finish(struct output_fixture *fixture) {
+	if (fixture->output != NULL) {
+		output_remove_listeners(fixture);
+	}
+	wl_list_remove(&fixture->new_output.link);
+}
+
+static void wait_for_event(struct output_fixture *fixture, const int *counter) {
+	int prev = *counter;
+	for (int i = 0; i < 100 && *counter == prev; i++) {
+		wl_event_loop_dispatch(fixture->loop, 100);
+	}
+	assert(*counter > prev);
+}
+
+void output_fixture_wait_for_frame(struct output_fixture *fixture) {
+	wait_for_event(fixture, &fixture->frames);
+}
+
+void output_fixture_wait_for_present(struct output_fixture *fixture) {
+	wait_for_event(fixture, &fixture->presents);
+}
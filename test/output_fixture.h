@@ -0,0 +1,52 @@
+#ifndef TEST_OUTPUT_FIXTURE_H
+#define TEST_OUTPUT_FIXTURE_H
+
+#include <time.h>
+#include <wayland-server-core.h>
+
+struct wlr_backend;
+struct wlr_output;
+
+/**
+ * Tracks the output created by a backend under test, along with the frame and
+ * present events it emits.
+ *
+ * Only a single output at a time is supported. The output may be destroyed and
+ * re-created, e.g. on hotplug.
+ */
+struct output_fixture {
+	struct wl_event_loop *loop;
+	struct wlr_backend *backend;
+	struct wlr_output *output; // NULL if the backend has no output
+
+	int frames;
+	struct timespec last_frame; // CLOCK_MONOTONIC time of the last frame event
+	int presents;
+	struct timespec last_present; // presentation time of the last present event
+
+	struct wl_listener new_output;
+	struct wl_listener output_frame;
+	struct wl_listener output_present;
+	struct wl_listener output_destroy;
+};
+
+/**
+ * Start the backend and track the output it creates.
+ */
+void output_fixture_init(struct output_fixture *fixture,
+	struct wl_event_loop *loop, struct wlr_backend *backend);
+/**
+ * Stop tracking the output. This must be called before destroying the backend.
+ */
+void output_fixture_finish(struct output_fixture *fixture);
+
+/**
+ * Run the event loop until the output emits a frame event.
+ */
+void output_fixture_wait_for_frame(struct output_fixture *fixture);
+/**
+ * Run the event loop until the output emits a present event.
+ */
+void output_fixture_wait_for_present(struct output_fixture *fixture);
+
+#endif
@@ -0,0 +1,248 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <wlr/backend.h>
+#include <wlr/backend/drm.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include "mock_kms.h"
+#include "output_fixture.h"
+
+struct test {
+	struct wl_event_loop *loop;
+	struct mock_kms *kms;
+	struct wlr_backend *backend;
+	struct output_fixture output;
+};
+
+static void test_init(struct test *test, const struct mock_kms_options *options) {
+	*test = (struct test){0};
+	test->loop = wl_event_loop_create();
+	assert(test->loop != NULL);
+	test->kms = mock_kms_create(test->loop, options);
+	assert(test->kms != NULL);
+	test->backend = mock_kms_create_backend(test->kms);
+	assert(test->backend != NULL);
+	output_fixture_init(&test->output, test->loop, test->backend);
+}
+
+static void test_finish(struct test *test) {
+	// The backend is destroyed along with the device
+	output_fixture_finish(&test->output);
+	mock_kms_destroy(test->kms);
+	wl_event_loop_destroy(test->loop);
+}
+
+static void wait_for_present(struct test *test) {
+	output_fixture_wait_for_present(&test->output);
+}
+
+static bool commit_existing_buffer(struct test *test, struct wlr_buffer *buffer,
+		bool test_only) {
+	struct wlr_output *output = test->output.output;
+	struct wlr_output_mode *mode = wlr_output_preferred_mode(output);
+	assert(mode != NULL);
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	if (!output->enabled) {
+		wlr_output_state_set_enabled(&state, true);
+		wlr_output_state_set_mode(&state, mode);
+	}
+	wlr_output_state_set_buffer(&state, buffer);
+	bool ok = test_only ? wlr_output_test_state(output, &state) :
+		wlr_output_commit_state(output, &state);
+	wlr_output_state_finish(&state);
+	return ok;
+}
+
+static bool commit_buffer(struct test *test, uint32_t format, bool test_only) {
+	struct wlr_output_mode *mode = wlr_output_preferred_mode(test->output.output);
+	assert(mode != NULL);
+
+	struct wlr_buffer *buffer = mock_kms_buffer_create(mode->width, mode->height,
+		format, DRM_FORMAT_MOD_INVALID);
+	assert(buffer != NULL);
+	bool ok = commit_existing_buffer(test, buffer, test_only);
+	wlr_buffer_drop(buffer);
+	return ok;
+}
+
+static void test_modeset_and_flip(void) {
+	struct test test;
+	bool ok;
+	test_init(&test, &(struct mock_kms_options){0});
+	assert(test.output.output != NULL);
+	const struct mock_kms_stats *stats = mock_kms_get_stats(test.kms);
+
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	assert(test.output.output->enabled);
+	assert(stats->modesets == 1);
+	assert(stats->fbs_created == 1);
+	wait_for_present(&test);
+
+	// Page-flips don't need a modeset
+	uint64_t page_flips = stats->page_flips;
+	for (int i = 0; i < 3; i++) {
+		ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+		assert(ok);
+		wait_for_present(&test);
+	}
+	assert(stats->modesets == 1);
+	assert(stats->page_flips == page_flips + 3);
+	assert(stats->failed_commits == 0);
+
+	test_finish(&test);
+}
+
+static void test_unsupported_format(void) {
+	struct test test;
+	bool ok;
+	test_init(&test, &(struct mock_kms_options){0});
+
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	ok = commit_buffer(&test, DRM_FORMAT_ABGR2101010, true);
+	assert(!ok);
+	assert(mock_kms_get_stats(test.kms)->modesets == 1);
+
+	test_finish(&test);
+}
+
+static void test_legacy(void) {
+	struct test test;
+	bool ok;
+	test_init(&test, &(struct mock_kms_options){ .legacy_only = true });
+	const struct mock_kms_stats *stats = mock_kms_get_stats(test.kms);
+
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	wait_for_present(&test);
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	wait_for_present(&test);
+	assert(stats->modesets == 1);
+	assert(stats->test_commits == 0);
+
+	test_finish(&test);
+}
+
+static void test_hotplug(void) {
+	struct test test;
+	bool ok;
+	test_init(&test, &(struct mock_kms_options){0});
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+
+	mock_kms_set_connected(test.kms, 0, false);
+	assert(test.output.output == NULL);
+
+	mock_kms_set_connected(test.kms, 0, true);
+	assert(test.output.output != NULL);
+	assert(!test.output.output->enabled);
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+
+	test_finish(&test);
+}
+
+static void test_test_cache(void) {
+	struct test test;
+	bool ok;
+	test_init(&test, &(struct mock_kms_options){0});
+	const struct mock_kms_stats *stats = mock_kms_get_stats(test.kms);
+	struct wlr_drm_backend_stats drm_stats;
+
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	wait_for_present(&test);
+
+	// Testing the same configuration twice only reaches the kernel once
+	uint64_t test_commits = stats->test_commits;
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, true);
+	assert(ok);
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, true);
+	assert(ok);
+	assert(stats->test_commits == test_commits + 1);
+	wlr_drm_backend_get_stats(test.backend, &drm_stats);
+	assert(drm_stats.test_cache_misses == 1);
+	assert(drm_stats.test_cache_hits == 1);
+
+	// A different format is a different configuration
+	ok = commit_buffer(&test, DRM_FORMAT_ARGB8888, true);
+	assert(ok);
+	assert(stats->test_commits == test_commits + 2);
+
+	// Page-flips keep cached results
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	wait_for_present(&test);
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, true);
+	assert(ok);
+	assert(stats->test_commits == test_commits + 2);
+
+	// Hotplug and modesets clear the cache
+	mock_kms_set_connected(test.kms, 0, false);
+	mock_kms_set_connected(test.kms, 0, true);
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	wait_for_present(&test);
+	test_commits = stats->test_commits;
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, true);
+	assert(ok);
+	assert(stats->test_commits == test_commits + 1);
+	wlr_drm_backend_get_stats(test.backend, &drm_stats);
+	assert(drm_stats.test_cache_misses == 3);
+	assert(drm_stats.test_cache_hits == 2);
+
+	test_finish(&test);
+}
+
+static void test_fb_cache(void) {
+	struct test test;
+	bool ok;
+	test_init(&test, &(struct mock_kms_options){0});
+	const struct mock_kms_stats *stats = mock_kms_get_stats(test.kms);
+	struct wlr_drm_backend_stats drm_stats;
+
+	struct wlr_output_mode *mode = wlr_output_preferred_mode(test.output.output);
+	struct wlr_buffer *buffer = mock_kms_buffer_create(mode->width, mode->height,
+		DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_INVALID);
+	assert(buffer != NULL);
+	struct wlr_buffer *reimported = mock_kms_buffer_dup(buffer);
+	assert(reimported != NULL);
+
+	ok = commit_existing_buffer(&test, buffer, false);
+	assert(ok);
+	wait_for_present(&test);
+	wlr_buffer_drop(buffer);
+
+	// Replacing the buffer on screen destroys it, its FB is kept around
+	ok = commit_buffer(&test, DRM_FORMAT_XRGB8888, false);
+	assert(ok);
+	wait_for_present(&test);
+	uint64_t fbs_created = stats->fbs_created;
+
+	// Importing the same DMA-BUF again re-uses the FB
+	ok = commit_existing_buffer(&test, reimported, false);
+	assert(ok);
+	wait_for_present(&test);
+	assert(stats->fbs_created == fbs_created);
+	wlr_drm_backend_get_stats(test.backend, &drm_stats);
+	assert(drm_stats.fb_cache_hits == 1);
+	assert(drm_stats.fb_cache_misses == 2);
+	wlr_buffer_drop(reimported);
+
+	test_finish(&test);
+}
+
+int main(void) {
+	test_modeset_and_flip();
+	test_unsupported_format();
+	test_legacy();
+	test_hotplug();
+	test_test_cache();
+	test_fb_cache();
+	return 0;
+}
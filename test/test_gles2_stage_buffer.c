@@ -0,0 +1,178 @@
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/gles2.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+
+#include "render/egl.h"
+#include "render/gles2.h"
+
+// Exit code for skipped tests
+#define TEST_SKIP 77
+
+#define WIDTH 300
+#define HEIGHT 200
+
+struct test_buffer {
+	struct wlr_buffer base;
+	uint8_t *data;
+	size_t stride;
+};
+
+static void test_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct test_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	wlr_buffer_finish(wlr_buffer);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool test_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct test_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*data = buffer->data;
+	*format = DRM_FORMAT_ARGB8888;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void test_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// This space is intentionally left blank
+}
+
+static const struct wlr_buffer_impl test_buffer_impl = {
+	.destroy = test_buffer_destroy,
+	.begin_data_ptr_access = test_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = test_buffer_end_data_ptr_access,
+};
+
+static struct test_buffer *test_buffer_create(void) {
+	struct test_buffer *buffer = calloc(1, sizeof(*buffer));
+	assert(buffer != NULL);
+	wlr_buffer_init(&buffer->base, &test_buffer_impl, WIDTH, HEIGHT);
+	// Not tightly packed, to exercise the stride conversion
+	buffer->stride = WIDTH * 4 + 16;
+	buffer->data = malloc(HEIGHT * buffer->stride);
+	assert(buffer->data != NULL);
+	for (size_t i = 0; i < HEIGHT * buffer->stride; i++) {
+		buffer->data[i] = rand();
+	}
+	return buffer;
+}
+
+static void fill_box(struct test_buffer *buffer, int x, int y, int width,
+		int height) {
+	for (int row = y; row < y + height; row++) {
+		uint8_t *p = &buffer->data[row * buffer->stride + x * 4];
+		for (int i = 0; i < width * 4; i++) {
+			p[i] = rand();
+		}
+	}
+}
+
+static void check_read_pixels(struct wlr_texture *texture,
+		struct test_buffer *buffer) {
+	size_t stride = WIDTH * 4;
+	uint8_t *data = malloc(HEIGHT * stride);
+	assert(data != NULL);
+	bool ok = wlr_texture_read_pixels(texture, &(struct wlr_texture_read_pixels_options){
+		.data = data,
+		.format = DRM_FORMAT_ARGB8888,
+		.stride = stride,
+	});
+	assert(ok);
+	for (int y = 0; y < HEIGHT; y++) {
+		assert(memcmp(&data[y * stride], &buffer->data[y * buffer->stride],
+			WIDTH * 4) == 0);
+	}
+	free(data);
+}
+
+static void test_upload_and_read_pixels(struct wlr_renderer *renderer) {
+	struct test_buffer *buffer = test_buffer_create();
+	struct wlr_texture *texture =
+		wlr_texture_from_buffer(renderer, &buffer->base);
+	assert(texture != NULL);
+	check_read_pixels(texture, buffer);
+
+	// Partial updates go through stage buffers as well
+	pixman_region32_t damage;
+	pixman_region32_init_rect(&damage, 10, 20, 30, 40);
+	pixman_region32_union_rect(&damage, &damage, 200, 100, 100, 100);
+	fill_box(buffer, 10, 20, 30, 40);
+	fill_box(buffer, 200, 100, 100, 100);
+	bool ok = wlr_texture_update_from_buffer(texture, &buffer->base, &damage);
+	assert(ok);
+	pixman_region32_fini(&damage);
+	check_read_pixels(texture, buffer);
+
+	wlr_texture_destroy(texture);
+	wlr_buffer_drop(&buffer->base);
+}
+
+static GLenum client_wait_sync_failed(GLsync sync, GLbitfield flags,
+		GLuint64 timeout) {
+	return GL_WAIT_FAILED_APPLE;
+}
+
+static void test_wait_failed(struct wlr_renderer *wlr_renderer) {
+	struct wlr_gles2_renderer *renderer = gles2_get_renderer(wlr_renderer);
+	bool ok = wlr_egl_make_current(renderer->egl, NULL);
+	assert(ok);
+
+	// Fill the pool with buffers the GPU may still be accessing
+	struct wlr_gles2_stage_buffer *bufs[16];
+	size_t n_bufs = 0;
+	while (n_bufs < sizeof(bufs) / sizeof(bufs[0])) {
+		bufs[n_bufs] = gles2_get_stage_buffer(renderer, 4096, GL_STREAM_READ);
+		if (bufs[n_bufs] == NULL) {
+			break;
+		}
+		n_bufs++;
+	}
+	assert(n_bufs > 0 && n_bufs == renderer->stage.n_buffers);
+	for (size_t i = 0; i < n_bufs; i++) {
+		gles2_stage_buffer_release(renderer, bufs[i], true);
+	}
+
+	// Buffers whose fence can't be waited on must not stay busy forever
+	PFNGLCLIENTWAITSYNCAPPLEPROC client_wait_sync =
+		renderer->procs.glClientWaitSync;
+	renderer->procs.glClientWaitSync = client_wait_sync_failed;
+	struct wlr_gles2_stage_buffer *buf =
+		gles2_get_stage_buffer(renderer, 4096, GL_STREAM_READ);
+	renderer->procs.glClientWaitSync = client_wait_sync;
+	assert(buf != NULL);
+	assert(renderer->stage.n_buffers == 1);
+	gles2_stage_buffer_release(renderer, buf, false);
+
+	wlr_egl_unset_current(renderer->egl);
+}
+
+int main(void) {
+#ifdef NDEBUG
+	fprintf(stderr, "NDEBUG must be disabled for tests\n");
+	return 1;
+#endif
+
+	// Without a DRM FD, the software renderer (e.g. llvmpipe) is picked
+	struct wlr_renderer *renderer = wlr_gles2_renderer_create_with_drm_fd(-1);
+	if (renderer == NULL) {
+		fprintf(stderr, "No software GLES2 renderer available, skipping\n");
+		return TEST_SKIP;
+	}
+	if (!gles2_get_renderer(renderer)->stage.enabled) {
+		fprintf(stderr, "Stage buffers aren't supported, skipping\n");
+		wlr_renderer_destroy(renderer);
+		return TEST_SKIP;
+	}
+
+	test_upload_and_read_pixels(renderer);
+	test_wait_failed(renderer);
+
+	wlr_renderer_destroy(renderer);
+	return 0;
+}
@@ -0,0 +1,176 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+#include "output_fixture.h"
+
+// The headless backend sends frame events every 16ms at 60Hz
+#define REFRESH_MSEC 16
+
+struct test {
+	struct wl_event_loop *loop;
+	struct wlr_backend *backend;
+	struct wlr_renderer *renderer;
+	struct wlr_allocator *allocator;
+	struct output_fixture output;
+};
+
+static double timespec_diff_msec(struct timespec *start, struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) * 1e3 +
+		(double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void test_init(struct test *test) {
+	*test = (struct test){0};
+	test->loop = wl_event_loop_create();
+	assert(test->loop != NULL);
+	test->backend = wlr_headless_backend_create(test->loop);
+	assert(test->backend != NULL);
+	test->renderer = wlr_pixman_renderer_create();
+	assert(test->renderer != NULL);
+	test->allocator = wlr_allocator_autocreate(test->backend, test->renderer);
+	assert(test->allocator != NULL);
+	output_fixture_init(&test->output, test->loop, test->backend);
+
+	struct wlr_output *output = wlr_headless_add_output(test->backend, 64, 64);
+	assert(output != NULL && output == test->output.output);
+	bool ok = wlr_output_init_render(output, test->allocator, test->renderer);
+	assert(ok);
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	wlr_output_state_set_custom_mode(&state, 64, 64, 60000);
+	ok = wlr_output_commit_state(output, &state);
+	assert(ok);
+	wlr_output_state_finish(&state);
+}
+
+static void test_finish(struct test *test) {
+	output_fixture_finish(&test->output);
+	wlr_backend_destroy(test->backend);
+	wlr_allocator_destroy(test->allocator);
+	wlr_renderer_destroy(test->renderer);
+	wl_event_loop_destroy(test->loop);
+}
+
+static void set_frame_pacing(struct test *test,
+		const struct wlr_output_frame_pacing_options *options) {
+	bool ok = wlr_output_set_frame_pacing(test->output.output, options);
+	assert(ok);
+}
+
+static void commit_frame(struct test *test) {
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	struct wlr_render_pass *pass =
+		wlr_output_begin_render_pass(test->output.output, &state, NULL);
+	assert(pass != NULL);
+	bool ok = wlr_render_pass_submit(pass);
+	assert(ok);
+
+	ok = wlr_output_commit_state(test->output.output, &state);
+	assert(ok);
+	wlr_output_state_finish(&state);
+}
+
+// Commits a frame and returns the time between its presentation and the next
+// frame event, in milliseconds. The headless backend never sends the frame
+// event less than a refresh period after the presentation time, so frame
+// pacing always targets a later vblank.
+static double commit_and_wait(struct test *test) {
+	commit_frame(test);
+
+	// The present event is emitted before the frame event
+	int presents = test->output.presents;
+	output_fixture_wait_for_frame(&test->output);
+	assert(test->output.presents > presents);
+	return timespec_diff_msec(&test->output.last_present, &test->output.last_frame);
+}
+
+static void test_frame_delayed(void) {
+	struct test test;
+	test_init(&test);
+	output_fixture_wait_for_frame(&test.output);
+
+	// Without a render duration, frames are sent right after the vblank. The
+	// headless backend never presents less than a refresh period after the
+	// commit.
+	set_frame_pacing(&test,
+		&(struct wlr_output_frame_pacing_options){ .margin_ns = 1000000 });
+	double unpaced = commit_and_wait(&test);
+	assert(unpaced >= REFRESH_MSEC);
+
+	// With a 5ms render time and a 1ms margin, the frame is sent 6ms before
+	// the vblank following the frame timer, which is at least two refresh
+	// periods after the presentation. The delay is rounded down to the
+	// millisecond and timers never fire early, so only check the lower bound.
+	wlr_output_report_render_duration(test.output.output, 5000000);
+	double paced = commit_and_wait(&test);
+	assert(paced > 2 * REFRESH_MSEC - 6 - 1);
+
+	test_finish(&test);
+}
+
+static void test_render_too_slow(void) {
+	struct test test;
+	test_init(&test);
+	output_fixture_wait_for_frame(&test.output);
+
+	// Rendering takes longer than a refresh cycle: never delay frames
+	set_frame_pacing(&test, &(struct wlr_output_frame_pacing_options){0});
+	wlr_output_report_render_duration(test.output.output, 40000000);
+	commit_and_wait(&test);
+
+	// Signal the vblank ourselves instead of waiting for the backend's: the
+	// frame event must be sent right away
+	commit_frame(&test);
+	output_fixture_wait_for_present(&test.output);
+	int frames = test.output.frames;
+	wlr_output_send_frame(test.output.output);
+	assert(test.output.frames == frames + 1);
+
+	test_finish(&test);
+}
+
+static void test_disable_while_delayed(void) {
+	struct test test;
+	test_init(&test);
+	output_fixture_wait_for_frame(&test.output);
+
+	set_frame_pacing(&test, &(struct wlr_output_frame_pacing_options){0});
+	wlr_output_report_render_duration(test.output.output, 1000000);
+	commit_and_wait(&test);
+
+	// The frame is held back until 1ms before the second vblank, stop right
+	// after the first one. The deferred present event is dispatched before
+	// the loop blocks, the backend's vblank wakes it up.
+	commit_frame(&test);
+	int frames = test.output.frames;
+	output_fixture_wait_for_present(&test.output);
+
+	// Disabling pacing releases the delayed frame right away. Skip the check
+	// if the loop was too slow for the frame to be delayed at all.
+	if (test.output.frames == frames) {
+		assert(test.output.output->frame_pending);
+		set_frame_pacing(&test, NULL);
+		assert(test.output.frames == frames + 1);
+	}
+
+	test_finish(&test);
+}
+
+int main(void) {
+	test_frame_delayed();
+	test_render_too_slow();
+	test_disable_while_delayed();
+	return 0;
+}
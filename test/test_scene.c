@@ -0,0 +1,92 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_scene.h>
+
+static const float color_a[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+static const float color_b[4] = { 0.0f, 1.0f, 0.0f, 1.0f };
+static const float color_c[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+// Checks that only the rect with the given color is visible, over its whole
+// area
+static void assert_only_visible(struct wlr_scene *scene, const float color[4]) {
+	struct wlr_scene_snapshot *snapshot = wlr_scene_snapshot_create(scene, NULL);
+	assert(snapshot != NULL);
+	assert(snapshot->nodes_len == 1);
+
+	const struct wlr_scene_snapshot_node *node = &snapshot->nodes[0];
+	assert(node->type == WLR_SCENE_NODE_RECT);
+	for (size_t i = 0; i < 4; i++) {
+		assert(node->color[i] == color[i]);
+	}
+	assert(pixman_region32_n_rects(&node->visible) == 1);
+	pixman_box32_t *extents = pixman_region32_extents(&node->visible);
+	assert(extents->x1 == 0 && extents->y1 == 0 &&
+		extents->x2 == 100 && extents->y2 == 100);
+
+	wlr_scene_snapshot_unref(snapshot);
+}
+
+static void test_place_above_lowers(void) {
+	struct wlr_scene *scene = wlr_scene_create();
+	assert(scene != NULL);
+
+	// Three opaque rects on top of each other, from bottom to top
+	struct wlr_scene_rect *a = wlr_scene_rect_create(&scene->tree, 100, 100, color_a);
+	struct wlr_scene_rect *b = wlr_scene_rect_create(&scene->tree, 100, 100, color_b);
+	struct wlr_scene_rect *c = wlr_scene_rect_create(&scene->tree, 100, 100, color_c);
+	assert(a != NULL && b != NULL && c != NULL);
+	assert_only_visible(scene, color_c);
+
+	// Moving the top rect down uncovers the one which used to be below it
+	wlr_scene_node_place_above(&c->node, &a->node);
+	assert_only_visible(scene, color_b);
+
+	// Moving it back up covers everything again
+	wlr_scene_node_place_above(&c->node, &b->node);
+	assert_only_visible(scene, color_c);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+}
+
+static void test_place_below_raises(void) {
+	struct wlr_scene *scene = wlr_scene_create();
+	assert(scene != NULL);
+
+	struct wlr_scene_rect *a = wlr_scene_rect_create(&scene->tree, 100, 100, color_a);
+	struct wlr_scene_rect *b = wlr_scene_rect_create(&scene->tree, 100, 100, color_b);
+	struct wlr_scene_rect *c = wlr_scene_rect_create(&scene->tree, 100, 100, color_c);
+	assert(a != NULL && b != NULL && c != NULL);
+
+	wlr_scene_node_place_below(&c->node, &a->node);
+	assert_only_visible(scene, color_b);
+
+	wlr_scene_node_place_below(&a->node, &c->node);
+	assert_only_visible(scene, color_b);
+
+	wlr_scene_node_raise_to_top(&a->node);
+	assert_only_visible(scene, color_a);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+}
+
+static void test_destroy_during_batch(void) {
+	struct wlr_scene *scene = wlr_scene_create();
+	assert(scene != NULL);
+
+	struct wlr_scene_tree *tree = wlr_scene_tree_create(&scene->tree);
+	assert(tree != NULL);
+	struct wlr_scene_rect *a = wlr_scene_rect_create(tree, 100, 100, color_a);
+	assert(a != NULL);
+
+	// The children destroyed with the scene don't queue updates to the batch
+	wlr_scene_begin_batch(scene);
+	wlr_scene_node_set_position(&a->node, 10, 10);
+	wlr_scene_node_destroy(&scene->tree.node);
+}
+
+int main(void) {
+	test_place_above_lowers();
+	test_place_below_raises();
+	test_destroy_during_batch();
+	return 0;
+}
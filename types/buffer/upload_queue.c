@@ -0,0 +1,489 @@
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_damage_ring.h>
+#include <wlr/util/log.h>
+#include "render/pixel_format.h"
+#include "types/wlr_shm.h"
+#include "types/wlr_upload_queue.h"
+#include "util/time.h"
+
+#include "config.h"
+
+#if HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+// Maximum number of staging buffers per stream
+#define UPLOAD_STREAM_MAX_STAGING_BUFFERS 3
+
+struct upload_queue {
+	int ev_fd;
+	struct wl_event_source *event_source;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // signalled when a job is queued or on stop
+
+	// Protected by lock
+	struct wl_list pending; // upload_job.queue_link
+	struct wl_list finished; // upload_job.queue_link
+	bool stop;
+};
+
+struct upload_stream {
+	struct wlr_damage_ring ring;
+	struct wl_list staging; // upload_staging_buffer.link
+	size_t n_staging;
+	struct wl_list jobs; // upload_job.stream_link
+};
+
+struct upload_staging_buffer {
+	struct wlr_buffer base;
+	struct wl_list link; // upload_stream.staging
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+};
+
+struct upload_job {
+	struct wl_list queue_link; // upload_queue.pending or finished
+	struct wl_list stream_link; // upload_stream.jobs
+
+	struct wlr_buffer *src, *dst;
+	struct wlr_shm_mapping *src_mapping;
+	const void *src_data;
+	size_t src_stride;
+	void *dst_data;
+	size_t dst_stride;
+	uint32_t bytes_per_pixel;
+	pixman_region32_t region; // within the buffer bounds
+
+	size_t bytes;
+	int64_t submit_nsec;
+
+	upload_done_func_t done; // NULL if cancelled
+	void *data;
+};
+
+static const struct wlr_buffer_impl staging_buffer_impl;
+
+static int64_t get_current_time_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
+static struct upload_staging_buffer *staging_buffer_from_buffer(
+		struct wlr_buffer *wlr_buffer) {
+	assert(wlr_buffer->impl == &staging_buffer_impl);
+	struct upload_staging_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	return buffer;
+}
+
+static void staging_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct upload_staging_buffer *buffer = staging_buffer_from_buffer(wlr_buffer);
+	wlr_buffer_finish(wlr_buffer);
+	wl_list_remove(&buffer->link);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool staging_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct upload_staging_buffer *buffer = staging_buffer_from_buffer(wlr_buffer);
+	if (flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE) {
+		return false;
+	}
+	*data = buffer->data;
+	*format = buffer->format;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void staging_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// This space is intentionally left blank
+}
+
+static const struct wlr_buffer_impl staging_buffer_impl = {
+	.destroy = staging_buffer_destroy,
+	.begin_data_ptr_access = staging_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = staging_buffer_end_data_ptr_access,
+};
+
+static struct upload_staging_buffer *staging_buffer_create(
+		const struct wlr_pixel_format_info *info, int width, int height) {
+	struct upload_staging_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	// Keep rows 32-bit aligned, like wl_shm clients usually do
+	buffer->stride = ((size_t)width * info->bytes_per_block + 3) & ~(size_t)3;
+	buffer->data = malloc(buffer->stride * height);
+	if (buffer->data == NULL) {
+		free(buffer);
+		return NULL;
+	}
+	buffer->format = info->drm_format;
+
+	wlr_buffer_init(&buffer->base, &staging_buffer_impl, width, height);
+	wl_list_init(&buffer->link);
+
+	return buffer;
+}
+
+static void job_copy(struct upload_job *job) {
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&job->region, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		size_t offset = (size_t)rect->x1 * job->bytes_per_pixel;
+		size_t len = (size_t)(rect->x2 - rect->x1) * job->bytes_per_pixel;
+		for (int y = rect->y1; y < rect->y2; y++) {
+			memcpy((char *)job->dst_data + (size_t)y * job->dst_stride + offset,
+				(const char *)job->src_data + (size_t)y * job->src_stride + offset,
+				len);
+		}
+	}
+}
+
+static void *worker_main(void *data) {
+	struct upload_queue *queue = data;
+
+	pthread_mutex_lock(&queue->lock);
+	while (true) {
+		while (!queue->stop && wl_list_empty(&queue->pending)) {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		}
+		if (queue->stop) {
+			break;
+		}
+
+		struct upload_job *job =
+			wl_container_of(queue->pending.next, job, queue_link);
+
+		// A SIGBUS raised while reading a truncated shm buffer is handled by
+		// wlr_shm, the copy then completes with zeroes
+		pthread_mutex_unlock(&queue->lock);
+		job_copy(job);
+		pthread_mutex_lock(&queue->lock);
+
+		wl_list_remove(&job->queue_link);
+		wl_list_insert(queue->finished.prev, &job->queue_link);
+
+		uint64_t value = 1;
+		if (write(queue->ev_fd, &value, sizeof(value)) < 0) {
+			wlr_log_errno(WLR_ERROR, "write() failed");
+		}
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+static void job_cancel(struct upload_job *job) {
+	if (job->done != NULL) {
+		job->done(NULL, job->data);
+		job->done = NULL;
+	}
+	wl_list_remove(&job->stream_link);
+	wl_list_init(&job->stream_link);
+}
+
+static void job_destroy(struct upload_job *job) {
+	shm_mapping_end_access(job->src_mapping);
+	wlr_buffer_unlock(job->src);
+	wlr_buffer_unlock(job->dst);
+	wl_list_remove(&job->stream_link);
+	pixman_region32_fini(&job->region);
+	free(job);
+}
+
+static void job_complete(struct upload_job *job) {
+	// Release the source buffer before notifying the user, so that the client
+	// gets it back as early as possible
+	upload_done_func_t done = job->done;
+	void *data = job->data;
+	struct upload_event event = {
+		.latency_nsec = get_current_time_nsec() - job->submit_nsec,
+		.bytes = job->bytes,
+	};
+	job_destroy(job);
+
+	if (done != NULL) {
+		done(&event, data);
+	}
+}
+
+static int handle_eventfd_ready(int ev_fd, uint32_t mask, void *data) {
+	struct upload_queue *queue = data;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		wlr_log(WLR_ERROR, "Upload queue eventfd error");
+	}
+
+	if (mask & WL_EVENT_READABLE) {
+		uint64_t ev_fd_value;
+		if (read(ev_fd, &ev_fd_value, sizeof(ev_fd_value)) <= 0) {
+			wlr_log(WLR_ERROR, "Failed to read upload queue eventfd");
+		}
+	}
+
+	struct wl_list finished;
+	wl_list_init(&finished);
+	pthread_mutex_lock(&queue->lock);
+	wl_list_insert_list(&finished, &queue->finished);
+	wl_list_init(&queue->finished);
+	pthread_mutex_unlock(&queue->lock);
+
+	// Completion callbacks may destroy streams, which only cancels their
+	// jobs: the finished list is private and stays valid
+	struct upload_job *job, *tmp;
+	wl_list_for_each_safe(job, tmp, &finished, queue_link) {
+		wl_list_remove(&job->queue_link);
+		job_complete(job);
+	}
+
+	return 0;
+}
+
+struct upload_queue *upload_queue_create(struct wl_event_loop *loop) {
+	struct upload_queue *queue = calloc(1, sizeof(*queue));
+	if (queue == NULL) {
+		return NULL;
+	}
+
+#if HAVE_EVENTFD
+	queue->ev_fd = eventfd(0, EFD_CLOEXEC);
+	if (queue->ev_fd < 0) {
+		wlr_log_errno(WLR_ERROR, "eventfd() failed");
+	}
+#else
+	queue->ev_fd = -1;
+	wlr_log(WLR_ERROR, "eventfd() is unavailable");
+#endif
+	if (queue->ev_fd < 0) {
+		free(queue);
+		return NULL;
+	}
+
+	queue->event_source = wl_event_loop_add_fd(loop, queue->ev_fd,
+		WL_EVENT_READABLE, handle_eventfd_ready, queue);
+	if (queue->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add FD to event loop");
+		close(queue->ev_fd);
+		free(queue);
+		return NULL;
+	}
+
+	wl_list_init(&queue->pending);
+	wl_list_init(&queue->finished);
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+
+	// Asynchronous signals are handled by the event loop on the compositor
+	// thread, the worker only needs to receive synchronous ones
+	sigset_t mask, prev_mask;
+	sigfillset(&mask);
+	sigdelset(&mask, SIGBUS);
+	sigdelset(&mask, SIGSEGV);
+	sigdelset(&mask, SIGFPE);
+	sigdelset(&mask, SIGILL);
+	pthread_sigmask(SIG_SETMASK, &mask, &prev_mask);
+	int err = pthread_create(&queue->thread, NULL, worker_main, queue);
+	pthread_sigmask(SIG_SETMASK, &prev_mask, NULL);
+	if (err != 0) {
+		wlr_log(WLR_ERROR, "pthread_create failed (error %d)", err);
+		pthread_cond_destroy(&queue->cond);
+		pthread_mutex_destroy(&queue->lock);
+		wl_event_source_remove(queue->event_source);
+		close(queue->ev_fd);
+		free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+void upload_queue_destroy(struct upload_queue *queue) {
+	if (queue == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	queue->stop = true;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+	pthread_join(queue->thread, NULL);
+
+	// The worker is gone, the job lists can be accessed without locking.
+	// Finish the remaining jobs here, in submission order.
+	struct wl_list jobs;
+	wl_list_init(&jobs);
+	wl_list_insert_list(&jobs, &queue->pending);
+	wl_list_insert_list(&jobs, &queue->finished);
+	wl_list_init(&queue->pending);
+	wl_list_init(&queue->finished);
+
+	struct upload_job *job, *tmp;
+	wl_list_for_each_safe(job, tmp, &jobs, queue_link) {
+		wl_list_remove(&job->queue_link);
+		if (job->done != NULL) {
+			job_copy(job);
+		}
+		job_complete(job);
+	}
+
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->lock);
+	wl_event_source_remove(queue->event_source);
+	close(queue->ev_fd);
+	free(queue);
+}
+
+struct upload_stream *upload_stream_create(void) {
+	struct upload_stream *stream = calloc(1, sizeof(*stream));
+	if (stream == NULL) {
+		return NULL;
+	}
+
+	wlr_damage_ring_init(&stream->ring);
+	wl_list_init(&stream->staging);
+	wl_list_init(&stream->jobs);
+
+	return stream;
+}
+
+static void stream_drop_staging_buffer(struct upload_stream *stream,
+		struct upload_staging_buffer *buffer) {
+	wl_list_remove(&buffer->link);
+	wl_list_init(&buffer->link);
+	stream->n_staging--;
+	wlr_buffer_drop(&buffer->base);
+}
+
+void upload_stream_destroy(struct upload_stream *stream) {
+	if (stream == NULL) {
+		return;
+	}
+
+	// Jobs may still be in progress on the worker thread, they'll be
+	// destroyed once they complete
+	struct upload_job *job, *job_tmp;
+	wl_list_for_each_safe(job, job_tmp, &stream->jobs, stream_link) {
+		job_cancel(job);
+	}
+
+	struct upload_staging_buffer *buffer, *buffer_tmp;
+	wl_list_for_each_safe(buffer, buffer_tmp, &stream->staging, link) {
+		stream_drop_staging_buffer(stream, buffer);
+	}
+
+	wlr_damage_ring_finish(&stream->ring);
+	free(stream);
+}
+
+static struct upload_staging_buffer *stream_get_staging_buffer(
+		struct upload_stream *stream, const struct wlr_pixel_format_info *info,
+		int width, int height) {
+	struct upload_staging_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &stream->staging, link) {
+		if (buffer->base.n_locks > 0) {
+			continue;
+		}
+		if (buffer->base.width == width && buffer->base.height == height &&
+				buffer->format == info->drm_format) {
+			return buffer;
+		}
+		stream_drop_staging_buffer(stream, buffer);
+	}
+
+	if (stream->n_staging >= UPLOAD_STREAM_MAX_STAGING_BUFFERS) {
+		return NULL;
+	}
+
+	buffer = staging_buffer_create(info, width, height);
+	if (buffer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Failed to allocate staging buffer");
+		return NULL;
+	}
+	wl_list_insert(&stream->staging, &buffer->link);
+	stream->n_staging++;
+	return buffer;
+}
+
+struct wlr_buffer *upload_stream_submit(struct upload_stream *stream,
+		struct upload_queue *queue, struct wlr_buffer *buffer,
+		const pixman_region32_t *damage, upload_done_func_t done, void *data) {
+	// The staging buffers miss this damage even if the buffer ends up being
+	// used directly
+	wlr_damage_ring_add(&stream->ring, damage);
+
+	struct wlr_shm_attributes shm;
+	if (!wlr_buffer_get_shm(buffer, &shm)) {
+		return NULL;
+	}
+	const struct wlr_pixel_format_info *info = drm_get_pixel_format_info(shm.format);
+	if (info == NULL || pixel_format_info_pixels_per_block(info) != 1) {
+		return NULL;
+	}
+
+	struct upload_staging_buffer *staging =
+		stream_get_staging_buffer(stream, info, buffer->width, buffer->height);
+	if (staging == NULL) {
+		return NULL;
+	}
+
+	struct upload_job *job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		return NULL;
+	}
+
+	// Don't hold a data pointer access on the buffer while the worker reads
+	// it: the same buffer may be committed to another surface and uploaded
+	// synchronously in the meantime, or submitted again
+	uint32_t src_format;
+	job->src_mapping = shm_buffer_begin_mapping_access(buffer, &job->src_data,
+		&src_format, &job->src_stride);
+	if (job->src_mapping == NULL) {
+		free(job);
+		return NULL;
+	}
+	assert(src_format == staging->format);
+
+	job->src = wlr_buffer_lock(buffer);
+	job->dst = wlr_buffer_lock(&staging->base);
+	job->dst_data = staging->data;
+	job->dst_stride = staging->stride;
+	job->bytes_per_pixel = info->bytes_per_block;
+	job->done = done;
+	job->data = data;
+	job->submit_nsec = get_current_time_nsec();
+
+	pixman_region32_init(&job->region);
+	wlr_damage_ring_rotate_buffer(&stream->ring, &staging->base, &job->region);
+	pixman_region32_intersect_rect(&job->region, &job->region,
+		0, 0, buffer->width, buffer->height);
+
+	int n_rects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&job->region, &n_rects);
+	for (int i = 0; i < n_rects; i++) {
+		job->bytes += (size_t)(rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1) * job->bytes_per_pixel;
+	}
+
+	wl_list_insert(stream->jobs.prev, &job->stream_link);
+
+	pthread_mutex_lock(&queue->lock);
+	wl_list_insert(queue->pending.prev, &job->queue_link);
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return wlr_buffer_lock(&staging->base);
+}
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include "types/wlr_output.h"
+#include "util/time.h"
+
+// Number of render durations the prediction is based on
+#define RENDER_HISTORY_LEN 16
+
+struct wlr_output_frame_pacing {
+	int64_t margin; // ns
+
+	// Ring buffer of the last reported render durations, in nanoseconds
+	int64_t render_durations[RENDER_HISTORY_LEN];
+	size_t render_durations_len, render_durations_next;
+
+	// Last presentation time and refresh period, in nanoseconds
+	int64_t last_present;
+	int64_t refresh;
+
+	struct wl_event_source *timer;
+	bool frame_delayed;
+};
+
+static int handle_timer(void *data) {
+	struct wlr_output *output = data;
+	output->frame_pacing->frame_delayed = false;
+	output_emit_frame(output);
+	return 0;
+}
+
+static int64_t predict_render_duration(struct wlr_output_frame_pacing *pacing) {
+	// Be conservative: missing a vblank costs a whole refresh cycle
+	int64_t duration = 0;
+	for (size_t i = 0; i < pacing->render_durations_len; i++) {
+		if (pacing->render_durations[i] > duration) {
+			duration = pacing->render_durations[i];
+		}
+	}
+	return duration;
+}
+
+bool output_frame_pacing_delay_frame(struct wlr_output *output) {
+	struct wlr_output_frame_pacing *pacing = output->frame_pacing;
+	if (pacing == NULL || !output->enabled || pacing->refresh <= 0 ||
+			pacing->render_durations_len == 0 ||
+			output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+		return false;
+	}
+
+	struct timespec now_ts;
+	clock_gettime(CLOCK_MONOTONIC, &now_ts);
+	int64_t now = timespec_to_nsec(&now_ts);
+
+	int64_t elapsed = now - pacing->last_present;
+	if (elapsed < 0) {
+		elapsed = 0;
+	}
+	int64_t next_vblank = pacing->last_present +
+		(elapsed / pacing->refresh + 1) * pacing->refresh;
+	int64_t deadline = next_vblank - predict_render_duration(pacing) - pacing->margin;
+
+	// The timer has a millisecond granularity: round down, so that the frame
+	// is sent early rather than late
+	int64_t delay_ms = (deadline - now) / 1000000;
+	if (delay_ms <= 0) {
+		return false;
+	}
+
+	if (wl_event_source_timer_update(pacing->timer, delay_ms) != 0) {
+		wlr_log(WLR_ERROR, "Failed to arm frame pacing timer");
+		return false;
+	}
+	pacing->frame_delayed = true;
+	output->frame_pending = true;
+	return true;
+}
+
+void output_frame_pacing_cancel(struct wlr_output *output) {
+	struct wlr_output_frame_pacing *pacing = output->frame_pacing;
+	if (pacing == NULL || !pacing->frame_delayed) {
+		return;
+	}
+	wl_event_source_timer_update(pacing->timer, 0);
+	pacing->frame_delayed = false;
+}
+
+void output_frame_pacing_handle_present(struct wlr_output *output,
+		const struct wlr_output_event_present *event) {
+	struct wlr_output_frame_pacing *pacing = output->frame_pacing;
+	if (pacing == NULL) {
+		return;
+	}
+
+	pacing->last_present = timespec_to_nsec(&event->when);
+	if (event->refresh > 0) {
+		pacing->refresh = event->refresh;
+	} else if (output->refresh > 0) {
+		pacing->refresh = 1000000000000 / output->refresh;
+	} else {
+		pacing->refresh = 0;
+	}
+}
+
+void output_frame_pacing_destroy(struct wlr_output *output) {
+	struct wlr_output_frame_pacing *pacing = output->frame_pacing;
+	if (pacing == NULL) {
+		return;
+	}
+	wl_event_source_remove(pacing->timer);
+	free(pacing);
+	output->frame_pacing = NULL;
+}
+
+bool wlr_output_set_frame_pacing(struct wlr_output *output,
+		const struct wlr_output_frame_pacing_options *options) {
+	struct wlr_output_frame_pacing *pacing = output->frame_pacing;
+	if (options == NULL) {
+		bool frame_delayed = pacing != NULL && pacing->frame_delayed;
+		output_frame_pacing_destroy(output);
+		if (frame_delayed) {
+			output_emit_frame(output);
+		}
+		return true;
+	}
+
+	if (pacing == NULL) {
+		pacing = calloc(1, sizeof(*pacing));
+		if (pacing == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+		pacing->timer = wl_event_loop_add_timer(output->event_loop,
+			handle_timer, output);
+		if (pacing->timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create frame pacing timer");
+			free(pacing);
+			return false;
+		}
+		output->frame_pacing = pacing;
+	}
+
+	pacing->margin = options->margin_ns;
+	return true;
+}
+
+void wlr_output_report_render_duration(struct wlr_output *output,
+		int64_t duration_ns) {
+	struct wlr_output_frame_pacing *pacing = output->frame_pacing;
+	if (pacing == NULL || duration_ns < 0) {
+		return;
+	}
+
+	pacing->render_durations[pacing->render_durations_next] = duration_ns;
+	pacing->render_durations_next =
+		(pacing->render_durations_next + 1) % RENDER_HISTORY_LEN;
+	if (pacing->render_durations_len < RENDER_HISTORY_LEN) {
+		pacing->render_durations_len++;
+	}
+}
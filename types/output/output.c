@@ -434,6 +434,8 @@ void wlr_output_finish(struct wlr_output *output) {
 		wl_event_source_remove(output->idle_frame);
 	}
 
+	output_frame_pacing_destroy(output);
+
 	if (output->idle_done != NULL) {
 		wl_event_source_remove(output->idle_done);
 	}
@@ -786,6 +788,8 @@ void output_apply_commit(struct wlr_output *output, const struct wlr_output_stat
 	output->commit_seq++;
 
 	if (output_pending_enabled(output, state)) {
+		// The backend will send a new frame event once this commit is done
+		output_frame_pacing_cancel(output);
 		output->frame_pending = true;
 		output->needs_frame = false;
 	}
@@ -844,13 +848,20 @@ bool wlr_output_commit_state(struct wlr_output *output,
 	return true;
 }
 
-void wlr_output_send_frame(struct wlr_output *output) {
+void output_emit_frame(struct wlr_output *output) {
 	output->frame_pending = false;
 	if (output->enabled) {
 		wl_signal_emit_mutable(&output->events.frame, output);
 	}
 }
 
+void wlr_output_send_frame(struct wlr_output *output) {
+	if (output_frame_pacing_delay_frame(output)) {
+		return;
+	}
+	output_emit_frame(output);
+}
+
 static void schedule_frame_handle_idle_timer(void *data) {
 	struct wlr_output *output = data;
 	output->idle_frame = NULL;
@@ -888,6 +899,10 @@ void wlr_output_send_present(struct wlr_output *output,
 		}
 	}
 
+	if (event->presented) {
+		output_frame_pacing_handle_present(output, event);
+	}
+
 	wl_signal_emit_mutable(&output->events.present, event);
 }
 
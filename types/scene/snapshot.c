@@ -0,0 +1,306 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/render/drm_syncobj.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_scene.h>
+#include "types/wlr_scene.h"
+
+#ifdef __STDC_NO_ATOMICS__
+#error "C11 atomics are required"
+#endif
+
+struct scene_snapshot {
+	struct wlr_scene_snapshot base;
+	struct wlr_scene_snapshot_cache *cache;
+
+	atomic_size_t n_refs;
+	// Captures the whole scene rather than a box
+	bool whole;
+	// Link in wlr_scene_snapshot_cache.released
+	struct scene_snapshot *next_released;
+
+	struct wlr_scene_snapshot_node nodes[];
+};
+
+struct wlr_scene_snapshot_cache {
+	// Last snapshot created, NULL once something changed in its box. The cache
+	// holds a reference.
+	struct scene_snapshot *current;
+	// Snapshots whose last reference was dropped, only destroyed on the
+	// compositor thread
+	_Atomic(struct scene_snapshot *) released;
+	// Snapshots not destroyed yet
+	size_t n_snapshots;
+};
+
+static struct scene_snapshot *scene_snapshot_from_snapshot(
+		struct wlr_scene_snapshot *snapshot) {
+	struct scene_snapshot *scene_snapshot = wl_container_of(snapshot, scene_snapshot, base);
+	return scene_snapshot;
+}
+
+static void snapshot_node_finish(struct wlr_scene_snapshot_node *node) {
+	pixman_region32_fini(&node->visible);
+	wlr_buffer_unlock(node->buffer);
+	wlr_drm_syncobj_timeline_unref(node->wait_timeline);
+}
+
+static void scene_snapshot_destroy(struct scene_snapshot *snapshot) {
+	for (size_t i = 0; i < snapshot->base.nodes_len; i++) {
+		snapshot_node_finish(&snapshot->nodes[i]);
+	}
+	snapshot->cache->n_snapshots--;
+	free(snapshot);
+}
+
+static bool scene_snapshot_drop(struct scene_snapshot *snapshot) {
+	return atomic_fetch_sub_explicit(&snapshot->n_refs, 1, memory_order_acq_rel) == 1;
+}
+
+static void cache_collect(struct wlr_scene_snapshot_cache *cache) {
+	struct scene_snapshot *snapshot = atomic_exchange_explicit(&cache->released,
+		NULL, memory_order_acquire);
+	while (snapshot != NULL) {
+		struct scene_snapshot *next = snapshot->next_released;
+		scene_snapshot_destroy(snapshot);
+		snapshot = next;
+	}
+}
+
+static void cache_drop_current(struct wlr_scene_snapshot_cache *cache) {
+	if (cache->current == NULL) {
+		return;
+	}
+	// We're on the compositor thread, no need to defer the destruction
+	if (scene_snapshot_drop(cache->current)) {
+		scene_snapshot_destroy(cache->current);
+	}
+	cache->current = NULL;
+}
+
+void scene_snapshot_cache_invalidate(struct wlr_scene *scene,
+		const pixman_region32_t *region) {
+	struct wlr_scene_snapshot_cache *cache = scene->snapshot_cache;
+	if (cache == NULL || cache->current == NULL) {
+		return;
+	}
+
+	const struct wlr_box *box = &cache->current->base.box;
+	pixman_box32_t snapshot_box = {
+		.x1 = box->x,
+		.y1 = box->y,
+		.x2 = box->x + box->width,
+		.y2 = box->y + box->height,
+	};
+	if (cache->current->whole || pixman_region32_contains_rectangle(region,
+			&snapshot_box) != PIXMAN_REGION_OUT) {
+		cache_drop_current(cache);
+	}
+}
+
+void scene_snapshot_cache_collect(struct wlr_scene *scene) {
+	if (scene->snapshot_cache != NULL) {
+		cache_collect(scene->snapshot_cache);
+	}
+}
+
+void scene_snapshot_cache_destroy(struct wlr_scene *scene) {
+	struct wlr_scene_snapshot_cache *cache = scene->snapshot_cache;
+	if (cache == NULL) {
+		return;
+	}
+
+	cache_drop_current(cache);
+	cache_collect(cache);
+	assert(cache->n_snapshots == 0);
+	free(cache);
+	scene->snapshot_cache = NULL;
+}
+
+static bool snapshot_add_node(struct wl_array *nodes, struct wlr_scene_node *node,
+		int lx, int ly, const struct wlr_box *box) {
+	if (!node->enabled) {
+		return true;
+	}
+
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &tree->children, link) {
+			if (!snapshot_add_node(nodes, child, lx + child->x, ly + child->y, box)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	struct wlr_scene_snapshot_node snapshot_node = {
+		.type = node->type,
+		.box = { .x = lx, .y = ly },
+	};
+	scene_node_get_size(node, &snapshot_node.box.width, &snapshot_node.box.height);
+
+	if (node->type == WLR_SCENE_NODE_RECT) {
+		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
+		if (scene_rect->color[3] == 0) {
+			return true;
+		}
+		memcpy(snapshot_node.color, scene_rect->color, sizeof(snapshot_node.color));
+	} else {
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+		if (scene_buffer->buffer == NULL && scene_buffer->texture == NULL) {
+			return true;
+		}
+		snapshot_node.src_box = scene_buffer->src_box;
+		snapshot_node.transform = scene_buffer->transform;
+		snapshot_node.opacity = scene_buffer->opacity;
+		snapshot_node.filter_mode = scene_buffer->filter_mode;
+		snapshot_node.wait_point = scene_buffer->wait_point;
+	}
+
+	pixman_region32_init(&snapshot_node.visible);
+	if (box != NULL) {
+		pixman_region32_intersect_rect(&snapshot_node.visible, &node->visible,
+			box->x, box->y, box->width, box->height);
+	} else {
+		pixman_region32_copy(&snapshot_node.visible, &node->visible);
+	}
+	if (pixman_region32_empty(&snapshot_node.visible)) {
+		pixman_region32_fini(&snapshot_node.visible);
+		return true;
+	}
+
+	struct wlr_scene_snapshot_node *entry = wl_array_add(nodes, sizeof(*entry));
+	if (entry == NULL) {
+		pixman_region32_fini(&snapshot_node.visible);
+		return false;
+	}
+
+	if (node->type == WLR_SCENE_NODE_BUFFER) {
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+		if (scene_buffer->buffer != NULL) {
+			snapshot_node.buffer = wlr_buffer_lock(scene_buffer->buffer);
+		}
+		if (scene_buffer->wait_timeline != NULL) {
+			snapshot_node.wait_timeline =
+				wlr_drm_syncobj_timeline_ref(scene_buffer->wait_timeline);
+		}
+	}
+	*entry = snapshot_node;
+	return true;
+}
+
+static void snapshot_get_bounds(const struct scene_snapshot *snapshot,
+		struct wlr_box *box) {
+	*box = (struct wlr_box){0};
+	if (snapshot->base.nodes_len == 0) {
+		return;
+	}
+
+	pixman_region32_t bounds;
+	pixman_region32_init(&bounds);
+	for (size_t i = 0; i < snapshot->base.nodes_len; i++) {
+		pixman_region32_union(&bounds, &bounds, &snapshot->nodes[i].visible);
+	}
+	const pixman_box32_t *extents = pixman_region32_extents(&bounds);
+	*box = (struct wlr_box){
+		.x = extents->x1,
+		.y = extents->y1,
+		.width = extents->x2 - extents->x1,
+		.height = extents->y2 - extents->y1,
+	};
+	pixman_region32_fini(&bounds);
+}
+
+struct wlr_scene_snapshot *wlr_scene_snapshot_create(struct wlr_scene *scene,
+		const struct wlr_box *box) {
+	assert(scene->batch_depth == 0);
+
+	if (scene->snapshot_cache == NULL) {
+		scene->snapshot_cache = calloc(1, sizeof(*scene->snapshot_cache));
+		if (scene->snapshot_cache == NULL) {
+			return NULL;
+		}
+	}
+	struct wlr_scene_snapshot_cache *cache = scene->snapshot_cache;
+	cache_collect(cache);
+
+	struct scene_snapshot *current = cache->current;
+	if (current != NULL && (box == NULL ? current->whole :
+			!current->whole && wlr_box_equal(&current->base.box, box))) {
+		return wlr_scene_snapshot_ref(&current->base);
+	}
+
+	struct wl_array nodes;
+	wl_array_init(&nodes);
+	if (!snapshot_add_node(&nodes, &scene->tree.node,
+			scene->tree.node.x, scene->tree.node.y, box)) {
+		goto error_nodes;
+	}
+
+	struct scene_snapshot *snapshot = malloc(sizeof(*snapshot) + nodes.size);
+	if (snapshot == NULL) {
+		goto error_nodes;
+	}
+	*snapshot = (struct scene_snapshot){
+		.cache = cache,
+		.whole = box == NULL,
+		.base = {
+			.nodes = snapshot->nodes,
+			.nodes_len = nodes.size / sizeof(struct wlr_scene_snapshot_node),
+		},
+	};
+	atomic_init(&snapshot->n_refs, 2);
+	if (nodes.size > 0) {
+		memcpy(snapshot->nodes, nodes.data, nodes.size);
+	}
+	wl_array_release(&nodes);
+
+	if (box != NULL) {
+		snapshot->base.box = *box;
+	} else {
+		snapshot_get_bounds(snapshot, &snapshot->base.box);
+	}
+
+	cache->n_snapshots++;
+	cache_drop_current(cache);
+	// One reference for the caller, one for the cache
+	cache->current = snapshot;
+	return &snapshot->base;
+
+error_nodes:;
+	struct wlr_scene_snapshot_node *node;
+	wl_array_for_each(node, &nodes) {
+		snapshot_node_finish(node);
+	}
+	wl_array_release(&nodes);
+	return NULL;
+}
+
+struct wlr_scene_snapshot *wlr_scene_snapshot_ref(struct wlr_scene_snapshot *snapshot) {
+	struct scene_snapshot *scene_snapshot = scene_snapshot_from_snapshot(snapshot);
+	atomic_fetch_add_explicit(&scene_snapshot->n_refs, 1, memory_order_relaxed);
+	return snapshot;
+}
+
+void wlr_scene_snapshot_unref(struct wlr_scene_snapshot *snapshot) {
+	if (snapshot == NULL) {
+		return;
+	}
+
+	struct scene_snapshot *scene_snapshot = scene_snapshot_from_snapshot(snapshot);
+	if (!scene_snapshot_drop(scene_snapshot)) {
+		return;
+	}
+
+	// This may not be the compositor thread, hand the snapshot over to it
+	struct wlr_scene_snapshot_cache *cache = scene_snapshot->cache;
+	struct scene_snapshot *head = atomic_load_explicit(&cache->released,
+		memory_order_relaxed);
+	do {
+		scene_snapshot->next_released = head;
+	} while (!atomic_compare_exchange_weak_explicit(&cache->released, &head,
+		scene_snapshot, memory_order_release, memory_order_relaxed));
+}
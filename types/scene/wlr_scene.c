@@ -21,7 +21,9 @@
 #include "types/wlr_scene.h"
 #include "util/array.h"
 #include "util/env.h"
+#include "util/rect_union.h"
 #include "util/time.h"
+#include "util/worker_pool.h"
 
 #include <wlr/config.h>
 
@@ -66,6 +68,18 @@ struct wlr_scene *scene_node_get_root(struct wlr_scene_node *node) {
 	return scene;
 }
 
+/**
+ * Mark the cached bounds of all trees containing this node as stale. The
+ * bounds are lazily re-computed the next time they're queried.
+ */
+static void scene_node_invalidate_bounds(struct wlr_scene_node *node) {
+	struct wlr_scene_tree *tree = node->parent;
+	while (tree != NULL && !tree->bounds_dirty) {
+		tree->bounds_dirty = true;
+		tree = tree->node.parent;
+	}
+}
+
 static void scene_node_init(struct wlr_scene_node *node,
 		enum wlr_scene_node_type type, struct wlr_scene_tree *parent) {
 	*node = (struct wlr_scene_node){
@@ -92,6 +106,17 @@ struct highlight_region {
 	struct wl_list link;
 };
 
+struct wlr_scene_batch {
+	struct rect_union update_region;
+	struct rect_union damage;
+};
+
+static void scene_batch_destroy(struct wlr_scene_batch *batch) {
+	rect_union_finish(&batch->update_region);
+	rect_union_finish(&batch->damage);
+	free(batch);
+}
+
 static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_buffer *buffer);
 static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
@@ -135,6 +160,15 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 			wl_list_remove(&scene->linux_dmabuf_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_set_gamma.link);
+
+			// Children destroyed below must not queue updates to the batch
+			if (scene->batch != NULL) {
+				scene_batch_destroy(scene->batch);
+				scene->batch = NULL;
+			}
+			scene->batch_depth = 0;
+			worker_pool_destroy(scene->worker_pool);
+			scene_snapshot_cache_destroy(scene);
 		} else {
 			assert(node->parent);
 		}
@@ -187,6 +221,17 @@ struct wlr_scene *wlr_scene_create(void) {
 	scene->direct_scanout = !env_parse_bool("WLR_SCENE_DISABLE_DIRECT_SCANOUT");
 	scene->calculate_visibility = !env_parse_bool("WLR_SCENE_DISABLE_VISIBILITY");
 	scene->highlight_transparent_region = env_parse_bool("WLR_SCENE_HIGHLIGHT_TRANSPARENT_REGION");
+	scene->spatial_index = !env_parse_bool("WLR_SCENE_DISABLE_SPATIAL_INDEX");
+
+	// The caller's thread builds output states too
+	size_t threads = env_parse_threads("WLR_SCENE_THREADS");
+	if (threads > 1) {
+		scene->worker_pool = worker_pool_create(threads - 1);
+		if (scene->worker_pool == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create scene threads, "
+				"building output states on a single thread");
+		}
+	}
 
 	return scene;
 }
@@ -203,11 +248,89 @@ struct wlr_scene_tree *wlr_scene_tree_create(struct wlr_scene_tree *parent) {
 	return tree;
 }
 
+/**
+ * Grow dest so that it also covers box. Empty boxes are ignored.
+ */
+static void box_union(struct wlr_box *dest, const struct wlr_box *box) {
+	if (wlr_box_empty(box)) {
+		return;
+	}
+	if (wlr_box_empty(dest)) {
+		*dest = *box;
+		return;
+	}
+
+	int x1 = dest->x < box->x ? dest->x : box->x;
+	int y1 = dest->y < box->y ? dest->y : box->y;
+	int x2 = dest->x + dest->width > box->x + box->width ?
+		dest->x + dest->width : box->x + box->width;
+	int y2 = dest->y + dest->height > box->y + box->height ?
+		dest->y + dest->height : box->y + box->height;
+	*dest = (struct wlr_box){
+		.x = x1,
+		.y = y1,
+		.width = x2 - x1,
+		.height = y2 - y1,
+	};
+}
+
+static void scene_node_get_bounds(struct wlr_scene_node *node, struct wlr_box *box);
+
+static const struct wlr_box *scene_tree_get_bounds(struct wlr_scene_tree *tree) {
+	if (!tree->bounds_dirty) {
+		return &tree->bounds;
+	}
+
+	tree->bounds = (struct wlr_box){0};
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &tree->children, link) {
+		if (!child->enabled) {
+			continue;
+		}
+
+		struct wlr_box child_box;
+		scene_node_get_bounds(child, &child_box);
+		child_box.x += child->x;
+		child_box.y += child->y;
+		box_union(&tree->bounds, &child_box);
+	}
+
+	tree->bounds_dirty = false;
+	return &tree->bounds;
+}
+
+/**
+ * Check whether any enabled descendant of the tree at the given layout
+ * coordinates can intersect the box.
+ */
+static bool scene_tree_intersects(struct wlr_scene_tree *tree, int lx, int ly,
+		const struct wlr_box *box) {
+	struct wlr_box bounds = *scene_tree_get_bounds(tree);
+	bounds.x += lx;
+	bounds.y += ly;
+	return wlr_box_intersects(&bounds, box);
+}
+
+/**
+ * Get the box covering the node and all of its enabled descendants, relative
+ * to the node's position.
+ */
+static void scene_node_get_bounds(struct wlr_scene_node *node, struct wlr_box *box) {
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		*box = *scene_tree_get_bounds(wlr_scene_tree_from_node(node));
+		return;
+	}
+
+	*box = (struct wlr_box){0};
+	scene_node_get_size(node, &box->width, &box->height);
+}
+
 typedef bool (*scene_node_box_iterator_func_t)(struct wlr_scene_node *node,
 	int sx, int sy, void *data);
 
 static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
-		scene_node_box_iterator_func_t iterator, void *user_data, int lx, int ly) {
+		scene_node_box_iterator_func_t iterator, void *user_data, int lx, int ly,
+		bool spatial_index) {
 	if (!node->enabled) {
 		return false;
 	}
@@ -215,9 +338,15 @@ static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:;
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		if (spatial_index && !scene_tree_intersects(scene_tree, lx, ly, box)) {
+			// None of the children can intersect, skip the whole sub-tree
+			break;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each_reverse(child, &scene_tree->children, link) {
-			if (_scene_nodes_in_box(child, box, iterator, user_data, lx + child->x, ly + child->y)) {
+			if (_scene_nodes_in_box(child, box, iterator, user_data,
+					lx + child->x, ly + child->y, spatial_index)) {
 				return true;
 			}
 		}
@@ -242,7 +371,9 @@ static bool scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
 	int x, y;
 	wlr_scene_node_coords(node, &x, &y);
 
-	return _scene_nodes_in_box(node, box, iterator, user_data, x, y);
+	struct wlr_scene *scene = scene_node_get_root(node);
+	return _scene_nodes_in_box(node, box, iterator, user_data, x, y,
+		scene->spatial_index);
 }
 
 static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
@@ -286,6 +417,11 @@ struct scene_update_data {
 	bool calculate_visibility;
 	bool restack_xwayland_surfaces;
 
+	// Topmost node whose visibility may have changed, cleared once the
+	// iterator reaches it. Nodes above it only occlude what's below.
+	struct wlr_scene_node *first_changed;
+	uint64_t *visibility_updates;
+
 #if WLR_HAS_XWAYLAND
 	struct wlr_xwayland_surface *restack_above;
 #endif
@@ -383,6 +519,26 @@ static void scene_output_damage_whole(struct wlr_scene_output *scene_output) {
 	pixman_region32_fini(&damage);
 }
 
+static void scene_invalidate_render_lists(struct wlr_scene *scene,
+		const pixman_region32_t *region) {
+	scene_snapshot_cache_invalidate(scene, region);
+
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		const struct wlr_box *box = &scene_output->render_list_box;
+		pixman_box32_t list_box = {
+			.x1 = box->x,
+			.y1 = box->y,
+			.x2 = box->x + box->width,
+			.y2 = box->y + box->height,
+		};
+		if (pixman_region32_contains_rectangle(region,
+				&list_box) != PIXMAN_REGION_OUT) {
+			scene_output->render_list_dirty = true;
+		}
+	}
+}
+
 static void scene_damage_outputs(struct wlr_scene *scene, const pixman_region32_t *damage) {
 	if (pixman_region32_empty(damage)) {
 		return;
@@ -554,6 +710,43 @@ static void restack_xwayland_surface(struct wlr_scene_node *node,
 }
 #endif
 
+static bool scene_node_is_descendant(struct wlr_scene_node *node,
+		struct wlr_scene_node *ancestor) {
+	while (node != ancestor) {
+		if (node->parent == NULL) {
+			return false;
+		}
+		node = &node->parent->node;
+	}
+	return true;
+}
+
+/**
+ * The new visible region of a node is its previous visible region outside
+ * of the update region, plus whatever is still uncovered inside of it. It
+ * can only differ from the previous one if either part touches the node.
+ */
+static bool scene_node_visibility_may_change(struct wlr_scene_node *node,
+		const struct wlr_box *box, struct scene_update_data *data) {
+	pixman_box32_t node_box = {
+		.x1 = box->x,
+		.y1 = box->y,
+		.x2 = box->x + box->width,
+		.y2 = box->y + box->height,
+	};
+	if (pixman_region32_contains_rectangle(data->visible,
+			&node_box) != PIXMAN_REGION_OUT) {
+		return true;
+	}
+
+	if (pixman_region32_empty(&node->visible)) {
+		return false;
+	}
+
+	return pixman_region32_contains_rectangle(data->update_region,
+		pixman_region32_extents(&node->visible)) != PIXMAN_REGION_OUT;
+}
+
 static bool scene_node_update_iterator(struct wlr_scene_node *node,
 		int lx, int ly, void *_data) {
 	struct scene_update_data *data = _data;
@@ -561,12 +754,27 @@ static bool scene_node_update_iterator(struct wlr_scene_node *node,
 	struct wlr_box box = { .x = lx, .y = ly };
 	scene_node_get_size(node, &box.width, &box.height);
 
-	pixman_region32_subtract(&node->visible, &node->visible, data->update_region);
-	pixman_region32_union(&node->visible, &node->visible, data->visible);
-	pixman_region32_intersect_rect(&node->visible, &node->visible,
-		lx, ly, box.width, box.height);
+	if (data->first_changed != NULL &&
+			scene_node_is_descendant(node, data->first_changed)) {
+		data->first_changed = NULL;
+	}
+
+	// Nodes above the first changed node keep their visibility. Below it,
+	// only nodes which are either uncovered or lose visible area are updated.
+	if (data->first_changed == NULL &&
+			scene_node_visibility_may_change(node, &box, data)) {
+		pixman_region32_subtract(&node->visible, &node->visible, data->update_region);
+		pixman_region32_union(&node->visible, &node->visible, data->visible);
+		pixman_region32_intersect_rect(&node->visible, &node->visible,
+			lx, ly, box.width, box.height);
 
-	if (data->calculate_visibility) {
+		update_node_update_outputs(node, data->outputs, NULL, NULL);
+		(*data->visibility_updates)++;
+	}
+
+	// Once the update region is fully occluded there is nothing left to
+	// subtract from
+	if (data->calculate_visibility && !pixman_region32_empty(data->visible)) {
 		pixman_region32_t opaque;
 		pixman_region32_init(&opaque);
 		scene_node_opaque_region(node, lx, ly, &opaque);
@@ -574,7 +782,6 @@ static bool scene_node_update_iterator(struct wlr_scene_node *node,
 		pixman_region32_fini(&opaque);
 	}
 
-	update_node_update_outputs(node, data->outputs, NULL, NULL);
 #if WLR_HAS_XWAYLAND
 	if (data->restack_xwayland_surfaces) {
 		restack_xwayland_surface(node, &box, data);
@@ -622,8 +829,14 @@ static void scene_node_bounds(struct wlr_scene_node *node,
 	pixman_region32_union_rect(visible, visible, x, y, width, height);
 }
 
+/**
+ * Updates the visibility and outputs of the nodes intersecting the update
+ * region. If first_changed is given, the nodes stacked above it are assumed
+ * to be unaffected by the update.
+ */
 static void scene_update_region(struct wlr_scene *scene,
-		const pixman_region32_t *update_region) {
+		const pixman_region32_t *update_region,
+		struct wlr_scene_node *first_changed) {
 	pixman_region32_t visible;
 	pixman_region32_init(&visible);
 	pixman_region32_copy(&visible, update_region);
@@ -641,14 +854,49 @@ static void scene_update_region(struct wlr_scene *scene,
 		.outputs = &scene->outputs,
 		.calculate_visibility = scene->calculate_visibility,
 		.restack_xwayland_surfaces = scene->restack_xwayland_surfaces,
+		.first_changed = first_changed,
+		.visibility_updates = &scene->stats.visibility_updates,
 	};
 
+	scene_invalidate_render_lists(scene, update_region);
+
 	// update node visibility and output enter/leave events
 	scene_nodes_in_box(&scene->tree.node, &data.update_box, scene_node_update_iterator, &data);
 
 	pixman_region32_fini(&visible);
 }
 
+static void rect_union_add_region(struct rect_union *r,
+		const pixman_region32_t *region) {
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		rect_union_add(r, &rects[i]);
+	}
+}
+
+/**
+ * If a batch is in progress, queue the update of the given region to be
+ * applied once the batch is committed and return true.
+ */
+static bool scene_batch_queue_update(struct wlr_scene *scene,
+		const pixman_region32_t *update_region, const pixman_region32_t *damage) {
+	struct wlr_scene_batch *batch = scene->batch;
+	if (batch == NULL) {
+		return false;
+	}
+
+	// Nodes in the render lists may be destroyed before the batch is
+	// committed
+	scene_invalidate_render_lists(scene, update_region);
+
+	rect_union_add_region(&batch->update_region, update_region);
+	if (damage != NULL) {
+		rect_union_add_region(&batch->damage, damage);
+	}
+	return true;
+}
+
 static void scene_node_cleanup_when_disabled(struct wlr_scene_node *node,
 		bool xwayland_restack, struct wl_list *outputs) {
 	if (node->type == WLR_SCENE_NODE_TREE) {
@@ -693,11 +941,17 @@ static void scene_node_cleanup_when_disabled(struct wlr_scene_node *node,
  * scenarios like updating the color or whatever. However, it's not what we want
  * when disabling the node. Note that reparenting the node could lead to the node
  * being reparented to a disabled super tree.
+ *
+ * Without explicit damage, only the node and what's stacked below it are
+ * updated, unless the node was just lowered: the nodes which used to be
+ * below it are then stacked above it and may have been uncovered.
  */
-static void scene_node_update(struct wlr_scene_node *node,
-		pixman_region32_t *damage) {
+static void _scene_node_update(struct wlr_scene_node *node,
+		pixman_region32_t *damage, bool lowered) {
 	struct wlr_scene *scene = scene_node_get_root(node);
 
+	scene_node_invalidate_bounds(node);
+
 	int x, y;
 	if (!wlr_scene_node_coords(node, &x, &y)) {
 		// We assume explicit damage on a disabled tree means the node was just
@@ -705,14 +959,24 @@ static void scene_node_update(struct wlr_scene_node *node,
 		if (damage) {
 			scene_node_cleanup_when_disabled(node, scene->restack_xwayland_surfaces, &scene->outputs);
 
-			scene_update_region(scene, damage);
-			scene_damage_outputs(scene, damage);
+			if (!scene_batch_queue_update(scene, damage, damage)) {
+				scene_update_region(scene, damage, NULL);
+				scene_damage_outputs(scene, damage);
+			}
 			pixman_region32_fini(damage);
 		}
 
 		return;
 	}
 
+	// A node without any area is never reached by the update iterator
+	struct wlr_scene_node *first_changed = NULL;
+	struct wlr_box bounds;
+	scene_node_get_bounds(node, &bounds);
+	if (!damage && !lowered && !wlr_box_empty(&bounds)) {
+		first_changed = node;
+	}
+
 	pixman_region32_t visible;
 	if (!damage) {
 		pixman_region32_init(&visible);
@@ -725,7 +989,15 @@ static void scene_node_update(struct wlr_scene_node *node,
 	pixman_region32_copy(&update_region, damage);
 	scene_node_bounds(node, x, y, &update_region);
 
-	scene_update_region(scene, &update_region);
+	// The new visibility of the node isn't known until the batch is
+	// committed, damage everything it may cover instead
+	if (scene_batch_queue_update(scene, &update_region, &update_region)) {
+		pixman_region32_fini(&update_region);
+		pixman_region32_fini(damage);
+		return;
+	}
+
+	scene_update_region(scene, &update_region, first_changed);
 	pixman_region32_fini(&update_region);
 
 	scene_node_visibility(node, damage);
@@ -733,6 +1005,45 @@ static void scene_node_update(struct wlr_scene_node *node,
 	pixman_region32_fini(damage);
 }
 
+static void scene_node_update(struct wlr_scene_node *node,
+		pixman_region32_t *damage) {
+	_scene_node_update(node, damage, false);
+}
+
+void wlr_scene_begin_batch(struct wlr_scene *scene) {
+	if (scene->batch_depth++ > 0) {
+		return;
+	}
+
+	struct wlr_scene_batch *batch = calloc(1, sizeof(*batch));
+	if (batch == NULL) {
+		// Changes will be applied right away instead
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	rect_union_init(&batch->update_region);
+	rect_union_init(&batch->damage);
+	scene->batch = batch;
+}
+
+void wlr_scene_commit_batch(struct wlr_scene *scene) {
+	assert(scene->batch_depth > 0);
+	if (--scene->batch_depth > 0) {
+		return;
+	}
+
+	struct wlr_scene_batch *batch = scene->batch;
+	if (batch == NULL) {
+		return;
+	}
+	scene->batch = NULL;
+
+	scene_update_region(scene, rect_union_evaluate(&batch->update_region), NULL);
+	scene_damage_outputs(scene, rect_union_evaluate(&batch->damage));
+	scene_batch_destroy(batch);
+}
+
 struct wlr_scene_rect *wlr_scene_rect_create(struct wlr_scene_tree *parent,
 		int width, int height, const float color[static 4]) {
 	assert(parent);
@@ -782,10 +1093,19 @@ static void scene_buffer_handle_buffer_release(struct wl_listener *listener,
 	scene_buffer->buffer = NULL;
 	wl_list_remove(&scene_buffer->buffer_release.link);
 	wl_list_init(&scene_buffer->buffer_release.link);
+
+	if (scene_buffer->texture == NULL) {
+		// The node has nothing left to render
+		scene_invalidate_render_lists(scene_node_get_root(&scene_buffer->node),
+			&scene_buffer->node.visible);
+	}
 }
 
 static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 		struct wlr_buffer *buffer) {
+	int prev_width = scene_buffer->buffer_width;
+	int prev_height = scene_buffer->buffer_height;
+
 	wl_list_remove(&scene_buffer->buffer_release.link);
 	wl_list_init(&scene_buffer->buffer_release.link);
 	if (scene_buffer->own_buffer) {
@@ -796,24 +1116,32 @@ static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	scene_buffer->buffer_width = scene_buffer->buffer_height = 0;
 	scene_buffer->buffer_is_opaque = false;
 
-	if (!buffer) {
-		return;
-	}
+	if (buffer) {
+		scene_buffer->own_buffer = true;
+		scene_buffer->buffer = wlr_buffer_lock(buffer);
+		scene_buffer->buffer_width = buffer->width;
+		scene_buffer->buffer_height = buffer->height;
+		scene_buffer->buffer_is_opaque = wlr_buffer_is_opaque(buffer);
 
-	scene_buffer->own_buffer = true;
-	scene_buffer->buffer = wlr_buffer_lock(buffer);
-	scene_buffer->buffer_width = buffer->width;
-	scene_buffer->buffer_height = buffer->height;
-	scene_buffer->buffer_is_opaque = wlr_buffer_is_opaque(buffer);
+		scene_buffer->buffer_release.notify = scene_buffer_handle_buffer_release;
+		wl_signal_add(&buffer->events.release, &scene_buffer->buffer_release);
+	}
 
-	scene_buffer->buffer_release.notify = scene_buffer_handle_buffer_release;
-	wl_signal_add(&buffer->events.release, &scene_buffer->buffer_release);
+	if (scene_buffer->buffer_width != prev_width ||
+			scene_buffer->buffer_height != prev_height) {
+		scene_node_invalidate_bounds(&scene_buffer->node);
+	}
 }
 
 static void scene_buffer_handle_renderer_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_scene_buffer *scene_buffer = wl_container_of(listener, scene_buffer, renderer_destroy);
 	scene_buffer_set_texture(scene_buffer, NULL);
+
+	if (scene_buffer->buffer == NULL) {
+		scene_invalidate_render_lists(scene_node_get_root(&scene_buffer->node),
+			&scene_buffer->node.visible);
+	}
 }
 
 static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
@@ -899,6 +1227,7 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 	// Cache that so we can still apply rendering optimisations even when
 	// the original buffer has been freed after texture upload.
 	if (buffer != scene_buffer->buffer) {
+		bool prev_single_pixel_buffer = scene_buffer->is_single_pixel_buffer;
 		scene_buffer->is_single_pixel_buffer = false;
 		struct wlr_client_buffer *client_buffer = NULL;
 		if (buffer != NULL) {
@@ -915,12 +1244,20 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 				scene_buffer->single_pixel_buffer_color[3] = single_pixel_buffer->a;
 			}
 		}
+
+		// Black single-pixel buffers are left out of the render lists
+		if (prev_single_pixel_buffer || scene_buffer->is_single_pixel_buffer) {
+			scene_invalidate_render_lists(scene_node_get_root(&scene_buffer->node),
+				&scene_buffer->node.visible);
+		}
 	}
 
 	scene_buffer_set_buffer(scene_buffer, buffer);
 	scene_buffer_set_texture(scene_buffer, NULL);
 	scene_buffer_set_wait_timeline(scene_buffer,
 		options->wait_timeline, options->wait_point);
+	scene_snapshot_cache_invalidate(scene_node_get_root(&scene_buffer->node),
+		&scene_buffer->node.visible);
 
 	if (update) {
 		scene_node_update(&scene_buffer->node, NULL);
@@ -1048,7 +1385,10 @@ void wlr_scene_buffer_set_opaque_region(struct wlr_scene_buffer *scene_buffer,
 	pixman_region32_t update_region;
 	pixman_region32_init(&update_region);
 	scene_node_bounds(&scene_buffer->node, x, y, &update_region);
-	scene_update_region(scene_node_get_root(&scene_buffer->node), &update_region);
+	struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
+	if (!scene_batch_queue_update(scene, &update_region, NULL)) {
+		scene_update_region(scene, &update_region, &scene_buffer->node);
+	}
 	pixman_region32_fini(&update_region);
 }
 
@@ -1242,9 +1582,19 @@ void wlr_scene_node_place_above(struct wlr_scene_node *node,
 		return;
 	}
 
+	// The node is lowered if the sibling used to be stacked below it
+	bool lowered = false;
+	for (struct wl_list *link = node->link.prev;
+			link != &node->parent->children; link = link->prev) {
+		if (link == &sibling->link) {
+			lowered = true;
+			break;
+		}
+	}
+
 	wl_list_remove(&node->link);
 	wl_list_insert(&sibling->link, &node->link);
-	scene_node_update(node, NULL);
+	_scene_node_update(node, NULL, lowered);
 }
 
 void wlr_scene_node_place_below(struct wlr_scene_node *node,
@@ -1258,7 +1608,7 @@ void wlr_scene_node_place_below(struct wlr_scene_node *node,
 
 	wl_list_remove(&node->link);
 	wl_list_insert(sibling->link.prev, &node->link);
-	scene_node_update(node, NULL);
+	_scene_node_update(node, NULL, true);
 }
 
 void wlr_scene_node_raise_to_top(struct wlr_scene_node *node) {
@@ -1300,6 +1650,7 @@ void wlr_scene_node_reparent(struct wlr_scene_node *node,
 		scene_node_visibility(node, &visible);
 	}
 
+	scene_node_invalidate_bounds(node);
 	wl_list_remove(&node->link);
 	node->parent = new_parent;
 	wl_list_insert(new_parent->children.prev, &node->link);
@@ -1421,35 +1772,59 @@ static float get_luminance_multiplier(const struct wlr_color_luminances *src_lum
 	return (dst_lum->reference / src_lum->reference) * (src_lum->max / dst_lum->max);
 }
 
-static void scene_entry_render(struct render_list_entry *entry, const struct render_data *data) {
+/**
+ * Regions of a render list entry to render, computed before the entry is added
+ * to the render pass.
+ */
+struct render_list_clip {
+	// Empty if the entry doesn't need to be rendered
+	pixman_region32_t render_region;
+	// Part of the render region not covered by the opaque region of the node
+	pixman_region32_t transparent;
+	struct wlr_box dst_box;
+};
+
+static void render_list_clip_init(struct render_list_clip *clip,
+		const struct render_list_entry *entry, const struct render_data *data) {
 	struct wlr_scene_node *node = entry->node;
 
-	pixman_region32_t render_region;
-	pixman_region32_init(&render_region);
-	pixman_region32_copy(&render_region, &node->visible);
-	pixman_region32_translate(&render_region, -data->logical.x, -data->logical.y);
-	logical_to_buffer_coords(&render_region, data, true);
-	pixman_region32_intersect(&render_region, &render_region, &data->damage);
-	if (pixman_region32_empty(&render_region)) {
-		pixman_region32_fini(&render_region);
+	pixman_region32_init(&clip->render_region);
+	pixman_region32_init(&clip->transparent);
+
+	pixman_region32_copy(&clip->render_region, &node->visible);
+	pixman_region32_translate(&clip->render_region, -data->logical.x, -data->logical.y);
+	logical_to_buffer_coords(&clip->render_region, data, true);
+	pixman_region32_intersect(&clip->render_region, &clip->render_region, &data->damage);
+	if (pixman_region32_empty(&clip->render_region)) {
 		return;
 	}
 
 	int x = entry->x - data->logical.x;
 	int y = entry->y - data->logical.y;
 
-	struct wlr_box dst_box = {
+	clip->dst_box = (struct wlr_box){
 		.x = x,
 		.y = y,
 	};
-	scene_node_get_size(node, &dst_box.width, &dst_box.height);
-	transform_output_box(&dst_box, data);
+	scene_node_get_size(node, &clip->dst_box.width, &clip->dst_box.height);
+	transform_output_box(&clip->dst_box, data);
 
-	pixman_region32_t opaque;
-	pixman_region32_init(&opaque);
-	scene_node_opaque_region(node, x, y, &opaque);
-	logical_to_buffer_coords(&opaque, data, false);
-	pixman_region32_subtract(&opaque, &render_region, &opaque);
+	scene_node_opaque_region(node, x, y, &clip->transparent);
+	logical_to_buffer_coords(&clip->transparent, data, false);
+	pixman_region32_subtract(&clip->transparent, &clip->render_region, &clip->transparent);
+}
+
+static void render_list_clip_finish(struct render_list_clip *clip) {
+	pixman_region32_fini(&clip->transparent);
+	pixman_region32_fini(&clip->render_region);
+}
+
+static void scene_entry_render(struct render_list_entry *entry,
+		const struct render_list_clip *clip, const struct render_data *data) {
+	struct wlr_scene_node *node = entry->node;
+	if (pixman_region32_empty(&clip->render_region)) {
+		return;
+	}
 
 	switch (node->type) {
 	case WLR_SCENE_NODE_TREE:
@@ -1459,14 +1834,14 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 		struct wlr_scene_rect *scene_rect = wlr_scene_rect_from_node(node);
 
 		wlr_render_pass_add_rect(data->render_pass, &(struct wlr_render_rect_options){
-			.box = dst_box,
+			.box = clip->dst_box,
 			.color = {
 				.r = scene_rect->color[0],
 				.g = scene_rect->color[1],
 				.b = scene_rect->color[2],
 				.a = scene_rect->color[3],
 			},
-			.clip = &render_region,
+			.clip = &clip->render_region,
 		});
 		break;
 	case WLR_SCENE_NODE_BUFFER:;
@@ -1475,7 +1850,7 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 		if (scene_buffer->is_single_pixel_buffer) {
 			// Render the buffer as a rect, this is likely to be more efficient
 			wlr_render_pass_add_rect(data->render_pass, &(struct wlr_render_rect_options){
-				.box = dst_box,
+				.box = clip->dst_box,
 				.color = {
 					.r = (float)scene_buffer->single_pixel_buffer_color[0] / (float)UINT32_MAX,
 					.g = (float)scene_buffer->single_pixel_buffer_color[1] / (float)UINT32_MAX,
@@ -1483,7 +1858,7 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 					.a = (float)scene_buffer->single_pixel_buffer_color[3] /
 						(float)UINT32_MAX * scene_buffer->opacity,
 				},
-				.clip = &render_region,
+				.clip = &clip->render_region,
 			});
 			break;
 		}
@@ -1491,7 +1866,7 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 		struct wlr_texture *texture = scene_buffer_get_texture(scene_buffer,
 			data->output->output->renderer);
 		if (texture == NULL) {
-			scene_output_damage(data->output, &render_region);
+			scene_output_damage(data->output, &clip->render_region);
 			break;
 		}
 
@@ -1514,13 +1889,13 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
 			.texture = texture,
 			.src_box = scene_buffer->src_box,
-			.dst_box = dst_box,
+			.dst_box = clip->dst_box,
 			.transform = transform,
-			.clip = &render_region,
+			.clip = &clip->render_region,
 			.alpha = &scene_buffer->opacity,
 			.filter_mode = scene_buffer->filter_mode,
 			.blend_mode = !data->output->scene->calculate_visibility ||
-					!pixman_region32_empty(&opaque) ?
+					!pixman_region32_empty(&clip->transparent) ?
 				WLR_RENDER_BLEND_MODE_PREMULTIPLIED : WLR_RENDER_BLEND_MODE_NONE,
 			.transfer_function = scene_buffer->transfer_function,
 			.primaries = scene_buffer->primaries != 0 ? &primaries : NULL,
@@ -1541,17 +1916,15 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 
 		if (entry->highlight_transparent_region) {
 			wlr_render_pass_add_rect(data->render_pass, &(struct wlr_render_rect_options){
-				.box = dst_box,
+				.box = clip->dst_box,
 				.color = { .r = 0, .g = 0.3, .b = 0, .a = 0.3 },
-				.clip = &opaque,
+				.clip = &clip->transparent,
 			});
 		}
 
 		break;
 	}
 
-	pixman_region32_fini(&opaque);
-	pixman_region32_fini(&render_region);
 }
 
 static void scene_handle_linux_dmabuf_v1_destroy(struct wl_listener *listener,
@@ -1712,14 +2085,28 @@ static const struct wlr_addon_interface output_addon_impl = {
 	.destroy = scene_output_handle_destroy,
 };
 
+/**
+ * Update the active outputs of all buffers below the node. If box is
+ * non-NULL, only nodes which intersect it are considered.
+ */
 static void scene_node_output_update(struct wlr_scene_node *node,
+		int lx, int ly, const struct wlr_box *box,
 		struct wl_list *outputs, struct wlr_scene_output *ignore,
 		struct wlr_scene_output *force) {
 	if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+
+		// Disabled nodes have an empty visible region, so they can't be
+		// displayed on any output
+		if (box != NULL && (!node->enabled ||
+				!scene_tree_intersects(scene_tree, lx, ly, box))) {
+			return;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
-			scene_node_output_update(child, outputs, ignore, force);
+			scene_node_output_update(child, lx + child->x, ly + child->y,
+				box, outputs, ignore, force);
 		}
 		return;
 	}
@@ -1727,12 +2114,36 @@ static void scene_node_output_update(struct wlr_scene_node *node,
 	update_node_update_outputs(node, outputs, ignore, force);
 }
 
+/**
+ * Update the active outputs of all buffers in the scene after the output's
+ * geometry or state changed.
+ */
+static void scene_output_update_node_outputs(struct wlr_scene_output *scene_output,
+		struct wlr_scene_output *ignore, struct wlr_scene_output *force) {
+	struct wlr_scene *scene = scene_output->scene;
+
+	struct wlr_box geometry = { .x = scene_output->x, .y = scene_output->y };
+	wlr_output_effective_resolution(scene_output->output,
+		&geometry.width, &geometry.height);
+
+	// Buffers whose visible region intersects neither the previous nor the
+	// current output geometry can't have their outputs changed
+	struct wlr_box update_box = scene_output->geometry;
+	box_union(&update_box, &geometry);
+	scene_output->geometry = geometry;
+
+	struct wlr_scene_node *root = &scene->tree.node;
+	scene_node_output_update(root, root->x, root->y,
+		scene->spatial_index ? &update_box : NULL,
+		&scene->outputs, ignore, force);
+}
+
 static void scene_output_update_geometry(struct wlr_scene_output *scene_output,
 		bool force_update) {
 	scene_output_damage_whole(scene_output);
 
-	scene_node_output_update(&scene_output->scene->tree.node,
-			&scene_output->scene->outputs, NULL, force_update ? scene_output : NULL);
+	scene_output_update_node_outputs(scene_output, NULL,
+		force_update ? scene_output : NULL);
 }
 
 static void scene_output_handle_commit(struct wl_listener *listener, void *data) {
@@ -1775,6 +2186,9 @@ static void scene_output_handle_commit(struct wl_listener *listener, void *data)
 			!scene_output->output->enabled) {
 		scene_output->gamma_lut_changed = true;
 	}
+
+	// Unlock the buffers of the snapshots released from other threads
+	scene_snapshot_cache_collect(scene_output->scene);
 }
 
 static void scene_output_handle_damage(struct wl_listener *listener, void *data) {
@@ -1815,6 +2229,7 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 	wlr_damage_ring_init(&scene_output->damage_ring);
 	pixman_region32_init(&scene_output->pending_commit_damage);
 	wl_list_init(&scene_output->damage_highlight_regions);
+	scene_output->render_list_dirty = true;
 
 	int prev_output_index = -1;
 	struct wl_list *prev_output_link = &scene->outputs;
@@ -1874,8 +2289,7 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 
 	wl_signal_emit_mutable(&scene_output->events.destroy, NULL);
 
-	scene_node_output_update(&scene_output->scene->tree.node,
-		&scene_output->scene->outputs, scene_output, NULL);
+	scene_output_update_node_outputs(scene_output, scene_output, NULL);
 
 	assert(wl_list_empty(&scene_output->events.destroy.listener_list));
 
@@ -2350,98 +2764,153 @@ cleanup_transforms:
 	return result;
 }
 
-bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
-		struct wlr_output_state *state, const struct wlr_scene_output_state_options *options) {
-	struct wlr_scene_output_state_options default_options = {0};
-	if (!options) {
-		options = &default_options;
-	}
-	struct wlr_scene_timer *timer = options->timer;
+/**
+ * An output state being built. Frames go through stages alternately run on the
+ * caller's thread, which may modify anything, and on the scene's worker
+ * threads, which only read the scene graph and only write to their own frame
+ * and render list.
+ */
+struct scene_output_frame {
+	struct wlr_scene_output *scene_output;
+	struct wlr_output_state *state;
+	const struct wlr_scene_output_state_options *options;
+
+	// Set once no stage is left to run for the frame
+	bool done, ok;
+
 	struct timespec start_time;
+	bool render_gamma_lut;
+	int resolution_width, resolution_height;
+	struct render_data render_data;
+	struct render_list_constructor_data list_con;
+	bool build_render_list;
+	struct timespec now;
+
+	struct wlr_buffer *buffer;
+	pixman_region32_t background;
+	struct render_list_clip *clips; // one per render list entry
+};
+
+static void scene_output_frame_begin(struct scene_output_frame *frame) {
+	struct wlr_scene_output *scene_output = frame->scene_output;
+	struct wlr_output_state *state = frame->state;
+	const struct wlr_scene_output_state_options *options = frame->options;
+
+	struct wlr_scene_timer *timer = options->timer;
 	if (timer) {
-		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		clock_gettime(CLOCK_MONOTONIC, &frame->start_time);
 		wlr_scene_timer_finish(timer);
 		*timer = (struct wlr_scene_timer){0};
 	}
 
 	if ((state->committed & WLR_OUTPUT_STATE_ENABLED) && !state->enabled) {
 		// if the state is being disabled, do nothing.
-		return true;
+		frame->done = frame->ok = true;
+		return;
 	}
 
 	struct wlr_output *output = scene_output->output;
-	enum wlr_scene_debug_damage_option debug_damage =
-		scene_output->scene->debug_damage_option;
 
-	bool render_gamma_lut = false;
 	if (wlr_output_get_gamma_size(output) == 0 && output->renderer->features.output_color_transform) {
 		if (scene_output->gamma_lut_color_transform != scene_output->prev_gamma_lut_color_transform) {
 			scene_output_damage_whole(scene_output);
 		}
 		if (scene_output->gamma_lut_color_transform != NULL) {
-			render_gamma_lut = true;
+			frame->render_gamma_lut = true;
 		}
 	}
 
-	struct render_data render_data = {
+	struct render_data *render_data = &frame->render_data;
+	*render_data = (struct render_data){
 		.transform = output->transform,
 		.scale = output->scale,
 		.logical = { .x = scene_output->x, .y = scene_output->y },
 		.output = scene_output,
 	};
 
-	int resolution_width, resolution_height;
 	output_pending_resolution(output, state,
-		&resolution_width, &resolution_height);
+		&frame->resolution_width, &frame->resolution_height);
 
 	if (state->committed & WLR_OUTPUT_STATE_TRANSFORM) {
-		if (render_data.transform != state->transform) {
+		if (render_data->transform != state->transform) {
 			scene_output_damage_whole(scene_output);
 		}
 
-		render_data.transform = state->transform;
+		render_data->transform = state->transform;
 	}
 
 	if (state->committed & WLR_OUTPUT_STATE_SCALE) {
-		if (render_data.scale != state->scale) {
+		if (render_data->scale != state->scale) {
 			scene_output_damage_whole(scene_output);
 		}
 
-		render_data.scale = state->scale;
+		render_data->scale = state->scale;
 	}
 
-	render_data.trans_width = resolution_width;
-	render_data.trans_height = resolution_height;
-	wlr_output_transform_coords(render_data.transform,
-		&render_data.trans_width, &render_data.trans_height);
+	render_data->trans_width = frame->resolution_width;
+	render_data->trans_height = frame->resolution_height;
+	wlr_output_transform_coords(render_data->transform,
+		&render_data->trans_width, &render_data->trans_height);
 
-	render_data.logical.width = render_data.trans_width / render_data.scale;
-	render_data.logical.height = render_data.trans_height / render_data.scale;
+	render_data->logical.width = render_data->trans_width / render_data->scale;
+	render_data->logical.height = render_data->trans_height / render_data->scale;
 
-	struct render_list_constructor_data list_con = {
-		.box = render_data.logical,
+	frame->list_con = (struct render_list_constructor_data){
+		.box = render_data->logical,
 		.render_list = &scene_output->render_list,
 		.calculate_visibility = scene_output->scene->calculate_visibility,
 		.highlight_transparent_region = scene_output->scene->highlight_transparent_region,
-		.fractional_scale = floor(render_data.scale) != render_data.scale,
+		.fractional_scale = floor(render_data->scale) != render_data->scale,
 	};
 
-	list_con.render_list->size = 0;
-	scene_nodes_in_box(&scene_output->scene->tree.node, &list_con.box,
-		construct_render_list_iterator, &list_con);
-	array_realloc(list_con.render_list, list_con.render_list->size);
+	// Frames which only carry content damage can re-use the previous list
+	frame->build_render_list = scene_output->render_list_dirty ||
+		!wlr_box_equal(&scene_output->render_list_box, &frame->list_con.box) ||
+		scene_output->render_list_fractional_scale != frame->list_con.fractional_scale;
+}
+
+static void scene_output_frame_build_render_list(size_t index, void *data) {
+	struct scene_output_frame *frame = &((struct scene_output_frame *)data)[index];
+	if (frame->done || !frame->build_render_list) {
+		return;
+	}
+
+	struct render_list_constructor_data *list_con = &frame->list_con;
+	list_con->render_list->size = 0;
+	scene_nodes_in_box(&frame->scene_output->scene->tree.node, &list_con->box,
+		construct_render_list_iterator, list_con);
+	array_realloc(list_con->render_list, list_con->render_list->size);
+}
+
+static void scene_output_frame_begin_pass(struct scene_output_frame *frame) {
+	struct wlr_scene_output *scene_output = frame->scene_output;
+	struct wlr_output_state *state = frame->state;
+	const struct wlr_scene_output_state_options *options = frame->options;
+	struct render_data *render_data = &frame->render_data;
+	struct render_list_constructor_data *list_con = &frame->list_con;
+	struct wlr_scene_timer *timer = options->timer;
+
+	struct wlr_output *output = scene_output->output;
+	enum wlr_scene_debug_damage_option debug_damage =
+		scene_output->scene->debug_damage_option;
+
+	if (frame->build_render_list) {
+		scene_output->render_list_box = list_con->box;
+		scene_output->render_list_fractional_scale = list_con->fractional_scale;
+		scene_output->render_list_dirty = false;
+		scene_output->scene->stats.render_list_builds++;
+	}
 
-	struct render_list_entry *list_data = list_con.render_list->data;
-	int list_len = list_con.render_list->size / sizeof(*list_data);
+	struct render_list_entry *list_data = list_con->render_list->data;
+	int list_len = list_con->render_list->size / sizeof(*list_data);
 
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_RERENDER) {
 		scene_output_damage_whole(scene_output);
 	}
 
-	struct timespec now;
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
 		struct wl_list *regions = &scene_output->damage_highlight_regions;
-		clock_gettime(CLOCK_MONOTONIC, &now);
+		clock_gettime(CLOCK_MONOTONIC, &frame->now);
 
 		// add the current frame's damage if there is damage
 		if (!pixman_region32_empty(&scene_output->damage_ring.current)) {
@@ -2450,7 +2919,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 				pixman_region32_init(&current_damage->region);
 				pixman_region32_copy(&current_damage->region,
 					&scene_output->damage_ring.current);
-				current_damage->when = now;
+				current_damage->when = frame->now;
 				wl_list_insert(regions, &current_damage->link);
 			}
 		}
@@ -2465,7 +2934,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 			// if this damage is too old or has nothing in it, get rid of it
 			struct timespec time_diff;
-			timespec_sub(&time_diff, &now, &damage->when);
+			timespec_sub(&time_diff, &frame->now, &damage->when);
 			if (timespec_to_msec(&time_diff) >= HIGHLIGHT_DAMAGE_FADEOUT_TIME ||
 					pixman_region32_empty(&damage->region)) {
 				highlight_region_destroy(damage);
@@ -2490,9 +2959,9 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	// - There are no color transforms that need to be applied
 	// - Damage highlight debugging is not enabled
 	enum scene_direct_scanout_result scanout_result = SCANOUT_INELIGIBLE;
-	if (options->color_transform == NULL && !render_gamma_lut && list_len == 1
+	if (options->color_transform == NULL && !frame->render_gamma_lut && list_len == 1
 			&& debug_damage != WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
-		scanout_result = scene_entry_try_direct_scanout(&list_data[0], state, &render_data);
+		scanout_result = scene_entry_try_direct_scanout(&list_data[0], state, render_data);
 	}
 
 	if (scanout_result == SCANOUT_INELIGIBLE) {
@@ -2519,16 +2988,18 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		if (timer) {
 			struct timespec end_time, duration;
 			clock_gettime(CLOCK_MONOTONIC, &end_time);
-			timespec_sub(&duration, &end_time, &start_time);
+			timespec_sub(&duration, &end_time, &frame->start_time);
 			timer->pre_render_duration = timespec_to_nsec(&duration);
 		}
-		return true;
+		frame->done = frame->ok = true;
+		return;
 	}
 
 	struct wlr_swapchain *swapchain = options->swapchain;
 	if (!swapchain) {
 		if (!wlr_output_configure_primary_swapchain(output, state, &output->swapchain)) {
-			return false;
+			frame->done = true;
+			return;
 		}
 
 		swapchain = output->swapchain;
@@ -2536,30 +3007,43 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	struct wlr_buffer *buffer = wlr_swapchain_acquire(swapchain);
 	if (buffer == NULL) {
-		return false;
+		frame->done = true;
+		return;
 	}
 
-	assert(buffer->width == resolution_width && buffer->height == resolution_height);
+	assert(buffer->width == frame->resolution_width &&
+		buffer->height == frame->resolution_height);
 
 	if (timer) {
 		timer->render_timer = wlr_render_timer_create(output->renderer);
 
 		struct timespec end_time, duration;
 		clock_gettime(CLOCK_MONOTONIC, &end_time);
-		timespec_sub(&duration, &end_time, &start_time);
+		timespec_sub(&duration, &end_time, &frame->start_time);
 		timer->pre_render_duration = timespec_to_nsec(&duration);
 	}
 
-	if ((render_gamma_lut
+	if ((frame->render_gamma_lut
 			&& scene_output->gamma_lut_color_transform != scene_output->prev_gamma_lut_color_transform)
 			|| scene_output->prev_supplied_color_transform != options->color_transform
 			|| (state->committed & WLR_OUTPUT_STATE_IMAGE_DESCRIPTION)) {
 		const struct wlr_output_image_description *output_description =
 			output_pending_image_description(output, state);
 		if (!scene_output_combine_color_transforms(scene_output, options->color_transform,
-				output_description, render_gamma_lut)) {
+				output_description, frame->render_gamma_lut)) {
 			wlr_buffer_unlock(buffer);
-			return false;
+			frame->done = true;
+			return;
+		}
+	}
+
+	struct render_list_clip *clips = NULL;
+	if (list_len > 0) {
+		clips = calloc(list_len, sizeof(*clips));
+		if (clips == NULL) {
+			wlr_buffer_unlock(buffer);
+			frame->done = true;
+			return;
 		}
 	}
 
@@ -2572,19 +3056,36 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		.signal_point = scene_output->in_point,
 	});
 	if (render_pass == NULL) {
+		free(clips);
 		wlr_buffer_unlock(buffer);
-		return false;
+		frame->done = true;
+		return;
 	}
 
-	render_data.render_pass = render_pass;
+	render_data->render_pass = render_pass;
+	frame->buffer = buffer;
+	frame->clips = clips;
 
-	pixman_region32_init(&render_data.damage);
+	pixman_region32_init(&render_data->damage);
 	wlr_damage_ring_rotate_buffer(&scene_output->damage_ring, buffer,
-		&render_data.damage);
+		&render_data->damage);
 
-	pixman_region32_t background;
-	pixman_region32_init(&background);
-	pixman_region32_copy(&background, &render_data.damage);
+	pixman_region32_init(&frame->background);
+	pixman_region32_copy(&frame->background, &render_data->damage);
+}
+
+static void scene_output_frame_clip(size_t index, void *data) {
+	struct scene_output_frame *frame = &((struct scene_output_frame *)data)[index];
+	if (frame->done) {
+		return;
+	}
+
+	struct wlr_scene_output *scene_output = frame->scene_output;
+	struct render_data *render_data = &frame->render_data;
+	pixman_region32_t *background = &frame->background;
+
+	struct render_list_entry *list_data = frame->list_con.render_list->data;
+	int list_len = frame->list_con.render_list->size / sizeof(*list_data);
 
 	// Cull areas of the background that are occluded by opaque regions of
 	// scene nodes above. Those scene nodes will just render atop having us
@@ -2604,30 +3105,47 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			pixman_region32_intersect(&opaque, &opaque, &entry->node->visible);
 
 			pixman_region32_translate(&opaque, -scene_output->x, -scene_output->y);
-			logical_to_buffer_coords(&opaque, &render_data, false);
-			pixman_region32_subtract(&background, &background, &opaque);
+			logical_to_buffer_coords(&opaque, render_data, false);
+			pixman_region32_subtract(background, background, &opaque);
 			pixman_region32_fini(&opaque);
 		}
 
-		if (floor(render_data.scale) != render_data.scale) {
-			wlr_region_expand(&background, &background, 1);
+		if (floor(render_data->scale) != render_data->scale) {
+			wlr_region_expand(background, background, 1);
 
 			// reintersect with the damage because we never want to render
 			// outside of the damage region
-			pixman_region32_intersect(&background, &background, &render_data.damage);
+			pixman_region32_intersect(background, background, &render_data->damage);
 		}
 	}
 
+	for (int i = 0; i < list_len; i++) {
+		render_list_clip_init(&frame->clips[i], &list_data[i], render_data);
+	}
+}
+
+static void scene_output_frame_render(struct scene_output_frame *frame) {
+	struct wlr_scene_output *scene_output = frame->scene_output;
+	struct wlr_output_state *state = frame->state;
+	struct render_data *render_data = &frame->render_data;
+	struct wlr_render_pass *render_pass = render_data->render_pass;
+	struct wlr_buffer *buffer = frame->buffer;
+	struct wlr_output *output = scene_output->output;
+
+	struct render_list_entry *list_data = frame->list_con.render_list->data;
+	int list_len = frame->list_con.render_list->size / sizeof(*list_data);
+
 	wlr_render_pass_add_rect(render_pass, &(struct wlr_render_rect_options){
 		.box = { .width = buffer->width, .height = buffer->height },
 		.color = { .r = 0, .g = 0, .b = 0, .a = 1 },
-		.clip = &background,
+		.clip = &frame->background,
 	});
-	pixman_region32_fini(&background);
+	pixman_region32_fini(&frame->background);
 
 	for (int i = list_len - 1; i >= 0; i--) {
 		struct render_list_entry *entry = &list_data[i];
-		scene_entry_render(entry, &render_data);
+		scene_entry_render(entry, &frame->clips[i], render_data);
+		render_list_clip_finish(&frame->clips[i]);
 
 		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
 			struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(entry->node);
@@ -2646,12 +3164,13 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			}
 		}
 	}
+	free(frame->clips);
 
-	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
+	if (scene_output->scene->debug_damage_option == WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT) {
 		struct highlight_region *damage;
 		wl_list_for_each(damage, &scene_output->damage_highlight_regions, link) {
 			struct timespec time_diff;
-			timespec_sub(&time_diff, &now, &damage->when);
+			timespec_sub(&time_diff, &frame->now, &damage->when);
 			int64_t time_diff_ms = timespec_to_msec(&time_diff);
 			float alpha = 1.0 - (double)time_diff_ms / HIGHLIGHT_DAMAGE_FADEOUT_TIME;
 
@@ -2663,8 +3182,10 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		}
 	}
 
-	wlr_output_add_software_cursors_to_render_pass(output, render_pass, &render_data.damage);
-	pixman_region32_fini(&render_data.damage);
+	wlr_output_add_software_cursors_to_render_pass(output, render_pass, &render_data->damage);
+	pixman_region32_fini(&render_data->damage);
+
+	frame->done = true;
 
 	if (!wlr_render_pass_submit(render_pass)) {
 		wlr_buffer_unlock(buffer);
@@ -2672,7 +3193,7 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		// if we failed to render the buffer, it will have undefined contents
 		// Trash the damage ring
 		wlr_damage_ring_add_whole(&scene_output->damage_ring);
-		return false;
+		return;
 	}
 
 	wlr_output_state_set_buffer(state, buffer);
@@ -2686,11 +3207,104 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 			scene_output->out_point);
 	}
 
-	if (!render_gamma_lut) {
+	if (!frame->render_gamma_lut) {
 		scene_output_state_attempt_gamma(scene_output, state);
 	}
 
-	return true;
+	frame->ok = true;
+}
+
+/**
+ * Run a stage of the frames, on the worker threads of the scene if any.
+ */
+static void scene_run_output_frames(struct wlr_scene *scene,
+		struct scene_output_frame *frames, size_t frames_len,
+		worker_pool_func_t func) {
+	if (scene->worker_pool != NULL && frames_len > 1) {
+		worker_pool_run(scene->worker_pool, frames_len, func, frames);
+		return;
+	}
+
+	for (size_t i = 0; i < frames_len; i++) {
+		func(i, frames);
+	}
+}
+
+static void scene_build_output_frames(struct wlr_scene *scene,
+		struct scene_output_frame *frames, size_t frames_len) {
+	for (size_t i = 0; i < frames_len; i++) {
+		scene_output_frame_begin(&frames[i]);
+	}
+
+	if (scene->worker_pool != NULL && scene->spatial_index) {
+		// Tree bounds are computed lazily when traversing the scene, which
+		// worker threads must not do
+		scene_tree_get_bounds(&scene->tree);
+	}
+	scene_run_output_frames(scene, frames, frames_len,
+		scene_output_frame_build_render_list);
+
+	for (size_t i = 0; i < frames_len; i++) {
+		if (!frames[i].done) {
+			scene_output_frame_begin_pass(&frames[i]);
+		}
+	}
+
+	scene_run_output_frames(scene, frames, frames_len, scene_output_frame_clip);
+
+	for (size_t i = 0; i < frames_len; i++) {
+		if (!frames[i].done) {
+			scene_output_frame_render(&frames[i]);
+		}
+	}
+}
+
+static const struct wlr_scene_output_state_options default_state_options = {0};
+
+bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state, const struct wlr_scene_output_state_options *options) {
+	struct scene_output_frame frame = {
+		.scene_output = scene_output,
+		.state = state,
+		.options = options != NULL ? options : &default_state_options,
+	};
+	scene_build_output_frames(scene_output->scene, &frame, 1);
+	return frame.ok;
+}
+
+bool wlr_scene_build_output_states(struct wlr_scene *scene,
+		struct wlr_scene_output_build_job *jobs, size_t jobs_len) {
+	struct scene_output_frame *frames = calloc(jobs_len, sizeof(*frames));
+	if (frames == NULL && jobs_len > 0) {
+		for (size_t i = 0; i < jobs_len; i++) {
+			jobs[i].ok = false;
+		}
+		return false;
+	}
+
+	for (size_t i = 0; i < jobs_len; i++) {
+		struct wlr_scene_output_build_job *job = &jobs[i];
+		assert(job->scene_output->scene == scene);
+		for (size_t j = 0; j < i; j++) {
+			assert(jobs[j].scene_output != job->scene_output);
+		}
+
+		frames[i] = (struct scene_output_frame){
+			.scene_output = job->scene_output,
+			.state = job->state,
+			.options = job->options != NULL ? job->options : &default_state_options,
+		};
+	}
+
+	scene_build_output_frames(scene, frames, jobs_len);
+
+	bool ok = true;
+	for (size_t i = 0; i < jobs_len; i++) {
+		jobs[i].ok = frames[i].ok;
+		ok = ok && frames[i].ok;
+	}
+	free(frames);
+	return ok;
 }
 
 int64_t wlr_scene_timer_get_duration_ns(struct wlr_scene_timer *timer) {
@@ -2738,7 +3352,7 @@ void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
 }
 
 static void scene_output_for_each_scene_buffer(const struct wlr_box *output_box,
-		struct wlr_scene_node *node, int lx, int ly,
+		struct wlr_scene_node *node, int lx, int ly, bool spatial_index,
 		wlr_scene_buffer_iterator_func_t user_iterator, void *user_data) {
 	if (!node->enabled) {
 		return;
@@ -2758,10 +3372,14 @@ static void scene_output_for_each_scene_buffer(const struct wlr_box *output_box,
 		}
 	} else if (node->type == WLR_SCENE_NODE_TREE) {
 		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		if (spatial_index && !scene_tree_intersects(scene_tree, lx, ly, output_box)) {
+			return;
+		}
+
 		struct wlr_scene_node *child;
 		wl_list_for_each(child, &scene_tree->children, link) {
 			scene_output_for_each_scene_buffer(output_box, child, lx, ly,
-				user_iterator, user_data);
+				spatial_index, user_iterator, user_data);
 		}
 	}
 }
@@ -2772,5 +3390,5 @@ void wlr_scene_output_for_each_buffer(struct wlr_scene_output *scene_output,
 	wlr_output_effective_resolution(scene_output->output,
 		&box.width, &box.height);
 	scene_output_for_each_scene_buffer(&box, &scene_output->scene->tree.node, 0, 0,
-		iterator, user_data);
+		scene_output->scene->spatial_index, iterator, user_data);
 }
@@ -13,6 +13,7 @@
 #include "types/wlr_buffer.h"
 #include "types/wlr_region.h"
 #include "types/wlr_subcompositor.h"
+#include "types/wlr_upload_queue.h"
 #include "util/array.h"
 #include "util/time.h"
 
@@ -572,6 +573,67 @@ static void surface_commit_state(struct wlr_surface *surface,
 	surface->current.buffer = NULL;
 }
 
+struct surface_upload {
+	struct wlr_surface *surface;
+	uint32_t cached_seq;
+};
+
+static void surface_upload_handle_done(const struct upload_event *event,
+		void *data) {
+	struct surface_upload *upload = data;
+	struct wlr_surface *surface = upload->surface;
+
+	if (event != NULL) {
+		struct wlr_compositor_shm_upload_event shm_event = {
+			.surface = surface,
+			.latency_nsec = event->latency_nsec,
+			.bytes = event->bytes,
+		};
+		wl_signal_emit_mutable(&surface->compositor->events.shm_upload, &shm_event);
+		wlr_surface_unlock_cached(surface, upload->cached_seq);
+	}
+
+	free(upload);
+}
+
+static void surface_upload_pending(struct wlr_surface *surface) {
+	struct wlr_surface_state *pending = &surface->pending;
+	struct upload_queue *queue = surface->compositor->upload_queue;
+	if (queue == NULL || !(pending->committed & WLR_SURFACE_STATE_BUFFER) ||
+			pending->buffer == NULL) {
+		return;
+	}
+
+	if (surface->upload_stream == NULL) {
+		surface->upload_stream = upload_stream_create();
+		if (surface->upload_stream == NULL) {
+			return;
+		}
+	}
+
+	struct surface_upload *upload = calloc(1, sizeof(*upload));
+	if (upload == NULL) {
+		return;
+	}
+	upload->surface = surface;
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	surface_update_damage(&damage, pending);
+	struct wlr_buffer *staging = upload_stream_submit(surface->upload_stream,
+		queue, pending->buffer, &damage, surface_upload_handle_done, upload);
+	pixman_region32_fini(&damage);
+	if (staging == NULL) {
+		free(upload);
+		return;
+	}
+
+	// The commit is applied once the staging buffer has been filled
+	upload->cached_seq = wlr_surface_lock_pending(surface);
+	wlr_buffer_unlock(pending->buffer);
+	pending->buffer = staging;
+}
+
 static void surface_handle_commit(struct wl_client *client,
 		struct wl_resource *resource) {
 	struct wlr_surface *surface = wlr_surface_from_resource(resource);
@@ -591,6 +653,8 @@ static void surface_handle_commit(struct wl_client *client,
 		return;
 	}
 
+	surface_upload_pending(surface);
+
 	if (surface->pending.cached_state_locks > 0 || !wl_list_empty(&surface->cached)) {
 		surface_cache_pending(surface);
 	} else {
@@ -747,6 +811,8 @@ static void surface_handle_resource_destroy(struct wl_resource *resource) {
 
 	wl_list_remove(&surface->pending_buffer_resource_destroy.link);
 
+	upload_stream_destroy(surface->upload_stream);
+
 	surface_state_finish(&surface->pending);
 	surface_state_finish(&surface->current);
 	pixman_region32_fini(&surface->buffer_damage);
@@ -1352,6 +1418,9 @@ static void compositor_handle_display_destroy(
 	assert(wl_list_empty(&compositor->events.new_surface.listener_list));
 	assert(wl_list_empty(&compositor->events.destroy.listener_list));
 
+	assert(wl_list_empty(&compositor->events.shm_upload.listener_list));
+
+	upload_queue_destroy(compositor->upload_queue);
 	wl_list_remove(&compositor->display_destroy.link);
 	wl_list_remove(&compositor->renderer_destroy.link);
 	wl_global_destroy(compositor->global);
@@ -1383,6 +1452,9 @@ struct wlr_compositor *wlr_compositor_create(struct wl_display *display,
 
 	wl_signal_init(&compositor->events.new_surface);
 	wl_signal_init(&compositor->events.destroy);
+	wl_signal_init(&compositor->events.shm_upload);
+
+	compositor->event_loop = wl_display_get_event_loop(display);
 
 	wl_list_init(&compositor->renderer_destroy.link);
 
@@ -1407,6 +1479,20 @@ void wlr_compositor_set_renderer(struct wlr_compositor *compositor,
 	}
 }
 
+bool wlr_compositor_set_async_shm_upload(struct wlr_compositor *compositor,
+		bool enabled) {
+	if (!enabled) {
+		upload_queue_destroy(compositor->upload_queue);
+		compositor->upload_queue = NULL;
+		return true;
+	}
+
+	if (compositor->upload_queue == NULL) {
+		compositor->upload_queue = upload_queue_create(compositor->event_loop);
+	}
+	return compositor->upload_queue != NULL;
+}
+
 static bool surface_state_add_synced(struct wlr_surface_state *state, void *value) {
 	void **ptr = wl_array_add(&state->synced, sizeof(void *));
 	if (ptr == NULL) {
@@ -12,20 +12,30 @@ void wlr_damage_ring_init(struct wlr_damage_ring *ring) {
 	*ring = (struct wlr_damage_ring){ 0 };
 	pixman_region32_init(&ring->current);
 	wl_list_init(&ring->buffers);
+	for (size_t i = 0; i < WLR_DAMAGE_RING_SLOTS; i++) {
+		struct wlr_damage_ring_buffer *slot = &ring->slots[i];
+		slot->ring = ring;
+		wl_list_init(&slot->link);
+		pixman_region32_init(&slot->damage);
+	}
 }
 
-static void buffer_destroy(struct wlr_damage_ring_buffer *entry) {
-	wl_list_remove(&entry->destroy.link);
-	wl_list_remove(&entry->link);
-	pixman_region32_fini(&entry->damage);
-	free(entry);
+static void slot_reset(struct wlr_damage_ring_buffer *slot) {
+	if (slot->buffer != NULL) {
+		wl_list_remove(&slot->destroy.link);
+		wl_list_remove(&slot->link);
+		wl_list_init(&slot->link);
+		slot->buffer = NULL;
+	}
+	pixman_region32_clear(&slot->damage);
 }
 
 void wlr_damage_ring_finish(struct wlr_damage_ring *ring) {
 	pixman_region32_fini(&ring->current);
-	struct wlr_damage_ring_buffer *entry, *tmp_entry;
-	wl_list_for_each_safe(entry, tmp_entry, &ring->buffers, link) {
-		buffer_destroy(entry);
+	for (size_t i = 0; i < WLR_DAMAGE_RING_SLOTS; i++) {
+		struct wlr_damage_ring_buffer *slot = &ring->slots[i];
+		slot_reset(slot);
+		pixman_region32_fini(&slot->damage);
 	}
 }
 
@@ -45,86 +55,114 @@ void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring) {
 	int width = 0;
 	int height = 0;
 
-	struct wlr_damage_ring_buffer *entry;
-	wl_list_for_each(entry, &ring->buffers, link) {
-		width = width < entry->buffer->width ? entry->buffer->width : width;
-		height = height < entry->buffer->height ? entry->buffer->height : height;
+	for (size_t i = 0; i < WLR_DAMAGE_RING_SLOTS; i++) {
+		struct wlr_buffer *buffer = ring->slots[i].buffer;
+		if (buffer == NULL) {
+			continue;
+		}
+		width = width < buffer->width ? buffer->width : width;
+		height = height < buffer->height ? buffer->height : height;
 	}
 
 	pixman_region32_union_rect(&ring->current,
 		&ring->current, 0, 0, width, height);
 }
 
-static void entry_squash_damage(struct wlr_damage_ring_buffer *entry) {
-	pixman_region32_t *prev;
-	if (entry->link.prev == &entry->ring->buffers) {
-		// this entry is the first in the list
-		prev = &entry->ring->current;
-	} else {
-		struct wlr_damage_ring_buffer *last =
-			wl_container_of(entry->link.prev, last, link);
-		prev = &last->damage;
+static uint64_t region_area(const pixman_region32_t *region) {
+	uint64_t area = 0;
+
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+	for (int i = 0; i < nrects; ++i) {
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(uint64_t)(rects[i].y2 - rects[i].y1);
 	}
 
-	pixman_region32_union(prev, prev, &entry->damage);
+	return area;
 }
 
-static void buffer_handle_destroy(struct wl_listener *listener, void *data) {
-	struct wlr_damage_ring_buffer *entry = wl_container_of(listener, entry, destroy);
-	entry_squash_damage(entry);
-	buffer_destroy(entry);
+// Replace the region with its extents if it has too many rectangles
+static void simplify_region(struct wlr_damage_ring *ring,
+		pixman_region32_t *region) {
+	int n_rects = pixman_region32_n_rects(region);
+	if (n_rects > WLR_DAMAGE_RING_MAX_RECTS) {
+		pixman_box32_t *extents = pixman_region32_extents(region);
+		pixman_region32_union_rect(region, region,
+			extents->x1, extents->y1,
+			extents->x2 - extents->x1,
+			extents->y2 - extents->y1);
+		ring->stats.simplifications++;
+	}
 }
 
-void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
-		struct wlr_buffer *buffer, pixman_region32_t *damage) {
-	pixman_region32_copy(damage, &ring->current);
+static void buffer_handle_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_damage_ring_buffer *slot = wl_container_of(listener, slot, destroy);
+	slot_reset(slot);
+}
 
-	struct wlr_damage_ring_buffer *entry;
-	wl_list_for_each(entry, &ring->buffers, link) {
-		if (entry->buffer != buffer) {
-			pixman_region32_union(damage, damage, &entry->damage);
-			continue;
+static struct wlr_damage_ring_buffer *ring_get_slot(struct wlr_damage_ring *ring,
+		struct wlr_buffer *buffer) {
+	for (size_t i = 0; i < WLR_DAMAGE_RING_SLOTS; i++) {
+		if (ring->slots[i].buffer == buffer) {
+			return &ring->slots[i];
 		}
+	}
+	return NULL;
+}
 
-		pixman_region32_intersect_rect(damage, damage, 0, 0, buffer->width, buffer->height);
-
-		// Check the number of rectangles
-		int n_rects = pixman_region32_n_rects(damage);
-		if (n_rects > WLR_DAMAGE_RING_MAX_RECTS) {
-			pixman_box32_t *extents = pixman_region32_extents(damage);
-			pixman_region32_union_rect(damage, damage,
-				extents->x1, extents->y1,
-				extents->x2 - extents->x1,
-				extents->y2 - extents->y1);
+static struct wlr_damage_ring_buffer *ring_add_slot(struct wlr_damage_ring *ring,
+		struct wlr_buffer *buffer) {
+	// Pick an unused slot, or evict the least recently used buffer
+	struct wlr_damage_ring_buffer *slot = NULL;
+	for (size_t i = 0; i < WLR_DAMAGE_RING_SLOTS; i++) {
+		if (ring->slots[i].buffer == NULL) {
+			slot = &ring->slots[i];
+			break;
 		}
+	}
+	if (slot == NULL) {
+		slot = wl_container_of(ring->buffers.prev, slot, link);
+	}
 
-		// rotate
-		entry_squash_damage(entry);
-		pixman_region32_copy(&entry->damage, &ring->current);
-		pixman_region32_clear(&ring->current);
+	slot_reset(slot);
+	slot->buffer = buffer;
+	slot->destroy.notify = buffer_handle_destroy;
+	wl_signal_add(&buffer->events.destroy, &slot->destroy);
+	wl_list_insert(&ring->buffers, &slot->link);
+	return slot;
+}
 
-		wl_list_remove(&entry->link);
-		wl_list_insert(&ring->buffers, &entry->link);
-		return;
+void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
+		struct wlr_buffer *buffer, pixman_region32_t *damage) {
+	struct wlr_damage_ring_buffer *slot = ring_get_slot(ring, buffer);
+	if (slot != NULL) {
+		pixman_region32_union(damage, &slot->damage, &ring->current);
+		pixman_region32_intersect_rect(damage, damage, 0, 0, buffer->width, buffer->height);
+		pixman_region32_clear(&slot->damage);
+	} else {
+		pixman_region32_clear(damage);
+		pixman_region32_union_rect(damage, damage,
+			0, 0, buffer->width, buffer->height);
+		slot = ring_add_slot(ring, buffer);
 	}
 
-	pixman_region32_clear(damage);
-	pixman_region32_union_rect(damage, damage,
-		0, 0, buffer->width, buffer->height);
+	ring->stats.rects = pixman_region32_n_rects(damage);
+	simplify_region(ring, damage);
+	ring->stats.current_area = region_area(&ring->current);
+	ring->stats.accumulated_area = region_area(damage);
 
-	entry = calloc(1, sizeof(*entry));
-	if (!entry) {
-		return;
+	wl_list_remove(&slot->link);
+	wl_list_insert(&ring->buffers, &slot->link);
+
+	// The current damage is now part of what every other buffer is missing
+	for (size_t i = 0; i < WLR_DAMAGE_RING_SLOTS; i++) {
+		struct wlr_damage_ring_buffer *other = &ring->slots[i];
+		if (other == slot || other->buffer == NULL) {
+			continue;
+		}
+		pixman_region32_union(&other->damage, &other->damage, &ring->current);
+		simplify_region(ring, &other->damage);
 	}
 
-	pixman_region32_init(&entry->damage);
-	pixman_region32_copy(&entry->damage, &ring->current);
 	pixman_region32_clear(&ring->current);
-
-	wl_list_insert(&ring->buffers, &entry->link);
-	entry->buffer = buffer;
-	entry->ring = ring;
-
-	entry->destroy.notify = buffer_handle_destroy;
-	wl_signal_add(&buffer->events.destroy, &entry->destroy);
 }
@@ -68,9 +68,13 @@ static void frame_destroy(struct wlr_ext_image_copy_capture_frame_v1 *frame) {
 	}
 	wl_signal_emit_mutable(&frame->events.destroy, NULL);
 	assert(wl_list_empty(&frame->events.destroy.listener_list));
+	if (frame->copy_task != NULL) {
+		wlr_texture_read_pixels_task_cancel(frame->copy_task);
+	}
 	wl_resource_set_user_data(frame->resource, NULL);
 	wlr_buffer_unlock(frame->buffer);
 	pixman_region32_fini(&frame->buffer_damage);
+	pixman_region32_fini(&frame->ready_damage);
 	if (frame->session->frame == frame) {
 		frame->session->frame = NULL;
 	}
@@ -81,30 +85,64 @@ static void frame_handle_resource_destroy(struct wl_resource *resource) {
 	frame_destroy(wl_resource_get_user_data(resource));
 }
 
-void wlr_ext_image_copy_capture_frame_v1_ready(struct wlr_ext_image_copy_capture_frame_v1 *frame,
+static void frame_send_ready(struct wlr_ext_image_copy_capture_frame_v1 *frame,
 		enum wl_output_transform transform,
-		const struct timespec *presentation_time) {
-	assert(frame->capturing);
-
+		const struct timespec *presentation_time, const pixman_region32_t *damage) {
 	int rects_len = 0;
-	const pixman_box32_t *rects =
-		pixman_region32_rectangles(&frame->session->damage, &rects_len);
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
 	for (int i = 0; i < rects_len; i++) {
 		const pixman_box32_t *rect = &rects[i];
 		ext_image_copy_capture_frame_v1_send_damage(frame->resource,
 			rect->x1, rect->y1, rect->x2 - rect->x1, rect->y2 - rect->y1);
 	}
 
-	pixman_region32_clear(&frame->session->damage);
-
 	uint64_t pres_time_sec = (uint64_t)presentation_time->tv_sec;
 	ext_image_copy_capture_frame_v1_send_transform(frame->resource, transform);
 	ext_image_copy_capture_frame_v1_send_presentation_time(frame->resource,
 		pres_time_sec >> 32, (uint32_t)pres_time_sec, presentation_time->tv_nsec);
 	ext_image_copy_capture_frame_v1_send_ready(frame->resource);
+}
+
+void wlr_ext_image_copy_capture_frame_v1_ready(struct wlr_ext_image_copy_capture_frame_v1 *frame,
+		enum wl_output_transform transform,
+		const struct timespec *presentation_time) {
+	assert(frame->capturing);
+	assert(!frame->ready_pending);
+
+	if (frame->copy_task != NULL) {
+		// Damage accumulated from now on belongs to the next frame
+		frame->ready_pending = true;
+		frame->ready_transform = transform;
+		frame->ready_presentation_time = *presentation_time;
+		pixman_region32_copy(&frame->ready_damage, &frame->session->damage);
+		pixman_region32_clear(&frame->session->damage);
+		return;
+	}
+
+	frame_send_ready(frame, transform, presentation_time, &frame->session->damage);
+	pixman_region32_clear(&frame->session->damage);
 	frame_destroy(frame);
 }
 
+static void frame_handle_copy_done(bool ok, void *data) {
+	struct wlr_ext_image_copy_capture_frame_v1 *frame = data;
+	frame->copy_task = NULL;
+
+	if (!ok) {
+		pixman_region32_union(&frame->session->damage,
+			&frame->session->damage, &frame->ready_damage);
+		wlr_ext_image_copy_capture_frame_v1_fail(frame,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN);
+		return;
+	}
+
+	if (frame->ready_pending) {
+		frame_send_ready(frame, frame->ready_transform,
+			&frame->ready_presentation_time, &frame->ready_damage);
+		frame_destroy(frame);
+	}
+}
+
 static bool copy_dmabuf(struct wlr_buffer *dst,
 		struct wlr_buffer *src, struct wlr_renderer *renderer,
 		const pixman_region32_t *clip) {
@@ -132,24 +170,32 @@ out:
 	return ok;
 }
 
-static bool copy_shm(void *data, uint32_t format, size_t stride,
+static bool copy_shm(struct wlr_ext_image_copy_capture_frame_v1 *frame,
 		struct wlr_buffer *src, struct wlr_renderer *renderer) {
+	assert(frame->copy_task == NULL);
+
 	// TODO: bypass renderer if source buffer supports data ptr access
 	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, src);
 	if (!texture) {
 		return false;
 	}
 
-	// TODO: only copy damaged region
-	bool ok = wlr_texture_read_pixels(texture, &(struct wlr_texture_read_pixels_options){
-		.data = data,
-		.format = format,
-		.stride = stride,
-	});
+	// The client buffer holds the previous contents outside of the buffer
+	// damage, which includes the session damage
+	struct wl_display *display =
+		wl_client_get_display(wl_resource_get_client(frame->resource));
+	frame->copy_task = wlr_texture_read_pixels_async(texture,
+		&(struct wlr_texture_read_pixels_async_options){
+			.buffer = frame->buffer,
+			.region = &frame->buffer_damage,
+			.event_loop = wl_display_get_event_loop(display),
+			.done = frame_handle_copy_done,
+			.data = frame,
+		});
 
 	wlr_texture_destroy(texture);
 
-	return ok;
+	return frame->copy_task != NULL;
 }
 
 bool wlr_ext_image_copy_capture_frame_v1_copy_buffer(struct wlr_ext_image_copy_capture_frame_v1 *frame,
@@ -178,13 +224,13 @@ bool wlr_ext_image_copy_capture_frame_v1_copy_buffer(struct wlr_ext_image_copy_c
 		}
 	} else if (wlr_buffer_begin_data_ptr_access(dst,
 			WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
+		wlr_buffer_end_data_ptr_access(dst);
 		if (frame->session->source->shm_formats_len == 0) {
 			ok = false;
 			failure_reason = EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS;
 		} else {
-			ok = copy_shm(data, format, stride, src, renderer);
+			ok = copy_shm(frame, src, renderer);
 		}
-		wlr_buffer_end_data_ptr_access(dst);
 	}
 	if (!ok) {
 		wlr_ext_image_copy_capture_frame_v1_fail(frame, failure_reason);
@@ -333,6 +379,7 @@ static void session_handle_create_frame(struct wl_client *client,
 	frame->resource = frame_resource;
 	frame->session = session;
 	pixman_region32_init(&frame->buffer_damage);
+	pixman_region32_init(&frame->ready_damage);
 	wl_signal_init(&frame->events.destroy);
 
 	wl_resource_set_user_data(frame_resource, frame);
@@ -424,9 +471,11 @@ static void session_handle_source_frame(struct wl_listener *listener, void *data
 
 	pixman_region32_union(&session->damage, &session->damage, event->damage);
 
+	// Frames whose copy is still in flight already have their contents, the
+	// damage is accumulated for the next frame
 	struct wlr_ext_image_copy_capture_frame_v1 *frame = session->frame;
-	if (frame != NULL && frame->capturing &&
-			!pixman_region32_empty(&session->damage)) {
+	if (frame != NULL && frame->capturing && frame->copy_task == NULL &&
+			!frame->ready_pending && !pixman_region32_empty(&session->damage)) {
 		pixman_region32_union(&frame->buffer_damage,
 			&frame->buffer_damage, &session->damage);
 
@@ -5,6 +5,7 @@
 #include <wlr/render/allocator.h>
 #include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_damage_ring.h>
 #include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/backend.h>
 #include <wlr/util/box.h>
@@ -20,6 +21,10 @@ struct screencopy_damage {
 	struct wl_list link;
 	struct wlr_output *output;
 	struct pixman_region32 damage;
+	// Contents of the client buffers filled by frames with damage, relative
+	// to buffer_box
+	struct wlr_damage_ring buffers;
+	struct wlr_box buffer_box;
 	struct wl_listener output_precommit;
 	struct wl_listener output_destroy;
 };
@@ -71,6 +76,7 @@ static void screencopy_damage_destroy(struct screencopy_damage *damage) {
 	wl_list_remove(&damage->output_precommit.link);
 	wl_list_remove(&damage->link);
 	pixman_region32_fini(&damage->damage);
+	wlr_damage_ring_finish(&damage->buffers);
 	free(damage);
 }
 
@@ -92,6 +98,7 @@ static struct screencopy_damage *screencopy_damage_create(
 	damage->output = output;
 	pixman_region32_init_rect(&damage->damage, 0, 0, output->width,
 		output->height);
+	wlr_damage_ring_init(&damage->buffers);
 	wl_list_insert(&client->damages, &damage->link);
 
 	wl_signal_add(&output->events.precommit, &damage->output_precommit);
@@ -133,6 +140,68 @@ static struct wlr_screencopy_frame_v1 *frame_from_resource(
 	return wl_resource_get_user_data(resource);
 }
 
+// Move the damage accumulated since the previous copy into the frame, so that
+// damage arriving while the frame is copied is reported with the next one
+static void frame_take_damage(struct wlr_screencopy_frame_v1 *frame) {
+	if (!frame->with_damage) {
+		return;
+	}
+
+	struct screencopy_damage *damage =
+		screencopy_damage_get_or_create(frame->client, frame->output);
+	if (damage == NULL) {
+		return;
+	}
+
+	pixman_region32_copy(&frame->damage, &damage->damage);
+	pixman_region32_clear(&damage->damage);
+}
+
+// Give the damage back after a failed copy. The contents of the client buffer
+// are unknown at this point.
+static void frame_restore_damage(struct wlr_screencopy_frame_v1 *frame) {
+	struct screencopy_damage *damage =
+		screencopy_damage_find(frame->client, frame->output);
+	if (damage != NULL) {
+		pixman_region32_union(&damage->damage, &damage->damage, &frame->damage);
+		wlr_damage_ring_add_whole(&damage->buffers);
+	}
+	pixman_region32_clear(&frame->damage);
+}
+
+// Get the region of the client buffer which doesn't hold the current contents
+// yet. Only buffers of frames with damage are tracked: clients requesting
+// these keep the buffer contents around between frames.
+static bool frame_get_buffer_damage(struct wlr_screencopy_frame_v1 *frame,
+		pixman_region32_t *region) {
+	if (!frame->with_damage) {
+		return false;
+	}
+
+	struct screencopy_damage *damage =
+		screencopy_damage_find(frame->client, frame->output);
+	if (damage == NULL) {
+		return false;
+	}
+
+	if (!wlr_box_equal(&damage->buffer_box, &frame->box)) {
+		// Buffers filled for another region of the output can't be reused
+		wlr_damage_ring_finish(&damage->buffers);
+		wlr_damage_ring_init(&damage->buffers);
+		damage->buffer_box = frame->box;
+	}
+
+	pixman_region32_t frame_damage;
+	pixman_region32_init(&frame_damage);
+	pixman_region32_copy(&frame_damage, &frame->damage);
+	pixman_region32_translate(&frame_damage, -frame->box.x, -frame->box.y);
+	wlr_damage_ring_add(&damage->buffers, &frame_damage);
+	pixman_region32_fini(&frame_damage);
+
+	wlr_damage_ring_rotate_buffer(&damage->buffers, frame->buffer, region);
+	return true;
+}
+
 static void frame_destroy(struct wlr_screencopy_frame_v1 *frame) {
 	if (frame == NULL) {
 		return;
@@ -143,12 +212,17 @@ static void frame_destroy(struct wlr_screencopy_frame_v1 *frame) {
 			wlr_output_lock_software_cursors(frame->output, false);
 		}
 	}
+	if (frame->copy_task != NULL) {
+		wlr_texture_read_pixels_task_cancel(frame->copy_task);
+		frame_restore_damage(frame);
+	}
 	wl_list_remove(&frame->link);
 	wl_list_remove(&frame->output_commit.link);
 	wl_list_remove(&frame->output_destroy.link);
 	// Make the frame resource inert
 	wl_resource_set_user_data(frame->resource, NULL);
 	wlr_buffer_unlock(frame->buffer);
+	pixman_region32_fini(&frame->damage);
 	client_unref(frame->client);
 	free(frame);
 }
@@ -158,14 +232,8 @@ static void frame_send_damage(struct wlr_screencopy_frame_v1 *frame) {
 		return;
 	}
 
-	struct screencopy_damage *damage =
-		screencopy_damage_get_or_create(frame->client, frame->output);
-	if (damage == NULL) {
-		return;
-	}
-
 	int n_boxes;
-	const pixman_box32_t *boxes = pixman_region32_rectangles(&damage->damage, &n_boxes);
+	const pixman_box32_t *boxes = pixman_region32_rectangles(&frame->damage, &n_boxes);
 	for (int i = 0; i < n_boxes; i++) {
 		const pixman_box32_t *box = &boxes[i];
 
@@ -177,8 +245,6 @@ static void frame_send_damage(struct wlr_screencopy_frame_v1 *frame) {
 		zwlr_screencopy_frame_v1_send_damage(frame->resource,
 			damage_x, damage_y, damage_width, damage_height);
 	}
-
-	pixman_region32_clear(&damage->damage);
 }
 
 static void frame_send_ready(struct wlr_screencopy_frame_v1 *frame,
@@ -190,45 +256,71 @@ static void frame_send_ready(struct wlr_screencopy_frame_v1 *frame,
 		tv_sec_hi, tv_sec_lo, when->tv_nsec);
 }
 
+static void frame_succeed(struct wlr_screencopy_frame_v1 *frame,
+		struct timespec *when) {
+	zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
+	frame_send_damage(frame);
+	frame_send_ready(frame, when);
+	frame_destroy(frame);
+}
+
+static void frame_fail(struct wlr_screencopy_frame_v1 *frame) {
+	frame_restore_damage(frame);
+	zwlr_screencopy_frame_v1_send_failed(frame->resource);
+	frame_destroy(frame);
+}
+
+static void frame_handle_shm_copy_done(bool ok, void *data) {
+	struct wlr_screencopy_frame_v1 *frame = data;
+	frame->copy_task = NULL;
+
+	if (!ok) {
+		wlr_log(WLR_DEBUG, "Failed to copy to destination during shm screencopy");
+		frame_fail(frame);
+		return;
+	}
+
+	frame_succeed(frame, &frame->copy_when);
+}
+
 static bool frame_shm_copy(struct wlr_screencopy_frame_v1 *frame,
 		struct wlr_buffer *src_buffer) {
 	struct wlr_output *output = frame->output;
 	struct wlr_renderer *renderer = output->renderer;
 	assert(renderer);
 
-	void *data;
-	uint32_t format;
-	size_t stride;
-	if (!wlr_buffer_begin_data_ptr_access(frame->buffer,
-			WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
-		return false;
-	}
-
-	bool ok = false;
-
 	struct wlr_texture *texture = wlr_texture_from_buffer(renderer, src_buffer);
 	if (!texture) {
 		wlr_log(WLR_DEBUG, "Failed to grab a texture from a buffer during shm screencopy");
-		goto out;
+		return false;
 	}
 
-	ok = wlr_texture_read_pixels(texture, &(struct wlr_texture_read_pixels_options) {
-		.data = data,
-		.format = format,
-		.stride = stride,
-		.src_box = frame->box,
-	});
-
+	pixman_region32_t buffer_damage;
+	pixman_region32_init(&buffer_damage);
+	bool has_buffer_damage = frame_get_buffer_damage(frame, &buffer_damage);
+
+	// The frame is ready once the pixels have been read back
+	struct wl_display *display =
+		wl_client_get_display(wl_resource_get_client(frame->resource));
+	frame->copy_task = wlr_texture_read_pixels_async(texture,
+		&(struct wlr_texture_read_pixels_async_options){
+			.buffer = frame->buffer,
+			.src_box = frame->box,
+			.region = has_buffer_damage ? &buffer_damage : NULL,
+			.event_loop = wl_display_get_event_loop(display),
+			.done = frame_handle_shm_copy_done,
+			.data = frame,
+		});
+
+	pixman_region32_fini(&buffer_damage);
 	wlr_texture_destroy(texture);
 
-out:
-	wlr_buffer_end_data_ptr_access(frame->buffer);
-
-	if (!ok) {
+	if (frame->copy_task == NULL) {
 		wlr_log(WLR_DEBUG, "Failed to copy to destination during shm screencopy");
+		return false;
 	}
 
-	return ok;
+	return true;
 }
 
 static bool frame_dma_copy(struct wlr_screencopy_frame_v1 *frame,
@@ -317,6 +409,8 @@ static void frame_handle_output_commit(struct wl_listener *listener,
 		goto err;
 	}
 
+	frame_take_damage(frame);
+
 	switch (frame->buffer_cap) {
 	case WLR_BUFFER_CAP_DMABUF:
 		if (!frame_dma_copy(frame, src_buffer)) {
@@ -324,23 +418,20 @@ static void frame_handle_output_commit(struct wl_listener *listener,
 		}
 		break;
 	case WLR_BUFFER_CAP_DATA_PTR:
+		frame->copy_when = event->when;
 		if (!frame_shm_copy(frame, src_buffer)) {
 			goto err;
 		}
-		break;
+		return;
 	default:
 		abort(); // unreachable
 	}
 
-	zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
-	frame_send_damage(frame);
-	frame_send_ready(frame, &event->when);
-	frame_destroy(frame);
+	frame_succeed(frame, &event->when);
 	return;
 
 err:
-	zwlr_screencopy_frame_v1_send_failed(frame->resource);
-	frame_destroy(frame);
+	frame_fail(frame);
 }
 
 static void frame_handle_output_destroy(struct wl_listener *listener,
@@ -528,6 +619,7 @@ static void capture_output(struct wl_client *wl_client,
 	wl_list_insert(&client->manager->frames, &frame->link);
 
 	wl_list_init(&frame->output_commit.link);
+	pixman_region32_init(&frame->damage);
 
 	wl_signal_add(&output->events.destroy, &frame->output_destroy);
 	frame->output_destroy.notify = frame_handle_output_destroy;
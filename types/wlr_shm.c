@@ -2,6 +2,7 @@
 #define _DEFAULT_SOURCE // for MAP_ANONYMOUS
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdlib.h>
@@ -14,6 +15,7 @@
 #include <wlr/types/wlr_shm.h>
 #include <wlr/util/log.h>
 #include "render/pixel_format.h"
+#include "types/wlr_shm.h"
 
 #ifdef __STDC_NO_ATOMICS__
 #error "C11 atomics are required"
@@ -24,6 +26,9 @@
 
 #define SHM_VERSION 2
 
+// Number of entries allocated at once in the table of accessed mappings
+#define SIGBUS_CHUNK_SIZE 64
+
 struct wlr_shm_pool {
 	struct wl_resource *resource; // may be NULL
 	struct wlr_shm *shm;
@@ -43,13 +48,29 @@ struct wlr_shm_pool {
 struct wlr_shm_mapping {
 	void *data;
 	size_t size;
+
+	// Protected by shm_lock
 	bool dropped; // false while a wlr_shm_pool references this mapping
+	size_t n_accesses;
+	struct wlr_shm_sigbus_entry *sigbus_entry; // NULL if not accessed
 };
 
-struct wlr_shm_sigbus_data {
-	struct wlr_shm_mapping *mapping;
-	struct sigaction prev_action;
-	struct wlr_shm_sigbus_data *_Atomic next;
+/**
+ * An entry in the table of accessed mappings, looked up by the SIGBUS handler.
+ *
+ * The handler may run on any thread, concurrently with updates of the table.
+ * Entries are updated with a sequence lock so that the handler never sees a
+ * partially updated entry, and chunks are never freed.
+ */
+struct wlr_shm_sigbus_entry {
+	atomic_uint seq; // odd while the entry is being updated
+	void *_Atomic data;
+	_Atomic size_t size; // zero if the entry is unused
+};
+
+struct wlr_shm_sigbus_chunk {
+	struct wlr_shm_sigbus_entry entries[SIGBUS_CHUNK_SIZE];
+	struct wlr_shm_sigbus_chunk *_Atomic next;
 };
 
 struct wlr_shm_buffer {
@@ -63,11 +84,18 @@ struct wlr_shm_buffer {
 
 	struct wl_listener release;
 
-	struct wlr_shm_sigbus_data sigbus_data;
+	struct wlr_shm_mapping *accessed_mapping; // NULL if not accessed
 };
 
-// Needs to be a lock-free atomic because it's accessed from a signal handler
-static struct wlr_shm_sigbus_data *_Atomic sigbus_data = NULL;
+// Protects the pools' current mappings, the mappings' access state and the
+// SIGBUS handler installation, so that buffers can be accessed from any thread
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
+// Protected by shm_lock
+static size_t n_sigbus_mappings = 0;
+static struct sigaction sigbus_prev_action;
+
+// Needs to be lock-free because it's accessed from a signal handler
+static struct wlr_shm_sigbus_chunk sigbus_table = {0};
 
 static const struct wl_buffer_interface wl_buffer_impl;
 static const struct wl_shm_pool_interface pool_impl;
@@ -116,17 +144,7 @@ static struct wlr_shm_mapping *mapping_create(int fd, size_t size) {
 	return mapping;
 }
 
-static void mapping_consider_destroy(struct wlr_shm_mapping *mapping) {
-	if (!mapping->dropped) {
-		return;
-	}
-
-	for (struct wlr_shm_sigbus_data *cur = sigbus_data; cur != NULL; cur = cur->next) {
-		if (cur->mapping == mapping) {
-			return;
-		}
-	}
-
+static void mapping_destroy(struct wlr_shm_mapping *mapping) {
 	munmap(mapping->data, mapping->size);
 	free(mapping);
 }
@@ -141,8 +159,14 @@ static void mapping_drop(struct wlr_shm_mapping *mapping) {
 		return;
 	}
 
+	pthread_mutex_lock(&shm_lock);
 	mapping->dropped = true;
-	mapping_consider_destroy(mapping);
+	bool destroy = mapping->n_accesses == 0;
+	pthread_mutex_unlock(&shm_lock);
+
+	if (destroy) {
+		mapping_destroy(mapping);
+	}
 }
 
 static const struct wlr_buffer_resource_interface buffer_resource_interface = {
@@ -179,30 +203,61 @@ static bool buffer_get_shm(struct wlr_buffer *wlr_buffer,
 	return true;
 }
 
-static void handle_sigbus(int sig, siginfo_t *info, void *context) {
-	assert(sigbus_data != NULL);
-	struct sigaction prev_action = sigbus_data->prev_action;
+static void sigbus_entry_set(struct wlr_shm_sigbus_entry *entry,
+		void *data, size_t size) {
+	unsigned int seq = atomic_load_explicit(&entry->seq, memory_order_relaxed);
+	atomic_store_explicit(&entry->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+	atomic_store_explicit(&entry->size, size, memory_order_relaxed);
+	atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+}
 
-	// Check whether the offending address is inside of the wl_shm_pool's mapped
-	// space
+// Returns false if the entry is being updated
+static bool sigbus_entry_get(struct wlr_shm_sigbus_entry *entry,
+		uintptr_t *data, size_t *size) {
+	unsigned int seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+	*data = (uintptr_t)atomic_load_explicit(&entry->data, memory_order_relaxed);
+	*size = atomic_load_explicit(&entry->size, memory_order_relaxed);
+	atomic_thread_fence(memory_order_acquire);
+	return seq % 2 == 0 &&
+		atomic_load_explicit(&entry->seq, memory_order_relaxed) == seq;
+}
+
+static void handle_sigbus(int sig, siginfo_t *info, void *context) {
+	struct sigaction prev_action = sigbus_prev_action;
+
+	// Check whether the offending address is inside of an accessed
+	// wl_shm_pool mapping. The entry of a mapping isn't updated while it's
+	// being accessed, so entries being updated concurrently can be skipped.
+	//
+	// The table only grows up to the peak number of mappings accessed at the
+	// same time, and this only runs when a client shrinks a pool under us, so
+	// a linear scan is fine. Keeping the entries sorted would instead slow
+	// down every first access of a mapping.
 	uintptr_t addr = (uintptr_t)info->si_addr;
-	struct wlr_shm_mapping *mapping = NULL;
-	for (struct wlr_shm_sigbus_data *data = sigbus_data; data != NULL; data = data->next) {
-		uintptr_t mapping_start = (uintptr_t)data->mapping->data;
-		size_t mapping_size = data->mapping->size;
-		if (addr >= mapping_start && addr < mapping_start + mapping_size) {
-			mapping = data->mapping;
-			break;
+	void *mapping_data = NULL;
+	size_t mapping_size = 0;
+	for (struct wlr_shm_sigbus_chunk *chunk = &sigbus_table; chunk != NULL;
+			chunk = atomic_load_explicit(&chunk->next, memory_order_acquire)) {
+		for (size_t i = 0; i < SIGBUS_CHUNK_SIZE; i++) {
+			uintptr_t data;
+			size_t size;
+			if (sigbus_entry_get(&chunk->entries[i], &data, &size) &&
+					addr >= data && addr < data + size) {
+				mapping_data = (void *)data;
+				mapping_size = size;
+				goto found;
+			}
 		}
 	}
-	if (mapping == NULL) {
-		goto reraise;
-	}
+	goto reraise;
 
+found:
 	// Replace the mapping with a new one which won't cause SIGBUS (instead, it
 	// will read as zeroes). Technically mmap() isn't part of the
 	// async-signal-safe functions...
-	if (mmap(mapping->data, mapping->size, PROT_READ | PROT_WRITE,
+	if (mmap(mapping_data, mapping_size, PROT_READ | PROT_WRITE,
 			MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
 		goto reraise;
 	}
@@ -217,39 +272,116 @@ reraise:
 	}
 }
 
-static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
-		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
-	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+// Must be called with shm_lock held
+static bool sigbus_add_mapping(struct wlr_shm_mapping *mapping) {
+	struct wlr_shm_sigbus_chunk *chunk = &sigbus_table;
+	struct wlr_shm_sigbus_entry *entry = NULL;
+	while (true) {
+		for (size_t i = 0; i < SIGBUS_CHUNK_SIZE; i++) {
+			if (atomic_load_explicit(&chunk->entries[i].size, memory_order_relaxed) == 0) {
+				entry = &chunk->entries[i];
+				break;
+			}
+		}
+		struct wlr_shm_sigbus_chunk *next =
+			atomic_load_explicit(&chunk->next, memory_order_relaxed);
+		if (entry != NULL || next == NULL) {
+			break;
+		}
+		chunk = next;
+	}
 
-	if (!atomic_is_lock_free(&sigbus_data)) {
-		wlr_log(WLR_ERROR, "Lock-free atomic pointers are required");
-		return false;
+	if (entry == NULL) {
+		// The signal handler may still be walking the table, so chunks are
+		// kept until the process exits
+		struct wlr_shm_sigbus_chunk *next = calloc(1, sizeof(*next));
+		if (next == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+		atomic_store_explicit(&chunk->next, next, memory_order_release);
+		entry = &next->entries[0];
 	}
 
 	// Install a SIGBUS handler. SIGBUS is triggered if the client shrinks the
 	// backing file, and then we try to access the mapping.
-	struct sigaction prev_action;
-	if (sigbus_data == NULL) {
+	if (n_sigbus_mappings == 0) {
 		struct sigaction new_action = {
 			.sa_sigaction = handle_sigbus,
 			.sa_flags = SA_SIGINFO | SA_NODEFER,
 		};
-		if (sigaction(SIGBUS, &new_action, &prev_action) != 0) {
+		if (sigaction(SIGBUS, &new_action, &sigbus_prev_action) != 0) {
 			wlr_log_errno(WLR_ERROR, "sigaction failed");
 			return false;
 		}
-	} else {
-		prev_action = sigbus_data->prev_action;
 	}
+	n_sigbus_mappings++;
+
+	sigbus_entry_set(entry, mapping->data, mapping->size);
+	mapping->sigbus_entry = entry;
+	return true;
+}
+
+// Must be called with shm_lock held
+static void sigbus_remove_mapping(struct wlr_shm_mapping *mapping) {
+	sigbus_entry_set(mapping->sigbus_entry, NULL, 0);
+	mapping->sigbus_entry = NULL;
+
+	n_sigbus_mappings--;
+	if (n_sigbus_mappings == 0) {
+		if (sigaction(SIGBUS, &sigbus_prev_action, NULL) != 0) {
+			wlr_log_errno(WLR_ERROR, "sigaction failed");
+		}
+	}
+}
 
+/**
+ * Begin an access to the mapping. Must be called with shm_lock held.
+ */
+static bool mapping_begin_access(struct wlr_shm_mapping *mapping) {
+	if (!atomic_is_lock_free(&sigbus_table.entries[0].size) ||
+			!atomic_is_lock_free(&sigbus_table.entries[0].seq)) {
+		wlr_log(WLR_ERROR, "Lock-free atomics are required");
+		return false;
+	}
+
+	if (mapping->n_accesses == 0 && !sigbus_add_mapping(mapping)) {
+		return false;
+	}
+	mapping->n_accesses++;
+	return true;
+}
+
+/**
+ * End an access started with mapping_begin_access(). May destroy the mapping.
+ */
+static void mapping_end_access(struct wlr_shm_mapping *mapping) {
+	pthread_mutex_lock(&shm_lock);
+	mapping->n_accesses--;
+	if (mapping->n_accesses == 0) {
+		sigbus_remove_mapping(mapping);
+	}
+	bool destroy = mapping->dropped && mapping->n_accesses == 0;
+	pthread_mutex_unlock(&shm_lock);
+
+	if (destroy) {
+		mapping_destroy(mapping);
+	}
+}
+
+static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+
+	pthread_mutex_lock(&shm_lock);
 	struct wlr_shm_mapping *mapping = buffer->pool->mapping;
+	bool ok = mapping_begin_access(mapping);
+	pthread_mutex_unlock(&shm_lock);
+	if (!ok) {
+		return false;
+	}
 
-	buffer->sigbus_data = (struct wlr_shm_sigbus_data){
-		.mapping = mapping,
-		.prev_action = prev_action,
-		.next = sigbus_data,
-	};
-	sigbus_data = &buffer->sigbus_data;
+	buffer->accessed_mapping = mapping;
 
 	*data = (char *)mapping->data + buffer->offset;
 	*format = buffer->drm_format;
@@ -259,25 +391,9 @@ static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
 
 static void buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
 	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
-
-	if (sigbus_data == &buffer->sigbus_data) {
-		sigbus_data = buffer->sigbus_data.next;
-	} else {
-		for (struct wlr_shm_sigbus_data *cur = sigbus_data; cur != NULL; cur = cur->next) {
-			if (cur->next == &buffer->sigbus_data) {
-				cur->next = buffer->sigbus_data.next;
-				break;
-			}
-		}
-	}
-
-	if (sigbus_data == NULL) {
-		if (sigaction(SIGBUS, &buffer->sigbus_data.prev_action, NULL) != 0) {
-			wlr_log_errno(WLR_ERROR, "sigaction failed");
-		}
-	}
-
-	mapping_consider_destroy(buffer->sigbus_data.mapping);
+	struct wlr_shm_mapping *mapping = buffer->accessed_mapping;
+	buffer->accessed_mapping = NULL;
+	mapping_end_access(mapping);
 }
 
 static const struct wlr_buffer_impl buffer_impl = {
@@ -287,6 +403,32 @@ static const struct wlr_buffer_impl buffer_impl = {
 	.end_data_ptr_access = buffer_end_data_ptr_access,
 };
 
+struct wlr_shm_mapping *shm_buffer_begin_mapping_access(
+		struct wlr_buffer *wlr_buffer, const void **data, uint32_t *format,
+		size_t *stride) {
+	if (wlr_buffer->impl != &buffer_impl) {
+		return NULL;
+	}
+	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+
+	pthread_mutex_lock(&shm_lock);
+	struct wlr_shm_mapping *mapping = buffer->pool->mapping;
+	bool ok = mapping_begin_access(mapping);
+	pthread_mutex_unlock(&shm_lock);
+	if (!ok) {
+		return NULL;
+	}
+
+	*data = (const char *)mapping->data + buffer->offset;
+	*format = buffer->drm_format;
+	*stride = buffer->stride;
+	return mapping;
+}
+
+void shm_mapping_end_access(struct wlr_shm_mapping *mapping) {
+	mapping_end_access(mapping);
+}
+
 static void destroy_resource(struct wl_client *client,
 		struct wl_resource *resource) {
 	wl_resource_destroy(resource);
@@ -390,8 +532,14 @@ static void pool_handle_resize(struct wl_client *client,
 		return;
 	}
 
-	mapping_drop(pool->mapping);
+	// The current mapping may be looked up concurrently by other threads
+	// starting to access a buffer
+	pthread_mutex_lock(&shm_lock);
+	struct wlr_shm_mapping *old_mapping = pool->mapping;
 	pool->mapping = mapping;
+	pthread_mutex_unlock(&shm_lock);
+
+	mapping_drop(old_mapping);
 }
 
 static const struct wl_shm_pool_interface pool_impl = {
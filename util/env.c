@@ -36,3 +36,25 @@ size_t env_parse_switch(const char *option, const char **switches) {
 	wlr_log(WLR_ERROR, "Unknown %s option: %s", option, env);
 	return 0;
 }
+
+size_t env_parse_threads(const char *option) {
+	const char *env = getenv(option);
+	if (env) {
+		wlr_log(WLR_INFO, "Loading %s option: %s", option, env);
+	} else {
+		return 1;
+	}
+
+	char *end;
+	long threads = strtol(env, &end, 10);
+	if (*env == '\0' || *end != '\0' || threads < 0) {
+		wlr_log(WLR_ERROR, "Unknown %s option: %s", option, env);
+		return 1;
+	}
+
+	if (threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = n_cpus > 0 ? n_cpus : 1;
+	}
+	return threads;
+}
@@ -1,6 +1,18 @@
 #include <limits.h>
+#include <stdint.h>
 #include "util/rect_union.h"
 
+// Number of pending rectangles after which they are compacted into the region
+#define RECT_UNION_COMPACT_THRESHOLD 1024
+// Regions with up to this many rectangles are never replaced by their bounding
+// box
+#define RECT_UNION_MIN_RECTS 1024
+// Hard limit on the number of rectangles in the region
+#define RECT_UNION_MAX_RECTS 16384
+// Estimated cost of an extra rectangle for consumers of the region (draw
+// calls, scissor changes, damage tracking), expressed in pixels
+#define RECT_UNION_RECT_COST 256
+
 static void box_union(pixman_box32_t *dst, const pixman_box32_t *box) {
 	dst->x1 = dst->x1 < box->x1 ? dst->x1 : box->x1;
 	dst->y1 = dst->y1 < box->y1 ? dst->y1 : box->y1;
@@ -37,6 +49,103 @@ static void handle_alloc_failure(struct rect_union *ru) {
 	wl_array_init(&ru->unsorted);
 }
 
+static int compare_boxes(const void *_a, const void *_b) {
+	const pixman_box32_t *a = _a, *b = _b;
+	if (a->y1 != b->y1) {
+		return a->y1 < b->y1 ? -1 : 1;
+	}
+	if (a->y2 != b->y2) {
+		return a->y2 < b->y2 ? -1 : 1;
+	}
+	if (a->x1 != b->x1) {
+		return a->x1 < b->x1 ? -1 : 1;
+	}
+	return 0;
+}
+
+/**
+ * Sort the pending rectangles and merge rectangles which span the same rows
+ * and touch or overlap horizontally. This removes duplicates and joins runs
+ * of small rectangles (e.g. glyphs on a line of text) before they are handed
+ * to pixman, whose union is quadratic in the worst case.
+ */
+static int merge_unsorted(struct rect_union *ru) {
+	pixman_box32_t *boxes = ru->unsorted.data;
+	int nrects = (int)(ru->unsorted.size / sizeof(pixman_box32_t));
+	if (nrects <= 1) {
+		return nrects;
+	}
+
+	qsort(boxes, nrects, sizeof(*boxes), compare_boxes);
+
+	int n = 0;
+	for (int i = 1; i < nrects; i++) {
+		pixman_box32_t *last = &boxes[n];
+		const pixman_box32_t *box = &boxes[i];
+		if (box->y1 == last->y1 && box->y2 == last->y2 && box->x1 <= last->x2) {
+			last->x2 = last->x2 > box->x2 ? last->x2 : box->x2;
+		} else {
+			boxes[++n] = *box;
+		}
+	}
+	n++;
+
+	ru->unsorted.size = n * sizeof(pixman_box32_t);
+	return n;
+}
+
+/**
+ * Check whether the region has become complex enough that repainting its
+ * bounding box is expected to be cheaper than handling every rectangle.
+ */
+static bool region_too_complex(const pixman_region32_t *region,
+		const pixman_box32_t *bounding_box) {
+	int nrects;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &nrects);
+	if (nrects <= RECT_UNION_MIN_RECTS) {
+		return false;
+	}
+	if (nrects > RECT_UNION_MAX_RECTS) {
+		return true;
+	}
+
+	uint64_t area = 0;
+	for (int i = 0; i < nrects; i++) {
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+			(uint64_t)(rects[i].y2 - rects[i].y1);
+	}
+	uint64_t bounding_area =
+		(uint64_t)(bounding_box->x2 - bounding_box->x1) *
+		(uint64_t)(bounding_box->y2 - bounding_box->y1);
+
+	return bounding_area - area <= (uint64_t)nrects * RECT_UNION_RECT_COST;
+}
+
+/**
+ * Move the pending rectangles into the region. Returns false if the region
+ * should be replaced by the bounding box.
+ */
+static bool compact(struct rect_union *ru) {
+	int nrects = merge_unsorted(ru);
+
+	pixman_region32_t reg;
+	bool ok = pixman_region32_init_rects(&reg, ru->unsorted.data, nrects);
+	if (!ok) {
+		return false;
+	}
+	ok = pixman_region32_union(&reg, &reg, &ru->region);
+	if (!ok) {
+		pixman_region32_fini(&reg);
+		return false;
+	}
+	pixman_region32_fini(&ru->region);
+	// pixman_region32_t is safe to move
+	ru->region = reg;
+	ru->unsorted.size = 0;
+
+	return !region_too_complex(&ru->region, &ru->bounding_box);
+}
+
 void rect_union_add(struct rect_union *ru, const pixman_box32_t *box) {
 	if (box_empty_or_invalid(box)) {
 		return;
@@ -49,7 +158,7 @@ void rect_union_add(struct rect_union *ru, const pixman_box32_t *box) {
 	}
 
 	int nrects = (int)(ru->unsorted.size / sizeof(pixman_box32_t));
-	if (nrects >= 1024) {
+	if (nrects >= RECT_UNION_COMPACT_THRESHOLD && !compact(ru)) {
 		handle_alloc_failure(ru);
 		return;
 	}
@@ -67,22 +176,10 @@ const pixman_region32_t *rect_union_evaluate(struct rect_union *ru) {
 		goto bounding_box;
 	}
 
-	int nrects = (int)(ru->unsorted.size / sizeof(pixman_box32_t));
-	pixman_region32_t reg;
-	bool ok = pixman_region32_init_rects(&reg, ru->unsorted.data, nrects);
-	if (!ok) {
-		handle_alloc_failure(ru);
-		goto bounding_box;
-	}
-	ok = pixman_region32_union(&reg, &reg, &ru->region);
-	if (!ok) {
-		pixman_region32_fini(&reg);
+	if (!compact(ru)) {
 		handle_alloc_failure(ru);
 		goto bounding_box;
 	}
-	pixman_region32_fini(&ru->region);
-	// pixman_region32_t is safe to move
-	ru->region = reg;
 	wl_array_release(&ru->unsorted);
 	wl_array_init(&ru->unsorted);
 
@@ -0,0 +1,166 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "util/worker_pool.h"
+
+struct worker_pool {
+	pthread_t *threads;
+	size_t n_threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond; // signalled when a loop is started or on stop
+	pthread_cond_t done_cond; // signalled when a loop completes
+
+	// Protected by lock
+	worker_pool_func_t func;
+	void *data;
+	size_t n; // number of iterations of the current loop
+	size_t next; // next iteration to start
+	size_t pending; // iterations not completed yet
+	bool stop;
+};
+
+// Must be called with the lock held
+static void run_iterations(struct worker_pool *pool) {
+	while (pool->next < pool->n) {
+		size_t index = pool->next++;
+		worker_pool_func_t func = pool->func;
+		void *data = pool->data;
+
+		pthread_mutex_unlock(&pool->lock);
+		func(index, data);
+		pthread_mutex_lock(&pool->lock);
+
+		pool->pending--;
+		if (pool->pending == 0) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+}
+
+static void *worker_main(void *data) {
+	struct worker_pool *pool = data;
+
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->stop && pool->next >= pool->n) {
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		}
+		if (pool->stop) {
+			break;
+		}
+		run_iterations(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void stop_threads(struct worker_pool *pool, size_t n_started) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < n_started; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+}
+
+struct worker_pool *worker_pool_create(size_t n_threads) {
+	struct worker_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	pool->threads = calloc(n_threads, sizeof(pool->threads[0]));
+	if (pool->threads == NULL && n_threads > 0) {
+		free(pool);
+		return NULL;
+	}
+	pool->n_threads = n_threads;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	// Asynchronous signals are handled by the event loop on the compositor
+	// thread, make sure the workers never receive them. Synchronous signals
+	// (e.g. SIGBUS raised when accessing a truncated shm buffer) must stay
+	// unblocked.
+	sigset_t mask, prev_mask;
+	sigfillset(&mask);
+	sigdelset(&mask, SIGBUS);
+	sigdelset(&mask, SIGSEGV);
+	sigdelset(&mask, SIGFPE);
+	sigdelset(&mask, SIGILL);
+	pthread_sigmask(SIG_SETMASK, &mask, &prev_mask);
+
+	size_t n_started = 0;
+	for (; n_started < n_threads; n_started++) {
+		int err = pthread_create(&pool->threads[n_started], NULL, worker_main, pool);
+		if (err != 0) {
+			wlr_log(WLR_ERROR, "pthread_create failed (error %d)", err);
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &prev_mask, NULL);
+
+	if (n_started < n_threads) {
+		stop_threads(pool, n_started);
+		pthread_cond_destroy(&pool->done_cond);
+		pthread_cond_destroy(&pool->work_cond);
+		pthread_mutex_destroy(&pool->lock);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+
+	stop_threads(pool, pool->n_threads);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+size_t worker_pool_get_size(const struct worker_pool *pool) {
+	return pool->n_threads;
+}
+
+void worker_pool_run(struct worker_pool *pool, size_t n,
+		worker_pool_func_t func, void *data) {
+	if (n == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->data = data;
+	pool->n = n;
+	pool->next = 0;
+	pool->pending = n;
+	if (n > 1) {
+		pthread_cond_broadcast(&pool->work_cond);
+	}
+
+	run_iterations(pool);
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	}
+
+	pool->func = NULL;
+	pool->data = NULL;
+	pthread_mutex_unlock(&pool->lock);
+}